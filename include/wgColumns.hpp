@@ -0,0 +1,179 @@
+#ifndef WGCOLUMNS_HPP_
+#define WGCOLUMNS_HPP_
+
+// system includes
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+
+// user includes
+#include "wgRawData.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                              Columnar export                              //
+///////////////////////////////////////////////////////////////////////////////
+
+// The decoded data can be exported in a simple columnar layout that
+// can be memory-mapped without any parsing (and without ROOT). A
+// column directory contains one binary file per field plus a small
+// JSON header :
+//
+//   <dir>/columns.json     header
+//   <dir>/<field>.bin      column files
+//
+// Each column file is a C-contiguous array of "dtype" elements with
+// the "shape" recorded in the header (numpy naming : "<i4" is a
+// little-endian 32 bit integer and "<f8" a little-endian double). The
+// first dimension of the per-spill columns is the spill (the TTree
+// entry). Constant columns (the calibration constants) have no spill
+// dimension. Every file starts at offset 0, so every column is page
+// aligned once mapped. For example, in Python :
+//
+//   header = json.load(open(dir + "/columns.json"))
+//   column = header["columns"]["charge"]
+//   charge = numpy.memmap(dir + "/" + column["file"], mode="r",
+//                         dtype=column["dtype"], shape=tuple(column["shape"]))
+//
+// The header is written last, so a directory without header is an
+// incomplete export and must be ignored.
+
+// Name of the header file inside the column directory
+const std::string COLUMNS_HEADER_FILE = "columns.json";
+
+///////////////////////////////////////////////////////////////////////////////
+//                             ColumnWriter class                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// The ColumnWriter class is used like a TTree : the address of each
+// per-spill column is registered once with the AddColumn method and
+// the current content of all the columns is appended to the files by
+// every Fill call. All the methods throw a wgInvalidFile exception if
+// a file cannot be written.
+
+class ColumnWriter {
+ public:
+  // Create the output_dir directory (if needed). If the directory
+  // already contains an export a wgInvalidFile exception is thrown
+  // unless overwrite is true.
+  ColumnWriter(const std::string& output_dir, bool overwrite);
+
+  // The files are closed but the header is not written : use the Close
+  // method to complete the export.
+  ~ColumnWriter();
+
+  // Add a per-spill column. At every Fill call the product of the
+  // "shape" dimensions elements are read from the address.
+  void AddColumn(const std::string& name, const int * address,
+                 const std::vector<std::size_t>& shape);
+  void AddColumn(const std::string& name, const double * address,
+                 const std::vector<std::size_t>& shape);
+
+  // Write a constant column immediately
+  void AddConstant(const std::string& name, const double * data,
+                   const std::vector<std::size_t>& shape);
+
+  // Integer attribute written into the header (DIF number, Pyrame log
+  // info, etc...)
+  void SetAttribute(const std::string& name, long value);
+
+  // Append the current content of all the per-spill columns
+  void Fill();
+
+  // Number of Fill calls
+  std::size_t GetEntries() const;
+
+  // Close the column files and write the header
+  void Close();
+
+ private:
+  struct Column {
+    std::string dtype;
+    std::vector<std::size_t> shape;
+    bool per_spill;
+    const char * address;
+    std::size_t row_bytes;
+    std::unique_ptr<std::ofstream> ofs;
+  };
+
+  std::string m_output_dir;
+  std::map<std::string, Column> m_columns;
+  std::map<std::string, long> m_attributes;
+  std::size_t m_n_entries = 0;
+  bool m_closed = false;
+
+  // Create the column file and return the column
+  Column& NewColumn(const std::string& name, const std::string& dtype,
+                    const std::vector<std::size_t>& shape, bool per_spill,
+                    const char * address, std::size_t element_size);
+
+  ColumnWriter(const ColumnWriter&) = delete;
+  ColumnWriter& operator=(const ColumnWriter&) = delete;
+};
+
+// Add the same columns as the branches of the dense decoder TTree :
+// spill_number, spill_mode, spill_count, chipid, charge, time, bcid,
+// hit, gs, debug_spill and debug_chip. If the ADC is calibrated the pe
+// column and the pedestal and gain constants are added too, and if
+// the TDC is calibrated the time_ns column and the tdc_slope and
+// tdc_intcpt constants. The rd object must outlive the writer.
+void AddRawDataColumns(ColumnWriter& writer, Raw_t& rd,
+                       bool adc_is_calibrated, bool tdc_is_calibrated);
+
+///////////////////////////////////////////////////////////////////////////////
+//                             ColumnReader class                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// Memory-map all the columns of a column directory. The columns are
+// read-only and stay valid until the reader is destroyed. A
+// wgInvalidFile exception is thrown if the header is missing or
+// invalid, or if the size of a column file does not match the header.
+
+class ColumnReader {
+ public:
+  explicit ColumnReader(const std::string& input_dir);
+  ~ColumnReader();
+
+  // Number of spills
+  std::size_t GetEntries() const;
+
+  bool HasColumn(const std::string& name) const;
+
+  // Shape of the column, including the spill dimension for the
+  // per-spill columns. A wgElementNotFound exception is thrown if the
+  // column does not exist.
+  const std::vector<std::size_t>& GetShape(const std::string& name) const;
+
+  // Pointer to the first element of the column. Only int and double
+  // are valid types. A wgElementNotFound exception is thrown if the
+  // column does not exist and std::invalid_argument if the type does
+  // not match the column dtype.
+  template <typename T>
+  const T * GetColumn(const std::string& name) const;
+
+  // Integer attribute of the header. A wgElementNotFound exception is
+  // thrown if the attribute does not exist.
+  long GetAttribute(const std::string& name) const;
+
+ private:
+  struct MappedColumn {
+    std::string dtype;
+    std::vector<std::size_t> shape;
+    const char * data = NULL;
+    std::size_t size = 0;
+  };
+
+  std::string m_input_dir;
+  std::size_t m_n_entries = 0;
+  std::map<std::string, MappedColumn> m_columns;
+  std::map<std::string, long> m_attributes;
+
+  const MappedColumn& FindColumn(const std::string& name) const;
+  void Unmap();
+
+  ColumnReader(const ColumnReader&) = delete;
+  ColumnReader& operator=(const ColumnReader&) = delete;
+};
+
+#endif /* WGCOLUMNS_HPP_ */
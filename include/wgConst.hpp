@@ -87,6 +87,8 @@ const unsigned HIGH_GAIN_BIT  = 1;    // high gain bit (gs)
 const unsigned LOW_GAIN_BIT   = 0;    // low gain bit (gs)
 const double   HIGH_GAIN_NORM   = 1.08; // Normalization for the high gain
 const double   LOW_GAIN_NORM    = 10.8; // Normalization for the low gain
+const unsigned TDC_RAMP_EVEN  = 0;    // TDC ramp used when the BCID is even
+const unsigned TDC_RAMP_ODD   = 1;    // TDC ramp used when the BCID is odd
 
 const unsigned MAX_VALUE_16BITS = 65535;
 const unsigned MAX_VALUE_12BITS = 4095;
@@ -3,6 +3,7 @@
 
 // system includes
 #include <bitset>
+#include <string>
 
 // user includes
 #include "wgConst.hpp"
@@ -34,22 +35,136 @@ const std::bitset<BITS_PER_LINE> xFF00                (0xFF00);
 const std::bitset<BITS_PER_LINE> xF000                (0xF000);
 const std::bitset<BITS_PER_LINE> x0000                (0x0000);
 
+///////////////////////////////////////////////////////////////////////////////
+//                            DecoderOptions struct                          //
+///////////////////////////////////////////////////////////////////////////////
+
+// Options of the DecodeRawFile and DecodeRun functions. The default
+// values are the same as the ones of the wgDecoder program. For an
+// in-depth explanation refer to the autogenerated sphinx
+// documentation.
+struct DecoderOptions {
+  // Overwrite the output files if they already exist
+  bool overwrite = false;
+  // Compatibility mode for old data
+  bool compatibility_mode = false;
+  // Number of decoding threads (0 means one thread per core)
+  unsigned n_threads = 1;
+  // Write only the list of hits of each spill (see the Hits_t class)
+  bool sparse_output = false;
+  // Write the spill index next to the raw file (see wgDecoderIndex.hpp)
+  bool write_index = false;
+  // Only the spills (TTree entries) from first_spill to last_spill
+  // (included) are decoded. If last_spill is negative, all the spills
+  // up to the end of the file are decoded.
+  int first_spill = 0;
+  int last_spill = -1;
+  // Follow mode : decode the raw file while it is being written (see
+  // wgDecoderFollow.hpp). Following stops when the acquisition is
+  // over, when the stop_file file is created (if not empty) or when
+  // the raw file has not grown for idle_timeout seconds (if not zero).
+  bool follow = false;
+  std::string stop_file;
+  unsigned idle_timeout = 0;
+  // Name of the ROOT I/O settings of the output files (see
+  // wgDecoderOutput.hpp). Empty means the default profile.
+  std::string output_profile;
+  // Fused mode : if pyrame_config_file is not empty the histograms of
+  // the wgMakeHist program selected by the makehist_flags flags are
+  // filled while decoding. If write_tree is false the TTree is not
+  // written at all.
+  std::string pyrame_config_file;
+  unsigned long makehist_flags = 0;
+  bool write_tree = true;
+  // Write the performance counters into the <raw file>_report.json run
+  // report (see wgDecoderStats.hpp)
+  bool write_report = false;
+  // Export the decoded data into the <raw file>_columns directory (see
+  // wgColumns.hpp)
+  bool write_columns = false;
+  // DecodeRun only : write the trees of all the DIFs into a single
+  // "<run name>_tree.root" file
+  bool single_file = false;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 C++ API                                   //
+///////////////////////////////////////////////////////////////////////////////
+
+// Decode the input_raw_file raw file of the DIF number "dif" into the
+// <raw file>_tree.root file in the output_dir directory. If dif is
+// zero it is read from the file name and if n_chips is zero it is
+// detected from the raw data. The calibration cards are read from the
+// calibration_dir directory (WAGASCI_CONFDIR if empty). A wagasci
+// error code is returned.
+int DecodeRawFile(const std::string& input_raw_file,
+                  const std::string& calibration_dir,
+                  const std::string& output_dir,
+                  unsigned dif = 0,
+                  unsigned n_chips = 0,
+                  const DecoderOptions& options = DecoderOptions());
+
+// Decode all the "*_ecal_dif_<N>.raw" files found in the run_dir
+// directory. The calibration constants of each DIF are loaded once
+// its number of chips is known and the Pyrame log file is read only
+// once for the whole run. Up to options.n_threads threads are shared
+// among the DIFs. If options.single_file is true all the
+// "tree_dif_<N>" trees are written into one "<run name>_tree.root"
+// file, otherwise one file per DIF is created, exactly like the
+// DecodeRawFile function does. The follow mode, the fused mode and the
+// spill range are not available for a whole run. A wagasci error code
+// is returned.
+int DecodeRun(const std::string& run_dir,
+              const std::string& calibration_dir,
+              const std::string& output_dir,
+              const DecoderOptions& options = DecoderOptions());
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  C API                                    //
+///////////////////////////////////////////////////////////////////////////////
+
 // The extern "C" is needed to call the wgDecoder from Python using
-// ctypes.
+// ctypes. These are thin wrappers around the DecodeRawFile and
+// DecodeRun functions : the arguments are the fields of the
+// DecoderOptions struct. C++ code should use the functions above.
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-  // For an in-depth explanation about the arguments refer to
-  // the autogenerated sphinx documentation.
-
   int wgDecoder(const char * x_input_raw_file,
                 const char * x_calibration_dir,
                 const char * x_output_dir,
                 bool overwrite = false,
                 bool compatibility_mode = false,
                 unsigned dif = 0,
-                unsigned n_chips = 0);
+                unsigned n_chips = 0,
+                unsigned n_threads = 1,
+                bool sparse_output = false,
+                bool write_index = false,
+                int first_spill = 0,
+                int last_spill = -1,
+                bool follow = false,
+                const char * x_stop_file = "",
+                unsigned idle_timeout = 0,
+                const char * x_output_profile = "",
+                const char * x_pyrame_config_file = "",
+                unsigned long makehist_flags = 0,
+                bool write_tree = true,
+                bool write_report = false,
+                bool write_columns = false);
+
+  int wgDecodeRun(const char * x_run_dir,
+                  const char * x_calibration_dir,
+                  const char * x_output_dir,
+                  bool overwrite = false,
+                  bool compatibility_mode = false,
+                  bool single_file = false,
+                  unsigned n_threads = 1,
+                  bool sparse_output = false,
+                  bool write_index = false,
+                  const char * x_output_profile = "",
+                  bool write_report = false,
+                  bool write_columns = false);
   
 #ifdef __cplusplus
 }
@@ -0,0 +1,95 @@
+#ifndef WGDECODERCOMPRESSED_HPP_
+#define WGDECODERCOMPRESSED_HPP_
+
+// system includes
+#include <string>
+#include <istream>
+#include <memory>
+
+// user includes
+#include "wgDecoderInput.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                           Compressed raw files                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// The archived raw files may be compressed with gzip (".raw.gz"), zstd
+// (".raw.zst") or xz (".raw.xz"). The compression format is detected
+// from the first bytes of the file (magic number), so the extension
+// is only needed to find the raw files in a directory (and to read a
+// compressed pipe). A compressed raw file is decompressed on the fly
+// while it is decoded and nothing is ever written to disk.
+//
+// Each format can be read only if the wgDecoder was built with the
+// corresponding library (zlib, libzstd or liblzma). Otherwise a
+// wgInvalidFile exception is thrown when the file is opened.
+
+enum RawDataCompression {
+  RAW_DATA_UNCOMPRESSED = 0,
+  RAW_DATA_GZIP,
+  RAW_DATA_ZSTD,
+  RAW_DATA_XZ
+};
+
+// Return the compression format of the input_raw_file file. If the
+// magic number is not recognized but the extension is the one of a
+// compressed file, or if the file cannot be read, a wgInvalidFile
+// exception is thrown. The format of a pipe is given by its extension
+// only because its magic number cannot be read twice.
+RawDataCompression GetRawDataCompression(const std::string& input_raw_file);
+
+// Name of the compression format (as in the command line tools)
+std::string RawDataCompressionName(RawDataCompression compression);
+
+// Return true if the file name ends with ".raw" or with ".raw" plus
+// the extension of a compressed file
+bool IsRawFileName(const std::string& path);
+
+// Return the file name without the directory, the compression
+// extension and the ".raw" extension. Used to name the output files.
+std::string RawFileBasename(const std::string& path);
+
+///////////////////////////////////////////////////////////////////////////////
+//                        CompressedRawDataInput class                       //
+///////////////////////////////////////////////////////////////////////////////
+
+// Decompress the raw data file on the fly. The file is read and
+// decompressed by a dedicated thread that stays a few blocks of
+// RAW_DATA_BLOCK_SIZE bytes ahead of the decoding, so that the
+// decompression and the decoding overlap.
+//
+// The decompressed data can only be read forward, so it is served
+// through a StreamRawDataInput object that keeps the last
+// RAW_DATA_LOOK_BACK bytes before the read position. The
+// SectionSeeker never rewinds more than that, not even when it
+// resynchronizes after a corrupted region, so the decoding of a
+// compressed file is exactly the same as the decoding of the
+// decompressed one. The spill index and the parallel decoding are not
+// available because they need random access to the whole file.
+//
+// If the compressed data is corrupted or truncated a wgInvalidFile
+// exception is thrown by the read methods.
+
+class CompressedRawDataInput : public RawDataInput {
+ public:
+  CompressedRawDataInput(const std::string& input_raw_file,
+                         RawDataCompression compression);
+  ~CompressedRawDataInput();
+
+  std::streampos tellg() const override;
+  void seekg(std::streampos pos) override;
+  RawDataSpan ReadLines(std::size_t n_lines) override;
+  RawDataSpan PeekLines(std::size_t max_lines) override;
+
+ private:
+  // std::streambuf fed by the decompression thread
+  class DecompressedBuffer;
+  std::unique_ptr<DecompressedBuffer> m_buffer;
+  std::unique_ptr<std::istream> m_is;
+  std::unique_ptr<StreamRawDataInput> m_input;
+
+  CompressedRawDataInput(const CompressedRawDataInput&) = delete;
+  CompressedRawDataInput& operator=(const CompressedRawDataInput&) = delete;
+};
+
+#endif /* WGDECODERCOMPRESSED_HPP_ */
@@ -0,0 +1,95 @@
+#ifndef WGDECODERFOLLOW_HPP_
+#define WGDECODERFOLLOW_HPP_
+
+// system includes
+#include <string>
+#include <chrono>
+#include <functional>
+
+// user includes
+#include "wgRawData.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderStats.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                              FollowOptions struct                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// How often the raw file is checked for new data
+const unsigned FOLLOW_POLL_MILLISECONDS = 500;
+// Minimum time between two consecutive saves of the output TTree
+const unsigned FOLLOW_AUTOSAVE_SECONDS = 5;
+
+// Stop conditions of the follow mode. Following stops as soon as any
+// of them is met.
+struct FollowOptions {
+  // Stop when this file exists (empty means never)
+  std::string stop_file;
+  // Stop when the raw file has not grown for this many seconds (zero
+  // means never)
+  unsigned idle_timeout = 0;
+  // Stop when this Pyrame log file is closed, i.e. when the stop time
+  // of the acquisition is written into it (empty means never)
+  std::string pyrame_log_file;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                             RawFileFollower class                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// The RawFileFollower class decodes a raw file that is still being
+// written by the acquisition. Every FOLLOW_POLL_MILLISECONDS the raw
+// file is memory-mapped again and all the complete spills that were
+// appended are decoded. When the end of the written data is reached in
+// the middle of a spill, the SectionSeeker and SectionReader objects
+// (and the spill counters) are rolled back to the end of the last
+// complete spill, exactly like at the start of a SpillChunk, and the
+// decoding resumes from there when more data is available.
+//
+// Only regular files can be followed. The follower never reads the
+// file past what was written when it was mapped, so the writer is
+// never disturbed.
+
+class RawFileFollower {
+ public:
+  RawFileFollower(const std::string& input_raw_file, const FollowOptions& options);
+
+  // Wait until enough data has been written to probe the raw data
+  // format (see the ProbeRawData function). If a stop condition is met
+  // before that, the best guess is returned. If the raw file cannot be
+  // read, an error is logged and zero chips are returned.
+  RawDataConfig WaitForFormat();
+
+  // Decode the raw file as it grows until a stop condition is met. The
+  // "fill" function is called for every complete spill, exactly like
+  // the SectionReader does. The "autosave" function is called at most
+  // every FOLLOW_AUTOSAVE_SECONDS if some new spills have been filled
+  // and once more at the end. The good and bad spills are counted in
+  // "counter" and the unrecognized lines in "skipped_lines" as the
+  // normal decoding would do. An incomplete spill at the end of the
+  // file is not filled. If "stats" is not NULL, the seek and read
+  // stages are timed and the decoded bytes and the seeker statistics
+  // are stored in it (see the DecoderStats class).
+  typedef std::function<void()> saver;
+  void Follow(const RawDataConfig& config, SectionReader::filler fill, Raw_t& rd,
+              SpillCounter& counter, unsigned& skipped_lines, saver autosave,
+              DecoderStats * stats = NULL);
+
+ private:
+  std::string m_input_raw_file;
+  FollowOptions m_options;
+  std::size_t m_last_size = 0;
+  std::chrono::steady_clock::time_point m_last_growth;
+
+  // Return the current size of the raw file. A wgInvalidFile exception
+  // is thrown if the file disappears or shrinks.
+  std::size_t PollSize();
+
+  // Return true if any of the stop conditions is met
+  bool StopConditionMet();
+};
+
+#endif /* WGDECODERFOLLOW_HPP_ */
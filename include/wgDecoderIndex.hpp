@@ -0,0 +1,128 @@
+#ifndef WGDECODERINDEX_HPP_
+#define WGDECODERINDEX_HPP_
+
+// system includes
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// user includes
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderParallel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                               SpillIndex struct                           //
+///////////////////////////////////////////////////////////////////////////////
+
+// The spill index describes where each spill of a raw file is and in
+// which state the SectionSeeker and SectionReader objects must be to
+// decode it. With the index, any spill (or range of spills) can be
+// decoded without reading the file from the start and the format of
+// the raw data is known without any pre-scan.
+//
+// The index is saved as a "sidecar" file next to the raw file (same
+// path plus the ".idx" extension). The sidecar records the size and
+// modification time of the raw file: if the raw file changes the
+// sidecar is considered stale and ignored.
+//
+// Each entry of the index corresponds to one entry of the decoded
+// TTree, i.e. to a spill whose spill trailer was read. Any garbage
+// found before a spill is included in its byte range.
+
+// Flags of the SpillIndexEntry::flags bitmask
+enum SpillIndexFlags {
+  // Some spills were lost or hopelessly corrupted in the byte range
+  SPILL_INDEX_BAD_SPILL     = 1,
+  // Some unrecognized lines were skipped in the byte range
+  SPILL_INDEX_SKIPPED_LINES = 2,
+  // The number of chips in the spill trailer is not the expected one
+  SPILL_INDEX_WRONG_NCHIPS  = 4
+};
+
+struct SpillIndexEntry {
+  // Spill number and spill count as read from the raw data
+  int32_t spill_number = -1;
+  int32_t spill_count = -1;
+  // Byte offset of the spill in the raw file and byte length of the
+  // spill (up to the start of the next entry)
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  // Number of chips as written in the spill trailer
+  uint32_t n_chips = 0;
+  // Bitmask of SpillIndexFlags. If zero the spill is not corrupted.
+  uint32_t flags = 0;
+  // State of the SectionSeeker and SectionReader objects at the start
+  // of the spill
+  SectionSeeker::State seeker_state;
+  SectionReader::State reader_state;
+
+  bool IsCorrupted() const { return flags != 0; }
+};
+
+struct SpillIndex {
+  // RawDataConfig used to build the index
+  uint32_t n_chips = 0;
+  uint32_t n_chip_id = 0;
+  bool has_spill_number = false;
+  bool has_phantom_menace = false;
+  // Maximum number of chips found in a spill trailer
+  uint32_t max_n_chips = 0;
+  // Size and modification time of the raw file
+  uint64_t raw_file_size = 0;
+  int64_t raw_file_mtime = 0;
+  // Same as the SpillCounter and skipped lines of a full decoding
+  uint32_t n_good_spills = 0;
+  uint32_t n_bad_spills = 0;
+  uint32_t skipped_lines = 0;
+
+  std::vector<SpillIndexEntry> entries;
+
+  // Return the RawDataConfig used to build the index
+  RawDataConfig GetConfig(bool adc_is_calibrated = false,
+                          bool tdc_is_calibrated = false) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                             Spill index functions                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// Return the path of the sidecar index of the input_raw_file file
+std::string SpillIndexPath(const std::string& input_raw_file);
+
+// Seek all the sections of the raw data "input" from the current
+// position to the end and build the spill index. Only the spill number
+// and spill header sections are read. The good and bad spills are
+// counted in "counter" and the number of unrecognized lines is added
+// to "skipped_lines". The size and modification time of the raw file
+// are NOT set.
+SpillIndex BuildSpillIndex(RawDataInput& input,
+                           const RawDataConfig& config,
+                           SpillCounter& counter,
+                           unsigned& skipped_lines);
+
+// Write the index of input_raw_file into its sidecar file. The size and
+// modification time of the raw file are set first. A wgInvalidFile
+// exception is thrown if the sidecar cannot be written.
+void WriteSpillIndex(const std::string& input_raw_file, SpillIndex& index);
+
+// Read the sidecar index of input_raw_file into "index". If
+// header_only is true the entries are not read (useful to know the
+// raw data format without reading the whole index). Return false if
+// the sidecar does not exist, is corrupted or is stale.
+bool ReadSpillIndex(const std::string& input_raw_file, SpillIndex& index,
+                    bool header_only = false);
+
+// Split the entries from "first_entry" (included) to "end_entry"
+// (excluded) of the index into chunks of "spills_per_chunk" spills to
+// be decoded by the DecodeSpillsInParallel function. The spills in the
+// range are counted in "counter".
+std::vector<SpillChunk> MakeSpillChunks(const SpillIndex& index,
+                                        unsigned spills_per_chunk,
+                                        std::size_t first_entry,
+                                        std::size_t end_entry,
+                                        SpillCounter& counter);
+
+#endif /* WGDECODERINDEX_HPP_ */
@@ -0,0 +1,186 @@
+#ifndef WGDECODERINPUT_HPP_
+#define WGDECODERINPUT_HPP_
+
+// system includes
+#include <bitset>
+#include <istream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// system C includes
+#include <cstdint>
+#include <cstring>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgDecoder.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                              RawDataSpan class                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// A RawDataSpan is a read-only view over a number of consecutive
+// 16-bit lines of raw data. It does not own the data it points to:
+// the memory belongs to the RawDataInput object that returned the
+// span.
+//
+// The lines are returned as std::bitset<BITS_PER_LINE> objects so
+// that the usual markers and masks defined in wgDecoder.hpp can be
+// used on them exactly as before. The lines are always copied out
+// with memcpy because after a ThrowOneByte call the span may start
+// at an odd byte offset.
+
+class RawDataSpan {
+ public:
+  RawDataSpan() : m_data(NULL), m_size(0) {}
+  RawDataSpan(const char * data, std::size_t size) : m_data(data), m_size(size) {}
+
+  std::bitset<BITS_PER_LINE> operator[](std::size_t index) const {
+    return std::bitset<BITS_PER_LINE>(line(index));
+  }
+
+  // Raw 16-bit value of the line
+  uint16_t line(std::size_t index) const {
+    uint16_t value;
+    std::memcpy(&value, m_data + index * BYTES_PER_LINE, BYTES_PER_LINE);
+    return value;
+  }
+
+  // Number of lines in the span
+  std::size_t size() const { return m_size; }
+
+  // Pointer to the first byte of the span
+  const char * data() const { return m_data; }
+
+ private:
+  const char * m_data;
+  std::size_t m_size;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                             RawDataInput class                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// Abstract input backend of the wgDecoder. The SectionSeeker and
+// SectionReader classes only talk to the raw data through this
+// interface, so that the same decoding logic can be used both on
+// memory-mapped files and on plain std::istream objects (pipes,
+// sockets, etc...).
+//
+// The positions are always expressed in bytes from the start of the
+// raw data, exactly like the output of the std::istream::tellg()
+// method.
+//
+// ATTENTION!
+// A RawDataSpan returned by ReadLines is guaranteed to be valid only
+// until the next call to ReadLines on the same object. For the
+// memory-mapped backend the span is valid until the object is
+// destroyed, but do not rely on that.
+
+class RawDataInput {
+ public:
+  virtual ~RawDataInput() {}
+
+  // Return the current read position
+  virtual std::streampos tellg() const = 0;
+
+  // Move the read position to the absolute position "pos"
+  virtual void seekg(std::streampos pos) = 0;
+
+  // Return a span over the next n_lines lines and move the read
+  // position past them. If less than n_lines lines are left, a wgEOF
+  // exception is thrown and the read position is not changed.
+  virtual RawDataSpan ReadLines(std::size_t n_lines) = 0;
+
+  // Return a span over the next max_lines lines without moving the
+  // read position. The span is shorter than max_lines only if the end
+  // of the data is reached.
+  virtual RawDataSpan PeekLines(std::size_t max_lines) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                          MappedRawDataInput class                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// Memory map the whole raw data file and return spans pointing
+// directly into the mapped memory (zero-copy). Only regular files can
+// be mapped. If the file cannot be opened or mapped a wgInvalidFile
+// exception is thrown.
+
+class MappedRawDataInput : public RawDataInput {
+ public:
+  explicit MappedRawDataInput(const std::string& input_raw_file);
+  ~MappedRawDataInput();
+
+  std::streampos tellg() const override;
+  void seekg(std::streampos pos) override;
+  RawDataSpan ReadLines(std::size_t n_lines) override;
+  RawDataSpan PeekLines(std::size_t max_lines) override;
+
+  // Size of the mapped file in bytes
+  std::size_t size() const { return m_size; }
+
+ private:
+  const char * m_data = NULL;
+  std::size_t m_size = 0;
+  std::size_t m_position = 0;
+
+  MappedRawDataInput(const MappedRawDataInput&) = delete;
+  MappedRawDataInput& operator=(const MappedRawDataInput&) = delete;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                          StreamRawDataInput class                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// Fallback backend for streams that cannot be memory-mapped (pipes,
+// FIFOs, etc...). The underlying std::istream is only ever read
+// forward: the data is copied into an internal buffer and every seek
+// is served from that buffer. To keep the memory bounded, only the
+// last RAW_DATA_LOOK_BACK bytes before the read position are
+// retained. This is enough for the SectionSeeker class that never
+// rewinds more than MAX_RAWDATA_LENGTH lines. Trying to seek before
+// the retained window throws a std::out_of_range exception.
+
+// Maximum number of bytes that the SectionSeeker can rewind
+const std::size_t RAW_DATA_LOOK_BACK = MAX_RAWDATA_LENGTH * BYTES_PER_LINE;
+// Number of bytes read from the underlying stream every time the
+// buffer is refilled
+const std::size_t RAW_DATA_BLOCK_SIZE = 1 << 20;
+
+class StreamRawDataInput : public RawDataInput {
+ public:
+  // Read from an already opened stream. The stream is not owned.
+  explicit StreamRawDataInput(std::istream& is);
+  // Open the input_raw_file file as a binary stream.
+  explicit StreamRawDataInput(const std::string& input_raw_file);
+
+  std::streampos tellg() const override;
+  void seekg(std::streampos pos) override;
+  RawDataSpan ReadLines(std::size_t n_lines) override;
+  RawDataSpan PeekLines(std::size_t max_lines) override;
+
+ private:
+  std::unique_ptr<std::ifstream> m_ifs;
+  std::istream& m_is;
+  std::vector<char> m_buffer;
+  // Position of m_buffer[0] in the stream
+  std::size_t m_buffer_start = 0;
+  std::size_t m_position = 0;
+
+  // Make sure that the bytes up to "stop" are in the buffer. Return
+  // false if the stream ends before that.
+  bool Fill(std::size_t stop);
+};
+
+// Open the raw data file "input_raw_file" using the fastest backend
+// available. Compressed files are decompressed on the fly (see the
+// CompressedRawDataInput class in wgDecoderCompressed.hpp), other
+// regular files are memory-mapped and everything else is read through
+// a StreamRawDataInput object. A wgInvalidFile exception is thrown if
+// the file cannot be opened at all.
+std::unique_ptr<RawDataInput> OpenRawDataInput(const std::string& input_raw_file);
+
+#endif /* WGDECODERINPUT_HPP_ */
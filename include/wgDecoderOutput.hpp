@@ -0,0 +1,89 @@
+#ifndef WGDECODEROUTPUT_HPP_
+#define WGDECODEROUTPUT_HPP_
+
+// system includes
+#include <string>
+#include <vector>
+
+// ROOT includes
+#include "TFile.h"
+#include "TTree.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//                              OutputProfile struct                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// An output profile is a set of ROOT I/O settings used to write the
+// decoded TTree. Writing the output takes a large share of the
+// decoding time and the same settings decide how fast the file is read
+// later on, so the best profile depends on what the file is for:
+//
+//  - "default" : the ROOT defaults. Nothing is changed.
+//
+//  - "fast"    : LZ4 compression. Fast to write and to read, the files
+//                are a bit larger than the default ones.
+//
+//  - "archive" : ZSTD compression (LZMA if ROOT is older than 6.20).
+//                Small files that are still fast to read.
+//
+//  - "compact" : LZMA compression. The smallest files, slow to write.
+//
+//  - "scratch" : no compression. For temporary files that are read
+//                once and deleted.
+//
+// Apart from the default one, all the profiles use large baskets and
+// clusters (see TTree::SetAutoFlush) of a fixed size in bytes, so
+// that every read of the file is a few large reads instead of many
+// small ones.
+
+struct OutputProfile {
+  std::string name;
+  // ROOT compression settings (100 * algorithm + level, see the
+  // ROOT::RCompressionSetting class). Negative means the ROOT default.
+  int compression = -1;
+  // Size in bytes of the basket buffer of each branch. Zero means the
+  // ROOT default.
+  int basket_size = 0;
+  // The baskets are flushed to disk every auto_flush_bytes bytes of
+  // uncompressed data, so that all the baskets of a cluster are
+  // contiguous in the file. Zero means the ROOT default.
+  long long auto_flush_bytes = 0;
+  // Compress the baskets of different branches in parallel using
+  // ROOT implicit multi-threading (see EnableParallelCompression)
+  bool parallel_compression = false;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                            Output profile functions                       //
+///////////////////////////////////////////////////////////////////////////////
+
+// Names of all the output profiles
+std::vector<std::string> OutputProfileNames();
+
+// Return the output profile called "name". An empty name means the
+// default profile. A std::invalid_argument exception is thrown if the
+// profile does not exist.
+OutputProfile GetOutputProfile(const std::string& name);
+
+// Set the compression of the output file. Must be called before any
+// TTree is created in the file.
+void ApplyOutputProfile(const OutputProfile& profile, TFile& file);
+
+// Set the basket size and the clustering of the TTree. Must be called
+// after all the branches have been created and before the first Fill.
+// When the first cluster is flushed ROOT resizes the baskets to fit
+// the cluster, so the basket size is just the starting point.
+void ApplyOutputProfile(const OutputProfile& profile, TTree& tree);
+
+// If the profile uses parallel compression and n_threads is more than
+// one, enable ROOT implicit multi-threading with half of the n_threads
+// threads, so that the TTree baskets are compressed in parallel when
+// flushed. Return the number of threads left for decoding, so that no
+// more than n_threads threads are busy at the same time. Does nothing
+// and returns n_threads if ROOT was built without implicit
+// multi-threading support or if it is already enabled (the existing
+// pool is used as it is). Must be called before the output files are
+// created.
+unsigned EnableParallelCompression(const OutputProfile& profile, unsigned n_threads);
+
+#endif /* WGDECODEROUTPUT_HPP_ */
@@ -0,0 +1,96 @@
+#ifndef WGDECODERPARALLEL_HPP_
+#define WGDECODERPARALLEL_HPP_
+
+// system includes
+#include <string>
+#include <vector>
+
+// user includes
+#include "wgRawData.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderUtils.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                              SpillCounter class                           //
+///////////////////////////////////////////////////////////////////////////////
+
+// Count the good and bad spills. A spill is good if its raw data is
+// correctly read, otherwise it is bad. Just pass every section
+// returned by the SectionSeeker to the Count method. The same class
+// is used by the sequential and parallel decoders so that they always
+// agree on the statistics.
+
+class SpillCounter {
+ public:
+  unsigned n_good_spills = 0;
+  unsigned n_bad_spills = 0;
+
+  void Count(const SectionSeeker::Section& section);
+
+ private:
+  int m_last_spill_count = -1;
+  unsigned m_last_section_type = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                               SpillChunk struct                           //
+///////////////////////////////////////////////////////////////////////////////
+
+// A SpillChunk is a range of consecutive spills that can be decoded
+// independently from the rest of the file. It starts right after a
+// spill trailer (or at the start of the file) and contains the state
+// that the SectionSeeker and SectionReader objects had at that
+// position. "n_spills" is the number of spills (TTree entries) that
+// are found in the chunk.
+
+// Number of spills in each chunk. Each thread keeps at most two
+// chunks of decoded spills in memory.
+const unsigned SPILLS_PER_CHUNK = 16;
+
+struct SpillChunk {
+  std::streampos start;
+  SectionSeeker::State seeker_state;
+  SectionReader::State reader_state;
+  unsigned n_spills = 0;
+};
+
+// First pass of the parallel decoder. Seek all the sections of the
+// raw data "input" from start to end and split the spills into chunks
+// of "spills_per_chunk" spills each. Only the spill number and spill
+// header sections are read, everything else is just sought, so this
+// is much faster than a full decoding. The good and bad spills are
+// counted in "counter" and the number of unrecognized lines is added
+// to "skipped_lines". The chunks are made from the spill index (see
+// the wgDecoderIndex.hpp header) that is built on the fly.
+std::vector<SpillChunk> IndexSpills(RawDataInput& input,
+                                    const RawDataConfig& config,
+                                    unsigned spills_per_chunk,
+                                    SpillCounter& counter,
+                                    unsigned& skipped_lines);
+
+// Second pass of the parallel decoder. The chunks are decoded by
+// "n_threads" threads, each one with its own memory-mapped view of
+// the input_raw_file file and its own Raw_t object. The per-spill data
+// of the decoded spills (see Raw_t::copy_spill) is then copied one by
+// one into the "rd" object and the "fill" function is called with it
+// (by the calling thread only) in the original spill order. This is the same function that the
+// SectionReader would call in the sequential decoder, so the output
+// is exactly the same.
+//
+// Any exception thrown while decoding a chunk is re-thrown by this
+// function after all the threads have stopped.
+//
+// If seeker_statistics is not NULL, the statistics of the
+// SectionSeeker objects of all the threads are added to it (see the
+// SectionSeeker::Statistics struct).
+void DecodeSpillsInParallel(const std::string& input_raw_file,
+                            const RawDataConfig& config,
+                            const std::vector<SpillChunk>& chunks,
+                            SectionReader::filler fill,
+                            Raw_t& rd,
+                            unsigned n_threads,
+                            SectionSeeker::Statistics * seeker_statistics = NULL);
+
+#endif /* WGDECODERPARALLEL_HPP_ */
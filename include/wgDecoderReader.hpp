@@ -5,6 +5,7 @@
 #include <bitset>
 #include <istream>
 #include <functional>
+#include <vector>
 
 // ROOT includes
 #include "TTree.h"
@@ -60,13 +61,32 @@ class SectionReader {
   
   SectionReader(const RawDataConfig& config, TTree* tree, Raw_t& rd);
 
-  // Read the Section section from the stream is into the Raw_t m_rd object
-  void ReadNextSection(std::istream& is, const SectionSeeker::Section& section);
+  // Same as above but, instead of filling a TTree, the "fill"
+  // function is called every time a whole spill has been read into
+  // the rd object. The rd object is cleared right after "fill"
+  // returns.
+  typedef std::function<void(Raw_t& rd)> filler;
+  SectionReader(const RawDataConfig& config, filler fill, Raw_t& rd);
+
+  // Read the Section section into the Raw_t m_rd object. The section
+  // lines are taken from the section.data view, so this method must be
+  // called before seeking the next section.
+  void ReadNextSection(const SectionSeeker::Section& section);
+
+  // Same as the SectionSeeker::State struct. It contains the info
+  // about the previous spill that is needed to read the next one.
+  struct State {
+    unsigned last_spill_number;
+    unsigned last_spill_count;
+  };
+
+  State GetState() const;
+  void SetState(const State& state);
   
  private:
 
   RawDataConfig m_config;
-  TTree * m_tree;
+  filler m_fill;
   std::reference_wrapper<Raw_t> m_rd;
 
   // To calculate the spill number gap and the spill count gap we need
@@ -77,21 +97,35 @@ class SectionReader {
   // The concept of readers ring is the very same of the seekers ring
   // in the SectionSeeker class
   std::size_t m_num_marker_types;
-  typedef std::function<void(std::istream& is, const SectionSeeker::Section& section)> reader;
+  typedef std::function<void(const SectionSeeker::Section& section)> reader;
   std::array<reader, NUM_SECTION_TYPES> m_readers_ring;
 
-  // Read the section delimited by the "Section" struct from the "is"
-  // file stream
-  void ReadSpillNumber (std::istream& is, const SectionSeeker::Section& section);
-  void ReadSpillHeader (std::istream& is, const SectionSeeker::Section& section);
-  void ReadChipHeader  (std::istream& is, const SectionSeeker::Section& section);
-  void ReadChipTrailer (std::istream& is, const SectionSeeker::Section& section);
-  void ReadSpillTrailer(std::istream& is, const SectionSeeker::Section& section);
-  void ReadRawData     (std::istream& is, const SectionSeeker::Section& section);
+  // Read the section described by the "Section" struct
+  void ReadSpillNumber (const SectionSeeker::Section& section);
+  void ReadSpillHeader (const SectionSeeker::Section& section);
+  void ReadChipHeader  (const SectionSeeker::Section& section);
+  void ReadChipTrailer (const SectionSeeker::Section& section);
+  void ReadSpillTrailer(const SectionSeeker::Section& section);
+  void ReadRawData     (const SectionSeeker::Section& section);
 
   void InitializeRing();
 
-  //  Fill the m_tree TTree with the m_rd Raw_t object
+  // The calibration constants are copied from the Raw_t object passed
+  // to the constructor and flattened in the [chip][channel][column]
+  // order (or [chip][channel][ramp] for the TDC). The gains and TDC
+  // slopes are inverted only once here, so that the conversion of
+  // every cell is just a multiplication.
+  std::vector<double> m_pedestal;
+  std::vector<double> m_pe_factor[2];   // NORM / gain for each gain bit
+  std::vector<double> m_tdc_intcpt;
+  std::vector<double> m_tdc_inv_slope;
+  void PrecomputeCalibration();
+
+  // Convert the charge into p.e. and the time into ns for all the
+  // channels and the first n_columns columns of the ichip chip
+  void CalibrateChip(unsigned ichip, unsigned n_columns);
+
+  //  Fill the TTree (or call the filler) with the m_rd Raw_t object
   void FillTree();
 };
 
@@ -0,0 +1,196 @@
+#ifndef WGDECODERRUN_HPP_
+#define WGDECODERRUN_HPP_
+
+// system includes
+#include <string>
+#include <vector>
+#include <map>
+
+// ROOT includes
+#include "TTree.h"
+
+// user includes
+#include "wgDecoder.hpp"
+#include "wgRawData.hpp"
+#include "wgGetCalibData.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderIndex.hpp"
+#include "wgDecoderFollow.hpp"
+#include "wgDecoderOutput.hpp"
+#include "wgDecoderStats.hpp"
+#include "wgMakeHist.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                               PyrameLog struct                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// Acquisition info written by Pyrame in the log file that is created
+// together with the .raw files. All the DIFs of the same acquisition
+// share the same log file, so it needs to be read only once per run.
+// The fields that were not read are -1, the same value used by
+// wgMakeHist for the parameters that were not recorded.
+
+struct PyrameLog {
+  bool found = false;
+  // Start time of the acquisition that produced the .raw file
+  Int_t start_time = -1;
+  // Stop time of the acquisition that produced the .raw file
+  Int_t stop_time = -1;
+  // Number of data packets acquired as reported by Pyrame
+  Int_t nb_data_pkts = -1;
+  // Number of lost packets as reported by Pyrame
+  Int_t nb_lost_pkts = -1;
+};
+
+// Return the path of the Pyrame log file that was created together
+// with the input_raw_file file (everything before "_ecal_dif_" plus
+// the ".log" extension)
+std::string GetPyrameLogFile(const std::string& input_raw_file);
+
+// Read the pyrame_log_file file. If the file does not exist an error
+// is logged and the "found" member is false.
+PyrameLog ReadPyrameLog(const std::string& pyrame_log_file);
+
+// Return true if the pyrame_log_file file exists and the stop time of
+// the acquisition has been written into it
+bool PyrameLogIsClosed(const std::string& pyrame_log_file);
+
+///////////////////////////////////////////////////////////////////////////////
+//                           FusedHistOptions struct                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// Options of the fused decode-and-histogram mode. Every decoded spill
+// is used to fill the same histograms that the wgMakeHist program
+// would fill reading the decoded TTree (see the MakeHist class), so
+// the _hist.root file is written without reading the TTree back.
+struct FusedHistOptions {
+  // Path of the output _hist.root file
+  std::string output_hist_file;
+  // Number of channels of each chip of the DIF (see Topology::dif_map)
+  std::map<unsigned, unsigned> chip_map;
+  // makehist flags selecting the histograms (see wgMakeHist.hpp)
+  std::bitset<makehist::NFLAGS> flags;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                            DifCalibration struct                          //
+///////////////////////////////////////////////////////////////////////////////
+
+// Calibration constants of a single DIF. The calibration cards are
+// parsed only by LoadDifCalibration, once the number of chips of the
+// DIF is known.
+struct DifCalibration {
+  // Directory containing the calibration cards
+  std::string calibration_dir;
+  // DIF number
+  unsigned dif = 0;
+  // Number of chips the constants were loaded for (zero if they were
+  // not loaded yet)
+  unsigned n_chips = 0;
+  bool pedestal_is_calibrated = false;
+  bool gain_is_calibrated = false;
+  bool tdc_is_calibrated = false;
+  // Same layout as the pedestal, gain, tdc_slope and tdc_intcpt
+  // arrays of the Raw_t class
+  std::vector<double> pedestal;
+  std::vector<double> gain;
+  std::vector<double> tdc_slope;
+  std::vector<double> tdc_intcpt;
+};
+
+// Read the calibration constants of the calib.dif DIF for n_chips
+// chips from the cards found in the calib.calibration_dir
+// directory. The constants that are not found are flagged as not
+// calibrated.
+void LoadDifCalibration(DifCalibration& calib, unsigned n_chips);
+
+///////////////////////////////////////////////////////////////////////////////
+//                               DecodeDifFile                               //
+///////////////////////////////////////////////////////////////////////////////
+
+// Decode the raw data of a single DIF "input_raw_file" into the
+// "tree_dif_<dif>" TTree and write it to the output_file_path ROOT
+// file. If n_chips is zero it is detected from the raw data. The
+// arguments must have been already checked by the caller.
+//
+// The calibration constants are taken from the "calib" object. If
+// they were not loaded yet, or were loaded for a different number of
+// chips, they are (re)loaded by LoadDifCalibration. If "calib" is NULL
+// the detector is considered not calibrated. The pyrame_log info is
+// added to the UserInfo of the TTree if found.
+//
+// The other settings are taken from the "options" object (see the
+// DecoderOptions struct in wgDecoder.hpp) :
+//
+//  - If options.n_threads is more than one, the file is decoded in
+//    parallel (see wgDecoderParallel.hpp). It must not be zero.
+//
+//  - If options.sparse_output is true, only the list of hits of each
+//    spill is written (see the Hits_t class) and the calibration
+//    constants are written once in the "calib_dif_<dif>" TTree.
+//
+//  - If a fresh spill index sidecar (see wgDecoderIndex.hpp) is
+//    found, the raw data format is read from it and the raw file is
+//    not pre-scanned. If options.write_index is true the spill index is
+//    written (or rewritten) next to the raw file. Decoding a range of
+//    spills needs the index, that is built on the fly if not found.
+//
+//  - If options.follow is true the raw file is still being written :
+//    the complete spills are decoded as they are appended to the file
+//    until the acquisition is over or one of the other stop conditions
+//    is met (see wgDecoderFollow.hpp). The TTree is saved periodically
+//    so that it can be read while it is being filled. In follow mode
+//    the spill index is not used nor written, only one thread is used
+//    and all the spills are decoded. The pyrame_log argument is
+//    ignored and the Pyrame log file is read at the end.
+//
+//  - The output file and TTree are written with the
+//    options.output_profile ROOT I/O settings (see wgDecoderOutput.hpp).
+//
+//  - If options.write_report is true the performance counters of the
+//    decoding (see the DecoderStats class in wgDecoderStats.hpp) are
+//    written as a JSON run report into the <raw file>_report.json file
+//    next to the output file, also when an error occurs while reading
+//    the raw data.
+//
+//  - If options.write_columns is true the decoded spills are also
+//    exported in the memory-mappable columnar layout into the
+//    <raw file>_columns directory next to the output file (see
+//    wgColumns.hpp). The export has the same (dense) content as the
+//    TTree, also in sparse output mode.
+//
+// If fused_hist is not NULL the histograms of the wgMakeHist program
+// are filled while decoding and written into the
+// fused_hist->output_hist_file file together with the Pyrame log
+// info. If options.write_tree is false, output_file_path is not
+// created. The options.pyrame_config_file and options.makehist_flags
+// fields are not used : fused_hist is built from them by the caller.
+//
+// A wagasci error code is returned.
+int DecodeDifFile(const std::string& input_raw_file,
+                  const std::string& output_file_path,
+                  unsigned dif,
+                  unsigned n_chips,
+                  DifCalibration * calib,
+                  const PyrameLog& pyrame_log,
+                  const DecoderOptions& options,
+                  const FusedHistOptions * fused_hist = NULL);
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 FindRawFiles                              //
+///////////////////////////////////////////////////////////////////////////////
+
+// A single DIF raw file of a run
+struct DifRawFile {
+  unsigned dif;
+  std::string path;
+};
+
+// Return all the "*_ecal_dif_<N>.raw" files found in the run_dir
+// directory sorted by DIF number. The DIF number is read from the
+// file name. Files whose DIF number cannot be read are ignored. A
+// wgInvalidFile exception is thrown if run_dir is not a directory.
+std::vector<DifRawFile> FindRawFiles(const std::string& run_dir);
+
+#endif /* WGDECODERRUN_HPP_ */
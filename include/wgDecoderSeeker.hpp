@@ -2,6 +2,7 @@
 #define WGDECODERNEW_H
 
 // system includes
+#include <array>
 #include <bitset>
 #include <istream>
 #include <functional>
@@ -9,6 +10,7 @@
 // user includes
 #include "wgConst.hpp"
 #include "wgDecoder.hpp"
+#include "wgDecoderInput.hpp"
 #include "wgDecoderUtils.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -90,6 +92,13 @@ class SectionSeeker {
   // element is incremented by one, no matter what is the spill
   // number, the spill flag or the acquisition ID fields in the raw
   // data.
+  //
+  // The "data" element is a view over the "lines" lines of the
+  // section that the seeker has already read. It is handed over to
+  // the SectionReader so that the section never needs to be read
+  // again. The view is valid only until the next call to the
+  // SeekNextSection method: read the section BEFORE seeking the next
+  // one.
 
   struct Section {
     std::streampos start;
@@ -98,6 +107,7 @@ class SectionSeeker {
     unsigned ispill = 0;
     unsigned type;
     unsigned lines;
+    RawDataSpan data;
   };
 
   // To construct the object you need to pass a RawDataConfig
@@ -107,19 +117,15 @@ class SectionSeeker {
 
   SectionSeeker(const RawDataConfig &config);
 
-  // The only argument is the input file stream descriptor "is". The
-  // file must be opened as a binary file with at least read
-  // access.
+  // The first argument is the raw data input "is". Usually it is the
+  // object returned by the OpenRawDataInput function (refer to the
+  // wgDecoderInput.hpp header) that memory-maps the raw data file
+  // when possible or falls back to a plain stream otherwise.
   //
-  // If the file is not opened, or the program has not read
-  // permission, or the stream is not clear (error bit are set) the
-  // behavior of this method is not defined. Most probably in any of
-  // those cases an exception will be thrown. This method doesn't
-  // check the sanity of the "is" stream in any way to avoid the
-  // overhead of having to check for all those condition each and
-  // every section. The wgDecoder is already slow as it is. For this
-  // reason, make sure to check if the file is correctly opened BEFORE
-  // calling this method.
+  // This method doesn't check the sanity of the "is" input in any way
+  // to avoid the overhead of having to check for all those condition
+  // each and every section. For this reason, make sure to check if
+  // the file is correctly opened BEFORE calling this method.
   //
   // If the end of file is reached an exception of type wgEOF is
   // thrown. Catch that exception if you want to gracefully close the
@@ -130,8 +136,49 @@ class SectionSeeker {
   // the method is undefined so always use the Section.start element
   // to locate the start of the next section and don't rely on the
   // stream position.
+  //
+  // If some lines cannot be recognized as part of any section they
+  // are skipped and their number is added to "skipped_lines". The
+  // search for the next recognizable section is iterative and only
+  // looks at a bounded window of the input at a time, so that the
+  // memory and stack usage do not depend on how long the corrupted
+  // region is.
   
-  Section SeekNextSection(std::istream& is, unsigned &recursive_counter);
+  Section SeekNextSection(RawDataInput& is, unsigned &skipped_lines);
+
+  // The "State" struct contains everything that the seeker remembers
+  // about the previous sections. Saving the state at a certain
+  // position and restoring it later (in the same object or in
+  // another one with the same RawDataConfig) allows to resume the
+  // seeking from that position exactly as if all the previous
+  // sections had just been sought.
+
+  struct State {
+    unsigned type;
+    unsigned last_ispill;
+    unsigned last_ichip;
+    unsigned current_ichip;
+  };
+
+  State GetState() const;
+  void SetState(const State& state);
+
+  // The "Statistics" struct counts what the seeker has found so far:
+  // the number of sections of each type (indexed by the SectionType
+  // enum), the number of times that the seeker had to resynchronize
+  // after some unrecognized lines and the number of times that one
+  // byte had to be thrown away to realign the lines. The statistics
+  // are not part of the State because they are not needed to resume
+  // the seeking but they can be saved and restored in the same way.
+
+  struct Statistics {
+    std::array<unsigned long, NUM_SECTION_TYPES> n_sections = {};
+    unsigned long n_resyncs = 0;
+    unsigned long n_thrown_bytes = 0;
+  };
+
+  const Statistics& GetStatistics() const;
+  void SetStatistics(const Statistics& statistics);
 
  private:
 
@@ -139,18 +186,13 @@ class SectionSeeker {
   // methods of this class in order to use it. Anyway, the variable
   // names are clear enough that no explanation should be needed.
 
-  // nuber of section types for this raw file. It can be different
-  // depending on the particular structure of the raw data file
-  // (e.g. if the spill number section is present or not, etc..). It
-  // is set when the object is constructed and never changed until the
-  // object goes out of scope.
-  std::size_t m_num_section_types;
-
   // The m_seeker_ring is a circular buffer containing all the "Seek*"
   // methods needed to decode the particular raw data file. It must be
   // a circular buffer because when the last section is reached we
-  // want to go straight to the first section again.
-  typedef std::function<bool(std::istream& is)> seeker;
+  // want to go straight to the first section again. The slots of the
+  // sections that are not present in the raw data file (depending on
+  // the RawDataConfig) are left empty and skipped.
+  typedef std::function<bool(RawDataInput& is)> seeker;
   std::array<seeker, NUM_SECTION_TYPES> m_seekers_ring;
 
   // This object contains all the configuration parameters about the
@@ -168,22 +210,34 @@ class SectionSeeker {
   unsigned m_last_ichip = 0;
   unsigned m_current_ichip = 0;
 
+  // Counters returned by GetStatistics
+  Statistics m_statistics;
+
   // The seekers return true if the section was found and in good
   // shape, false if the section was not found or was hopelessly
   // corrupted.
-  bool SeekSpillNumber  (std::istream& is);
-  bool SeekSpillHeader  (std::istream& is);
-  bool SeekChipHeader   (std::istream& is);
-  bool SeekChipTrailer  (std::istream& is);
-  bool SeekSpillTrailer (std::istream& is);
-  bool SeekPhantomMenace(std::istream& is);
-  bool SeekRawData      (std::istream& is);
+  bool SeekSpillNumber  (RawDataInput& is);
+  bool SeekSpillHeader  (RawDataInput& is);
+  bool SeekChipHeader   (RawDataInput& is);
+  bool SeekChipTrailer  (RawDataInput& is);
+  bool SeekSpillTrailer (RawDataInput& is);
+  bool SeekPhantomMenace(RawDataInput& is);
+  bool SeekRawData      (RawDataInput& is);
 
   // Given the last_section_type section type, tells what the next
   // section should be, depending if the last section was found or
   // not.
   unsigned NextSectionType(unsigned last_section_type, bool last_section_was_found);
 
+  // Called when no seeker recognizes the line at the current
+  // position. Move the position forward to the first line where a
+  // seeker may succeed, skipping all the lines in between without
+  // trying every seeker on each of them. If a section marker is found
+  // at an odd byte offset before any such line, one byte is thrown
+  // away to realign the input. If nothing is found until the end of
+  // the input a wgEOF exception is thrown.
+  void Resynchronize(RawDataInput& is, unsigned& skipped_lines);
+
   // During the object construction, the m_seekers_ring is initialized
   // with the needed seekers. Because all the seekers are not always
   // needed, the ring is initialized only with the necessary seekers
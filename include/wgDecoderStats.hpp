@@ -0,0 +1,119 @@
+#ifndef WGDECODERSTATS_HPP_
+#define WGDECODERSTATS_HPP_
+
+// system includes
+#include <string>
+#include <array>
+#include <chrono>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderParallel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                              DecoderStage enum                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// The stages of the decoding whose duration is measured. Used for
+// array indexes!
+enum DecoderStage {
+  // Open the raw file and guess the raw data format (or read the
+  // spill index). In follow mode it includes the waiting for data.
+  STAGE_PROBE = 0,
+  // Build and write the spill index
+  STAGE_INDEX,
+  // SectionSeeker::SeekNextSection (sequential and follow mode only)
+  STAGE_SEEK,
+  // SectionReader::ReadNextSection but the time spent in the filling
+  // of the spill (sequential and follow mode only)
+  STAGE_READ,
+  // Seek and read all the spills with many threads (parallel mode
+  // only). It is the wall time of the whole parallel decoding but the
+  // time spent in the filling of the spills.
+  STAGE_DECODE,
+  // Fill the histograms (fused mode only)
+  STAGE_HIST,
+  // TTree::Fill calls that did not write any basket to the file
+  STAGE_FILL,
+  // TTree::Fill calls that wrote some baskets to the file and the
+  // periodic saves of the TTree in follow mode
+  STAGE_FLUSH,
+  // Write the TTree and the histograms and close the files
+  STAGE_WRITE,
+  N_DECODER_STAGES
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                              DecoderStats class                           //
+///////////////////////////////////////////////////////////////////////////////
+
+// Performance counters of the decoding of a single raw file. They are
+// cheap enough to be always collected and are written into a JSON run
+// report (see the WriteDecoderReport function) so that a slow
+// decoding can be told apart from a corrupted raw file without
+// profiling the decoder. In parallel mode only the spills listed in
+// the spill index are read, so the bytes and sections after the last
+// complete spill are not counted.
+
+class DecoderStats {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  // Number of bytes of the raw file that have been decoded
+  unsigned long long bytes_read = 0;
+  // Sections found, resynchronizations and thrown bytes (see the
+  // SectionSeeker::Statistics struct)
+  SectionSeeker::Statistics seeker;
+  // Number of unrecognized lines that were skipped
+  unsigned long long skipped_lines = 0;
+  // Good and bad spills as counted by the SpillCounter class
+  unsigned n_good_spills = 0;
+  unsigned n_bad_spills = 0;
+  // Number of spills filled (TTree entries)
+  unsigned long n_filled_spills = 0;
+  // Number of TTree::Fill calls that wrote some baskets to the file
+  unsigned long n_flushes = 0;
+  // Sum of the debug_spill and debug_chip counters of all the filled
+  // spills (and all the chips)
+  std::array<unsigned long long, N_DEBUG_SPILL> debug_spill = {};
+  std::array<unsigned long long, N_DEBUG_CHIP> debug_chip = {};
+  // Duration of each stage in seconds (indexed by DecoderStage)
+  std::array<double, N_DECODER_STAGES> stage_seconds = {};
+  // Duration of the whole decoding in seconds
+  double total_seconds = 0;
+
+  // Add the time elapsed since "start" to the "stage" timer and return
+  // the current time, so that consecutive stages can be chained.
+  clock::time_point AddTime(DecoderStage stage, clock::time_point start);
+
+  // Total time spent in the filling of the spills (hist, fill and
+  // flush stages). Used to subtract the filling from the stages that
+  // call the fill function.
+  double FillSeconds() const;
+
+  // Add the debug counters of a filled spill
+  void CountSpill(Raw_t& rd);
+
+  // Copy the spill counters
+  void SetSpillCounter(const SpillCounter& counter);
+};
+
+// Name of the "stage" stage as written in the run report
+std::string DecoderStageName(DecoderStage stage);
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Run report                                //
+///////////////////////////////////////////////////////////////////////////////
+
+// Write the "stats" counters of the decoding of the input_raw_file
+// file (DIF "dif") into the report_file JSON file. A wgInvalidFile
+// exception is thrown if the file cannot be written.
+void WriteDecoderReport(const std::string& report_file,
+                        const std::string& input_raw_file,
+                        unsigned dif,
+                        int result,
+                        const DecoderStats& stats);
+
+#endif /* WGDECODERSTATS_HPP_ */
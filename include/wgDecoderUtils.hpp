@@ -8,6 +8,7 @@
 
 // user includes
 #include "wgDecoder.hpp"
+#include "wgDecoderInput.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////
 //                           wagasci_decoder_utils                           //
@@ -26,31 +27,67 @@ std::streampos ReadChunk(std::istream& is, std::vector<std::bitset<BITS_PER_LINE
 // Throw one byte away from the istream *is*. Sometimes the byte offset may
 // become wrong and we need it to restore balance in the force.
 void ThrowOneByte(std::istream& is);
+void ThrowOneByte(RawDataInput& is);
 
 // Find if element is present in vector_of_elements. If at least one
 // occurrence is found return true and the position of the first
 // occurence as a std::pair.
 std::pair<bool, std::size_t> FindInVector(const std::vector<std::bitset<BITS_PER_LINE>>& vector_of_elements,
                                           const std::bitset<BITS_PER_LINE>& element);
+std::pair<bool, std::size_t> FindInVector(const RawDataSpan& span_of_elements,
+                                          const std::bitset<BITS_PER_LINE>& element);
 
-// Parse the input_raw_file file and guess how many CHIP ID fields are
-// present at the end of the SPIROC2D raw data format.
-unsigned GetNumChipID(std::string & input_raw_file);
+// Patterns that can be searched with the FindCandidateLine function
+enum LinePattern {
+  // Any section marker (from FIRST_MARKER 0xFFFA to SPILL_TRAILER_MARKER 0xFFFF)
+  MARKER_PATTERN = 1,
+  // SPACE_MARKER or IP_MARKER (the line before the start of the raw data)
+  SPACE_PATTERN  = 2,
+  // 0x0000 (the PhantomMenace section)
+  ZERO_PATTERN   = 4
+};
 
-// Parse the input_raw_file file and return true if the PhantoMenace
-// section is present
-bool HasPhantomMenace(std::string & input_raw_file);
+// Return the index of the first line of "span" (starting from the
+// "start" index) that is equal to "line". If no such line is found
+// span.size() is returned. The search is vectorized when SSE2 is
+// available.
+std::size_t FindLine(const RawDataSpan& span, std::size_t start, uint16_t line);
+
+// Return the index of the first line of "span" (starting from the
+// "start" index) matching at least one of the LinePattern "patterns"
+// (bitwise OR of LinePattern values). If no such line is found
+// span.size() is returned. The search is vectorized when SSE2 is
+// available.
+std::size_t FindCandidateLine(const RawDataSpan& span, std::size_t start, unsigned patterns);
+
+// A single column of SPIROC2D raw data unpacked by the UnpackColumn
+// function. All the arrays are indexed by channel. The n_wrong_*
+// members count the lines that would increase the corresponding
+// DEBUG_WRONG_* debug counter.
+struct UnpackedColumn {
+  int charge[NCHANNELS];
+  int time[NCHANNELS];
+  int hit[NCHANNELS];
+  int gs[NCHANNELS];
+  unsigned n_wrong_adc;
+  unsigned n_wrong_tdc;
+  unsigned n_wrong_hit_bit;
+  unsigned n_wrong_gain_bit;
+};
 
-// Parse the input_raw_file file and return true if the SpillNumber
-// section is present
-bool HasSpillNumber  (std::string & input_raw_file);
+// Number of lines of a column without the BCID (NCHANNELS charge lines
+// and NCHANNELS time lines)
+const std::size_t COLUMN_CHANNEL_LINES = 2 * NCHANNELS;
 
-// Parse the input_raw_file file and guess how many chips are present
-// in each spill
-unsigned GetNumChips (std::string & input_raw_file);
+// Unpack the COLUMN_CHANNEL_LINES lines starting at "column". The raw
+// data is stored backwards, so the first line is the time of the last
+// channel and the last line is the charge of the first channel. The
+// 12-bit values, the hit bit and the gain bit of all the channels are
+// extracted at once when SSE2 is available. The hit and gain bits are
+// taken from the charge line and compared with the ones of the time
+// line.
+void UnpackColumn(const char * column, UnpackedColumn& unpacked);
 
-// increase the stack size to 64MB
-void increase_stack_size();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -77,4 +114,46 @@ class RawDataConfig {
                 bool has_phantom_menace, bool adc_is_calibrated, bool tdc_is_calibrated);
 };
 
+///////////////////////////////////////////////////////////////////////////////
+//                             Raw data format probe                         //
+///////////////////////////////////////////////////////////////////////////////
+
+// The format of the raw data (number of chips, number of CHIP ID
+// fields, presence of the SpillNumber and PhantomMenace sections) is
+// guessed by reading the beginning of the file only once. A feature is
+// considered present if it is found at least three times. The probe
+// stops after PROBE_MAX_SPILLS spill trailers or PROBE_MAX_LINES lines,
+// whichever comes first.
+
+namespace wagasci_decoder_utils {
+
+// About twenty spills of twenty chips
+const std::size_t PROBE_MAX_LINES = 20 * NCHIPS * (MEMDEPTH * (1 + 2 * NCHANNELS) + 2);
+const unsigned PROBE_MAX_SPILLS = 100;
+// Less than this number of spill trailers in the probed lines is
+// ambiguous (unless the whole file was probed)
+const unsigned PROBE_MIN_SPILLS = 3;
+
+// Probe the lines of the "span" view. If at_end is true the span
+// contains the whole rest of the file. "conclusive" is set to false if
+// the span is too short to tell the format apart. The number of chips
+// is the maximum number of chips found in a spill trailer. The
+// calibration flags of the returned object are false.
+RawDataConfig ProbeRawData(const RawDataSpan& span, bool at_end, bool& conclusive);
+
+// Probe the first PROBE_MAX_LINES lines of "input" starting from its
+// current position. The position is not changed. If the probe is not
+// conclusive and the input is memory-mapped, the rest of the file is
+// probed too (it is going to be read by the decoder anyway). Streams
+// cannot be rewound, so the best guess is returned for them.
+RawDataConfig ProbeRawData(RawDataInput& input);
+
+// Same as above but the input_raw_file file is opened. If a fresh
+// spill index (see wgDecoderIndex.hpp) is available, the raw data
+// format is read from it and the raw file is not read at all. A
+// wgInvalidFile exception is thrown if the file cannot be opened.
+RawDataConfig ProbeRawData(const std::string& input_raw_file);
+
+}
+
 #endif /* WGDECODERUTILS_H */
@@ -56,6 +56,7 @@ enum WG_ERROR_CODES {
   ERR_NOT_IMPLEMENTED_YET        = 33,
   ERR_EVENT_LOOP                 = 34,
   ERR_WORKSPACE_INITIALIZATION   = 35,
+  ERR_APPEND_ENTRIES_MISMATCH    = 36,
 
   N_WG_ERROR_CODES
 };
@@ -11,9 +11,6 @@
 #include "wgFileSystemTools.hpp"
 #include "wgConst.hpp"
 
-#define TDC_RAMP_ODD  1
-#define TDC_RAMP_EVEN 0
-
 using namespace tinyxml2;
 
 class wgGetCalibData
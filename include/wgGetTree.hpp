@@ -3,6 +3,9 @@
 
 // system includes
 #include <string>
+#include <memory>
+#include <bitset>
+#include <vector>
 
 // ROOT includes
 #include "TROOT.h"
@@ -15,6 +18,73 @@
 #include "wgConst.hpp"
 #include "wgRawData.hpp"
 
+namespace gettree {
+// Groups of TTree branches that can be selected for reading. The run
+// constants (geometry and calibration constants) are read only once
+// from the first entry.
+enum WG_GETTREE_FIELDS {
+  SPILL    = 0,  // spill_number, spill_mode, spill_count
+  CHIPID   = 1,  // chipid
+  CELLID   = 2,  // chanid, colid
+  CHARGE   = 3,  // charge
+  TIME     = 4,  // time
+  BCID     = 5,  // bcid
+  HIT      = 6,  // hit
+  GS       = 7,  // gs
+  GEOMETRY = 8,  // view, pln, chan, grid, x, y, z (run constants)
+  PEDESTAL = 9,  // pedestal (run constant)
+  PE       = 10, // pe
+  GAIN     = 11, // gain (run constant)
+  TIME_NS  = 12, // time_ns
+  TDC      = 13, // tdc_slope, tdc_intcpt (run constants)
+  DEBUG    = 14, // debug_chip, debug_spill
+  NFIELDS  = 15
+};
+typedef std::bitset<NFIELDS> Fields;
+// All the fields
+const Fields ALL_FIELDS = Fields().set();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                              SpillBlock class                             //
+///////////////////////////////////////////////////////////////////////////////
+
+// A block of consecutive TTree entries (spills) read in one go by the
+// wgGetTree::GetBlock method. Each field is a contiguous array whose
+// first dimension is the spill and whose other dimensions are the same
+// as in the Raw_t object. Only the columns of the fields selected in
+// the wgGetTree object and found in the TTree are filled, the others
+// are empty.
+
+class SpillBlock {
+public:
+  // First entry of the block
+  Long64_t first_entry = 0;
+  // Number of spills in the block
+  std::size_t n_spills = 0;
+  // Same as in the Raw_t object
+  int n_chips = 0;
+  int n_chans = 0;
+  int n_cols = 0;
+
+  std::vector<int> spill_count;   // [n_spills]
+  std::vector<int> chipid;        // [n_spills][n_chips]
+  std::vector<int> charge;        // [n_spills][n_chips][n_chans][n_cols]
+  std::vector<int> time;          // [n_spills][n_chips][n_chans][n_cols]
+  std::vector<int> bcid;          // [n_spills][n_chips]         [n_cols]
+  std::vector<int> hit;           // [n_spills][n_chips][n_chans][n_cols]
+  std::vector<int> gs;            // [n_spills][n_chips][n_chans][n_cols]
+  std::vector<double> pe;         // [n_spills][n_chips][n_chans][n_cols]
+
+  // Number of elements of one spill of a cell array (charge, time,
+  // hit, gs and pe)
+  std::size_t SpillCells() const { return (std::size_t) n_chips * n_chans * n_cols; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                              wgGetTree class                              //
+///////////////////////////////////////////////////////////////////////////////
+
 class wgGetTree
 {
 public:
@@ -23,15 +93,40 @@ public:
   // The constructors just call wgGetTree::Open followed by
   // wgGetTree::SetTreeFile. The exception thrown are just those
   // thrown by those two methods (there is no exception handling in
-  // the constructors)
-  wgGetTree(const std::string& finputname, Raw_t& rd, unsigned dif);
+  // the constructors). Only the branches of the selected fields are
+  // read : all the other branches are disabled and the corresponding
+  // Raw_t members are left untouched.
+  wgGetTree(const std::string& finputname, Raw_t& rd, unsigned dif,
+            const gettree::Fields& fields = gettree::ALL_FIELDS);
 
   // The destructor just calls the wgGetTree::Close function
   ~wgGetTree();
 
-  // Get one event from the TTree and store in the Raw_t rd object
+  // Get one event from the TTree and store in the Raw_t rd object.
+  // If the TTree was written in sparse output mode (list of hits), the
+  // hits are written into the rd object arrays and all the other cells
+  // are set to -1.
   void GetEntry(int event);
 
+  // Default maximum number of spills of a block
+  static const std::size_t DEFAULT_BLOCK_SPILLS = 256;
+
+  // Read up to max_spills consecutive entries, starting from
+  // first_entry, into the block. The spill_count, chipid, charge,
+  // time, bcid, hit, gs and pe columns of the selected fields are
+  // filled. The block never crosses the end of the TTree cluster
+  // containing first_entry, so that each basket is decompressed only
+  // once and every branch is read in one sweep directly into the block
+  // arrays. The Raw_t object is not modified for a dense TTree (a
+  // sparse TTree is expanded entry by entry through the Raw_t object).
+  // Return the number of spills read (0 if first_entry is past the end
+  // of the TTree).
+  std::size_t GetBlock(Long64_t first_entry, SpillBlock& block,
+                       std::size_t max_spills = DEFAULT_BLOCK_SPILLS);
+
+  // True if the TTree was written in sparse output mode
+  bool IsSparse() const;
+
   int GetStartTime();      // "start_time"
   int GetStopTime();       // "stop_time"
   int GetDataPacket();     // "nb_data_pkts"
@@ -41,6 +136,23 @@ private:
   std::string m_finputname;
   TFile * m_finput;
   std::reference_wrapper<Raw_t> m_rd;
+  gettree::Fields m_fields;
+  // Only used when reading a sparse TTree
+  std::unique_ptr<Hits_t> m_hits;
+
+  // Branches that are read by the GetBlock method. In sparse mode the
+  // branch and raw_address are NULL : only the columns are listed.
+  struct BlockBranch {
+    TBranch * branch;
+    // Raw_t array bound to the branch
+    char * raw_address;
+    // Block column
+    std::vector<int> SpillBlock::* int_column;
+    std::vector<double> SpillBlock::* double_column;
+    // Number of elements of one entry
+    std::size_t entry_size;
+  };
+  std::vector<BlockBranch> m_block_branches;
   
   // Open a ROOT file containing a TTree named "tree":
   // The string argument is a path to a valid ROOT file.
@@ -60,10 +172,44 @@ private:
   // If there was an error in the reading of the TTree a wgElementNotFound
   // exception is thrown
   void SetTreeFile(TString tree_name);
+
+  // Same as SetTreeFile but for a TTree written in sparse output
+  // mode. The calibration constants are read only once from the
+  // "calib_dif_<N>" TTree (if present).
+  void SetSparseTreeFile(TString tree_name);
   
   // Check if a branch exists in the tree_in TTree. Return true if it
   // exists and false otherwise.
   bool BranchExists(const std::string& branch_name);
+
+  // If the field is selected and the branch exists, enable the branch
+  // and set its address
+  template <typename T>
+  void BindBranch(gettree::WG_GETTREE_FIELDS field, const std::string& branch_name,
+                  T * address);
+
+  // Same as BindBranch and register the branch to be read by GetBlock
+  // into the column of the block
+  void BindBlockBranch(gettree::WG_GETTREE_FIELDS field, const std::string& branch_name,
+                       int * address, std::vector<int> SpillBlock::* column,
+                       std::size_t entry_size);
+  void BindBlockBranch(gettree::WG_GETTREE_FIELDS field, const std::string& branch_name,
+                       double * address, std::vector<double> SpillBlock::* column,
+                       std::size_t entry_size);
+
+  // In sparse mode, register the column of the block if the field is
+  // selected and the branch exists
+  void AddSparseBlockColumn(gettree::WG_GETTREE_FIELDS field, const std::string& branch_name,
+                            std::vector<int> SpillBlock::* column, std::size_t entry_size);
+
+  // Resize the block columns of the branches in m_block_branches
+  void ResizeBlock(SpillBlock& block, std::size_t n_spills) const;
+
+  // Same as BindBranch for a run constant branch : the first entry is
+  // read immediately and the branch is disabled again.
+  template <typename T>
+  void ReadConstantBranch(gettree::WG_GETTREE_FIELDS field, const std::string& branch_name,
+                          T * address);
 };
 
 #endif // WAGASCI_GET_TREE_HPP_ 
@@ -6,6 +6,7 @@
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 
 /* - Initialize: opens two files (one for info logging and another one for error
                  logging) in the log_dir directory. If the directory is not
@@ -15,6 +16,8 @@
 
    - eWrite: logs a message to the error logging file
 
+   Write and eWrite can be safely called from more than one thread.
+
    - LogToCout and LogToCerr: if set tu true the Logger will not log to file but
                               will redirect every message to std::cout and
                               std::cerr respectively
@@ -41,6 +44,7 @@ protected:
   std::string m_efileName;
   std::ofstream m_file;
   std::ofstream m_efile;
+  std::mutex m_mutex;
 };
 
 extern wgLogger Log;
@@ -3,33 +3,290 @@
 
 // system includes
 #include <bitset>
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <utility>
+#include <functional>
+
+// ROOT includes
+#include "TFile.h"
+#include "TH1I.h"
 
 // user includes
 #include "wgConst.hpp"
+#include "wgRawData.hpp"
+#include "wgGetTree.hpp"
 
 namespace makehist {
 enum WG_MAKEHIST_FLAGS {
-  SELECT_DARK_NOISE = 0, // 6
-  SELECT_CHARGE_HG  = 1, // 5
-  SELECT_CHARGE_LG  = 2, // 4
-  SELECT_PEU        = 3, // 3
-  SELECT_PEDESTAL   = 4, // 2
-  SELECT_TIME       = 5, // 1
-  OVERWRITE         = 6, // 0
-  NFLAGS = 7
+  SELECT_DARK_NOISE = 0, // 7
+  SELECT_CHARGE_HG  = 1, // 6
+  SELECT_CHARGE_LG  = 2, // 5
+  SELECT_PEU        = 3, // 4
+  SELECT_PEDESTAL   = 4, // 3
+  SELECT_TIME       = 5, // 2
+  OVERWRITE         = 6, // 1
+  APPEND            = 7, // 0
+  NFLAGS = 8
 };
 }
 
+// Set the makehist flags corresponding to the wgMakeHist program mode
+// (see the wgMakeHist -h option). A std::invalid_argument exception is
+// thrown if the mode is not recognized.
+void ModeSelect(const unsigned long mode, std::bitset<makehist::NFLAGS>& flag);
+
+// Return the TTree fields (see wgGetTree) needed to fill the histograms
+// selected by the makehist flags
+gettree::Fields MakeHistFields(const std::bitset<makehist::NFLAGS>& flags);
+
+///////////////////////////////////////////////////////////////////////////////
+//                              HistTensor class                             //
+///////////////////////////////////////////////////////////////////////////////
+
+// The HistTensor class stores the bin contents of all the histograms of
+// one type (for example all the charge_hit_HG histograms of a DIF) in a
+// single contiguous integer array indexed as [chip][chan][col][bin].
+// Each histogram has the same binning as a TH1I(name, title, n_bins, 0,
+// n_bins) : n_bins bins of unit width plus the underflow (bin 0) and
+// the overflow (bin n_bins + 1) bins. Filling a histogram is just the
+// increment of one integer and the TH1I objects are created only when
+// the histograms are written (MakeTH1I method), with the same content
+// and statistics they would have had if they had been filled directly.
+//
+// The statistics of the integer values (sum of x and of x^2) are
+// calculated from the bin contents when the TH1I is created, because
+// all the values in a bin are equal. The floating point values are
+// accumulated in the same order as TH1::Fill does, so that the
+// statistics are bit-identical.
+
+class HistTensor {
+ public:
+  HistTensor() {}
+
+  // Allocate the histograms of n_chans[ichip] channels for every chip
+  // and n_cols columns for every channel. If double_values is true the
+  // histograms must be filled only with floating point values.
+  HistTensor(const std::vector<unsigned>& n_chans, unsigned n_cols,
+             unsigned n_bins, bool double_values = false);
+
+  bool IsAllocated() const { return !m_bins.empty(); }
+
+  // Index of the histogram of a cell
+  std::size_t Index(unsigned chip, unsigned chan, unsigned col = 0) const {
+    return m_chip_offset[chip] + chan * m_n_cols + col;
+  }
+
+  // Same as TH1I::Fill(value) for an integer value
+  void Fill(std::size_t ihist, int value) {
+    unsigned bin;
+    if (value < 0) bin = 0;
+    else if (value >= (int) m_n_bins) bin = m_n_bins + 1;
+    else bin = value + 1;
+    ++m_bins[ihist * m_stride + bin];
+  }
+
+  // Same as TH1I::Fill(value) for a floating point value (the bin is
+  // found as in TAxis::FindBin)
+  void Fill(std::size_t ihist, double value) {
+    if (FillBin(ihist, value)) AddStatistics(ihist, value);
+  }
+
+  // Same as Fill but the statistics are not accumulated. Return true if
+  // the value is inside the axis range, that is if the statistics of
+  // the value must be accumulated (see AddStatistics).
+  bool FillBin(std::size_t ihist, double value) {
+    unsigned bin;
+    if (value < 0) bin = 0;
+    else if (!(value < m_n_bins)) bin = m_n_bins + 1;
+    else bin = 1 + int((double) m_n_bins * (value - 0.) / ((double) m_n_bins - 0.));
+    ++m_bins[ihist * m_stride + bin];
+    return bin != 0 && bin != m_n_bins + 1;
+  }
+
+  // Accumulate the statistics of a floating point value
+  void AddStatistics(std::size_t ihist, double value) {
+    m_sumwx[ihist]  += value;
+    m_sumwx2[ihist] += value * value;
+  }
+
+  // Add the bin contents of a tensor with the same layout. The
+  // statistics of the floating point values are not added because
+  // the result would depend on the order of the additions.
+  void AddBins(const HistTensor& other);
+
+  // Create a TH1I histogram called "name" with the content of the
+  // ihist histogram. The TH1I is attached to the current directory.
+  TH1I * MakeTH1I(std::size_t ihist, const char * name) const;
+
+  // Replace the content and the statistics of the ihist histogram with
+  // the ones of a TH1I histogram with the same binning (for example one
+  // written by the MakeTH1I method). A std::invalid_argument exception
+  // is thrown if the binning is different.
+  void LoadTH1I(std::size_t ihist, const TH1I * hist);
+
+ private:
+  unsigned m_n_cols = 0;
+  unsigned m_n_bins = 0;
+  // number of bins of one histogram including underflow and overflow
+  std::size_t m_stride = 0;
+  // index of the first histogram of each chip
+  std::vector<std::size_t> m_chip_offset;
+  bool m_double_values = false;
+  //          HIST x BIN
+  std::vector<int> m_bins;
+  // statistics of the floating point values (only if m_double_values)
+  std::vector<double> m_sumwx;
+  std::vector<double> m_sumwx2;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                MakeHist class                             //
+///////////////////////////////////////////////////////////////////////////////
+
+// The MakeHist class holds the histograms of one DIF selected by the
+// makehist flags. The histograms are filled one spill at a time, either
+// from the TTree written by the wgDecoder (wgMakeHist function) or
+// directly by the wgDecoder while decoding (fused mode, see the
+// wgDecoder function). They are kept in HistTensor objects and the TH1I
+// histograms are created in the output_hist_file only by the Write
+// method.
+
+class MakeHist {
+ public:
+  // chip_map maps each chip of the DIF to its number of channels (see
+  // the Topology::dif_map member). The output_hist_file can be NULL if
+  // the object is never written (for example if it is only merged into
+  // another one).
+  MakeHist(const std::bitset<makehist::NFLAGS>& flags,
+           unsigned dif,
+           const std::map<unsigned, unsigned>& chip_map,
+           TFile * output_hist_file);
+
+  // Fill the histograms with one spill. Only the chips of the Raw_t
+  // object that are also in the chip_map are used.
+  void Fill(Raw_t& rd);
+
+  // Fill the histograms with all the spills of a block (see
+  // wgGetTree::GetBlock). The result is the same as filling the spills
+  // one by one, but the histograms that need an empty column of the
+  // block (branch not found in the TTree) are not filled.
+  void Fill(const SpillBlock& block);
+
+  // List of (histogram index, value) pairs in fill order
+  typedef std::vector<std::pair<std::size_t, double>> ValueLog;
+
+  // If pe_log is not NULL, the Fill method does not accumulate the
+  // statistics of the photo-electrons histograms but appends the values
+  // to pe_log. The statistics are then accumulated with the
+  // AddPeStatistics method, possibly by another MakeHist object. Used
+  // to fill the histograms in parallel and still get exactly the same
+  // floating point sums as the serial fill.
+  void SetPeLog(ValueLog * pe_log) { m_pe_log = pe_log; }
+  void AddPeStatistics(const ValueLog& pe_log);
+
+  // Add the histograms and the spill counts of another MakeHist object
+  // created with the same flags and chip_map. The statistics of the
+  // photo-electrons histograms are not added (see SetPeLog).
+  void Merge(const MakeHist& other);
+
+  // Read the histograms and the spill counts written by the Write
+  // method into input_hist_file, so that the following Fill calls add
+  // to them. The result is the same as if all the spills had been
+  // filled by this object. A wgElementNotFound exception is thrown if
+  // one of the selected histograms or of the spill count parameters is
+  // missing and std::invalid_argument if a histogram has a different
+  // binning.
+  void Read(TFile * input_hist_file);
+
+  // Write the acquisition run info and all the histograms into the
+  // output_hist_file. The spill count is the difference between the
+  // largest and the smallest spill count filled. The smallest and
+  // largest spill counts and the number of spills are written too
+  // (min_spill_count, max_spill_count and n_spills parameters). Objects
+  // with the same name already in the file are replaced.
+  void Write(int start_time, int stop_time, int nb_data_pkts, int nb_lost_pkts);
+
+  // Number of spills filled so far
+  unsigned GetNSpills() const { return m_n_spills; }
+  // Difference between the largest and the smallest spill count
+  int GetSpillCountRange() const;
+
+ private:
+  std::bitset<makehist::NFLAGS> m_flags;
+  unsigned m_dif;
+  unsigned m_n_chips;
+  std::vector<unsigned> m_n_chans;
+  // index of the first histogram of each chip in the CHIP x CHAN x COL
+  // tensors (see HistTensor::Index)
+  std::vector<std::size_t> m_chip_offset;
+  TFile * m_output_hist_file;
+  unsigned m_n_spills = 0;
+  int m_min_spill_count = 0;
+  int m_max_spill_count = 0;
+  ValueLog * m_pe_log = NULL;
+
+  // Pointers to the arrays of one spill with the Raw_t layout. The
+  // arrays that were not read can be NULL : the histograms that need
+  // them are not filled.
+  struct SpillArrays {
+    int spill_count;
+    unsigned n_chips, n_chans, n_cols;
+    const int * chipid;
+    const int * charge;
+    const int * time;
+    const int * bcid;
+    const int * hit;
+    const int * gs;
+    const double * pe;
+  };
+  void FillSpill(const SpillArrays& spill);
+
+  // Call action(tensor, histogram index, histogram name, line color) for
+  // all the selected histograms in the order they are written
+  typedef std::function<void(HistTensor&, std::size_t, const char *, int)> HistAction;
+  void ForEachHistogram(const HistAction& action);
+
+  //   CHIP x CHAN x COL x BIN
+  HistTensor h_charge_hit_HG;
+  HistTensor h_charge_hit_LG;
+  HistTensor h_pe_hit;
+  HistTensor h_charge_nohit;
+  HistTensor h_time_hit;
+  HistTensor h_time_nohit;
+  // h_bcid_hit: For every channel fill it with the BCID of all the columns with
+  // a hit.
+  //   CHIP x CHAN x BIN
+  HistTensor h_bcid_hit;
+};
+
 // This is needed to call the following functions from Python using ctypes
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// If the makehist::APPEND flag is set and the output hist file already
+// exists, it is opened in update mode and only the TTree entries after
+// the last one filled by the previous call (last_entry parameter) are
+// added to the histograms. The start_time is the one of the first call,
+// the stop_time and the number of data and lost packets are the ones of
+// the TTree (unless they are not recorded yet) and the spill_count is
+// the range of all the spills filled by all the calls. If the file does
+// not exist it is created as usual.
+//
+// If n_threads is more than one, the TTree entries are split in chunks
+// that are read and filled by n_threads threads, each one with its own
+// TTree reader and its own copy of the histograms. The copies are
+// merged at the end, so the memory used by the histograms is
+// multiplied by n_threads. The output is bit-identical to the one of
+// the serial fill.
 int wgMakeHist(const char * x_input_file_name,
                const char * x_pyrame_config_file,
                const char * x_output_dir,
                const unsigned long ul_flags,
-               unsigned dif = 0);
+               unsigned dif = 0,
+               unsigned n_threads = 1);
   
 #ifdef __cplusplus
 }
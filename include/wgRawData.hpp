@@ -1,6 +1,10 @@
 #ifndef WGRAWDATA_H
 #define WGRAWDATA_H
 
+// system includes
+#include <vector>
+
+// user includes
 #include "wgConst.hpp"
 
 // ===================================================================== //
@@ -64,7 +68,101 @@ public:
   Raw_t(std::size_t n_chips, std::size_t n_chans);
 
   // CLEAR CONTENT OF OBJECT
+  // Only the per-spill data is cleared: the spill info, the chip IDs,
+  // the debug counters and the arrays of the chips that were marked
+  // as dirty since the last clear. The run constants (geometry and
+  // calibration data) are not touched.
   void clear();
+
+  // CLEAR THE PER-SPILL ARRAYS
+  // Reset only the charge, time, bcid, hit, gs, pe and time_ns arrays of
+  // the dirty chips. The spill info, chip IDs and debug counters are
+  // left untouched.
+  void clear_spill_arrays();
+
+  // CLEAR THE RUN CONSTANTS
+  // Clear the geometry and calibration data (chanid, colid, view, pln,
+  // chan, grid, x, y, z, pedestal, gain, tdc_slope, tdc_intcpt)
+  void clear_run_constants();
+
+  // DIRTY REGION TRACKING
+  // Whoever writes into the per-spill arrays of a chip must mark them
+  // as dirty, otherwise they are not reset by the next clear call.
+  enum SpillArrays {
+    RAW_DATA_ARRAYS  = 1,  // charge, time, bcid, hit, gs
+    PE_ARRAY         = 2,  // pe
+    TIME_NS_ARRAY    = 4,  // time_ns
+    ALL_SPILL_ARRAYS = 7
+  };
+  // Mark the "arrays" (bitwise OR of SpillArrays) of the chip "ichip"
+  void mark_dirty(std::size_t ichip, unsigned arrays = ALL_SPILL_ARRAYS);
+  // Mark all the per-spill arrays of all the chips
+  void mark_dirty();
+
+  // COPY CONTENT OF ANOTHER OBJECT
+  // The source object must have the same number of chips and channels
+  void copy(Raw_t& source);
+
+  // COPY THE PER-SPILL CONTENT OF ANOTHER OBJECT
+  // Same as copy but the run constants are not copied and only the
+  // per-spill arrays of the chips that are dirty in the source are
+  // (the arrays that are dirty only here are cleared). The source
+  // object must have the same number of chips and channels.
+  void copy_spill(Raw_t& source);
+
+private:
+  // SpillArrays flags of each chip written since the last clear
+  std::vector<unsigned> m_dirty_arrays;
+};
+
+// ===================================================================== //
+//                                                                       //
+//                             Hit List Class                            //
+//                                                                       //
+// ===================================================================== //
+
+// The Hits_t class is the zero-suppressed (sparse) version of the
+// Raw_t class. Only the cells (chip, channel, column) whose hit bit is
+// set are stored, one record per hit. The arrays are allocated once
+// for the maximum number of hits so that they can be used directly as
+// TTree branch addresses. Only the first n_hits elements of each
+// array are meaningful.
+
+class Hits_t
+{
+public:
+  int n_hits;
+  i1vector chip;              // [n_hits] chip counter (first index of Raw_t arrays)
+  i1vector chan;              // [n_hits]
+  i1vector col;               // [n_hits]
+  i1vector bcid;              // [n_hits]
+  i1vector charge;            // [n_hits]
+  i1vector time;              // [n_hits]
+  i1vector gs;                // [n_hits]
+  d1vector pe;                // [n_hits]
+  d1vector time_ns;           // [n_hits]
+
+  // COUNTERS (MAX VALUES)
+  int n_chips;
+  int n_chans;
+
+  // CONSTRUCTORS
+  explicit Hits_t(std::size_t n_chips);
+  Hits_t(std::size_t n_chips, std::size_t n_chans);
+
+  // Maximum number of hits that can be stored
+  std::size_t capacity() const;
+
+  // CLEAR CONTENT OF OBJECT
+  void clear();
+
+  // Fill the hit list with all the hits found in the "rd" object
+  void FromRaw(Raw_t& rd);
+
+  // Write the hits into the "rd" object. The hit data of "rd" is
+  // cleared first, so that all the cells without a hit are left to
+  // -1. The spill info and the calibration constants are not touched.
+  void ToRaw(Raw_t& rd) const;
 };
 
 #endif /* WGRAWDATA_H */
@@ -1,6 +1,10 @@
 #ifndef WGRAWEMULATOR_H
 #define WGRAWEMULATOR_H
 
+// system includes
+#include <string>
+
+// user includes
 #include "wgDecoder.hpp"
 
 class RawEmulatorConfig {
@@ -12,11 +16,65 @@ class RawEmulatorConfig {
   unsigned n_chip_id = 1;
   unsigned spill_mode = BEAM_SPILL;
   bool has_spill_number = false;
+  bool has_phantom_menace = false;
   unsigned time = 1;
   unsigned charge = 1;
   unsigned bcid = 1;
   bool gain = true;
   bool hit = true;
+
+  // Realistic content. If true, the time, charge, bcid, gain and hit
+  // members above are ignored. Each channel of each chip collects
+  // Poisson-distributed dark noise hits spread uniformly over the BCID
+  // window. Each different BCID fills one column (up to n_columns
+  // columns, the other hits are lost like in the SPIROC2D memory). The
+  // charge of a hit follows a multi p.e. finger spectrum around the
+  // pedestal of the channel and column. The channels without a hit in
+  // a column record just the pedestal.
+  bool realistic = false;
+  // Mean number of dark noise hits per channel per spill
+  double dark_noise_rate = 0.3;
+  // Mean number of additional p.e. per hit (optical crosstalk)
+  double crosstalk = 0.15;
+  // ADC counts of the pedestal, spread of the pedestal among channels
+  // and columns and electronic noise
+  double pedestal = 450;
+  double pedestal_spread = 20;
+  double pedestal_noise = 3;
+  // ADC counts per p.e. in high gain, spread of the gain among channels
+  // and width of each p.e. peak
+  double pe_gain = 40;
+  double pe_gain_spread = 3;
+  double pe_gain_noise = 4;
+  // Fraction of hits read with the high gain preamplifier. The low gain
+  // is ten times smaller.
+  double high_gain_fraction = 0.9;
+  // The dark noise hits are spread over BCIDs from 1 to bcid_window
+  unsigned bcid_window = 4000;
+
+  // Fault injection. All the faults are drawn from a random generator
+  // initialized with "seed", so the same configuration always produces
+  // the same file. The rates are probabilities per spill for the
+  // dropped and duplicated bytes and for the spill count gaps, and
+  // probabilities per chip for the other faults.
+  unsigned seed = 0;
+  // One random byte of the spill is dropped
+  double dropped_byte_rate = 0;
+  // One random byte of the spill is written twice
+  double duplicated_byte_rate = 0;
+  // The chip trailer is not written
+  double missing_chip_trailer_rate = 0;
+  // Some lines of a random column of the chip are not written
+  double truncated_column_rate = 0;
+  // The spill count jumps by one to three spills
+  double spill_count_gap_rate = 0;
+  // The chip ID in the chip trailer is not the one in the chip header
+  double chip_id_mismatch_rate = 0;
+  // If not empty, the ground truth about the generated spills and the
+  // injected faults (and the true pedestal and gain of every channel in
+  // realistic mode) is written into this JSON file
+  std::string manifest_file;
+
   RawEmulatorConfig() {};
 };
 
@@ -7,58 +7,72 @@
 #include <vector>
 #include <iomanip>
 #include <locale>
+#include <memory>
+#include <thread>
+#include <stdexcept>
 
 // boost includes
 #include <boost/filesystem.hpp>
 
-// ROOT includes
-#include "TFile.h"
-#include "TH1I.h"
-#include "TTree.h"
-#include "TParameter.h"
-
 // user includes
 #include "wgConst.hpp"
 #include "wgFileSystemTools.hpp"
 #include "wgErrorCodes.hpp"
 #include "wgExceptions.hpp"
 #include "wgGetCalibData.hpp"
-#include "wgRawData.hpp"
+#include "wgTopology.hpp"
 #include "wgDecoder.hpp"
-#include "wgDecoderSeeker.hpp"
-#include "wgDecoderReader.hpp"
-#include "wgDecoderUtils.hpp"
+#include "wgDecoderCompressed.hpp"
+#include "wgDecoderRun.hpp"
 #include "wgLogger.hpp"
 
 using namespace wagasci_tools;
 
-int wgDecoder(const char * x_input_raw_file,
-              const char * x_calibration_dir,
-              const char * x_output_dir,
-              const bool overwrite,
-              const bool compatibility_mode,
-              unsigned dif,
-              unsigned n_chips) {
+///////////////////////////////////////////////////////////////////////////////
+//                                DecodeRawFile                              //
+///////////////////////////////////////////////////////////////////////////////
+
+int DecodeRawFile(const std::string& input_raw_file,
+                  const std::string& x_calibration_dir,
+                  const std::string& output_dir,
+                  unsigned dif,
+                  const unsigned n_chips,
+                  const DecoderOptions& x_options) {
 
-  // If you think that the default stack size is not enough uncomment the next line
-  // wagasci_decoder_utils::increase_stack_size();
-  
-  std::string input_raw_file(x_input_raw_file);
   std::string calibration_dir(x_calibration_dir);
-  std::string output_dir(x_output_dir);
-  std::string output_file_name = get_stats::basename(input_raw_file) + "_tree.root";
+  // The number of threads is resolved below
+  DecoderOptions options(x_options);
+  std::string output_file_name = RawFileBasename(input_raw_file) + "_tree.root";
+  std::string output_hist_file_name = RawFileBasename(input_raw_file) + "_hist.root";
+  std::string report_file_name = RawFileBasename(input_raw_file) + "_report.json";
+  std::string columns_dir_name = RawFileBasename(input_raw_file) + "_columns";
 
   // ===================================================================== //
   //                         Arguments sanity check                        //
   // ===================================================================== //
 
   // ======== input_raw_file ========= //
-  
-  if (input_raw_file.empty() || !check_exist::raw_file(input_raw_file)) { 
+
+  // The raw file may be compressed (.raw.gz, .raw.zst or .raw.xz)
+  if (input_raw_file.empty() || !IsRawFileName(input_raw_file) ||
+      !boost::filesystem::is_regular_file(input_raw_file)) { 
     Log.eWrite("[wgDecoder] Input file doesn't exist : " + input_raw_file);
     return ERR_INPUT_FILE_NOT_FOUND;
   }
 
+  // A compressed file cannot grow while it is being decoded
+  if (options.follow) {
+    try {
+      if (GetRawDataCompression(input_raw_file) != RAW_DATA_UNCOMPRESSED) {
+        Log.eWrite("[wgDecoder] Follow mode : a compressed raw file cannot be followed");
+        return ERR_WRONG_MODE;
+      }
+    } catch (const wgInvalidFile& e) {
+      Log.eWrite("[wgDecoder] " + std::string(e.what()));
+      return ERR_FAILED_OPEN_RAW_FILE;
+    }
+  }
+
   // ======== calibration_dir ========= //
 
   if (calibration_dir.empty()) {
@@ -74,26 +88,64 @@ int wgDecoder(const char * x_input_raw_file,
     return ERR_WRONG_DIF_VALUE;
   }
   
-  // ======== n_chips ========= //
+  // ======== n_threads ========= //
+
+  if (options.n_threads == 0) {
+    options.n_threads = std::thread::hardware_concurrency();
+    if (options.n_threads == 0) options.n_threads = 1;
+  }
+
+  // ======== output_profile ========= //
+
+  OutputProfile output_profile;
+  try {
+    output_profile = GetOutputProfile(options.output_profile);
+  } catch (const std::invalid_argument& e) {
+    Log.eWrite("[wgDecoder] " + std::string(e.what()));
+    return ERR_WRONG_MODE;
+  }
 
-  if (n_chips == 0) {
-    n_chips = wagasci_decoder_utils::GetNumChips(input_raw_file);
+  // ======== pyrame_config_file (fused mode) ========= //
+
+  bool fused = !options.pyrame_config_file.empty();
+  if (fused && !check_exist::xml_file(options.pyrame_config_file)) {
+    Log.eWrite("[wgDecoder] Pyrame xml configuration file not found : " +
+               options.pyrame_config_file);
+    return ERR_CONFIG_XML_FILE_NOT_FOUND;
+  }
+  if (!fused && !options.write_tree) {
+    Log.eWrite("[wgDecoder] Nothing to write : the TTree can be skipped only "
+               "when the histograms are filled");
+    return ERR_WRONG_MODE;
+  }
+  // The sparse TTree does not keep the cells without a hit, so the
+  // pedestal and time histograms could not be appended to later by
+  // wgMakeHist
+  const std::bitset<makehist::NFLAGS> makehist_flags(options.makehist_flags);
+  if (fused && options.sparse_output &&
+      (makehist_flags[makehist::SELECT_PEDESTAL] || makehist_flags[makehist::SELECT_TIME])) {
+    Log.eWrite("[wgDecoder] The pedestal and time histograms cannot be filled "
+               "together with the sparse output");
+    return ERR_WRONG_MODE;
+  }
+
+  // ======== first_spill and last_spill ========= //
+
+  if (options.first_spill < 0 ||
+      (options.last_spill >= 0 && options.last_spill < options.first_spill)) {
+    Log.eWrite("[wgDecoder] Invalid spill range : " + std::to_string(options.first_spill) +
+               " - " + std::to_string(options.last_spill));
+    return ERR_WG_DECODER;
   }
-  if (n_chips == 0 || n_chips > NCHIPS) {
+
+  // ======== n_chips ========= //
+
+  if (n_chips > NCHIPS) {
     Log.eWrite("[wgDecoder] The number of chips per DIF must be {1-"
                + std::to_string(NCHIPS) + "}");
     return ERR_WRONG_CHIP_VALUE;
   }
 
-  // ============ pyrame_log_file ============ //
-
-  // This is not the output log file but the log file that should be already
-  // present in the input folder and was created together with the .raw file
-  std::string pyrame_log_file  = get_stats::basename(input_raw_file);
-  size_t pos  = pyrame_log_file.rfind("_ecal_dif_") ;
-  pyrame_log_file = get_stats::dirname(input_raw_file) + "/" +
-                    pyrame_log_file.substr(0, pos) + ".log";
-
   // ============ Create output_dir ============ //
   
   try { make::directory(output_dir); }
@@ -103,8 +155,19 @@ int wgDecoder(const char * x_input_raw_file,
   }
 
   Log.Write("[wgDecoder] READING FILE     : " + input_raw_file      );
-  Log.Write("[wgDecoder] OUTPUT TREE FILE : " + output_file_name );
+  if (options.write_tree)
+    Log.Write("[wgDecoder] OUTPUT TREE FILE : " + output_file_name );
+  if (fused)
+    Log.Write("[wgDecoder] OUTPUT HIST FILE : " + output_hist_file_name);
+  if (options.write_report)
+    Log.Write("[wgDecoder] RUN REPORT FILE  : " + report_file_name);
+  if (options.write_columns)
+    Log.Write("[wgDecoder] COLUMNS DIRECTORY: " + columns_dir_name);
   Log.Write("[wgDecoder] OUTPUT DIRECTORY : " + output_dir      );
+  Log.Write("[wgDecoder] OUTPUT PROFILE   : " + output_profile.name);
+
+  // The thread budget is shared with the compression
+  options.n_threads = EnableParallelCompression(output_profile, options.n_threads);
 
   // ===================================================================== //
   //                        DIF number detection                           //
@@ -113,6 +176,7 @@ int wgDecoder(const char * x_input_raw_file,
   // If the number of DIFs is not provided as an argument, try to infer it from
   // the file name
   if (dif == 0) {
+    std::size_t pos;
     std::string input_raw_file_name = wagasci_tools::get_stats::basename(input_raw_file);
     if ((pos = input_raw_file_name.find("dif_1_1_")) != std::string::npos) {
       try {
@@ -135,255 +199,102 @@ int wgDecoder(const char * x_input_raw_file,
   }
 
   // ===================================================================== //
-  //                  Allocate the raw data Raw_t class                    //
-  // ===================================================================== //
-  
-  Raw_t rd(n_chips);
-  
-  // ===================================================================== //
-  //                        Get calibration data                           //
+  //                 Read calibration and Pyrame log file                  //
   // ===================================================================== //
-  
-  // Read the value of pedestal, TDC ramp and gain from the calibration files
-  bool pedestal_is_calibrated = false;
-  bool gain_is_calibrated = false;
-  bool adc_is_calibrated = false;
-  bool tdc_is_calibrated = false;
-  try {
-    wgGetCalibData calib(calibration_dir, dif);
-    try {
-      if ((pedestal_is_calibrated = calib.isPedestalCalibrated()))
-        calib.GetPedestal(dif, rd.pedestal);
-    } catch (const std::exception & e ) {
-      pedestal_is_calibrated = false;
-      Log.Write("[wgDecoder] pedestal is not calibrated yet : " + std::string(e.what()));
-    }
-    try {
-      if ((gain_is_calibrated = calib.isGainCalibrated()))
-        calib.GetGain(dif, rd.gain);
-    } catch (const std::exception & e ) {
-      adc_is_calibrated = false;
-      Log.Write("[wgDecoder] ADC is not calibrated yet : " + std::string(e.what()));
-    }
-    try {
-      if ((tdc_is_calibrated = calib.isTDCCalibrated()))
-        calib.GetTDC(dif, rd.tdc_slope, rd.tdc_intcpt);
-    } catch (const std::exception & e ) {
-      tdc_is_calibrated = false;
-      Log.Write("[wgDecoder] TDC is not calibrated yet : " + std::string(e.what()));
-    }  
-  } catch (const std::exception & e ) {
-    Log.Write("[wgDecoder] detector is not calibrated yet : " + std::string(e.what())); 
-  }
-  adc_is_calibrated = pedestal_is_calibrated && gain_is_calibrated;
-
-  // ===================================================================== //
-  //                             Get mapping                               //
-  // ===================================================================== //
-  
-  // Get the geometrical information (position in space) for each channel
-  // wgChannelMap Map;
-  // if (adc_is_calibrated) {
-  //   vector<int> pln, ch, grid;
-  //   vector<double> x, y, z;
-  //   for(unsigned ichip = 0; ichip < n_chips; ichip++) {
-  //     Map.GetMap( dif,
-  //                 ichip,
-  //                 rd.pln [ichip].size(),
-  //                 rd.view,
-  //                 rd.pln [ichip].data(),
-  //                 rd.chan[ichip].data(),
-  //                 rd.grid[ichip].data(),
-  //                 rd.x   [ichip].data(),
-  //                 rd.y   [ichip].data(),
-  //                 rd.z   [ichip].data());
-  //   }
-  // }
-
-  // ===================================================================== //
-  //                         Create the output file                        //
-  // ===================================================================== //
-
-  TFile * output_file;
-  TString output_file_path(output_dir + "/" + output_file_name);
-  if (!overwrite) {
-    if (check_exist::root_file(output_file_path)) {
-      Log.eWrite("[wgDecoder] Error:" + std::string(output_file_path.Data()) +
-                 " already exists!");
-      return ERR_OVERWRITE_FLAG_NOT_SET;
-    }
-    output_file = new TFile(output_file_path, "create");
-  } else {
-    output_file = new TFile(output_file_path, "recreate");
-  }
 
+  // The calibration constants are loaded by DecodeDifFile once the
+  // number of chips is known
+  DifCalibration calib;
+  calib.calibration_dir = calibration_dir;
+  calib.dif = dif;
 
-  // ===================================================================== //
-  //                      Create TTree branches                            //
-  // ===================================================================== //
-
-  TString tree_name("tree_dif_" + std::to_string(dif));
-  TString tree_title("ROOT tree containing decoded data : DIF " + std::to_string(dif));
-  TTree * tree = new TTree(tree_name, tree_title);
-  
-  tree->SetDirectory(output_file);
-  tree->Branch("spill_number",&rd.spill_number     ,"spill_number/I"                                               );
-  tree->Branch("spill_mode"  ,&rd.spill_mode       ,"spill_mode/I"                                                 );
-  tree->Branch("spill_count" ,&rd.spill_count      ,"spill_count/I"                                                );
-
-  tree->Branch("chipid"      ,rd.chipid.data()     ,Form("chipid[%d]/I"             ,n_chips                      ));
-  tree->Branch("chanid"      ,rd.chanid.data()     ,Form("chanid[%d]/I"             ,         NCHANNELS           ));
-  tree->Branch("colid"       ,rd.colid.data()      ,Form("colid[%d]/I"              ,                    MEMDEPTH ));
-
-  tree->Branch("charge"      ,rd.charge.data()     ,Form("charge[%d][%d][%d]/I"     ,n_chips, NCHANNELS, MEMDEPTH ));
-  tree->Branch("time"        ,rd.time.data()       ,Form("time[%d][%d][%d]/I"       ,n_chips, NCHANNELS, MEMDEPTH ));
-  tree->Branch("bcid"        ,rd.bcid.data()       ,Form("bcid[%d][%d]/I"           ,n_chips,            MEMDEPTH ));
-  tree->Branch("hit"         ,rd.hit.data()        ,Form("hit[%d][%d][%d]/I"        ,n_chips, NCHANNELS, MEMDEPTH ));
-  tree->Branch("gs"          ,rd.gs.data()         ,Form("gs[%d][%d][%d]/I"         ,n_chips, NCHANNELS, MEMDEPTH ));
-
-  tree->Branch("debug_chip"  ,rd.debug_chip.data() ,Form("debug_chip[%d][%d]/I"     ,n_chips, N_DEBUG_CHIP        ));
-  tree->Branch("debug_spill" ,rd.debug_spill.data(),Form("debug_spill[%d]/I"        ,N_DEBUG_SPILL                ));
-  
-  if (adc_is_calibrated) {
-    tree->Branch("view"      ,&rd.view             ,"view/I"                                                       );
-    tree->Branch("pln"       ,rd.pln.data()        ,Form("pln[%d][%d]/I"            ,n_chips, NCHANNELS           ));
-    tree->Branch("chan"      ,rd.chan.data()       ,Form("chan[%d][%d]/I"           ,n_chips, NCHANNELS           ));
-    tree->Branch("grid"      ,rd.grid.data()       ,Form("grid[%d][%d]/I"           ,n_chips, NCHANNELS           ));
-    tree->Branch("x"         ,rd.x.data()          ,Form("x[%d][%d]/D"              ,n_chips, NCHANNELS           ));
-    tree->Branch("y"         ,rd.y.data()          ,Form("y[%d][%d]/D"              ,n_chips, NCHANNELS           ));
-    tree->Branch("z"         ,rd.z.data()          ,Form("z[%d][%d]/D"              ,n_chips, NCHANNELS           ));
-    
-    tree->Branch("pedestal"  ,rd.pedestal.data()   ,Form("pedestal[%d][%d][%d]/D"   ,n_chips, NCHANNELS, MEMDEPTH ));
-    tree->Branch("pe"        ,rd.pe.data()         ,Form("pe[%d][%d][%d]/D"         ,n_chips, NCHANNELS, MEMDEPTH ));
-    tree->Branch("gain"      ,rd.gain.data()       ,Form("gain[%d][%d][%d]/D"       ,n_chips, NCHANNELS, MEMDEPTH ));
-  }
-  if (tdc_is_calibrated) {
-    tree->Branch("time_ns"   ,rd.time_ns.data()    ,Form("time_ns[%d][%d][%d]/D"    ,n_chips, NCHANNELS, MEMDEPTH ));
-    tree->Branch("tdc_slope" ,rd.tdc_slope.data()  ,Form("tdc_slope[%d][%d][%d]/D"  ,n_chips, NCHANNELS, 2        ));
-    tree->Branch("tdc_intcpt",rd.tdc_intcpt.data() ,Form("tdc_intcpt[%d][%d][%d]/D" ,n_chips, NCHANNELS, 2        ));
-  }
-
-  // ===================================================================== //
-  //                        Read Pyrame log file                           //
-  // ===================================================================== //
-
-  if( check_exist::log_file(pyrame_log_file) ) {
-    // Will be filled with  v[0]: start_time,   v[1]: stop_time,
-    //                      v[2]: nb_data_pkts, v[3]: nb_lost_pkts
-    std::vector<std::string> v_log;
-    wgEditXML edit;
-    edit.GetLog(pyrame_log_file, v_log);
-    // Start time of the acquisition that produced the .raw file
-    tree->GetUserInfo()->Add(new TParameter<Int_t>(
-        "start_time", datetime::datetime_to_seconds(v_log[0])));
-    // Stop time of the acquisition that produced the .raw file
-    tree->GetUserInfo()->Add(new TParameter<Int_t>(
-        "stop_time", datetime::datetime_to_seconds(v_log[1])));
-    // Number of data packets acquired as reported by Pyrame in the acquisition
-    // log file
-    tree->GetUserInfo()->Add(new TParameter<Int_t>(
-        "nb_data_pkts", std::stoi(v_log[2])));
-    // Number of lost packets acquired as reported by Pyrame in the acquisition
-    // log file
-    tree->GetUserInfo()->Add(new TParameter<Int_t>(
-        "nb_lost_pkts", std::stoi(v_log[3])));
-  }
-  else Log.eWrite("[wgDecoder]  Pyrame log file : " + pyrame_log_file +
-                  " doesn't exist!");
-
-  // ===================================================================== //
-  //                Allocate the RawDataConfig class object                //
-  // ===================================================================== //
-
-  unsigned n_chip_id;
-  if (compatibility_mode) n_chip_id = 1;
-  else n_chip_id = wagasci_decoder_utils::GetNumChipID(input_raw_file);
-  RawDataConfig config(n_chips,
-                       NCHANNELS,
-                       n_chip_id,
-                       wagasci_decoder_utils::HasSpillNumber(input_raw_file),
-                       wagasci_decoder_utils::HasPhantomMenace(input_raw_file),
-                       adc_is_calibrated,
-                       tdc_is_calibrated);
+  // This is not the output log file but the log file that should be already
+  // present in the input folder and was created together with the .raw file.
+  // In follow mode it is read at the end of the acquisition.
+  PyrameLog pyrame_log;
+  if (!options.follow)
+    pyrame_log = ReadPyrameLog(GetPyrameLogFile(input_raw_file));
 
   // ===================================================================== //
-  //     ============================================================      //
-  //                          READ THE RAW FILE                            //
-  //     ============================================================      //
+  //                              Fused mode                               //
   // ===================================================================== //
 
-  std::ifstream ifs;
-  ifs.open(input_raw_file.c_str(), std::ios_base::in | std::ios_base::binary);
-  if (!ifs.is_open()) {
-    Log.eWrite("[wgDecoder] Failed to open raw file: " +
-               std::string(strerror(errno)));
-    return ERR_FAILED_OPEN_RAW_FILE;
-  }
-
-  unsigned n_good_spills = 0, n_bad_spills = 0;
-  int result;
-  try {
-    SectionSeeker seeker(config);
-    SectionReader reader(config, tree, rd);
-    int last_spill_count = -1;
-    unsigned last_section_type = 0;
-    unsigned recursive_counter = 0;
-    while (true) {
-
-      // ============ Seek and read next section ============ //
-      
-      SectionSeeker::Section current_section =
-          seeker.SeekNextSection(ifs, recursive_counter);
-      reader.ReadNextSection(ifs, current_section);
-
-      // ============ If the raw data was correctly read  ============ //
-      // ============ this is a good spill otherwise this ============ //
-      // ============ is a bad spill.                     ============ //
-      
-      if (current_section.type == SectionSeeker::SectionType::RawData) {
-        if (current_section.ispill == (unsigned) last_spill_count + 1) {
-          ++n_good_spills;
-        } else {
-          n_bad_spills += current_section.ispill - last_spill_count;
-        }
-        last_spill_count = current_section.ispill;
-      } else if (current_section.type == SectionSeeker::SectionType::ChipTrailer &&
-                 last_section_type != SectionSeeker::SectionType::RawData) {
-        n_bad_spills += current_section.ispill - last_spill_count;
-        last_spill_count = current_section.ispill;
-      }
-
-      // ============ Print the progress every 1000 spills ============ //
-      
-      if (current_section.type == SectionSeeker::SectionType::SpillTrailer &&
-          (n_good_spills + n_bad_spills) % 1000 == 0)
-        Log.Write("[wgDecoder] Decoded " + std::to_string(n_good_spills +
-                                                          n_bad_spills) + " spills");
-      
-      last_section_type = current_section.type;
+  // The same histograms as the wgMakeHist program are filled while
+  // decoding
+  FusedHistOptions fused_hist;
+  if (fused) {
+    try {
+      Topology topol(options.pyrame_config_file);
+      fused_hist.chip_map = topol.dif_map[dif];
+    } catch (const std::exception& e) {
+      Log.eWrite("[wgDecoder] " + std::string(e.what()));
+      return ERR_TOPOLOGY;
+    }
+    if (fused_hist.chip_map.empty() || fused_hist.chip_map.size() > NCHIPS) {
+      Log.eWrite("[wgDecoder] wrong number of chips in the Pyrame configuration : " +
+                 std::to_string(fused_hist.chip_map.size()));
+      return ERR_WRONG_CHIP_VALUE;
     }
-  } catch (const wgEOF& e) {
-    result = WG_SUCCESS;
-  } catch (const std::exception& e) {
-    Log.eWrite("[wgDecoder] Error while reading raw data : " +
-               std::string(e.what()));
-    result = ERR_WG_DECODER;
+    fused_hist.output_hist_file = output_dir + "/" + output_hist_file_name;
+    fused_hist.flags = makehist_flags;
   }
 
   // ===================================================================== //
-  //                           Close everything                            //
+  //                          Decode the raw file                          //
   // ===================================================================== //
 
-  ifs.close();
-  tree->Write();
-  output_file->Close();
-  delete output_file;
-
-  Log.Write("[wgDecoder] *****  GOOD spills : " + std::to_string(n_good_spills) +
-            " spills *****");
-  Log.Write("[wgDecoder] *****  BAD  spills : " + std::to_string(n_bad_spills) +
-            " spills *****");
-  
-  return result;
+  return DecodeDifFile(input_raw_file,
+                       output_dir + "/" + output_file_name,
+                       dif,
+                       n_chips,
+                       &calib,
+                       pyrame_log,
+                       options,
+                       fused ? &fused_hist : NULL);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//                                  wgDecoder                                //
+///////////////////////////////////////////////////////////////////////////////
+
+int wgDecoder(const char * x_input_raw_file,
+              const char * x_calibration_dir,
+              const char * x_output_dir,
+              const bool overwrite,
+              const bool compatibility_mode,
+              const unsigned dif,
+              const unsigned n_chips,
+              const unsigned n_threads,
+              const bool sparse_output,
+              const bool write_index,
+              const int first_spill,
+              const int last_spill,
+              const bool follow,
+              const char * x_stop_file,
+              const unsigned idle_timeout,
+              const char * x_output_profile,
+              const char * x_pyrame_config_file,
+              const unsigned long makehist_flags,
+              const bool write_tree,
+              const bool write_report,
+              const bool write_columns) {
+  DecoderOptions options;
+  options.overwrite = overwrite;
+  options.compatibility_mode = compatibility_mode;
+  options.n_threads = n_threads;
+  options.sparse_output = sparse_output;
+  options.write_index = write_index;
+  options.first_spill = first_spill;
+  options.last_spill = last_spill;
+  options.follow = follow;
+  options.stop_file = x_stop_file;
+  options.idle_timeout = idle_timeout;
+  options.output_profile = x_output_profile;
+  options.pyrame_config_file = x_pyrame_config_file;
+  options.makehist_flags = makehist_flags;
+  options.write_tree = write_tree;
+  options.write_report = write_report;
+  options.write_columns = write_columns;
+  return DecodeRawFile(x_input_raw_file, x_calibration_dir, x_output_dir,
+                       dif, n_chips, options);
+}
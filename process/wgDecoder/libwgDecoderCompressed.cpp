@@ -0,0 +1,449 @@
+// system includes
+#include <string>
+#include <istream>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+// system C includes
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+// user includes
+#include "wgExceptions.hpp"
+#include "wgFileSystemTools.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderCompressed.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                           Compression formats                             //
+///////////////////////////////////////////////////////////////////////////////
+
+// Magic numbers of the compressed formats
+static const unsigned char GZIP_MAGIC[] = {0x1F, 0x8B};
+static const unsigned char ZSTD_MAGIC[] = {0x28, 0xB5, 0x2F, 0xFD};
+static const unsigned char XZ_MAGIC[]   = {0xFD, 0x37, 0x7A, 0x58, 0x5A, 0x00};
+
+// Number of decompressed blocks that the decompression thread can
+// keep ready ahead of the decoding
+const std::size_t DECOMPRESSED_BLOCKS_IN_FLIGHT = 4;
+
+static bool EndsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+      str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Return the compression format of the file according to its
+// extension
+static RawDataCompression CompressionFromExtension(const std::string& path) {
+  if (EndsWith(path, ".gz"))  return RAW_DATA_GZIP;
+  if (EndsWith(path, ".zst")) return RAW_DATA_ZSTD;
+  if (EndsWith(path, ".xz"))  return RAW_DATA_XZ;
+  return RAW_DATA_UNCOMPRESSED;
+}
+
+static std::string CompressionExtension(RawDataCompression compression) {
+  switch (compression) {
+    case RAW_DATA_GZIP : return ".gz";
+    case RAW_DATA_ZSTD : return ".zst";
+    case RAW_DATA_XZ   : return ".xz";
+    default            : return "";
+  }
+}
+
+std::string RawDataCompressionName(RawDataCompression compression) {
+  switch (compression) {
+    case RAW_DATA_GZIP : return "gzip";
+    case RAW_DATA_ZSTD : return "zstd";
+    case RAW_DATA_XZ   : return "xz";
+    default            : return "none";
+  }
+}
+
+RawDataCompression GetRawDataCompression(const std::string& input_raw_file) {
+  // Reading the magic number of a pipe would consume it
+  struct stat file_stat;
+  if (stat(input_raw_file.c_str(), &file_stat) == 0 && !S_ISREG(file_stat.st_mode))
+    return CompressionFromExtension(input_raw_file);
+
+  std::ifstream ifs(input_raw_file.c_str(), std::ios_base::in | std::ios_base::binary);
+  if (!ifs.is_open())
+    throw wgInvalidFile("failed to open " + input_raw_file + " : " +
+                        std::string(std::strerror(errno)));
+  unsigned char magic[sizeof(XZ_MAGIC)] = {0};
+  ifs.read(reinterpret_cast<char *>(magic), sizeof(magic));
+  std::size_t size = ifs.gcount();
+
+  if (size >= sizeof(GZIP_MAGIC) && std::memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0)
+    return RAW_DATA_GZIP;
+  if (size >= sizeof(ZSTD_MAGIC) && std::memcmp(magic, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0)
+    return RAW_DATA_ZSTD;
+  if (size >= sizeof(XZ_MAGIC) && std::memcmp(magic, XZ_MAGIC, sizeof(XZ_MAGIC)) == 0)
+    return RAW_DATA_XZ;
+
+  RawDataCompression compression = CompressionFromExtension(input_raw_file);
+  if (compression != RAW_DATA_UNCOMPRESSED)
+    throw wgInvalidFile(input_raw_file + " is not a valid " +
+                        RawDataCompressionName(compression) + " file");
+  return RAW_DATA_UNCOMPRESSED;
+}
+
+bool IsRawFileName(const std::string& path) {
+  std::string extension = CompressionExtension(CompressionFromExtension(path));
+  return EndsWith(path.substr(0, path.size() - extension.size()), ".raw");
+}
+
+std::string RawFileBasename(const std::string& path) {
+  std::string extension = CompressionExtension(CompressionFromExtension(path));
+  return wagasci_tools::get_stats::basename(path.substr(0, path.size() - extension.size()));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                Decompressors                              //
+///////////////////////////////////////////////////////////////////////////////
+
+// Streaming decompressor of a single format. The Decompress method
+// decompresses the "in_size" bytes at "in" into the "out_size" bytes
+// at "out". The number of input bytes that have been used is stored
+// in "in_used" and the number of decompressed bytes is returned. The
+// input bytes that have not been used must be passed again in the
+// next call. "finish" is true when there is no more input after
+// "in". A wgInvalidFile exception is thrown if the data is corrupted
+// or if the input is over in the middle of the compressed stream.
+
+class Decompressor {
+ public:
+  virtual ~Decompressor() {}
+  virtual std::size_t Decompress(const char * in, std::size_t in_size, std::size_t& in_used,
+                                 char * out, std::size_t out_size, bool finish) = 0;
+};
+
+#ifdef HAVE_ZLIB
+class GzipDecompressor : public Decompressor {
+ public:
+  GzipDecompressor() {
+    std::memset(&m_stream, 0, sizeof(m_stream));
+    // 15 is the maximum window size and 32 enables the gzip header
+    // detection
+    if (inflateInit2(&m_stream, 15 + 32) != Z_OK)
+      throw wgInvalidFile("failed to initialize the gzip decompressor");
+  }
+  ~GzipDecompressor() { inflateEnd(&m_stream); }
+
+  std::size_t Decompress(const char * in, std::size_t in_size, std::size_t& in_used,
+                         char * out, std::size_t out_size, bool finish) override {
+    m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+    m_stream.avail_in = in_size;
+    m_stream.next_out = reinterpret_cast<Bytef *>(out);
+    m_stream.avail_out = out_size;
+    while (m_stream.avail_out > 0) {
+      if (m_stream_end) {
+        if (m_stream.avail_in == 0) break;
+        // Files compressed in parallel (pigz) are many gzip members
+        // one after the other
+        inflateReset(&m_stream);
+        m_stream_end = false;
+      }
+      int ret = inflate(&m_stream, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END)
+        m_stream_end = true;
+      else if (ret == Z_BUF_ERROR)
+        break;
+      else if (ret != Z_OK)
+        throw wgInvalidFile("corrupted gzip data : " +
+                            std::string(m_stream.msg != NULL ? m_stream.msg : "unknown error"));
+    }
+    in_used = in_size - m_stream.avail_in;
+    std::size_t produced = out_size - m_stream.avail_out;
+    if (finish && in_used == in_size && produced == 0 && !m_stream_end)
+      throw wgInvalidFile("truncated gzip data");
+    return produced;
+  }
+
+ private:
+  z_stream m_stream;
+  bool m_stream_end = false;
+};
+#endif
+
+#ifdef HAVE_ZSTD
+class ZstdDecompressor : public Decompressor {
+ public:
+  ZstdDecompressor() : m_stream(ZSTD_createDStream()) {
+    if (m_stream == NULL || ZSTD_isError(ZSTD_initDStream(m_stream)))
+      throw wgInvalidFile("failed to initialize the zstd decompressor");
+  }
+  ~ZstdDecompressor() { ZSTD_freeDStream(m_stream); }
+
+  std::size_t Decompress(const char * in, std::size_t in_size, std::size_t& in_used,
+                         char * out, std::size_t out_size, bool finish) override {
+    ZSTD_inBuffer input = {in, in_size, 0};
+    ZSTD_outBuffer output = {out, out_size, 0};
+    while (output.pos < output.size) {
+      std::size_t in_pos = input.pos, out_pos = output.pos;
+      std::size_t ret = ZSTD_decompressStream(m_stream, &output, &input);
+      if (ZSTD_isError(ret))
+        throw wgInvalidFile("corrupted zstd data : " + std::string(ZSTD_getErrorName(ret)));
+      if (input.pos == in_pos && output.pos == out_pos) break;
+      // Zero means that a frame has been completely decoded
+      m_frame_end = ret == 0;
+    }
+    in_used = input.pos;
+    if (finish && in_used == in_size && output.pos == 0 && !m_frame_end)
+      throw wgInvalidFile("truncated zstd data");
+    return output.pos;
+  }
+
+ private:
+  ZSTD_DStream * m_stream;
+  bool m_frame_end = false;
+};
+#endif
+
+#ifdef HAVE_LZMA
+class XzDecompressor : public Decompressor {
+ public:
+  XzDecompressor() {
+    lzma_stream init = LZMA_STREAM_INIT;
+    m_stream = init;
+    if (lzma_stream_decoder(&m_stream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+      throw wgInvalidFile("failed to initialize the xz decompressor");
+  }
+  ~XzDecompressor() { lzma_end(&m_stream); }
+
+  std::size_t Decompress(const char * in, std::size_t in_size, std::size_t& in_used,
+                         char * out, std::size_t out_size, bool finish) override {
+    m_stream.next_in = reinterpret_cast<const uint8_t *>(in);
+    m_stream.avail_in = in_size;
+    m_stream.next_out = reinterpret_cast<uint8_t *>(out);
+    m_stream.avail_out = out_size;
+    while (m_stream.avail_out > 0 && !m_stream_end) {
+      std::size_t avail_in = m_stream.avail_in, avail_out = m_stream.avail_out;
+      // With LZMA_CONCATENATED the decoder needs LZMA_FINISH to know
+      // that there are no more streams
+      lzma_ret ret = lzma_code(&m_stream, finish ? LZMA_FINISH : LZMA_RUN);
+      if (ret == LZMA_STREAM_END)
+        m_stream_end = true;
+      else if (ret == LZMA_BUF_ERROR)
+        break;
+      else if (ret != LZMA_OK)
+        throw wgInvalidFile("corrupted xz data : error code " + std::to_string(ret));
+      if (m_stream.avail_in == avail_in && m_stream.avail_out == avail_out) break;
+    }
+    in_used = in_size - m_stream.avail_in;
+    std::size_t produced = out_size - m_stream.avail_out;
+    if (finish && in_used == in_size && produced == 0 && !m_stream_end)
+      throw wgInvalidFile("truncated xz data");
+    return produced;
+  }
+
+ private:
+  lzma_stream m_stream;
+  bool m_stream_end = false;
+};
+#endif
+
+static std::unique_ptr<Decompressor> MakeDecompressor(RawDataCompression compression) {
+  switch (compression) {
+#ifdef HAVE_ZLIB
+    case RAW_DATA_GZIP : return std::unique_ptr<Decompressor>(new GzipDecompressor());
+#endif
+#ifdef HAVE_ZSTD
+    case RAW_DATA_ZSTD : return std::unique_ptr<Decompressor>(new ZstdDecompressor());
+#endif
+#ifdef HAVE_LZMA
+    case RAW_DATA_XZ   : return std::unique_ptr<Decompressor>(new XzDecompressor());
+#endif
+    default :
+      throw wgInvalidFile("the wgDecoder was built without " +
+                          RawDataCompressionName(compression) + " support");
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                             DecompressedBuffer                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// std::streambuf that returns the blocks decompressed by the
+// decompression thread. Any error of the decompression thread is
+// re-thrown by the underflow method after all the blocks decompressed
+// before the error have been read.
+
+class CompressedRawDataInput::DecompressedBuffer : public std::streambuf {
+ public:
+  DecompressedBuffer(const std::string& input_raw_file, RawDataCompression compression);
+  ~DecompressedBuffer();
+
+ protected:
+  int_type underflow() override;
+
+ private:
+  std::string m_input_raw_file;
+  std::ifstream m_ifs;
+  std::unique_ptr<Decompressor> m_decompressor;
+
+  // Everything below is protected by the mutex
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::vector<char>> m_blocks;
+  bool m_done = false;
+  bool m_stop = false;
+  std::exception_ptr m_error;
+
+  // Block currently read through the streambuf get area
+  std::vector<char> m_current;
+  std::thread m_thread;
+
+  // Body of the decompression thread
+  void Decompress();
+  // Hand a decompressed block over to the reading thread. Return false
+  // if the reading thread is gone.
+  bool Push(std::vector<char>& block);
+};
+
+CompressedRawDataInput::DecompressedBuffer::DecompressedBuffer(const std::string& input_raw_file,
+                                                               RawDataCompression compression) :
+    m_input_raw_file(input_raw_file),
+    m_ifs(input_raw_file.c_str(), std::ios_base::in | std::ios_base::binary),
+    m_decompressor(MakeDecompressor(compression)) {
+  if (!m_ifs.is_open())
+    throw wgInvalidFile("failed to open " + input_raw_file + " : " +
+                        std::string(std::strerror(errno)));
+  m_thread = std::thread(&DecompressedBuffer::Decompress, this);
+}
+
+CompressedRawDataInput::DecompressedBuffer::~DecompressedBuffer() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable()) m_thread.join();
+}
+
+bool CompressedRawDataInput::DecompressedBuffer::Push(std::vector<char>& block) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [&]() { return m_stop || m_blocks.size() < DECOMPRESSED_BLOCKS_IN_FLIGHT; });
+  if (m_stop) return false;
+  m_blocks.push_back(std::move(block));
+  m_cv.notify_all();
+  return true;
+}
+
+void CompressedRawDataInput::DecompressedBuffer::Decompress() {
+  try {
+    std::vector<char> input(RAW_DATA_BLOCK_SIZE);
+    std::size_t in_pos = 0, in_size = 0;
+    bool eof = false;
+    std::vector<char> block(RAW_DATA_BLOCK_SIZE);
+    std::size_t out_pos = 0;
+
+    while (true) {
+      if (in_pos == in_size && !eof) {
+        m_ifs.read(input.data(), input.size());
+        if (m_ifs.bad())
+          throw wgInvalidFile("failed to read " + m_input_raw_file);
+        in_pos = 0;
+        in_size = m_ifs.gcount();
+        eof = m_ifs.eof();
+      }
+
+      std::size_t in_used = 0;
+      std::size_t produced = m_decompressor->Decompress(input.data() + in_pos, in_size - in_pos,
+                                                        in_used, block.data() + out_pos,
+                                                        block.size() - out_pos, eof);
+      in_pos += in_used;
+      out_pos += produced;
+
+      // Nothing can be done with the data left
+      bool stalled = in_used == 0 && produced == 0 && in_pos < in_size;
+      if (stalled)
+        throw wgInvalidFile("unexpected data after the end of the compressed stream in " +
+                            m_input_raw_file);
+      bool finished = eof && in_pos == in_size && produced == 0;
+
+      if (out_pos == block.size() || (finished && out_pos > 0)) {
+        block.resize(out_pos);
+        if (!Push(block)) return;
+        block.assign(RAW_DATA_BLOCK_SIZE, 0);
+        out_pos = 0;
+      }
+      if (finished) break;
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_error = std::current_exception();
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_done = true;
+  m_cv.notify_all();
+}
+
+CompressedRawDataInput::DecompressedBuffer::int_type
+CompressedRawDataInput::DecompressedBuffer::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return m_done || !m_blocks.empty(); });
+    if (m_blocks.empty()) {
+      if (m_error) std::rethrow_exception(m_error);
+      return traits_type::eof();
+    }
+    m_current = std::move(m_blocks.front());
+    m_blocks.pop_front();
+  }
+  m_cv.notify_all();
+  setg(m_current.data(), m_current.data(), m_current.data() + m_current.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                           CompressedRawDataInput                          //
+///////////////////////////////////////////////////////////////////////////////
+
+CompressedRawDataInput::CompressedRawDataInput(const std::string& input_raw_file,
+                                               RawDataCompression compression) :
+    m_buffer(new DecompressedBuffer(input_raw_file, compression)),
+    m_is(new std::istream(m_buffer.get())) {
+  // The errors of the decompression thread are re-thrown by the read
+  // methods instead of just setting the badbit
+  m_is->exceptions(std::ios_base::badbit);
+  // Fail now if the file cannot be decompressed at all
+  m_is->peek();
+  m_input.reset(new StreamRawDataInput(*m_is));
+}
+
+CompressedRawDataInput::~CompressedRawDataInput() {}
+
+std::streampos CompressedRawDataInput::tellg() const {
+  return m_input->tellg();
+}
+
+void CompressedRawDataInput::seekg(std::streampos pos) {
+  m_input->seekg(pos);
+}
+
+RawDataSpan CompressedRawDataInput::ReadLines(std::size_t n_lines) {
+  return m_input->ReadLines(n_lines);
+}
+
+RawDataSpan CompressedRawDataInput::PeekLines(std::size_t max_lines) {
+  return m_input->PeekLines(max_lines);
+}
@@ -0,0 +1,201 @@
+// system includes
+#include <string>
+#include <chrono>
+#include <thread>
+#include <limits>
+
+// system C includes
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderStats.hpp"
+#include "wgDecoderRun.hpp"
+#include "wgDecoderFollow.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                              RawFileFollower                              //
+///////////////////////////////////////////////////////////////////////////////
+
+RawFileFollower::RawFileFollower(const std::string& input_raw_file,
+                                 const FollowOptions& options) :
+    m_input_raw_file(input_raw_file), m_options(options),
+    m_last_growth(std::chrono::steady_clock::now()) {}
+
+std::size_t RawFileFollower::PollSize() {
+  struct stat file_stat;
+  if (stat(m_input_raw_file.c_str(), &file_stat) == -1)
+    throw wgInvalidFile("failed to stat " + m_input_raw_file + " : " +
+                        std::string(std::strerror(errno)));
+  if (!S_ISREG(file_stat.st_mode))
+    throw wgInvalidFile(m_input_raw_file + " is not a regular file");
+  std::size_t size = file_stat.st_size;
+  if (size < m_last_size)
+    throw wgInvalidFile(m_input_raw_file + " has been truncated");
+  if (size > m_last_size) {
+    m_last_size = size;
+    m_last_growth = std::chrono::steady_clock::now();
+  }
+  return size;
+}
+
+bool RawFileFollower::StopConditionMet() {
+  struct stat file_stat;
+  if (!m_options.stop_file.empty() && stat(m_options.stop_file.c_str(), &file_stat) == 0) {
+    Log.Write("[wgDecoder] Follow : stop file found : " + m_options.stop_file);
+    return true;
+  }
+  if (m_options.idle_timeout > 0 &&
+      std::chrono::steady_clock::now() - m_last_growth >=
+      std::chrono::seconds(m_options.idle_timeout)) {
+    Log.Write("[wgDecoder] Follow : the raw file has not grown for " +
+              std::to_string(m_options.idle_timeout) + " seconds");
+    return true;
+  }
+  if (!m_options.pyrame_log_file.empty() && PyrameLogIsClosed(m_options.pyrame_log_file)) {
+    Log.Write("[wgDecoder] Follow : the acquisition is over : " + m_options.pyrame_log_file);
+    return true;
+  }
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               WaitForFormat                               //
+///////////////////////////////////////////////////////////////////////////////
+
+RawDataConfig RawFileFollower::WaitForFormat() {
+  Log.Write("[wgDecoder] Follow : waiting for data in " + m_input_raw_file);
+  while (true) {
+    // The stop condition is checked first, so that the last probe sees
+    // all the data written before the stop
+    bool stop = StopConditionMet();
+    try {
+      PollSize();
+      MappedRawDataInput input(m_input_raw_file);
+      bool conclusive;
+      RawDataConfig config = wagasci_decoder_utils::ProbeRawData(
+          input.PeekLines(std::numeric_limits<std::size_t>::max()), stop, conclusive);
+      if (conclusive) return config;
+    } catch (const wgInvalidFile& e) {
+      Log.eWrite("[wgDecoder] Follow : " + std::string(e.what()));
+      return RawDataConfig(0, NCHANNELS, 1, false, false, false, false);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(FOLLOW_POLL_MILLISECONDS));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                   Follow                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+void RawFileFollower::Follow(const RawDataConfig& config,
+                             SectionReader::filler fill,
+                             Raw_t& rd,
+                             SpillCounter& counter,
+                             unsigned& skipped_lines,
+                             saver autosave,
+                             DecoderStats * stats) {
+  unsigned n_filled_spills = 0;
+  SectionSeeker seeker(config);
+  SectionReader reader(config, [&](Raw_t& spill_rd) {
+      fill(spill_rd);
+      ++n_filled_spills;
+    }, rd);
+
+  // Everything needed to resume the decoding right after the last
+  // complete spill
+  std::streampos resume_position = 0;
+  SectionSeeker::State resume_seeker_state = seeker.GetState();
+  SectionReader::State resume_reader_state = reader.GetState();
+  SpillCounter resume_counter = counter;
+  unsigned resume_skipped_lines = skipped_lines;
+  SectionSeeker::Statistics resume_statistics = seeker.GetStatistics();
+
+  std::size_t decoded_size = 0;
+  unsigned n_saved_spills = 0;
+  auto last_save = std::chrono::steady_clock::now();
+  bool stop = false;
+
+  while (true) {
+    std::size_t size = PollSize();
+    if (size > decoded_size) {
+      MappedRawDataInput input(m_input_raw_file);
+      input.seekg(resume_position);
+      seeker.SetState(resume_seeker_state);
+      reader.SetState(resume_reader_state);
+      counter = resume_counter;
+      skipped_lines = resume_skipped_lines;
+      seeker.SetStatistics(resume_statistics);
+      // Forget the incomplete spill read during the last pass
+      rd.clear();
+      try {
+        while (true) {
+          DecoderStats::clock::time_point time = DecoderStats::clock::now();
+          SectionSeeker::Section section = seeker.SeekNextSection(input, skipped_lines);
+          if (stats != NULL) {
+            time = stats->AddTime(STAGE_SEEK, time);
+            double fill_seconds = stats->FillSeconds();
+            reader.ReadNextSection(section);
+            stats->AddTime(STAGE_READ, time);
+            stats->stage_seconds[STAGE_READ] -= stats->FillSeconds() - fill_seconds;
+          } else {
+            reader.ReadNextSection(section);
+          }
+          counter.Count(section);
+          if (section.type == SectionSeeker::SectionType::SpillTrailer &&
+              section.ichip < config.n_chips) {
+            resume_position = input.tellg();
+            resume_seeker_state = seeker.GetState();
+            resume_reader_state = reader.GetState();
+            resume_counter = counter;
+            resume_skipped_lines = skipped_lines;
+            resume_statistics = seeker.GetStatistics();
+          }
+        }
+      } catch (const wgEOF& e) {}
+      decoded_size = input.size();
+    }
+
+    // ============ Save the output ============ //
+
+    auto now = std::chrono::steady_clock::now();
+    if (n_filled_spills != n_saved_spills &&
+        (stop || now - last_save >= std::chrono::seconds(FOLLOW_AUTOSAVE_SECONDS))) {
+      autosave();
+      Log.Write("[wgDecoder] Follow : decoded " + std::to_string(n_filled_spills) + " spills");
+      n_saved_spills = n_filled_spills;
+      last_save = now;
+    }
+
+    // ============ Stop conditions ============ //
+
+    // After a stop condition is met the raw file is read one last time
+    if (stop) break;
+    stop = StopConditionMet();
+    if (!stop)
+      std::this_thread::sleep_for(std::chrono::milliseconds(FOLLOW_POLL_MILLISECONDS));
+  }
+
+  // The last pass read the whole file, so the spills are counted
+  // exactly as if the file had been decoded in one go. Only the
+  // incomplete spill at the end of the file (if any) is discarded.
+  rd.clear();
+  if (stats != NULL) {
+    stats->bytes_read = decoded_size;
+    stats->seeker = seeker.GetStatistics();
+  }
+  if (decoded_size > (std::size_t) resume_position)
+    Log.Write("[wgDecoder] Follow : ignored " +
+              std::to_string(decoded_size - (std::size_t) resume_position) +
+              " bytes after the last complete spill");
+}
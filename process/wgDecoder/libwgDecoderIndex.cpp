@@ -0,0 +1,334 @@
+// system includes
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+
+// system C includes
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoder.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderIndex.hpp"
+
+namespace {
+
+// The sidecar file starts with the SPILL_INDEX_MAGIC string followed
+// by the SPILL_INDEX_VERSION number. Bump the version every time the
+// layout below changes.
+const char SPILL_INDEX_MAGIC[8] = {'W', 'G', 'S', 'P', 'I', 'D', 'X', '\0'};
+const uint32_t SPILL_INDEX_VERSION = 1;
+
+// Size in bytes of a single entry of the sidecar file (see
+// WriteSpillIndex)
+const uint64_t SPILL_INDEX_ENTRY_SIZE = 2 * sizeof(int32_t) + 2 * sizeof(uint64_t) +
+                                        8 * sizeof(uint32_t);
+
+// All the values are written in the native (little-endian) byte
+// order, the same as the raw data.
+template <typename T>
+void WriteValue(std::ostream& os, T value) {
+  os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool ReadValue(std::istream& is, T& value) {
+  return (bool) is.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+// Return false if the input_raw_file file cannot be stat'ed
+bool GetRawFileStat(const std::string& input_raw_file, uint64_t& size, int64_t& mtime) {
+  struct stat file_stat;
+  if (stat(input_raw_file.c_str(), &file_stat) == -1 || !S_ISREG(file_stat.st_mode))
+    return false;
+  size = file_stat.st_size;
+  mtime = file_stat.st_mtime;
+  return true;
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+//                                SpillIndex                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+RawDataConfig SpillIndex::GetConfig(bool adc_is_calibrated, bool tdc_is_calibrated) const {
+  return RawDataConfig(n_chips, NCHANNELS, n_chip_id, has_spill_number,
+                       has_phantom_menace, adc_is_calibrated, tdc_is_calibrated);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               SpillIndexPath                              //
+///////////////////////////////////////////////////////////////////////////////
+
+std::string SpillIndexPath(const std::string& input_raw_file) {
+  return input_raw_file + ".idx";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                              BuildSpillIndex                              //
+///////////////////////////////////////////////////////////////////////////////
+
+SpillIndex BuildSpillIndex(RawDataInput& input,
+                           const RawDataConfig& config,
+                           SpillCounter& counter,
+                           unsigned& skipped_lines) {
+  SpillIndex index;
+  index.n_chips            = config.n_chips;
+  index.n_chip_id          = config.n_chip_id;
+  index.has_spill_number   = config.has_spill_number;
+  index.has_phantom_menace = config.has_phantom_menace;
+
+  // The reader is only needed to keep track of the spill number and
+  // spill count. Nothing is ever filled.
+  Raw_t rd(config.n_chips);
+  SectionSeeker seeker(config);
+  SectionReader reader(config, [](Raw_t&) {}, rd);
+
+  const unsigned first_good_spills = counter.n_good_spills;
+  const unsigned first_bad_spills = counter.n_bad_spills;
+  const unsigned first_skipped_lines = skipped_lines;
+  unsigned last_bad_spills = counter.n_bad_spills;
+  unsigned last_skipped_lines = skipped_lines;
+
+  SpillIndexEntry entry;
+  entry.offset = input.tellg();
+  entry.seeker_state = seeker.GetState();
+  entry.reader_state = reader.GetState();
+  try {
+    while (true) {
+      SectionSeeker::Section section = seeker.SeekNextSection(input, skipped_lines);
+      counter.Count(section);
+      if (section.type == SectionSeeker::SectionType::SpillHeader ||
+          section.type == SectionSeeker::SectionType::SpillNumber) {
+        reader.ReadNextSection(section);
+      } else if (section.type == SectionSeeker::SectionType::SpillTrailer) {
+        if ((counter.n_good_spills + counter.n_bad_spills) % 1000 == 0)
+          Log.Write("[wgDecoder] Indexed " + std::to_string(counter.n_good_spills +
+                                                            counter.n_bad_spills) + " spills");
+        // The TTree is filled only if the spill trailer is actually read
+        if (section.ichip >= config.n_chips) continue;
+
+        const uint64_t stop = input.tellg();
+        entry.spill_number = rd.spill_number;
+        entry.spill_count  = rd.spill_count;
+        entry.length       = stop - entry.offset;
+        entry.n_chips      = (section.data[3] & x00FF).to_ulong();
+        if (counter.n_bad_spills != last_bad_spills)
+          entry.flags |= SPILL_INDEX_BAD_SPILL;
+        if (skipped_lines != last_skipped_lines)
+          entry.flags |= SPILL_INDEX_SKIPPED_LINES;
+        if (entry.n_chips != config.n_chips)
+          entry.flags |= SPILL_INDEX_WRONG_NCHIPS;
+        index.max_n_chips = std::max(index.max_n_chips, entry.n_chips);
+        index.entries.push_back(entry);
+
+        // The next spill starts right after this one
+        entry = SpillIndexEntry();
+        entry.offset = stop;
+        entry.seeker_state = seeker.GetState();
+        entry.reader_state = reader.GetState();
+        last_bad_spills = counter.n_bad_spills;
+        last_skipped_lines = skipped_lines;
+        rd.clear();
+      }
+    }
+  } catch (const wgEOF& e) {}
+
+  index.n_good_spills = counter.n_good_spills - first_good_spills;
+  index.n_bad_spills  = counter.n_bad_spills - first_bad_spills;
+  index.skipped_lines = skipped_lines - first_skipped_lines;
+  return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                              WriteSpillIndex                              //
+///////////////////////////////////////////////////////////////////////////////
+
+void WriteSpillIndex(const std::string& input_raw_file, SpillIndex& index) {
+  if (!GetRawFileStat(input_raw_file, index.raw_file_size, index.raw_file_mtime))
+    throw wgInvalidFile("failed to stat " + input_raw_file + " : " +
+                        std::string(std::strerror(errno)));
+
+  // The index is written into a temporary file that is then renamed,
+  // so that a reader never sees a half-written index.
+  const std::string index_path = SpillIndexPath(input_raw_file);
+  const std::string tmp_path = index_path + ".tmp";
+  std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!ofs.is_open())
+    throw wgInvalidFile("failed to open " + tmp_path + " : " +
+                        std::string(std::strerror(errno)));
+
+  ofs.write(SPILL_INDEX_MAGIC, sizeof(SPILL_INDEX_MAGIC));
+  WriteValue<uint32_t>(ofs, SPILL_INDEX_VERSION);
+  WriteValue<uint32_t>(ofs, index.n_chips);
+  WriteValue<uint32_t>(ofs, index.n_chip_id);
+  WriteValue<uint32_t>(ofs, index.has_spill_number);
+  WriteValue<uint32_t>(ofs, index.has_phantom_menace);
+  WriteValue<uint32_t>(ofs, index.max_n_chips);
+  WriteValue<uint64_t>(ofs, index.raw_file_size);
+  WriteValue<int64_t> (ofs, index.raw_file_mtime);
+  WriteValue<uint32_t>(ofs, index.n_good_spills);
+  WriteValue<uint32_t>(ofs, index.n_bad_spills);
+  WriteValue<uint32_t>(ofs, index.skipped_lines);
+  WriteValue<uint64_t>(ofs, index.entries.size());
+
+  for (const auto& entry : index.entries) {
+    WriteValue<int32_t> (ofs, entry.spill_number);
+    WriteValue<int32_t> (ofs, entry.spill_count);
+    WriteValue<uint64_t>(ofs, entry.offset);
+    WriteValue<uint64_t>(ofs, entry.length);
+    WriteValue<uint32_t>(ofs, entry.n_chips);
+    WriteValue<uint32_t>(ofs, entry.flags);
+    WriteValue<uint32_t>(ofs, entry.seeker_state.type);
+    WriteValue<uint32_t>(ofs, entry.seeker_state.last_ispill);
+    WriteValue<uint32_t>(ofs, entry.seeker_state.last_ichip);
+    WriteValue<uint32_t>(ofs, entry.seeker_state.current_ichip);
+    WriteValue<uint32_t>(ofs, entry.reader_state.last_spill_number);
+    WriteValue<uint32_t>(ofs, entry.reader_state.last_spill_count);
+  }
+
+  ofs.close();
+  if (!ofs || std::rename(tmp_path.c_str(), index_path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    throw wgInvalidFile("failed to write " + index_path);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               ReadSpillIndex                              //
+///////////////////////////////////////////////////////////////////////////////
+
+bool ReadSpillIndex(const std::string& input_raw_file, SpillIndex& index,
+                    const bool header_only) {
+  const std::string index_path = SpillIndexPath(input_raw_file);
+  std::ifstream ifs(index_path, std::ios::binary);
+  if (!ifs.is_open()) return false;
+
+  char magic[sizeof(SPILL_INDEX_MAGIC)];
+  uint32_t version = 0, has_spill_number = 0, has_phantom_menace = 0;
+  uint64_t n_entries = 0;
+  if (!ifs.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, SPILL_INDEX_MAGIC, sizeof(magic)) != 0 ||
+      !ReadValue(ifs, version) || version != SPILL_INDEX_VERSION) {
+    Log.eWrite("[wgDecoder] Unknown spill index format : " + index_path);
+    return false;
+  }
+
+  SpillIndex tmp_index;
+  if (!ReadValue(ifs, tmp_index.n_chips)       ||
+      !ReadValue(ifs, tmp_index.n_chip_id)     ||
+      !ReadValue(ifs, has_spill_number)        ||
+      !ReadValue(ifs, has_phantom_menace)      ||
+      !ReadValue(ifs, tmp_index.max_n_chips)   ||
+      !ReadValue(ifs, tmp_index.raw_file_size) ||
+      !ReadValue(ifs, tmp_index.raw_file_mtime)||
+      !ReadValue(ifs, tmp_index.n_good_spills) ||
+      !ReadValue(ifs, tmp_index.n_bad_spills)  ||
+      !ReadValue(ifs, tmp_index.skipped_lines) ||
+      !ReadValue(ifs, n_entries)) {
+    Log.eWrite("[wgDecoder] Spill index is truncated : " + index_path);
+    return false;
+  }
+  tmp_index.has_spill_number = has_spill_number != 0;
+  tmp_index.has_phantom_menace = has_phantom_menace != 0;
+
+  uint64_t raw_file_size;
+  int64_t raw_file_mtime;
+  if (!GetRawFileStat(input_raw_file, raw_file_size, raw_file_mtime) ||
+      raw_file_size != tmp_index.raw_file_size ||
+      raw_file_mtime != tmp_index.raw_file_mtime) {
+    Log.Write("[wgDecoder] Spill index is stale and will be ignored : " + index_path);
+    return false;
+  }
+
+  if (!header_only) {
+    // A corrupted n_entries must not make us allocate more entries
+    // than the file can hold
+    const std::streamoff header_size = ifs.tellg();
+    ifs.seekg(0, std::ios::end);
+    const std::streamoff file_size = ifs.tellg();
+    ifs.seekg(header_size);
+    if (header_size < 0 || file_size < header_size ||
+        n_entries > (uint64_t) (file_size - header_size) / SPILL_INDEX_ENTRY_SIZE) {
+      Log.eWrite("[wgDecoder] Spill index is corrupted : " + index_path);
+      return false;
+    }
+    tmp_index.entries.resize(n_entries);
+    for (auto& entry : tmp_index.entries) {
+      if (!ReadValue(ifs, entry.spill_number)                   ||
+          !ReadValue(ifs, entry.spill_count)                    ||
+          !ReadValue(ifs, entry.offset)                         ||
+          !ReadValue(ifs, entry.length)                         ||
+          !ReadValue(ifs, entry.n_chips)                        ||
+          !ReadValue(ifs, entry.flags)                          ||
+          !ReadValue(ifs, entry.seeker_state.type)              ||
+          !ReadValue(ifs, entry.seeker_state.last_ispill)       ||
+          !ReadValue(ifs, entry.seeker_state.last_ichip)        ||
+          !ReadValue(ifs, entry.seeker_state.current_ichip)     ||
+          !ReadValue(ifs, entry.reader_state.last_spill_number) ||
+          !ReadValue(ifs, entry.reader_state.last_spill_count)  ||
+          entry.offset + entry.length > tmp_index.raw_file_size) {
+        Log.eWrite("[wgDecoder] Spill index is corrupted : " + index_path);
+        return false;
+      }
+    }
+  }
+
+  index = std::move(tmp_index);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                              MakeSpillChunks                              //
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<SpillChunk> MakeSpillChunks(const SpillIndex& index,
+                                        const unsigned spills_per_chunk,
+                                        std::size_t first_entry,
+                                        std::size_t end_entry,
+                                        SpillCounter& counter) {
+  end_entry = std::min(end_entry, index.entries.size());
+  std::vector<SpillChunk> chunks;
+  if (first_entry >= end_entry) return chunks;
+
+  // Only the totals of the whole file are known exactly. In a partial
+  // range every corrupted spill is counted as bad.
+  const bool whole_file = first_entry == 0 && end_entry == index.entries.size();
+  if (whole_file) {
+    counter.n_good_spills += index.n_good_spills;
+    counter.n_bad_spills  += index.n_bad_spills;
+  }
+
+  SpillChunk chunk;
+  for (std::size_t ientry = first_entry; ientry < end_entry; ++ientry) {
+    const SpillIndexEntry& entry = index.entries[ientry];
+    if (chunk.n_spills == 0) {
+      chunk.start = entry.offset;
+      chunk.seeker_state = entry.seeker_state;
+      chunk.reader_state = entry.reader_state;
+    }
+    if (!whole_file) {
+      if (entry.flags & SPILL_INDEX_BAD_SPILL) ++counter.n_bad_spills;
+      else ++counter.n_good_spills;
+    }
+    if (++chunk.n_spills == spills_per_chunk) {
+      chunks.push_back(chunk);
+      chunk.n_spills = 0;
+    }
+  }
+  if (chunk.n_spills > 0) chunks.push_back(chunk);
+  return chunks;
+}
@@ -0,0 +1,173 @@
+// system includes
+#include <algorithm>
+#include <string>
+#include <istream>
+#include <fstream>
+#include <memory>
+
+// system C includes
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgLogger.hpp"
+#include "wgDecoder.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderCompressed.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                            MappedRawDataInput                             //
+///////////////////////////////////////////////////////////////////////////////
+
+MappedRawDataInput::MappedRawDataInput(const std::string& input_raw_file) {
+  int fd = open(input_raw_file.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw wgInvalidFile("failed to open " + input_raw_file + " : " +
+                        std::string(std::strerror(errno)));
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode)) {
+    close(fd);
+    throw wgInvalidFile(input_raw_file + " is not a regular file");
+  }
+  m_size = file_stat.st_size;
+  if (m_size > 0) {
+    void * data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw wgInvalidFile("failed to map " + input_raw_file + " : " +
+                          std::string(std::strerror(errno)));
+    }
+    // The file is almost always read from start to end
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char *>(data);
+  }
+  // The mapping stays valid after the file descriptor is closed
+  close(fd);
+}
+
+MappedRawDataInput::~MappedRawDataInput() {
+  if (m_data != NULL)
+    munmap(const_cast<char *>(m_data), m_size);
+}
+
+std::streampos MappedRawDataInput::tellg() const {
+  return m_position;
+}
+
+void MappedRawDataInput::seekg(std::streampos pos) {
+  if (pos < 0 || (std::size_t) pos > m_size)
+    throw wgEOF("[wgDecoder] seek position out of the file");
+  m_position = pos;
+}
+
+RawDataSpan MappedRawDataInput::ReadLines(std::size_t n_lines) {
+  std::size_t n_bytes = n_lines * BYTES_PER_LINE;
+  if (m_position + n_bytes > m_size)
+    throw wgEOF("EOF reached");
+  RawDataSpan span(m_data + m_position, n_lines);
+  m_position += n_bytes;
+  return span;
+}
+
+RawDataSpan MappedRawDataInput::PeekLines(std::size_t max_lines) {
+  std::size_t n_lines = std::min(max_lines, (m_size - m_position) / BYTES_PER_LINE);
+  return RawDataSpan(m_data + m_position, n_lines);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                            StreamRawDataInput                             //
+///////////////////////////////////////////////////////////////////////////////
+
+StreamRawDataInput::StreamRawDataInput(std::istream& is) : m_is(is) {}
+
+StreamRawDataInput::StreamRawDataInput(const std::string& input_raw_file) :
+    m_ifs(new std::ifstream(input_raw_file.c_str(),
+                            std::ios_base::in | std::ios_base::binary)),
+    m_is(*m_ifs) {
+  if (!m_ifs->is_open())
+    throw wgInvalidFile("failed to open " + input_raw_file + " : " +
+                        std::string(std::strerror(errno)));
+}
+
+std::streampos StreamRawDataInput::tellg() const {
+  return m_position;
+}
+
+void StreamRawDataInput::seekg(std::streampos pos) {
+  if (pos < 0 || (std::size_t) pos < m_buffer_start)
+    throw std::out_of_range("[wgDecoder] cannot seek back to byte " +
+                            std::to_string(pos) + " of a stream");
+  m_position = pos;
+}
+
+bool StreamRawDataInput::Fill(std::size_t stop) {
+  std::size_t buffer_stop = m_buffer_start + m_buffer.size();
+  if (stop <= buffer_stop) return true;
+
+  // Drop everything that is too far behind the read position. The
+  // buffer is compacted only when there is at least RAW_DATA_LOOK_BACK
+  // bytes to drop, so that every byte is moved at most once.
+  if (m_position > m_buffer_start + 2 * RAW_DATA_LOOK_BACK) {
+    std::size_t new_start = std::min(m_position - RAW_DATA_LOOK_BACK, buffer_stop);
+    m_buffer.erase(m_buffer.begin(), m_buffer.begin() + (new_start - m_buffer_start));
+    m_buffer_start = new_start;
+  }
+
+  while (buffer_stop < stop && m_is.good()) {
+    std::size_t old_size = m_buffer.size();
+    std::size_t to_read = std::max(stop - buffer_stop, RAW_DATA_BLOCK_SIZE);
+    m_buffer.resize(old_size + to_read);
+    m_is.read(m_buffer.data() + old_size, to_read);
+    m_buffer.resize(old_size + m_is.gcount());
+    buffer_stop = m_buffer_start + m_buffer.size();
+  }
+  if (m_is.bad()) {
+    Log.eWrite("[wgDecoder] input stream is corrupted");
+    throw wgEOF("[wgDecoder] input stream is corrupted");
+  }
+  return stop <= buffer_stop;
+}
+
+RawDataSpan StreamRawDataInput::ReadLines(std::size_t n_lines) {
+  std::size_t n_bytes = n_lines * BYTES_PER_LINE;
+  if (!Fill(m_position + n_bytes))
+    throw wgEOF("EOF reached");
+  RawDataSpan span(m_buffer.data() + (m_position - m_buffer_start), n_lines);
+  m_position += n_bytes;
+  return span;
+}
+
+RawDataSpan StreamRawDataInput::PeekLines(std::size_t max_lines) {
+  Fill(m_position + max_lines * BYTES_PER_LINE);
+  std::size_t buffer_stop = m_buffer_start + m_buffer.size();
+  std::size_t n_lines = 0;
+  if (buffer_stop > m_position)
+    n_lines = std::min(max_lines, (buffer_stop - m_position) / BYTES_PER_LINE);
+  return RawDataSpan(m_buffer.data() + (m_position - m_buffer_start), n_lines);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                              OpenRawDataInput                             //
+///////////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<RawDataInput> OpenRawDataInput(const std::string& input_raw_file) {
+  RawDataCompression compression = GetRawDataCompression(input_raw_file);
+  if (compression != RAW_DATA_UNCOMPRESSED) {
+    Log.Write("[wgDecoder] " + RawDataCompressionName(compression) +
+              " compressed raw file : decompressing on the fly");
+    return std::unique_ptr<RawDataInput>(new CompressedRawDataInput(input_raw_file, compression));
+  }
+  try {
+    return std::unique_ptr<RawDataInput>(new MappedRawDataInput(input_raw_file));
+  } catch (const wgInvalidFile& e) {
+    Log.Write("[wgDecoder] memory mapping not possible (" + std::string(e.what()) +
+              "). Falling back to stream reading.");
+  }
+  return std::unique_ptr<RawDataInput>(new StreamRawDataInput(input_raw_file));
+}
@@ -0,0 +1,127 @@
+// system includes
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// ROOT includes
+#include "RConfigure.h"
+#include "RVersion.h"
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+
+// user includes
+#include "wgLogger.hpp"
+#include "wgDecoderOutput.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                               Output profiles                             //
+///////////////////////////////////////////////////////////////////////////////
+
+// ROOT compression algorithms (see ROOT::RCompressionSetting::EAlgorithm)
+const int ROOT_COMPRESSION_LZMA = 2;
+const int ROOT_COMPRESSION_LZ4  = 4;
+const int ROOT_COMPRESSION_ZSTD = 5;
+
+// Basket size and cluster size of the tuned profiles. A spill of 20
+// chips is about 46 kB per branch, so a basket holds about twenty
+// spills and a cluster a few hundreds.
+const int OUTPUT_BASKET_SIZE = 1024 * 1024;
+const long long OUTPUT_CLUSTER_SIZE = 32 * 1024 * 1024;
+
+std::vector<OutputProfile> AllOutputProfiles() {
+  std::vector<OutputProfile> profiles(5);
+
+  profiles[0].name = "default";
+
+  profiles[1].name = "fast";
+  profiles[1].compression = 100 * ROOT_COMPRESSION_LZ4 + 1;
+  profiles[1].basket_size = OUTPUT_BASKET_SIZE;
+  profiles[1].auto_flush_bytes = OUTPUT_CLUSTER_SIZE;
+  profiles[1].parallel_compression = true;
+
+  profiles[2].name = "archive";
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 20, 0)
+  profiles[2].compression = 100 * ROOT_COMPRESSION_ZSTD + 5;
+#else
+  profiles[2].compression = 100 * ROOT_COMPRESSION_LZMA + 5;
+#endif
+  profiles[2].basket_size = OUTPUT_BASKET_SIZE;
+  profiles[2].auto_flush_bytes = 2 * OUTPUT_CLUSTER_SIZE;
+  profiles[2].parallel_compression = true;
+
+  profiles[3].name = "compact";
+  profiles[3].compression = 100 * ROOT_COMPRESSION_LZMA + 8;
+  profiles[3].basket_size = OUTPUT_BASKET_SIZE;
+  profiles[3].auto_flush_bytes = 2 * OUTPUT_CLUSTER_SIZE;
+  profiles[3].parallel_compression = true;
+
+  profiles[4].name = "scratch";
+  profiles[4].compression = 0;
+  profiles[4].basket_size = OUTPUT_BASKET_SIZE;
+  profiles[4].auto_flush_bytes = OUTPUT_CLUSTER_SIZE;
+  profiles[4].parallel_compression = false;
+
+  return profiles;
+}
+
+std::vector<std::string> OutputProfileNames() {
+  std::vector<std::string> names;
+  for (auto const & profile : AllOutputProfiles())
+    names.push_back(profile.name);
+  return names;
+}
+
+OutputProfile GetOutputProfile(const std::string& name) {
+  std::vector<OutputProfile> profiles = AllOutputProfiles();
+  if (name.empty()) return profiles.front();
+  for (auto const & profile : profiles)
+    if (profile.name == name) return profile;
+  throw std::invalid_argument("unknown output profile : " + name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                             ApplyOutputProfile                            //
+///////////////////////////////////////////////////////////////////////////////
+
+void ApplyOutputProfile(const OutputProfile& profile, TFile& file) {
+  if (profile.compression >= 0)
+    file.SetCompressionSettings(profile.compression);
+}
+
+void ApplyOutputProfile(const OutputProfile& profile, TTree& tree) {
+  if (profile.basket_size > 0)
+    tree.SetBasketSize("*", profile.basket_size);
+  // A negative value means bytes instead of entries
+  if (profile.auto_flush_bytes > 0)
+    tree.SetAutoFlush(-profile.auto_flush_bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                          EnableParallelCompression                        //
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned EnableParallelCompression(const OutputProfile& profile, const unsigned n_threads) {
+  if (!profile.parallel_compression || n_threads <= 1) return n_threads;
+#ifdef R__USE_IMT
+  // The pool was enabled by someone else and may be of any size : the
+  // decoder threads are not touched
+  if (ROOT::IsImplicitMTEnabled()) {
+    Log.Write("[wgDecoder] ROOT implicit multi-threading is already enabled with " +
+              std::to_string(ROOT::GetThreadPoolSize()) + " threads : the baskets are "
+              "compressed by the existing pool");
+    return n_threads;
+  }
+  // Half of the thread budget goes to the compression
+  const unsigned n_compression_threads = n_threads / 2;
+  ROOT::EnableImplicitMT(n_compression_threads);
+  Log.Write("[wgDecoder] The baskets are compressed by " +
+            std::to_string(n_compression_threads) + " threads and the raw data is "
+            "decoded by " + std::to_string(n_threads - n_compression_threads) + " threads");
+  return n_threads - n_compression_threads;
+#else
+  Log.Write("[wgDecoder] ROOT was built without implicit multi-threading : "
+            "the baskets are compressed by one thread");
+  return n_threads;
+#endif
+}
@@ -0,0 +1,203 @@
+// system includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderIndex.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                                SpillCounter                               //
+///////////////////////////////////////////////////////////////////////////////
+
+void SpillCounter::Count(const SectionSeeker::Section& section) {
+  // If the raw data was correctly read this is a good spill otherwise
+  // this is a bad spill.
+  if (section.type == SectionSeeker::SectionType::RawData) {
+    if (section.ispill == (unsigned) m_last_spill_count + 1) {
+      ++n_good_spills;
+    } else {
+      n_bad_spills += section.ispill - m_last_spill_count;
+    }
+    m_last_spill_count = section.ispill;
+  } else if (section.type == SectionSeeker::SectionType::ChipTrailer &&
+             m_last_section_type != SectionSeeker::SectionType::RawData) {
+    n_bad_spills += section.ispill - m_last_spill_count;
+    m_last_spill_count = section.ispill;
+  }
+  m_last_section_type = section.type;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                IndexSpills                                //
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<SpillChunk> IndexSpills(RawDataInput& input,
+                                    const RawDataConfig& config,
+                                    unsigned spills_per_chunk,
+                                    SpillCounter& counter,
+                                    unsigned& skipped_lines) {
+  // The chunks are just groups of consecutive spills of the index
+  SpillIndex index = BuildSpillIndex(input, config, counter, skipped_lines);
+  // The spills have already been counted
+  SpillCounter index_counter;
+  return MakeSpillChunks(index, spills_per_chunk, 0, index.entries.size(), index_counter);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                           DecodeSpillsInParallel                          //
+///////////////////////////////////////////////////////////////////////////////
+
+void DecodeSpillsInParallel(const std::string& input_raw_file,
+                            const RawDataConfig& config,
+                            const std::vector<SpillChunk>& chunks,
+                            SectionReader::filler fill,
+                            Raw_t& rd,
+                            unsigned n_threads,
+                            SectionSeeker::Statistics * seeker_statistics) {
+  if (n_threads == 0) n_threads = 1;
+  const std::size_t max_chunks_in_flight = 2 * n_threads;
+
+  // The first chunk must start from the very same Raw_t object
+  // content as the sequential decoder (e.g. calibration data).
+  Raw_t first_rd(rd.n_chips, rd.n_chans);
+  first_rd.copy(rd);
+
+  // Everything below is protected by the mutex
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::vector<std::unique_ptr<Raw_t>>> decoded_spills(chunks.size());
+  std::vector<bool> chunk_is_decoded(chunks.size(), false);
+  std::vector<std::unique_ptr<Raw_t>> free_spills;
+  std::size_t next_chunk = 0, n_written_chunks = 0;
+  bool abort = false;
+  std::exception_ptr error;
+
+  auto worker = [&]() {
+    try {
+      MappedRawDataInput input(input_raw_file);
+      // The SectionReader takes the calibration constants from the
+      // Raw_t object it is constructed with
+      Raw_t worker_rd(rd.n_chips, rd.n_chans);
+      worker_rd.copy(first_rd);
+      SectionSeeker seeker(config);
+      std::vector<std::unique_ptr<Raw_t>> spills;
+      // Every time a spill is read, make a copy of its per-spill data
+      // (only the chips that were written) and store it
+      SectionReader reader(config, [&](Raw_t& spill_rd) {
+          std::unique_ptr<Raw_t> spill;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free_spills.empty()) {
+              spill = std::move(free_spills.back());
+              free_spills.pop_back();
+            }
+          }
+          if (!spill) spill.reset(new Raw_t(rd.n_chips, rd.n_chans));
+          spill->copy_spill(spill_rd);
+          spills.push_back(std::move(spill));
+        }, worker_rd);
+      unsigned skipped_lines = 0;
+
+      while (true) {
+        std::size_t ichunk;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]() {
+              return abort || next_chunk >= chunks.size() ||
+                  next_chunk < n_written_chunks + max_chunks_in_flight; });
+          if (abort || next_chunk >= chunks.size()) break;
+          ichunk = next_chunk++;
+        }
+
+        const SpillChunk& chunk = chunks[ichunk];
+        if (ichunk == 0) worker_rd.copy(first_rd);
+        else worker_rd.clear();
+        seeker.SetState(chunk.seeker_state);
+        reader.SetState(chunk.reader_state);
+        input.seekg(chunk.start);
+        try {
+          while (spills.size() < chunk.n_spills) {
+            SectionSeeker::Section section = seeker.SeekNextSection(input, skipped_lines);
+            reader.ReadNextSection(section);
+          }
+        } catch (const wgEOF& e) {}
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          decoded_spills[ichunk] = std::move(spills);
+          chunk_is_decoded[ichunk] = true;
+        }
+        spills.clear();
+        cv.notify_all();
+      }
+
+      if (seeker_statistics != NULL) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const SectionSeeker::Statistics& statistics = seeker.GetStatistics();
+        for (unsigned type = 0; type < NUM_SECTION_TYPES; ++type)
+          seeker_statistics->n_sections[type] += statistics.n_sections[type];
+        seeker_statistics->n_resyncs += statistics.n_resyncs;
+        seeker_statistics->n_thrown_bytes += statistics.n_thrown_bytes;
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) error = std::current_exception();
+      abort = true;
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned ithread = 0; ithread < n_threads; ++ithread)
+    threads.emplace_back(worker);
+
+  // Only this thread calls the "fill" function. The chunks are written
+  // strictly in order.
+  try {
+    for (std::size_t ichunk = 0; ichunk < chunks.size(); ++ichunk) {
+      std::vector<std::unique_ptr<Raw_t>> spills;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return abort || chunk_is_decoded[ichunk]; });
+        if (abort) break;
+        spills = std::move(decoded_spills[ichunk]);
+      }
+      // The run constants of rd are the same as the ones of the workers
+      for (auto& spill : spills) {
+        rd.copy_spill(*spill);
+        fill(rd);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& spill : spills)
+          free_spills.push_back(std::move(spill));
+        ++n_written_chunks;
+      }
+      cv.notify_all();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error) error = std::current_exception();
+    abort = true;
+    cv.notify_all();
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+  rd.clear();
+  if (error) std::rethrow_exception(error);
+}
@@ -19,25 +19,78 @@ namespace wg_utils = wagasci_decoder_utils;
 ///////////////////////////////////////////////////////////////////////////////
 
 SectionReader::SectionReader(const RawDataConfig& config, TTree* tree, Raw_t& rd):
-    m_config(config), m_tree(tree), m_rd(rd) {
+    SectionReader(config, [tree](Raw_t&) {
+        if (tree->Fill() < 0)
+          throw std::runtime_error("Failed to fill the TTree");
+      }, rd) {
+  if (tree == NULL)
+    throw std::runtime_error("pointer to TTree is NULL");
+}
+
+SectionReader::SectionReader(const RawDataConfig& config, filler fill, Raw_t& rd):
+    m_config(config), m_fill(fill), m_rd(rd) {
     if (m_config.has_spill_number) {
     m_num_marker_types = NUM_SECTION_TYPES - 1;
   } else {
     m_num_marker_types = NUM_SECTION_TYPES - 2;
   }
-    if (m_tree == NULL)
-      throw std::runtime_error("pointer to TTree is NULL");
     InitializeRing();
+    PrecomputeCalibration();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                           PrecomputeCalibration                           //
+///////////////////////////////////////////////////////////////////////////////
+
+void SectionReader::PrecomputeCalibration() {
+  Raw_t& rd = m_rd.get();
+  const std::size_t n_cells = rd.n_chips * NCHANNELS * MEMDEPTH;
+  const std::size_t n_ramps = rd.n_chips * NCHANNELS * 2;
+
+  if (m_config.adc_is_calibrated) {
+    m_pedestal.assign(rd.pedestal.data(), rd.pedestal.data() + n_cells);
+    m_pe_factor[LOW_GAIN_BIT].resize(n_cells);
+    m_pe_factor[HIGH_GAIN_BIT].resize(n_cells);
+    for (std::size_t i = 0; i < n_cells; ++i) {
+      // A channel without a valid gain has a zero factor
+      double inv_gain = rd.gain.data()[i] > 0 ? 1. / rd.gain.data()[i] : 0;
+      m_pe_factor[LOW_GAIN_BIT][i]  = LOW_GAIN_NORM * inv_gain;
+      m_pe_factor[HIGH_GAIN_BIT][i] = HIGH_GAIN_NORM * inv_gain;
+    }
+  }
+
+  if (m_config.tdc_is_calibrated) {
+    m_tdc_intcpt.assign(rd.tdc_intcpt.data(), rd.tdc_intcpt.data() + n_ramps);
+    m_tdc_inv_slope.resize(n_ramps);
+    for (std::size_t i = 0; i < n_ramps; ++i) {
+      // A ramp without a valid slope has a zero inverse slope
+      m_tdc_inv_slope[i] = rd.tdc_slope.data()[i] != 0 ? 1. / rd.tdc_slope.data()[i] : 0;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                            GetState / SetState                            //
+///////////////////////////////////////////////////////////////////////////////
+
+SectionReader::State SectionReader::GetState() const {
+  State state;
+  state.last_spill_number = m_last_spill_number;
+  state.last_spill_count  = m_last_spill_count;
+  return state;
+}
+
+void SectionReader::SetState(const State& state) {
+  m_last_spill_number = state.last_spill_number;
+  m_last_spill_count  = state.last_spill_count;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //                              ReadSpillNumber                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-void SectionReader::ReadSpillNumber(std::istream& is, const SectionSeeker::Section& section) {
-  is.seekg(section.start);
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(section.lines);
-  wg_utils::ReadChunk(is, raw_data);
+void SectionReader::ReadSpillNumber(const SectionSeeker::Section& section) {
+  const RawDataSpan& raw_data = section.data;
   
   // raw_data[0] is the SPILL_NUMBER_MARKER
   m_rd.get().spill_number = raw_data[1].to_ulong();
@@ -61,10 +114,8 @@ void SectionReader::ReadSpillNumber(std::istream& is, const SectionSeeker::Secti
   }
 }
 
-void SectionReader::ReadSpillHeader(std::istream& is, const SectionSeeker::Section& section) {
-  is.seekg(section.start);
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(section.lines);
-  wg_utils::ReadChunk(is, raw_data);
+void SectionReader::ReadSpillHeader(const SectionSeeker::Section& section) {
+  const RawDataSpan& raw_data = section.data;
   // raw_data[0] is the SPILL_HEADER_MARKER
   // Spill count most significant byte
   std::bitset<2*BITS_PER_LINE> spill_count_msb = raw_data[1].to_ulong();
@@ -91,10 +142,8 @@ void SectionReader::ReadSpillHeader(std::istream& is, const SectionSeeker::Secti
 //                               ReadChipHeader                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-void SectionReader::ReadChipHeader(std::istream& is, const SectionSeeker::Section& section) {
-  is.seekg(section.start);
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(section.lines);
-  wg_utils::ReadChunk(is, raw_data);
+void SectionReader::ReadChipHeader(const SectionSeeker::Section& section) {
+  const RawDataSpan& raw_data = section.data;
 
   unsigned chip_counter = (raw_data[1] & x00FF).to_ulong();
   if (chip_counter >= m_config.n_chips || chip_counter != section.ichip + 1) {
@@ -106,10 +155,8 @@ void SectionReader::ReadChipHeader(std::istream& is, const SectionSeeker::Sectio
 //                              ReadChipTrailer                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-void SectionReader::ReadChipTrailer(std::istream& is, const SectionSeeker::Section& section) {
-  is.seekg(section.start);
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(section.lines);
-  wg_utils::ReadChunk(is, raw_data);
+void SectionReader::ReadChipTrailer(const SectionSeeker::Section& section) {
+  const RawDataSpan& raw_data = section.data;
 
   unsigned chip_counter = (raw_data[1] & x00FF).to_ulong();
   if (chip_counter >= m_config.n_chips || chip_counter != section.ichip + 1) {
@@ -121,10 +168,8 @@ void SectionReader::ReadChipTrailer(std::istream& is, const SectionSeeker::Secti
 //                              ReadSpillTrailer                             //
 ///////////////////////////////////////////////////////////////////////////////
 
-void SectionReader::ReadSpillTrailer(std::istream& is, const SectionSeeker::Section& section) {
-  is.seekg(section.start);
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(section.lines);
-  wg_utils::ReadChunk(is, raw_data);
+void SectionReader::ReadSpillTrailer(const SectionSeeker::Section& section) {
+  const RawDataSpan& raw_data = section.data;
 
   // raw_data[0] is the SPILL_TRAILER_MARKER
   // Spill count most significant byte
@@ -166,10 +211,8 @@ void SectionReader::ReadSpillTrailer(std::istream& is, const SectionSeeker::Sect
 //                                ReadRawData                                //
 ///////////////////////////////////////////////////////////////////////////////
 
-void SectionReader::ReadRawData(std::istream& is, const SectionSeeker::Section& section) {
-  is.seekg(section.start);
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(section.lines);
-  wg_utils::ReadChunk(is, raw_data);
+void SectionReader::ReadRawData(const SectionSeeker::Section& section) {
+  const RawDataSpan& raw_data = section.data;
 
   if ((raw_data.size() - m_config.n_chip_id) % ONE_COLUMN_LENGTH != 0)
     throw std::out_of_range("SPIROC2D raw data is off range : " + std::to_string(raw_data.size()));
@@ -182,10 +225,11 @@ void SectionReader::ReadRawData(std::istream& is, const SectionSeeker::Section&
     n_columns = MEMDEPTH;
   }
 
-  std::vector<std::bitset<BITS_PER_LINE>>::reverse_iterator iraw_data = raw_data.rbegin(); 
+  // The raw data is read backwards starting from the last line
+  std::size_t iline = raw_data.size() - 1;
 
   // CHIPID
-  unsigned chipid = (*(iraw_data++) & x00FF).to_ulong();
+  unsigned chipid = (raw_data[iline--] & x00FF).to_ulong();
   if (chipid > m_config.n_chips) {
     Log.eWrite("[wgDecoder] ichip = " + std::to_string(section.ichip) +
                " : Chip ID (" + std::to_string(chipid) +
@@ -193,16 +237,20 @@ void SectionReader::ReadRawData(std::istream& is, const SectionSeeker::Section&
     m_rd.get().debug_chip[section.ichip][DEBUG_WRONG_CHIPID]++;
   }
   for (unsigned counter = 1; counter < m_config.n_chip_id; ++counter) {
-    unsigned duplicate_chipid = (*(iraw_data++) & x00FF).to_ulong();
+    unsigned duplicate_chipid = (raw_data[iline--] & x00FF).to_ulong();
     if (duplicate_chipid != chipid)
       m_rd.get().debug_chip[section.ichip][DEBUG_WRONG_CHIPID]++;
   }
   m_rd.get().chipid[section.ichip] = chipid;
+  // The charge, time, bcid, hit and gs arrays of this chip must be
+  // reset after the spill is filled
+  m_rd.get().mark_dirty(section.ichip, Raw_t::RAW_DATA_ARRAYS);
     
   // BCID
   for (unsigned icol = 0; icol < n_columns; ++icol) {
-    int bcid = (*iraw_data & x0FFF).to_ulong();
-    int loop_bcid = ((*(iraw_data++) & xF000) >> 12).to_ulong();
+    std::bitset<BITS_PER_LINE> raw_data_line = raw_data[iline--];
+    int bcid = (raw_data_line & x0FFF).to_ulong();
+    int loop_bcid = ((raw_data_line & xF000) >> 12).to_ulong();
     int bcid_slope;
     int bcid_inter;
     switch (loop_bcid) {
@@ -220,47 +268,87 @@ void SectionReader::ReadRawData(std::istream& is, const SectionSeeker::Section&
       m_rd.get().debug_chip[section.ichip][DEBUG_WRONG_BCID]++;
   }
 
+  Raw_t& rd = m_rd.get();
+  wg_utils::UnpackedColumn column;
   for (unsigned icol = 0; icol < n_columns; ++icol) {
 
+    // CHARGE, TIME, HIT and GAIN of all the channels. The first line
+    // of the column is the one with the lowest address.
+    std::size_t first_line = iline + 1 - wg_utils::COLUMN_CHANNEL_LINES;
+    wg_utils::UnpackColumn(raw_data.data() + first_line * BYTES_PER_LINE, column);
+    iline -= wg_utils::COLUMN_CHANNEL_LINES;
+
+    rd.debug_chip[section.ichip][DEBUG_WRONG_ADC]       += column.n_wrong_adc;
+    rd.debug_chip[section.ichip][DEBUG_WRONG_TDC]       += column.n_wrong_tdc;
+    rd.debug_chip[section.ichip][DEBUG_WRONG_HIT_BIT]   += column.n_wrong_hit_bit;
+    rd.debug_chip[section.ichip][DEBUG_WRONG_GAIN_BIT]  += column.n_wrong_gain_bit;
+
     for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
-      // CHARGE
-      m_rd.get().charge[section.ichip][ichan][icol] = (*iraw_data & x0FFF).to_ulong();
-      if ((unsigned) m_rd.get().charge[section.ichip][ichan][icol] > MAX_VALUE_12BITS)
-        m_rd.get().debug_chip[section.ichip][DEBUG_WRONG_ADC]++;
+      rd.charge[section.ichip][ichan][icol] = column.charge[ichan];
+      rd.time  [section.ichip][ichan][icol] = column.time[ichan];
       // HIT (0: no hit, 1: hit)
-      m_rd.get().hit[section.ichip][ichan][icol] = (*iraw_data)[12];
+      rd.hit   [section.ichip][ichan][icol] = column.hit[ichan];
       // GAIN (0: low gain, 1: high gain)
-      m_rd.get().gs[section.ichip][ichan][icol] = (*iraw_data)[13];
-      // Only if the detector is already calibrated fithe histograms
-      if (m_config.adc_is_calibrated) {
-        // P.E.
-        unsigned charge = m_rd.get().charge[section.ichip][ichan][icol];
-        unsigned pedestal = m_rd.get().pedestal[m_rd.get().chipid[section.ichip]][ichan][icol];
-        unsigned gain = m_rd.get().gain[m_rd.get().chipid[section.ichip]][ichan][icol];
-        if( m_rd.get().gs[section.ichip][ichan][icol] == HIGH_GAIN_BIT ) { // High Gain
-          m_rd.get().pe[section.ichip][ichan][icol] = HIGH_GAIN_NORM * ( charge - pedestal ) / gain;
-        } else { // Low Gain
-          m_rd.get().pe[section.ichip][ichan][icol] = LOW_GAIN_NORM * ( charge - pedestal ) / gain;
-        }
-      }
-      ++iraw_data;
+      rd.gs    [section.ichip][ichan][icol] = column.gs[ichan];
     }
+  }
+
+  // P.E. and TDC calibration of the whole chip at once
+  CalibrateChip(section.ichip, n_columns);
+}
 
+///////////////////////////////////////////////////////////////////////////////
+//                               CalibrateChip                               //
+///////////////////////////////////////////////////////////////////////////////
+
+void SectionReader::CalibrateChip(unsigned ichip, unsigned n_columns) {
+  Raw_t& rd = m_rd.get();
+  // The calibration constants are stored by chip ID, the data by chip
+  // counter. An invalid chip ID has already been counted as an error.
+  unsigned chipid = rd.chipid[ichip];
+  if (chipid >= (unsigned) rd.n_chips) return;
+
+  const std::size_t data_offset  = ichip  * NCHANNELS * MEMDEPTH;
+  const std::size_t calib_offset = chipid * NCHANNELS * MEMDEPTH;
+
+  // P.E. = NORM * (charge - pedestal) / gain
+  // where NORM depends on the gain bit (high or low gain)
+  if (m_config.adc_is_calibrated) {
+    rd.mark_dirty(ichip, Raw_t::PE_ARRAY);
+    const int * charge = rd.charge.data() + data_offset;
+    const int * gs = rd.gs.data() + data_offset;
+    double * pe = rd.pe.data() + data_offset;
+    const double * pedestal = m_pedestal.data() + calib_offset;
+    const double * low_factor = m_pe_factor[LOW_GAIN_BIT].data() + calib_offset;
+    const double * high_factor = m_pe_factor[HIGH_GAIN_BIT].data() + calib_offset;
     for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
-      // TIME
-      m_rd.get().time[section.ichip][ichan][icol] = (*iraw_data & x0FFF).to_ulong();
-      if ((unsigned) m_rd.get().time[section.ichip][ichan][icol] > MAX_VALUE_12BITS)
-        m_rd.get().debug_chip[section.ichip][DEBUG_WRONG_TDC]++;
-      if (m_config.tdc_is_calibrated) {
-        ;// TODO: TDC calibration
-      }
-      if (m_rd.get().hit[section.ichip][ichan][icol] != (*iraw_data)[12]) {
-        m_rd.get().debug_chip[section.ichip][DEBUG_WRONG_HIT_BIT]++;
+      const std::size_t row = ichan * MEMDEPTH;
+      for (unsigned icol = 0; icol < n_columns; ++icol) {
+        const std::size_t i = row + icol;
+        const double factor = gs[i] == (int) HIGH_GAIN_BIT ? high_factor[i] : low_factor[i];
+        pe[i] = factor != 0 ? (charge[i] - pedestal[i]) * factor : -1;
       }
-      if (m_rd.get().gs[section.ichip][ichan][icol] != (*iraw_data)[13]) {
-        m_rd.get().debug_chip[section.ichip][DEBUG_WRONG_GAIN_BIT]++;
+    }
+  }
+
+  // TIME_NS = (time - intercept) / slope
+  // where the slope and the intercept depend on the TDC ramp (even or
+  // odd BCID)
+  if (m_config.tdc_is_calibrated) {
+    rd.mark_dirty(ichip, Raw_t::TIME_NS_ARRAY);
+    const int * time = rd.time.data() + data_offset;
+    const int * bcid = rd.bcid.data() + ichip * MEMDEPTH;
+    double * time_ns = rd.time_ns.data() + data_offset;
+    const double * intcpt = m_tdc_intcpt.data() + chipid * NCHANNELS * 2;
+    const double * inv_slope = m_tdc_inv_slope.data() + chipid * NCHANNELS * 2;
+    for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
+      const std::size_t row = ichan * MEMDEPTH;
+      for (unsigned icol = 0; icol < n_columns; ++icol) {
+        const std::size_t i = row + icol;
+        const unsigned ramp = bcid[icol] % 2 == 0 ? TDC_RAMP_EVEN : TDC_RAMP_ODD;
+        const double factor = inv_slope[ichan * 2 + ramp];
+        time_ns[i] = factor != 0 ? (time[i] - intcpt[ichan * 2 + ramp]) * factor : -1;
       }
-      ++iraw_data;
     }
   }
 }
@@ -269,7 +357,7 @@ void SectionReader::ReadRawData(std::istream& is, const SectionSeeker::Section&
 //                              ReadNextSection                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-void SectionReader::ReadNextSection(std::istream& is, const SectionSeeker::Section& section) {
+void SectionReader::ReadNextSection(const SectionSeeker::Section& section) {
   if (section.ichip >= m_config.n_chips) {
     m_rd.get().debug_spill[DEBUG_WRONG_NCHIPS]++;
     Log.eWrite("[wgDecoder] Spill " + std::to_string(section.ispill) +
@@ -278,7 +366,7 @@ void SectionReader::ReadNextSection(std::istream& is, const SectionSeeker::Secti
                std::to_string(m_config.n_chips) );
     return;
   }
-  m_readers_ring[section.type](is, section);
+  m_readers_ring[section.type](section);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -286,8 +374,7 @@ void SectionReader::ReadNextSection(std::istream& is, const SectionSeeker::Secti
 ///////////////////////////////////////////////////////////////////////////////
 
 void SectionReader::FillTree() {
-  if (m_tree->Fill() < 0)
-    throw std::runtime_error("Failed to fill the TTree");
+  m_fill(m_rd.get());
   this->m_rd.get().clear();
 }
 
@@ -296,11 +383,11 @@ void SectionReader::FillTree() {
 ///////////////////////////////////////////////////////////////////////////////
 
 void SectionReader::InitializeRing() {
-  m_readers_ring[SectionSeeker::SectionType::SpillHeader]  = [this](std::istream& is, const SectionSeeker::Section section) { return this->ReadSpillHeader(is, section); };
-  m_readers_ring[SectionSeeker::SectionType::ChipHeader]   = [this](std::istream& is, const SectionSeeker::Section section) { return this->ReadChipHeader(is, section); };
-  m_readers_ring[SectionSeeker::SectionType::RawData]      = [this](std::istream& is, const SectionSeeker::Section section) { return this->ReadRawData(is, section); };
-  m_readers_ring[SectionSeeker::SectionType::ChipTrailer]  = [this](std::istream& is, const SectionSeeker::Section section) { return this->ReadChipTrailer(is, section); };
-  m_readers_ring[SectionSeeker::SectionType::SpillTrailer] = [this](std::istream& is, const SectionSeeker::Section section) { return this->ReadSpillTrailer(is, section); };
+  m_readers_ring[SectionSeeker::SectionType::SpillHeader]  = [this](const SectionSeeker::Section& section) { return this->ReadSpillHeader(section); };
+  m_readers_ring[SectionSeeker::SectionType::ChipHeader]   = [this](const SectionSeeker::Section& section) { return this->ReadChipHeader(section); };
+  m_readers_ring[SectionSeeker::SectionType::RawData]      = [this](const SectionSeeker::Section& section) { return this->ReadRawData(section); };
+  m_readers_ring[SectionSeeker::SectionType::ChipTrailer]  = [this](const SectionSeeker::Section& section) { return this->ReadChipTrailer(section); };
+  m_readers_ring[SectionSeeker::SectionType::SpillTrailer] = [this](const SectionSeeker::Section& section) { return this->ReadSpillTrailer(section); };
   if (m_config.has_spill_number)
-    m_readers_ring[SectionSeeker::SectionType::SpillNumber]  = [this](std::istream& is, const SectionSeeker::Section section) { return this->ReadSpillNumber(is, section); };
+    m_readers_ring[SectionSeeker::SectionType::SpillNumber]  = [this](const SectionSeeker::Section& section) { return this->ReadSpillNumber(section); };
 }
@@ -0,0 +1,1004 @@
+// system C++ includes
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+
+// system C includes
+#include <cstdio>
+
+// ROOT includes
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TParameter.h"
+
+// user includes
+#include "wgConst.hpp"
+#include "wgFileSystemTools.hpp"
+#include "wgErrorCodes.hpp"
+#include "wgExceptions.hpp"
+#include "wgEditXML.hpp"
+#include "wgGetCalibData.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoder.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderCompressed.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderIndex.hpp"
+#include "wgDecoderFollow.hpp"
+#include "wgDecoderOutput.hpp"
+#include "wgDecoderStats.hpp"
+#include "wgColumns.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderRun.hpp"
+#include "wgLogger.hpp"
+
+using namespace wagasci_tools;
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Pyrame log                                //
+///////////////////////////////////////////////////////////////////////////////
+
+std::string GetPyrameLogFile(const std::string& input_raw_file) {
+  std::string pyrame_log_file = get_stats::basename(input_raw_file);
+  std::size_t pos = pyrame_log_file.rfind("_ecal_dif_");
+  return get_stats::dirname(input_raw_file) + "/" +
+      pyrame_log_file.substr(0, pos) + ".log";
+}
+
+PyrameLog ReadPyrameLog(const std::string& pyrame_log_file) {
+  PyrameLog pyrame_log;
+  if (!check_exist::log_file(pyrame_log_file)) {
+    Log.eWrite("[wgDecoder]  Pyrame log file : " + pyrame_log_file +
+               " doesn't exist!");
+    return pyrame_log;
+  }
+  // Will be filled with  v[0]: start_time,   v[1]: stop_time,
+  //                      v[2]: nb_data_pkts, v[3]: nb_lost_pkts
+  std::vector<std::string> v_log;
+  wgEditXML edit;
+  edit.GetLog(pyrame_log_file, v_log);
+  try {
+    pyrame_log.start_time   = datetime::datetime_to_seconds(v_log[0]);
+    pyrame_log.stop_time    = datetime::datetime_to_seconds(v_log[1]);
+    pyrame_log.nb_data_pkts = std::stoi(v_log[2]);
+    pyrame_log.nb_lost_pkts = std::stoi(v_log[3]);
+  } catch (const std::logic_error& e) {
+    // The log file is still being written by Pyrame
+    Log.eWrite("[wgDecoder]  Pyrame log file : " + pyrame_log_file +
+               " is incomplete!");
+    return PyrameLog();
+  }
+  pyrame_log.found = true;
+  return pyrame_log;
+}
+
+bool PyrameLogIsClosed(const std::string& pyrame_log_file) {
+  if (!check_exist::log_file(pyrame_log_file))
+    return false;
+  std::vector<std::string> v_log;
+  wgEditXML edit;
+  edit.GetLog(pyrame_log_file, v_log);
+  return datetime::datetime_to_seconds(v_log[1]) != -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                             LoadDifCalibration                            //
+///////////////////////////////////////////////////////////////////////////////
+
+void LoadDifCalibration(DifCalibration& calib, const unsigned n_chips) {
+  calib.n_chips = n_chips;
+  calib.pedestal_is_calibrated = false;
+  calib.gain_is_calibrated = false;
+  calib.tdc_is_calibrated = false;
+
+  std::unique_ptr<wgGetCalibData> cards;
+  try {
+    cards.reset(new wgGetCalibData(calib.calibration_dir, calib.dif));
+  } catch (const std::exception & e ) {
+    Log.Write("[wgDecoder] detector is not calibrated yet : " + std::string(e.what()));
+    return;
+  }
+
+  d3CCvector pedestal  (n_chips, NCHANNELS, MEMDEPTH);
+  d3CCvector gain      (n_chips, NCHANNELS, MEMDEPTH);
+  d3CCvector tdc_slope (n_chips, NCHANNELS, 2);
+  d3CCvector tdc_intcpt(n_chips, NCHANNELS, 2);
+  const std::size_t n_cells = n_chips * NCHANNELS * MEMDEPTH;
+  const std::size_t n_ramps = n_chips * NCHANNELS * 2;
+
+  try {
+    if ((calib.pedestal_is_calibrated = cards->isPedestalCalibrated())) {
+      cards->GetPedestal(calib.dif, pedestal);
+      calib.pedestal.assign(pedestal.data(), pedestal.data() + n_cells);
+    }
+  } catch (const std::exception & e ) {
+    calib.pedestal_is_calibrated = false;
+    Log.Write("[wgDecoder] pedestal is not calibrated yet : " + std::string(e.what()));
+  }
+  try {
+    if ((calib.gain_is_calibrated = cards->isGainCalibrated())) {
+      cards->GetGain(calib.dif, gain);
+      calib.gain.assign(gain.data(), gain.data() + n_cells);
+    }
+  } catch (const std::exception & e ) {
+    calib.gain_is_calibrated = false;
+    Log.Write("[wgDecoder] ADC is not calibrated yet : " + std::string(e.what()));
+  }
+  try {
+    if ((calib.tdc_is_calibrated = cards->isTDCCalibrated())) {
+      cards->GetTDC(calib.dif, tdc_slope, tdc_intcpt);
+      calib.tdc_slope.assign(tdc_slope.data(), tdc_slope.data() + n_ramps);
+      calib.tdc_intcpt.assign(tdc_intcpt.data(), tdc_intcpt.data() + n_ramps);
+    }
+  } catch (const std::exception & e ) {
+    calib.tdc_is_calibrated = false;
+    Log.Write("[wgDecoder] TDC is not calibrated yet : " + std::string(e.what()));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               DecodeDifFile                               //
+///////////////////////////////////////////////////////////////////////////////
+
+int DecodeDifFile(const std::string& input_raw_file,
+                  const std::string& output_file_path,
+                  const unsigned dif,
+                  unsigned n_chips,
+                  DifCalibration * calib,
+                  const PyrameLog& pyrame_log,
+                  const DecoderOptions& options,
+                  const FusedHistOptions * fused_hist) {
+
+  // The performance counters of the run report
+  DecoderStats stats;
+  const DecoderStats::clock::time_point start_time = DecoderStats::clock::now();
+  DecoderStats::clock::time_point time = start_time;
+
+  // ============ Options ============ //
+
+  // The number of threads and the spill index may be changed below
+  // depending on the raw file
+  unsigned n_threads = options.n_threads;
+  bool write_index = options.write_index;
+  OutputProfile output_profile;
+  try {
+    output_profile = GetOutputProfile(options.output_profile);
+  } catch (const std::invalid_argument& e) {
+    Log.eWrite("[wgDecoder] " + std::string(e.what()));
+    return ERR_WRONG_MODE;
+  }
+  // The run report and the columnar export are written next to the
+  // output file
+  const std::string output_name = get_stats::dirname(output_file_path) + "/" +
+                                  RawFileBasename(input_raw_file);
+  const std::string report_file = options.write_report ? output_name + "_report.json" : "";
+  const std::string columns_dir = options.write_columns ? output_name + "_columns" : "";
+
+  // ============ Open the raw file ============ //
+
+  // Regular files are memory-mapped. Everything else (pipes, etc...)
+  // is read through a buffered stream. The same input is used to probe
+  // the raw data format and to decode it. In follow mode the raw file
+  // is mapped again every time it grows by the RawFileFollower.
+  std::unique_ptr<RawDataInput> input;
+  std::unique_ptr<RawFileFollower> follower;
+  try {
+    if (options.follow) {
+      // Following always stops when the acquisition is over, that is
+      // when the stop time is written into the Pyrame log file
+      FollowOptions follow;
+      follow.stop_file = options.stop_file;
+      follow.idle_timeout = options.idle_timeout;
+      follow.pyrame_log_file = GetPyrameLogFile(input_raw_file);
+      follower.reset(new RawFileFollower(input_raw_file, follow));
+    }
+    else
+      input = OpenRawDataInput(input_raw_file);
+  } catch (const wgInvalidFile& e) {
+    Log.eWrite("[wgDecoder] Failed to open raw file: " + std::string(e.what()));
+    return ERR_FAILED_OPEN_RAW_FILE;
+  }
+
+  // ============ Spill index ============ //
+
+  // If the spill index is available the raw file does not need to be
+  // probed. The index is never used nor written in compatibility
+  // mode because it would not know about the forced CHIP ID fields,
+  // nor in follow mode because the raw file is still growing. Pipes
+  // and compressed raw files cannot be read out of order, so their
+  // index would be useless.
+  SpillIndex index;
+  bool has_index = false;
+  if (options.compatibility_mode || follower) {
+    write_index = false;
+  } else if (dynamic_cast<MappedRawDataInput*>(input.get()) == NULL) {
+    has_index = false;
+  } else if ((has_index = ReadSpillIndex(input_raw_file, index)) &&
+             n_chips != 0 && n_chips != index.n_chips) {
+    Log.Write("[wgDecoder] The spill index was built for " + std::to_string(index.n_chips) +
+              " chips : ignoring it");
+    has_index = false;
+  }
+
+  // ============ Raw data format ============ //
+
+  // Otherwise the beginning of the raw file is read only once to guess
+  // the raw data format (in follow mode, after waiting for enough
+  // data). A corrupted compressed file may already fail here.
+  std::unique_ptr<const RawDataConfig> probed_format;
+  try {
+    probed_format.reset(new RawDataConfig(has_index ? index.GetConfig() :
+                                          follower ? follower->WaitForFormat() :
+                                          wagasci_decoder_utils::ProbeRawData(*input)));
+  } catch (const wgInvalidFile& e) {
+    Log.eWrite("[wgDecoder] Failed to read raw file: " + std::string(e.what()));
+    return ERR_FAILED_OPEN_RAW_FILE;
+  }
+  const RawDataConfig& format = *probed_format;
+  stats.AddTime(STAGE_PROBE, time);
+
+  // ============ n_chips ============ //
+
+  if (n_chips == 0) n_chips = format.n_chips;
+  if (n_chips == 0 || n_chips > NCHIPS) {
+    Log.eWrite("[wgDecoder] The number of chips per DIF must be {1-"
+               + std::to_string(NCHIPS) + "}");
+    return ERR_WRONG_CHIP_VALUE;
+  }
+
+  // ===================================================================== //
+  //                  Allocate the raw data Raw_t class                    //
+  // ===================================================================== //
+
+  Raw_t rd(n_chips);
+
+  // ===================================================================== //
+  //                        Get calibration data                           //
+  // ===================================================================== //
+
+  // The value of pedestal, TDC ramp and gain are usually already
+  // loaded from the calibration files
+  bool pedestal_is_calibrated = false;
+  bool gain_is_calibrated = false;
+  bool adc_is_calibrated = false;
+  bool tdc_is_calibrated = false;
+  if (calib != NULL) {
+    if (calib->n_chips != n_chips)
+      LoadDifCalibration(*calib, n_chips);
+    if ((pedestal_is_calibrated = calib->pedestal_is_calibrated))
+      std::copy(calib->pedestal.begin(), calib->pedestal.end(), rd.pedestal.data());
+    if ((gain_is_calibrated = calib->gain_is_calibrated))
+      std::copy(calib->gain.begin(), calib->gain.end(), rd.gain.data());
+    if ((tdc_is_calibrated = calib->tdc_is_calibrated)) {
+      std::copy(calib->tdc_slope.begin(), calib->tdc_slope.end(), rd.tdc_slope.data());
+      std::copy(calib->tdc_intcpt.begin(), calib->tdc_intcpt.end(), rd.tdc_intcpt.data());
+    }
+  }
+  adc_is_calibrated = pedestal_is_calibrated && gain_is_calibrated;
+
+  // ===================================================================== //
+  //                       Create the columnar export                      //
+  // ===================================================================== //
+
+  // The columns are bound to the rd arrays exactly like the TTree
+  // branches
+  std::unique_ptr<ColumnWriter> columns;
+  if (!columns_dir.empty()) {
+    try {
+      columns.reset(new ColumnWriter(columns_dir, options.overwrite));
+      AddRawDataColumns(*columns, rd, adc_is_calibrated, tdc_is_calibrated);
+      columns->SetAttribute("dif", dif);
+    } catch (const wgInvalidFile& e) {
+      Log.eWrite("[wgDecoder] Failed to create the columnar export : " + std::string(e.what()));
+      return ERR_FAILED_CREATE_DIRECTORY;
+    }
+  }
+
+  // ===================================================================== //
+  //                         Create the output file                        //
+  // ===================================================================== //
+
+  // In fused mode the TTree can be skipped altogether : it is created
+  // (so that the rest of the code does not change) but never filled
+  // and the output file is not created.
+  const bool write_tree = fused_hist == NULL || options.write_tree;
+  TFile * output_file = NULL;
+  TString output_file_tpath(output_file_path);
+  if (write_tree) {
+    if (!options.overwrite) {
+      if (check_exist::root_file(output_file_tpath)) {
+        Log.eWrite("[wgDecoder] Error:" + output_file_path + " already exists!");
+        return ERR_OVERWRITE_FLAG_NOT_SET;
+      }
+      output_file = new TFile(output_file_tpath, "create");
+    } else {
+      output_file = new TFile(output_file_tpath, "recreate");
+    }
+    if (output_file->IsZombie()) {
+      Log.eWrite("[wgDecoder] Error: failed to create " + output_file_path);
+      delete output_file;
+      return ERR_FAILED_OPEN_TREE_FILE;
+    }
+    ApplyOutputProfile(output_profile, *output_file);
+  }
+
+  // ===================================================================== //
+  //                  Create the histograms (fused mode)                   //
+  // ===================================================================== //
+
+  std::unique_ptr<TFile> output_hist_file;
+  std::unique_ptr<MakeHist> make_hist;
+  if (fused_hist != NULL) {
+    output_hist_file.reset(new TFile(fused_hist->output_hist_file.c_str(),
+                                     fused_hist->flags[makehist::OVERWRITE] ?
+                                     "recreate" : "create"));
+    if (!output_hist_file->IsOpen()) {
+      Log.eWrite("[wgDecoder] Failed to create output hist file : " +
+                 fused_hist->output_hist_file);
+      if (output_file != NULL) {
+        output_file->Close();
+        delete output_file;
+      }
+      return ERR_FAILED_OPEN_HIST_FILE;
+    }
+    make_hist.reset(new MakeHist(fused_hist->flags, dif, fused_hist->chip_map,
+                                 output_hist_file.get()));
+    if (output_file != NULL) output_file->cd();
+  }
+
+  // ===================================================================== //
+  //                      Create TTree branches                            //
+  // ===================================================================== //
+
+  TString tree_name("tree_dif_" + std::to_string(dif));
+  TString tree_title("ROOT tree containing decoded data : DIF " + std::to_string(dif));
+  TTree * tree = new TTree(tree_name, tree_title);
+
+  tree->SetDirectory(output_file);
+
+  // The hit list is used only in sparse output mode
+  std::unique_ptr<Hits_t> hits;
+
+  if (!options.sparse_output) {
+    tree->Branch("spill_number",&rd.spill_number     ,"spill_number/I"                                               );
+    tree->Branch("spill_mode"  ,&rd.spill_mode       ,"spill_mode/I"                                                 );
+    tree->Branch("spill_count" ,&rd.spill_count      ,"spill_count/I"                                                );
+
+    tree->Branch("chipid"      ,rd.chipid.data()     ,Form("chipid[%d]/I"             ,n_chips                      ));
+    tree->Branch("chanid"      ,rd.chanid.data()     ,Form("chanid[%d]/I"             ,         NCHANNELS           ));
+    tree->Branch("colid"       ,rd.colid.data()      ,Form("colid[%d]/I"              ,                    MEMDEPTH ));
+
+    tree->Branch("charge"      ,rd.charge.data()     ,Form("charge[%d][%d][%d]/I"     ,n_chips, NCHANNELS, MEMDEPTH ));
+    tree->Branch("time"        ,rd.time.data()       ,Form("time[%d][%d][%d]/I"       ,n_chips, NCHANNELS, MEMDEPTH ));
+    tree->Branch("bcid"        ,rd.bcid.data()       ,Form("bcid[%d][%d]/I"           ,n_chips,            MEMDEPTH ));
+    tree->Branch("hit"         ,rd.hit.data()        ,Form("hit[%d][%d][%d]/I"        ,n_chips, NCHANNELS, MEMDEPTH ));
+    tree->Branch("gs"          ,rd.gs.data()         ,Form("gs[%d][%d][%d]/I"         ,n_chips, NCHANNELS, MEMDEPTH ));
+
+    tree->Branch("debug_chip"  ,rd.debug_chip.data() ,Form("debug_chip[%d][%d]/I"     ,n_chips, N_DEBUG_CHIP        ));
+    tree->Branch("debug_spill" ,rd.debug_spill.data(),Form("debug_spill[%d]/I"        ,N_DEBUG_SPILL                ));
+
+    if (adc_is_calibrated) {
+      tree->Branch("view"      ,&rd.view             ,"view/I"                                                       );
+      tree->Branch("pln"       ,rd.pln.data()        ,Form("pln[%d][%d]/I"            ,n_chips, NCHANNELS           ));
+      tree->Branch("chan"      ,rd.chan.data()       ,Form("chan[%d][%d]/I"           ,n_chips, NCHANNELS           ));
+      tree->Branch("grid"      ,rd.grid.data()       ,Form("grid[%d][%d]/I"           ,n_chips, NCHANNELS           ));
+      tree->Branch("x"         ,rd.x.data()          ,Form("x[%d][%d]/D"              ,n_chips, NCHANNELS           ));
+      tree->Branch("y"         ,rd.y.data()          ,Form("y[%d][%d]/D"              ,n_chips, NCHANNELS           ));
+      tree->Branch("z"         ,rd.z.data()          ,Form("z[%d][%d]/D"              ,n_chips, NCHANNELS           ));
+
+      tree->Branch("pedestal"  ,rd.pedestal.data()   ,Form("pedestal[%d][%d][%d]/D"   ,n_chips, NCHANNELS, MEMDEPTH ));
+      tree->Branch("pe"        ,rd.pe.data()         ,Form("pe[%d][%d][%d]/D"         ,n_chips, NCHANNELS, MEMDEPTH ));
+      tree->Branch("gain"      ,rd.gain.data()       ,Form("gain[%d][%d][%d]/D"       ,n_chips, NCHANNELS, MEMDEPTH ));
+    }
+    if (tdc_is_calibrated) {
+      tree->Branch("time_ns"   ,rd.time_ns.data()    ,Form("time_ns[%d][%d][%d]/D"    ,n_chips, NCHANNELS, MEMDEPTH ));
+      tree->Branch("tdc_slope" ,rd.tdc_slope.data()  ,Form("tdc_slope[%d][%d][%d]/D"  ,n_chips, NCHANNELS, 2        ));
+      tree->Branch("tdc_intcpt",rd.tdc_intcpt.data() ,Form("tdc_intcpt[%d][%d][%d]/D" ,n_chips, NCHANNELS, 2        ));
+    }
+  } else {
+    hits.reset(new Hits_t(n_chips));
+    tree->Branch("spill_number",&rd.spill_number       ,"spill_number/I"                             );
+    tree->Branch("spill_mode"  ,&rd.spill_mode         ,"spill_mode/I"                               );
+    tree->Branch("spill_count" ,&rd.spill_count        ,"spill_count/I"                              );
+    tree->Branch("chipid"      ,rd.chipid.data()       ,Form("chipid[%d]/I"        ,n_chips         ));
+
+    tree->Branch("n_hits"      ,&hits->n_hits          ,"n_hits/I"                                   );
+    tree->Branch("hit_chip"    ,hits->chip.data()      ,"hit_chip[n_hits]/I"                         );
+    tree->Branch("hit_chan"    ,hits->chan.data()      ,"hit_chan[n_hits]/I"                         );
+    tree->Branch("hit_col"     ,hits->col.data()       ,"hit_col[n_hits]/I"                          );
+    tree->Branch("hit_bcid"    ,hits->bcid.data()      ,"hit_bcid[n_hits]/I"                         );
+    tree->Branch("hit_charge"  ,hits->charge.data()    ,"hit_charge[n_hits]/I"                       );
+    tree->Branch("hit_time"    ,hits->time.data()      ,"hit_time[n_hits]/I"                         );
+    tree->Branch("hit_gs"      ,hits->gs.data()        ,"hit_gs[n_hits]/I"                           );
+    if (adc_is_calibrated)
+      tree->Branch("hit_pe"    ,hits->pe.data()        ,"hit_pe[n_hits]/D"                           );
+    if (tdc_is_calibrated)
+      tree->Branch("hit_time_ns",hits->time_ns.data()  ,"hit_time_ns[n_hits]/D"                      );
+
+    tree->Branch("debug_chip"  ,rd.debug_chip.data()   ,Form("debug_chip[%d][%d]/I",n_chips, N_DEBUG_CHIP));
+    tree->Branch("debug_spill" ,rd.debug_spill.data()  ,Form("debug_spill[%d]/I"   ,N_DEBUG_SPILL   ));
+
+    // The calibration constants are the same for every spill so they
+    // are written only once in the "calib_dif_<N>" TTree
+    if (output_file != NULL && (adc_is_calibrated || tdc_is_calibrated)) {
+      TString calib_tree_name("calib_dif_" + std::to_string(dif));
+      TString calib_tree_title("Calibration constants used by the decoder : DIF " + std::to_string(dif));
+      TTree * calib_tree = new TTree(calib_tree_name, calib_tree_title);
+      calib_tree->SetDirectory(output_file);
+      if (adc_is_calibrated) {
+        calib_tree->Branch("pedestal"  ,rd.pedestal.data()  ,Form("pedestal[%d][%d][%d]/D"  ,n_chips, NCHANNELS, MEMDEPTH));
+        calib_tree->Branch("gain"      ,rd.gain.data()      ,Form("gain[%d][%d][%d]/D"      ,n_chips, NCHANNELS, MEMDEPTH));
+      }
+      if (tdc_is_calibrated) {
+        calib_tree->Branch("tdc_slope" ,rd.tdc_slope.data() ,Form("tdc_slope[%d][%d][%d]/D" ,n_chips, NCHANNELS, 2       ));
+        calib_tree->Branch("tdc_intcpt",rd.tdc_intcpt.data(),Form("tdc_intcpt[%d][%d][%d]/D",n_chips, NCHANNELS, 2       ));
+      }
+      calib_tree->Fill();
+      calib_tree->Write();
+    }
+  }
+
+  ApplyOutputProfile(output_profile, *tree);
+
+  // Called every time a whole spill has been decoded into rd. A
+  // TTree::Fill call that writes some baskets to the file is counted as
+  // a flush.
+  SectionReader::filler fill = [tree, &hits, &make_hist, &columns, &stats,
+                                 write_tree](Raw_t& spill_rd) {
+    stats.CountSpill(spill_rd);
+    DecoderStats::clock::time_point fill_time = DecoderStats::clock::now();
+    if (make_hist) {
+      make_hist->Fill(spill_rd);
+      fill_time = stats.AddTime(STAGE_HIST, fill_time);
+    }
+    if (columns) {
+      columns->Fill();
+      fill_time = stats.AddTime(STAGE_FILL, fill_time);
+    }
+    if (!write_tree) return;
+    if (hits) hits->FromRaw(spill_rd);
+    const Long64_t zip_bytes = tree->GetZipBytes();
+    if (tree->Fill() < 0)
+      throw std::runtime_error("Failed to fill the TTree");
+    if (tree->GetZipBytes() != zip_bytes) {
+      stats.AddTime(STAGE_FLUSH, fill_time);
+      ++stats.n_flushes;
+    } else {
+      stats.AddTime(STAGE_FILL, fill_time);
+    }
+  };
+
+  // ===================================================================== //
+  //                Allocate the RawDataConfig class object                //
+  // ===================================================================== //
+
+  RawDataConfig config(n_chips,
+                       NCHANNELS,
+                       options.compatibility_mode ? 1 : format.n_chip_id,
+                       format.has_spill_number,
+                       format.has_phantom_menace,
+                       adc_is_calibrated,
+                       tdc_is_calibrated);
+
+  // ===================================================================== //
+  //     ============================================================      //
+  //                          READ THE RAW FILE                            //
+  //     ============================================================      //
+  // ===================================================================== //
+
+  // Only memory-mapped files can be decoded by more than one thread,
+  // indexed or decoded in part. A growing file is always decoded from
+  // start to end by a single thread.
+  bool partial = options.first_spill > 0 || options.last_spill >= 0;
+  if (follower) {
+    if (partial)
+      Log.Write("[wgDecoder] Follow mode : decoding all the spills");
+    if (n_threads > 1)
+      Log.Write("[wgDecoder] Follow mode : using only one thread");
+    n_threads = 1;
+    partial = false;
+  } else if (dynamic_cast<MappedRawDataInput*>(input.get()) == NULL) {
+    if (partial) {
+      Log.eWrite("[wgDecoder] The input cannot be memory-mapped : cannot decode a range of spills");
+      if (output_file != NULL) {
+        output_file->Close();
+        delete output_file;
+      }
+      return ERR_FAILED_OPEN_RAW_FILE;
+    }
+    if (n_threads > 1)
+      Log.Write("[wgDecoder] The input cannot be memory-mapped : using only one thread");
+    if (write_index)
+      Log.Write("[wgDecoder] The input cannot be memory-mapped : the spill index is not written");
+    n_threads = 1;
+    write_index = false;
+  }
+
+  SpillCounter spill_counter;
+  unsigned skipped_lines = 0;
+  int result = WG_SUCCESS;
+
+  // ============ Build the spill index ============ //
+
+  // The index is built in a first pass that only seeks the sections,
+  // if it is needed and not already available
+  time = DecoderStats::clock::now();
+  if (!has_index && (write_index || partial || n_threads > 1)) {
+    SpillCounter index_counter;
+    unsigned index_skipped_lines = 0;
+    index = BuildSpillIndex(*input, config, index_counter, index_skipped_lines);
+    has_index = true;
+    input->seekg(0);
+  }
+  if (write_index) {
+    try {
+      WriteSpillIndex(input_raw_file, index);
+      Log.Write("[wgDecoder] Spill index written : " + SpillIndexPath(input_raw_file));
+    } catch (const wgInvalidFile& e) {
+      Log.eWrite("[wgDecoder] Failed to write the spill index : " + std::string(e.what()));
+    }
+  }
+  time = stats.AddTime(STAGE_INDEX, time);
+
+  if (follower) {
+
+    // ============ Follow the growing raw file ============ //
+
+    Log.Write("[wgDecoder] DIF " + std::to_string(dif) + " : following " + input_raw_file);
+    try {
+      follower->Follow(config, fill, rd, spill_counter, skipped_lines,
+                       [tree, &stats, write_tree]() {
+                         if (!write_tree) return;
+                         DecoderStats::clock::time_point save_time = DecoderStats::clock::now();
+                         tree->AutoSave("SaveSelf");
+                         stats.AddTime(STAGE_FLUSH, save_time);
+                       }, &stats);
+    } catch (const std::exception& e) {
+      Log.eWrite("[wgDecoder] Error while reading raw data : " +
+                 std::string(e.what()));
+      result = ERR_WG_DECODER;
+    }
+  } else if (n_threads > 1 || partial) {
+
+    // ============ Decode the spills in parallel ============ //
+
+    std::size_t first_entry = options.first_spill;
+    std::size_t end_entry = options.last_spill < 0 ? index.entries.size() :
+                            options.last_spill + 1;
+    Log.Write("[wgDecoder] DIF " + std::to_string(dif) + " : decoding spills " +
+              std::to_string(first_entry) + " - " +
+              std::to_string(std::min(end_entry, index.entries.size())) + " of " +
+              std::to_string(index.entries.size()) + " with " +
+              std::to_string(n_threads) + " threads");
+    if (first_entry == 0 && end_entry >= index.entries.size())
+      skipped_lines = index.skipped_lines;
+    if (first_entry >= index.entries.size()) {
+      Log.eWrite("[wgDecoder] DIF " + std::to_string(dif) + " : spill " +
+                 std::to_string(first_entry) + " not found");
+      result = ERR_WG_DECODER;
+    } else try {
+      std::vector<SpillChunk> chunks = MakeSpillChunks(index, SPILLS_PER_CHUNK, first_entry,
+                                                       end_entry, spill_counter);
+      for (std::size_t ientry = first_entry;
+           ientry < std::min(end_entry, index.entries.size()); ++ientry)
+        stats.bytes_read += index.entries[ientry].length;
+      const double fill_seconds = stats.FillSeconds();
+      DecodeSpillsInParallel(input_raw_file, config, chunks, fill, rd, n_threads,
+                             &stats.seeker);
+      stats.AddTime(STAGE_DECODE, time);
+      stats.stage_seconds[STAGE_DECODE] -= stats.FillSeconds() - fill_seconds;
+    } catch (const std::exception& e) {
+      Log.eWrite("[wgDecoder] Error while reading raw data : " +
+                 std::string(e.what()));
+      result = ERR_WG_DECODER;
+    }
+  } else {
+    SectionSeeker seeker(config);
+    try {
+      SectionReader reader(config, fill, rd);
+      while (true) {
+
+        // ============ Seek and read next section ============ //
+
+        time = DecoderStats::clock::now();
+        SectionSeeker::Section current_section =
+            seeker.SeekNextSection(*input, skipped_lines);
+        time = stats.AddTime(STAGE_SEEK, time);
+        const double fill_seconds = stats.FillSeconds();
+        reader.ReadNextSection(current_section);
+        stats.AddTime(STAGE_READ, time);
+        stats.stage_seconds[STAGE_READ] -= stats.FillSeconds() - fill_seconds;
+
+        // ============ Count the good and bad spills ============ //
+
+        spill_counter.Count(current_section);
+
+        // ============ Print the progress every 1000 spills ============ //
+
+        if (current_section.type == SectionSeeker::SectionType::SpillTrailer &&
+            (spill_counter.n_good_spills + spill_counter.n_bad_spills) % 1000 == 0)
+          Log.Write("[wgDecoder] DIF " + std::to_string(dif) + " : decoded " +
+                    std::to_string(spill_counter.n_good_spills +
+                                   spill_counter.n_bad_spills) + " spills");
+      }
+    } catch (const wgEOF& e) {
+      result = WG_SUCCESS;
+    } catch (const std::exception& e) {
+      Log.eWrite("[wgDecoder] Error while reading raw data : " +
+                 std::string(e.what()));
+      result = ERR_WG_DECODER;
+    }
+    stats.seeker = seeker.GetStatistics();
+    if (input->tellg() > 0) stats.bytes_read = input->tellg();
+  }
+
+  // ===================================================================== //
+  //                           Close everything                            //
+  // ===================================================================== //
+
+  input.reset();
+
+  // ============ Add Pyrame log info ============ //
+
+  time = DecoderStats::clock::now();
+
+  // In follow mode the Pyrame log is complete only at the end of the
+  // acquisition
+  const PyrameLog final_pyrame_log = follower ?
+                                     ReadPyrameLog(GetPyrameLogFile(input_raw_file)) :
+                                     pyrame_log;
+  if (final_pyrame_log.found) {
+    tree->GetUserInfo()->Add(new TParameter<Int_t>("start_time",   final_pyrame_log.start_time));
+    tree->GetUserInfo()->Add(new TParameter<Int_t>("stop_time",    final_pyrame_log.stop_time));
+    tree->GetUserInfo()->Add(new TParameter<Int_t>("nb_data_pkts", final_pyrame_log.nb_data_pkts));
+    tree->GetUserInfo()->Add(new TParameter<Int_t>("nb_lost_pkts", final_pyrame_log.nb_lost_pkts));
+  }
+
+  if (make_hist) {
+    make_hist->Write(final_pyrame_log.start_time, final_pyrame_log.stop_time,
+                     final_pyrame_log.nb_data_pkts, final_pyrame_log.nb_lost_pkts);
+    output_hist_file->Close();
+    Log.Write("[wgDecoder] Histograms written : " + fused_hist->output_hist_file);
+  }
+
+  if (output_file != NULL) {
+    tree->Write();
+    output_file->Close();
+    delete output_file;
+  } else {
+    delete tree;
+  }
+
+  if (columns) {
+    if (final_pyrame_log.found) {
+      columns->SetAttribute("start_time",   final_pyrame_log.start_time);
+      columns->SetAttribute("stop_time",    final_pyrame_log.stop_time);
+      columns->SetAttribute("nb_data_pkts", final_pyrame_log.nb_data_pkts);
+      columns->SetAttribute("nb_lost_pkts", final_pyrame_log.nb_lost_pkts);
+    }
+    try {
+      columns->Close();
+      Log.Write("[wgDecoder] Columnar export written : " + columns_dir);
+    } catch (const wgInvalidFile& e) {
+      Log.eWrite("[wgDecoder] Failed to write the columnar export : " + std::string(e.what()));
+      if (result == WG_SUCCESS) result = ERR_FAILED_WRITE;
+    }
+  }
+  stats.AddTime(STAGE_WRITE, time);
+
+  std::string dif_tag("[wgDecoder] DIF " + std::to_string(dif) + " *****  ");
+  Log.Write(dif_tag + "GOOD spills : " + std::to_string(spill_counter.n_good_spills) +
+            " spills *****");
+  Log.Write(dif_tag + "BAD  spills : " + std::to_string(spill_counter.n_bad_spills) +
+            " spills *****");
+  if (skipped_lines > 0)
+    Log.Write(dif_tag + "Skipped " + std::to_string(skipped_lines) +
+              " unrecognized lines *****");
+
+  // ============ Run report ============ //
+
+  if (!report_file.empty()) {
+    stats.skipped_lines = skipped_lines;
+    stats.SetSpillCounter(spill_counter);
+    stats.total_seconds = std::chrono::duration<double>(DecoderStats::clock::now() -
+                                                        start_time).count();
+    try {
+      WriteDecoderReport(report_file, input_raw_file, dif, result, stats);
+      Log.Write("[wgDecoder] Run report written : " + report_file);
+    } catch (const wgInvalidFile& e) {
+      Log.eWrite("[wgDecoder] Failed to write the run report : " + std::string(e.what()));
+    }
+  }
+
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 FindRawFiles                              //
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<DifRawFile> FindRawFiles(const std::string& run_dir) {
+  std::vector<DifRawFile> raw_files;
+  // The raw files may be compressed (see the IsRawFileName function)
+  for (auto const & raw_file : list::list_files(run_dir, false, "")) {
+    if (!IsRawFileName(raw_file) ||
+        RawFileBasename(raw_file).find("_ecal_dif_") == std::string::npos)
+      continue;
+    int dif = string::extract_dif_id(raw_file);
+    if (dif < 0) {
+      Log.eWrite("[wgDecoder] failed to read the DIF number from the file name : " +
+                 raw_file);
+      continue;
+    }
+    raw_files.push_back({(unsigned) dif, raw_file});
+  }
+  std::sort(raw_files.begin(), raw_files.end(),
+            [](const DifRawFile& a, const DifRawFile& b) { return a.dif < b.dif; });
+  return raw_files;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  DecodeRun                                //
+///////////////////////////////////////////////////////////////////////////////
+
+int DecodeRun(const std::string& run_dir,
+              const std::string& x_calibration_dir,
+              const std::string& output_dir,
+              const DecoderOptions& options) {
+
+  std::string calibration_dir(x_calibration_dir);
+
+  // ===================================================================== //
+  //                         Arguments sanity check                        //
+  // ===================================================================== //
+
+  // ======== run_dir ========= //
+
+  std::vector<DifRawFile> raw_files;
+  try {
+    raw_files = FindRawFiles(run_dir);
+  } catch (const wgInvalidFile& e) {
+    Log.eWrite("[wgDecoder] Run directory not found : " + std::string(e.what()));
+    return ERR_INPUT_FILE_NOT_FOUND;
+  }
+  if (raw_files.empty()) {
+    Log.eWrite("[wgDecoder] No *_ecal_dif_*.raw file found in " + run_dir);
+    return ERR_INPUT_FILE_NOT_FOUND;
+  }
+  for (std::size_t i = 0; i < raw_files.size(); ++i) {
+    if (raw_files[i].dif > NDIFS) {
+      Log.eWrite("[wgDecoder] The DIF number must be {0-" +
+                 std::to_string(NDIFS - 1) + "} : " + raw_files[i].path);
+      return ERR_WRONG_DIF_VALUE;
+    }
+    if (i > 0 && raw_files[i].dif == raw_files[i - 1].dif) {
+      Log.eWrite("[wgDecoder] More than one raw file found for DIF " +
+                 std::to_string(raw_files[i].dif) + " in " + run_dir);
+      return ERR_WRONG_DIF_VALUE;
+    }
+  }
+
+  // ======== options ========= //
+
+  if (options.follow || options.first_spill != 0 || options.last_spill >= 0 ||
+      !options.pyrame_config_file.empty()) {
+    Log.eWrite("[wgDecoder] The follow mode, the fused mode and the spill range "
+               "are not available for a whole run");
+    return ERR_WRONG_MODE;
+  }
+
+  // ======== calibration_dir ========= //
+
+  if (calibration_dir.empty()) {
+    wgEnvironment env;
+    calibration_dir = env.CONF_DIRECTORY;
+  }
+
+  // ======== n_threads ========= //
+
+  unsigned n_threads = options.n_threads;
+  if (n_threads == 0) {
+    n_threads = std::thread::hardware_concurrency();
+    if (n_threads == 0) n_threads = 1;
+  }
+
+  // ======== output_profile ========= //
+
+  OutputProfile output_profile;
+  try {
+    output_profile = GetOutputProfile(options.output_profile);
+  } catch (const std::invalid_argument& e) {
+    Log.eWrite("[wgDecoder] " + std::string(e.what()));
+    return ERR_WRONG_MODE;
+  }
+
+  // ============ Create output_dir ============ //
+
+  try { make::directory(output_dir); }
+  catch (const wgInvalidFile& e) {
+    Log.eWrite("[wgDecoder] " + std::string(e.what()));
+    return ERR_FAILED_CREATE_DIRECTORY;
+  }
+
+  // ============ Output file names ============ //
+
+  // In single file mode every DIF is first decoded into its own
+  // temporary file and then all the trees are copied into the run
+  // file. The temporary files are always overwritten.
+  std::string run_name = RawFileBasename(raw_files.front().path);
+  run_name = run_name.substr(0, run_name.rfind("_ecal_dif_"));
+  std::string run_file_path = output_dir + "/" + run_name + "_tree.root";
+  if (options.single_file && !options.overwrite && check_exist::root_file(run_file_path)) {
+    Log.eWrite("[wgDecoder] Error:" + run_file_path + " already exists!");
+    return ERR_OVERWRITE_FLAG_NOT_SET;
+  }
+  std::vector<std::string> output_file_paths;
+  for (auto const & raw_file : raw_files)
+    output_file_paths.push_back(output_dir + "/" + RawFileBasename(raw_file.path) +
+                                (options.single_file ? "_tree.tmp.root" : "_tree.root"));
+
+  Log.Write("[wgDecoder] READING RUN      : " + run_dir);
+  for (auto const & raw_file : raw_files)
+    Log.Write("[wgDecoder]   DIF " + std::to_string(raw_file.dif) + " : " + raw_file.path);
+  if (options.single_file)
+    Log.Write("[wgDecoder] OUTPUT TREE FILE : " + run_file_path);
+  Log.Write("[wgDecoder] OUTPUT DIRECTORY : " + output_dir);
+  Log.Write("[wgDecoder] OUTPUT PROFILE   : " + output_profile.name);
+
+  // ===================================================================== //
+  //                      Calibration and Pyrame log                       //
+  // ===================================================================== //
+
+  // The calibration constants of every DIF are loaded by DecodeDifFile
+  // once the number of chips is known, so each raw file is probed
+  // only once
+  std::vector<DifCalibration> calibs(raw_files.size());
+  for (std::size_t ifile = 0; ifile < raw_files.size(); ++ifile) {
+    calibs[ifile].calibration_dir = calibration_dir;
+    calibs[ifile].dif = raw_files[ifile].dif;
+  }
+
+  // Usually all the DIFs of a run share the same log file
+  std::map<std::string, PyrameLog> pyrame_logs;
+  for (auto const & raw_file : raw_files) {
+    std::string pyrame_log_file = GetPyrameLogFile(raw_file.path);
+    if (pyrame_logs.find(pyrame_log_file) == pyrame_logs.end())
+      pyrame_logs[pyrame_log_file] = ReadPyrameLog(pyrame_log_file);
+  }
+
+  // ===================================================================== //
+  //                       Decode the DIFs in parallel                     //
+  // ===================================================================== //
+
+  // The thread budget is shared with the compression and among the
+  // DIFs : n_workers DIFs are decoded at the same time, each one by
+  // threads_per_dif threads.
+  n_threads = EnableParallelCompression(output_profile, n_threads);
+  unsigned n_workers = std::min<unsigned>(n_threads, raw_files.size());
+  unsigned threads_per_dif = std::max<unsigned>(1, n_threads / n_workers);
+  if (n_workers > 1) ROOT::EnableThreadSafety();
+  Log.Write("[wgDecoder] Decoding " + std::to_string(raw_files.size()) + " DIFs with " +
+            std::to_string(n_workers) + " x " + std::to_string(threads_per_dif) + " threads");
+
+  // Each worker writes to its own TFile so no ROOT object is ever
+  // shared among threads
+  std::vector<int> results(raw_files.size(), WG_SUCCESS);
+  // The temporary files of the single file mode are always overwritten
+  DecoderOptions dif_options(options);
+  dif_options.overwrite = options.overwrite || options.single_file;
+  dif_options.n_threads = threads_per_dif;
+  std::atomic<unsigned> next_file(0);
+  auto worker = [&]() {
+    unsigned ifile;
+    while ((ifile = next_file++) < raw_files.size()) {
+      try {
+        results[ifile] = DecodeDifFile(raw_files[ifile].path,
+                                       output_file_paths[ifile],
+                                       raw_files[ifile].dif,
+                                       0,
+                                       &calibs[ifile],
+                                       pyrame_logs.at(GetPyrameLogFile(raw_files[ifile].path)),
+                                       dif_options);
+      } catch (const std::exception& e) {
+        Log.eWrite("[wgDecoder] DIF " + std::to_string(raw_files[ifile].dif) +
+                   " : " + std::string(e.what()));
+        results[ifile] = ERR_WG_DECODER;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned iworker = 1; iworker < n_workers; ++iworker)
+    workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers)
+    thread.join();
+
+  int result = WG_SUCCESS;
+  for (std::size_t ifile = 0; ifile < raw_files.size(); ++ifile) {
+    if (results[ifile] != WG_SUCCESS) {
+      Log.eWrite("[wgDecoder] DIF " + std::to_string(raw_files[ifile].dif) +
+                 " failed with code " + std::to_string(results[ifile]));
+      result = results[ifile];
+    }
+  }
+
+  // ===================================================================== //
+  //                 Merge all the trees into the run file                 //
+  // ===================================================================== //
+
+  if (options.single_file) {
+    TFile run_file(run_file_path.c_str(), options.overwrite ? "recreate" : "create");
+    if (run_file.IsZombie()) {
+      Log.eWrite("[wgDecoder] Error: failed to create " + run_file_path);
+      return ERR_FAILED_OPEN_TREE_FILE;
+    }
+    ApplyOutputProfile(output_profile, run_file);
+    for (std::size_t ifile = 0; ifile < raw_files.size(); ++ifile) {
+      if (results[ifile] != WG_SUCCESS) {
+        std::remove(output_file_paths[ifile].c_str());
+        continue;
+      }
+      TFile dif_file(output_file_paths[ifile].c_str(), "read");
+      std::string dif_number(std::to_string(raw_files[ifile].dif));
+      std::string tree_name("tree_dif_" + dif_number);
+      if (dif_file.Get(tree_name.c_str()) == NULL) {
+        Log.eWrite("[wgDecoder] " + tree_name + " not found in " + output_file_paths[ifile]);
+        result = ERR_FAILED_OPEN_TREE_FILE;
+      }
+      // The calib_dif_<N> tree is present only in sparse output mode
+      for (const std::string& name : {tree_name, "calib_dif_" + dif_number}) {
+        TTree * dif_tree = (TTree*) dif_file.Get(name.c_str());
+        if (dif_tree == NULL) continue;
+        // The baskets are copied as they are without decompressing them
+        run_file.cd();
+        TTree * run_tree = dif_tree->CloneTree(-1, "fast");
+        run_tree->Write();
+        delete run_tree;
+      }
+      dif_file.Close();
+      std::remove(output_file_paths[ifile].c_str());
+    }
+    run_file.Close();
+  }
+
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 wgDecodeRun                               //
+///////////////////////////////////////////////////////////////////////////////
+
+int wgDecodeRun(const char * x_run_dir,
+                const char * x_calibration_dir,
+                const char * x_output_dir,
+                const bool overwrite,
+                const bool compatibility_mode,
+                const bool single_file,
+                const unsigned n_threads,
+                const bool sparse_output,
+                const bool write_index,
+                const char * x_output_profile,
+                const bool write_report,
+                const bool write_columns) {
+  DecoderOptions options;
+  options.overwrite = overwrite;
+  options.compatibility_mode = compatibility_mode;
+  options.single_file = single_file;
+  options.n_threads = n_threads;
+  options.sparse_output = sparse_output;
+  options.write_index = write_index;
+  options.output_profile = x_output_profile;
+  options.write_report = write_report;
+  options.write_columns = write_columns;
+  return DecodeRun(x_run_dir, x_calibration_dir, x_output_dir, options);
+}
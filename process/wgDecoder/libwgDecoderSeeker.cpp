@@ -1,17 +1,21 @@
 // system includes
 #include <bitset>
+#include <string>
 #include <istream>
 #include <functional>
 #include <iomanip>
 
 // system C includes
 #include <csignal>
+#include <cstring>
 
 // user includes
 #include "wgConst.hpp"
 #include "wgDecoder.hpp"
+#include "wgDecoderInput.hpp"
 #include "wgDecoderSeeker.hpp"
 #include "wgDecoderUtils.hpp"
+#include "wgExceptions.hpp"
 #include "wgLogger.hpp"
 
 namespace wg_utils = wagasci_decoder_utils;
@@ -21,13 +25,6 @@ namespace wg_utils = wagasci_decoder_utils;
 ///////////////////////////////////////////////////////////////////////////////
 
 SectionSeeker::SectionSeeker(const RawDataConfig &config) : m_config(config) {
-  if (m_config.has_spill_number && m_config.has_phantom_menace) {
-    m_num_section_types = NUM_SECTION_TYPES;
-  } else if (m_config.has_spill_number ^ m_config.has_phantom_menace) {
-    m_num_section_types = NUM_SECTION_TYPES - 1;
-  } else {
-    m_num_section_types = NUM_SECTION_TYPES - 2;
-  }
   m_current_section.type = SectionType::SpillTrailer;
   InitializeRing();
 }
@@ -36,33 +33,33 @@ SectionSeeker::SectionSeeker(const RawDataConfig &config) : m_config(config) {
 //                               GetNextSection                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-SectionSeeker::Section SectionSeeker::SeekNextSection(std::istream& is,
-                                                      unsigned& recursive_counter) {
-  bool found = true;
+SectionSeeker::Section SectionSeeker::SeekNextSection(RawDataInput& is,
+                                                      unsigned& skipped_lines) {
+  bool found = false;
   unsigned last_section_type = m_current_section.type;
-  m_last_ichip = m_current_ichip;
 
-  do {
-    m_current_section.type = NextSectionType(m_current_section.type, found);
-    found = m_seekers_ring[m_current_section.type](is);
-  } while (!found && (m_current_section.type != last_section_type));
-
-  if (!found) {
-    std::bitset<BITS_PER_LINE> raw_data_line;
-    if (++recursive_counter >= MAX_RAWDATA_LENGTH) {
-      recursive_counter = 0;
-      wg_utils::ThrowOneByte(is);
-      std::cout << "Had to remove one byte at position " << is.tellg()  <<
-          " to restore balance in the force\n";
-    }
-    wg_utils::ReadLine(is, raw_data_line);
-    // Uncomment the following lines if you want to debug
-    //std::stringstream res;
-    //res << std::setfill('0') << std::setw(4) << std::hex << std::uppercase <<
-    //raw_data_line.to_ulong();
-    //Log.eWrite("[wgDecoder] Line \"" + res.str() + "\" not recognized at byte " +
-    //to_string(is.tellg()) + ". Skipping it.");
-    return this->SeekNextSection(is, recursive_counter);
+  while (!found) {
+    found = true;
+    m_last_ichip = m_current_ichip;
+    // Number of seekers that failed at the current position. When the
+    // chip header is not found the ring jumps to the spill trailer, so
+    // it may never come back to last_section_type. In that case give
+    // up after all the seekers have failed at the same position.
+    unsigned n_failed = 0;
+    std::streampos position = is.tellg();
+    do {
+      m_current_section.type = NextSectionType(m_current_section.type, found);
+      found = m_seekers_ring[m_current_section.type](is);
+      if (is.tellg() != position) {
+        position = is.tellg();
+        n_failed = 0;
+      }
+    } while (!found && (m_current_section.type != last_section_type) &&
+             (++n_failed < NUM_SECTION_TYPES));
+
+    // No seeker recognized the current line. Skip forward to the next
+    // line that may be the start of a section and try again.
+    if (!found) Resynchronize(is, skipped_lines);
   }
 
   // In any case the chip counter cannot get bigger than the number of chips
@@ -74,9 +71,47 @@ SectionSeeker::Section SectionSeeker::SeekNextSection(std::istream& is,
   }
   m_current_section.ispill = m_last_ispill;
   m_current_section.lines = GetNumberOfLines(m_current_section);
+  ++m_statistics.n_sections[m_current_section.type];
+  // Hand the section lines over to the reader. Nothing is actually
+  // read here: the lines have already been read by the seeker and the
+  // span just points to them.
+  is.seekg(m_current_section.start);
+  m_current_section.data = is.ReadLines(m_current_section.lines);
   return m_current_section;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//                            GetState / SetState                            //
+///////////////////////////////////////////////////////////////////////////////
+
+SectionSeeker::State SectionSeeker::GetState() const {
+  State state;
+  state.type          = m_current_section.type;
+  state.last_ispill   = m_last_ispill;
+  state.last_ichip    = m_last_ichip;
+  state.current_ichip = m_current_ichip;
+  return state;
+}
+
+void SectionSeeker::SetState(const State& state) {
+  m_current_section.type = state.type;
+  m_last_ispill          = state.last_ispill;
+  m_last_ichip           = state.last_ichip;
+  m_current_ichip        = state.current_ichip;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                       GetStatistics / SetStatistics                       //
+///////////////////////////////////////////////////////////////////////////////
+
+const SectionSeeker::Statistics& SectionSeeker::GetStatistics() const {
+  return m_statistics;
+}
+
+void SectionSeeker::SetStatistics(const Statistics& statistics) {
+  m_statistics = statistics;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //                              NextSectionType                              //
 ///////////////////////////////////////////////////////////////////////////////
@@ -99,17 +134,125 @@ unsigned SectionSeeker::NextSectionType(const unsigned last_section_type, const
   else if (!last_section_was_found && last_section_type == ChipHeader)
     return SpillTrailer;
 
-  return (m_current_section.type + 1) % m_num_section_types;
+  // Skip the sections that are not present in this raw data file
+  unsigned next_section_type = last_section_type;
+  do {
+    next_section_type = (next_section_type + 1) % NUM_SECTION_TYPES;
+  } while (!m_seekers_ring[next_section_type]);
+  return next_section_type;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               Resynchronize                               //
+///////////////////////////////////////////////////////////////////////////////
+
+// Number of lines scanned at a time while resynchronizing
+const std::size_t RESYNC_WINDOW_LENGTH = 1 << 16;
+// Number of lines at the end of the window that are scanned again as
+// part of the next window. It must be at least as long as the longest
+// signature checked by IsSectionStart.
+const std::size_t RESYNC_LOOK_AHEAD = 16;
+
+// Return true if a well formed spill number, spill header, chip
+// header, chip trailer or spill trailer starts at the "index" line of
+// "span". Used to tell a section that has been shifted by one byte
+// from a random sequence of bytes that just happens to look like a
+// section marker.
+static bool IsSectionStart(const RawDataSpan& span, std::size_t index) {
+  if (index + SPILL_TRAILER_LENGTH > span.size()) return false;
+  std::bitset<BITS_PER_LINE> marker = span[index];
+  if (marker == SPILL_NUMBER_MARKER)
+    return span[index + SPILL_NUMBER_LENGTH] == SPILL_HEADER_MARKER;
+  if (marker == SPILL_HEADER_MARKER || marker == FIRST_MARKER)
+    return span[index + 3] == SP_MARKER && span[index + 4] == IL_MARKER;
+  if (marker == CHIP_HEADER_MARKER)
+    return span[index + 2] == CH_MARKER && span[index + 3] == IP_MARKER;
+  if (marker == CHIP_TRAILER_MARKER)
+    return span[index + 2] == SPACE_MARKER && span[index + 3] == SPACE_MARKER;
+  if (marker == SPILL_TRAILER_MARKER)
+    return span[index + 6] == SPACE_MARKER;
+  return false;
+}
+
+void SectionSeeker::Resynchronize(RawDataInput& is, unsigned& skipped_lines) {
+  // A seeker can only succeed (or skip a corrupted section) at a line
+  // that is a section marker, that follows a SPACE or IP marker (raw
+  // data) or that is followed by two zeros (phantom menace). A
+  // partially corrupted spill header can be recovered up to
+  // SPILL_HEADER_LENGTH - 1 lines before its marker, so the position
+  // is always moved that many lines before the candidate line.
+  const unsigned patterns = wg_utils::MARKER_PATTERN | wg_utils::SPACE_PATTERN |
+      (m_config.has_phantom_menace ? wg_utils::ZERO_PATTERN : 0);
+
+  ++m_statistics.n_resyncs;
+
+  // The current line was not recognized so the search starts from the
+  // next one
+  std::size_t start = 1;
+  while (true) {
+    std::streampos position = is.tellg();
+    // At the very start of the file the raw data seeker does not need
+    // the SPACE or IP marker
+    if (position + std::streamoff(start * BYTES_PER_LINE) <= BYTES_PER_LINE) {
+      is.seekg(position + std::streamoff(start * BYTES_PER_LINE));
+      skipped_lines += start;
+      return;
+    }
+
+    RawDataSpan window = is.PeekLines(RESYNC_WINDOW_LENGTH);
+    bool last_window = window.size() < RESYNC_WINDOW_LENGTH;
+    std::size_t stop = last_window ? window.size() : window.size() - RESYNC_LOOK_AHEAD;
+
+    std::size_t candidate = wg_utils::FindCandidateLine(window, start, patterns);
+
+    // The same window shifted by one byte. The n-th line of the
+    // shifted window starts before the (n+1)-th line of the window.
+    // FindCandidateLine returns shifted.size() when nothing is found,
+    // which in the last window is still smaller than stop.
+    RawDataSpan shifted(window.data() + 1, window.size() > 0 ? window.size() - 1 : 0);
+    std::size_t misaligned = start == 0 ? 0 : start - 1;
+    while ((misaligned = wg_utils::FindCandidateLine(shifted, misaligned, wg_utils::MARKER_PATTERN)) <
+           shifted.size() && misaligned < candidate && misaligned < stop &&
+           !IsSectionStart(shifted, misaligned))
+      ++misaligned;
+
+    if (misaligned < shifted.size() && misaligned < candidate && misaligned < stop) {
+      is.seekg(position + std::streamoff(misaligned * BYTES_PER_LINE));
+      wg_utils::ThrowOneByte(is);
+      ++m_statistics.n_thrown_bytes;
+      skipped_lines += misaligned;
+      Log.eWrite("[wgDecoder] Had to remove one byte at position " + std::to_string(is.tellg()) +
+                 " to restore balance in the force");
+      return;
+    }
+    if (candidate < stop) {
+      std::size_t jump = start;
+      if (candidate >= start + SPILL_HEADER_LENGTH - 1)
+        jump = candidate - (SPILL_HEADER_LENGTH - 1);
+      is.seekg(position + std::streamoff(jump * BYTES_PER_LINE));
+      skipped_lines += jump;
+      return;
+    }
+    if (last_window) {
+      is.seekg(position + std::streamoff(window.size() * BYTES_PER_LINE));
+      skipped_lines += window.size();
+      throw wgEOF("EOF reached");
+    }
+    // Nothing found in this window. Go on with the next one.
+    is.seekg(position + std::streamoff(stop * BYTES_PER_LINE));
+    skipped_lines += stop;
+    start = 0;
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //                              SeekSpillNumber                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool SectionSeeker::SeekSpillNumber(std::istream& is) {
+bool SectionSeeker::SeekSpillNumber(RawDataInput& is) {
   std::streampos start_read = is.tellg();
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(SPILL_NUMBER_LENGTH);
-  std::streampos stop_read = wg_utils::ReadChunk(is, raw_data);
+  RawDataSpan raw_data = is.ReadLines(SPILL_NUMBER_LENGTH);
+  std::streampos stop_read = is.tellg();
   // Everything should be fine
   if ((raw_data[0] == SPILL_NUMBER_MARKER || raw_data[0] == FIRST_MARKER) &&
       raw_data[2] != SPILL_HEADER_MARKER) {
@@ -121,12 +264,11 @@ bool SectionSeeker::SeekSpillNumber(std::istream& is) {
     // Else the spill number section is corrupted or missing. In that
     // case we just ignore it and go on with reading the spill header
     // section if we find it
-    std::vector<std::bitset<BITS_PER_LINE>> raw_data_emergency(SPILL_NUMBER_LENGTH + 2);
-    is.seekg(start_read);
-    wg_utils::ReadChunk(is, raw_data_emergency);
     bool has_spill_header;
     std::size_t spill_header_pos;
     std::tie(has_spill_header, spill_header_pos) = wg_utils::FindInVector(raw_data, SPILL_HEADER_MARKER);
+    is.seekg(start_read);
+    is.ReadLines(SPILL_NUMBER_LENGTH + 2);
     if (has_spill_header) {
       // skip the spill number section
       is.seekg(start_read + std::streampos((spill_header_pos + 1) * BYTES_PER_LINE));
@@ -144,10 +286,10 @@ bool SectionSeeker::SeekSpillNumber(std::istream& is) {
 //                              SeekSpillHeader                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool SectionSeeker::SeekSpillHeader(std::istream& is) {
+bool SectionSeeker::SeekSpillHeader(RawDataInput& is) {
   std::streampos start_read = is.tellg();
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(SPILL_HEADER_LENGTH);
-  std::streampos stop_read = wg_utils::ReadChunk(is, raw_data);
+  RawDataSpan raw_data = is.ReadLines(SPILL_HEADER_LENGTH);
+  std::streampos stop_read = is.tellg();
 
   // If everything is in place just return and call it a day
   if ((raw_data[0] == SPILL_HEADER_MARKER  || raw_data[0] == FIRST_MARKER) &&
@@ -169,9 +311,8 @@ bool SectionSeeker::SeekSpillHeader(std::istream& is) {
     std::tie(has_SP_marker, SP_marker_pos) = wg_utils::FindInVector(raw_data, SP_MARKER);
 
     // Just make sure that the chip header is in the following lines.
-    std::vector<std::bitset<BITS_PER_LINE>> raw_data_emergency(SPILL_HEADER_LENGTH + 2);
     is.seekg(start_read);
-    wg_utils::ReadChunk(is, raw_data_emergency);
+    RawDataSpan raw_data_emergency = is.ReadLines(SPILL_HEADER_LENGTH + 2);
     
     bool has_chip_header;
     std::size_t chip_header_pos;
@@ -202,10 +343,10 @@ bool SectionSeeker::SeekSpillHeader(std::istream& is) {
 //                               SeekChipHeader                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool SectionSeeker::SeekChipHeader(std::istream& is) {
+bool SectionSeeker::SeekChipHeader(RawDataInput& is) {
   std::streampos start_read = is.tellg();
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(CHIP_HEADER_LENGTH);
-  std::streampos stop_read = wg_utils::ReadChunk(is, raw_data);
+  RawDataSpan raw_data = is.ReadLines(CHIP_HEADER_LENGTH);
+  std::streampos stop_read = is.tellg();
 
   // If everything is in place just return true and call it a day
   if (raw_data[0] == CHIP_HEADER_MARKER &&
@@ -264,10 +405,10 @@ bool SectionSeeker::SeekChipHeader(std::istream& is) {
 //                              SeekChipTrailer                              //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool SectionSeeker::SeekChipTrailer(std::istream& is) {
+bool SectionSeeker::SeekChipTrailer(RawDataInput& is) {
   std::streampos start_read = is.tellg();
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(CHIP_TRAILER_LENGTH);
-  std::streampos stop_read = wg_utils::ReadChunk(is, raw_data);
+  RawDataSpan raw_data = is.ReadLines(CHIP_TRAILER_LENGTH);
+  std::streampos stop_read = is.tellg();
   // Everything is good
   if (raw_data[0] == CHIP_TRAILER_MARKER &&
       raw_data[2] == SPACE_MARKER &&
@@ -281,9 +422,8 @@ bool SectionSeeker::SeekChipTrailer(std::istream& is) {
   // If the chip trailer is corrupted we may as well skip it and go
   // straightly to the next section
   else if (raw_data[0] == CHIP_TRAILER_MARKER) {
-    std::vector<std::bitset<BITS_PER_LINE>> raw_data_emergency(CHIP_TRAILER_LENGTH + 2);
     is.seekg(start_read);
-    wg_utils::ReadChunk(is, raw_data_emergency);
+    RawDataSpan raw_data_emergency = is.ReadLines(CHIP_TRAILER_LENGTH + 2);
     bool has_chip_header, has_spill_number, has_spill_trailer;
     std::size_t chip_header_pos, spill_number_pos, spill_trailer_pos, pos;
     std::tie(has_chip_header, chip_header_pos) = wg_utils::FindInVector(raw_data_emergency, CHIP_HEADER_MARKER);
@@ -312,19 +452,27 @@ bool SectionSeeker::SeekChipTrailer(std::istream& is) {
 //                              SeekSpillTrailer                             //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool SectionSeeker::SeekSpillTrailer(std::istream& is) {
+bool SectionSeeker::SeekSpillTrailer(RawDataInput& is) {
   std::streampos start_read = is.tellg();
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(SPILL_TRAILER_LENGTH);
-  std::streampos stop_read;
+  // If the spill trailer is truncated by the end of the file, the
+  // lines that are there are read and the missing ones are zero
+  // (exactly as if the trailer was corrupted). It may still be
+  // recovered below.
+  char truncated_lines[SPILL_TRAILER_LENGTH * BYTES_PER_LINE] = {};
+  RawDataSpan raw_data;
   try {
-  stop_read = wg_utils::ReadChunk(is, raw_data);
+    raw_data = is.ReadLines(SPILL_TRAILER_LENGTH);
   } catch (const wgEOF&) {
-    is.clear();
-    is.seekg(0, is.end);
-    stop_read = is.tellg();
+    RawDataSpan available = is.PeekLines(SPILL_TRAILER_LENGTH);
+    if (available.size() > 0)
+      std::memcpy(truncated_lines, available.data(), available.size() * BYTES_PER_LINE);
+    is.ReadLines(available.size());
+    raw_data = RawDataSpan(truncated_lines, SPILL_TRAILER_LENGTH);
   }
+  std::streampos stop_read = is.tellg();
+  bool has_trailer_marker = raw_data[0] == SPILL_TRAILER_MARKER;
   // Everything is good
-  if ((raw_data[0] == SPILL_TRAILER_MARKER) &&
+  if (has_trailer_marker &&
       ((raw_data[3] & xFF00) == x0000) &&      
       (raw_data[6] == SPACE_MARKER)) {
     m_current_section.start = start_read;
@@ -340,19 +488,16 @@ bool SectionSeeker::SeekSpillTrailer(std::istream& is) {
 
     // Look for the spill number or spill header sections in the
     // immediate proximity of the spill trailer
-    std::vector<std::bitset<BITS_PER_LINE>> raw_data_emergency(SPILL_TRAILER_LENGTH + 2);
+    bool has_spill_header = false, has_spill_number = false;
+    std::size_t spill_number_pos, spill_header_pos;
     try {
       is.seekg(start_read);
-      wg_utils::ReadChunk(is, raw_data_emergency);
+      RawDataSpan raw_data_emergency = is.ReadLines(SPILL_TRAILER_LENGTH + 2);
+      std::tie(has_spill_header, spill_header_pos) = wg_utils::FindInVector(raw_data_emergency, SPILL_HEADER_MARKER);
+      std::tie(has_spill_number, spill_number_pos) = wg_utils::FindInVector(raw_data_emergency, SPILL_NUMBER_MARKER);
     } catch (const wgEOF&) {
-      is.clear();
-      is.seekg(0, is.end);
+      is.seekg(stop_read);
     }
-    bool has_spill_header, has_spill_number;
-    std::size_t spill_number_pos, spill_header_pos;
- 
-    std::tie(has_spill_header, spill_header_pos) = wg_utils::FindInVector(raw_data_emergency, SPILL_HEADER_MARKER);
-    std::tie(has_spill_number, spill_number_pos) = wg_utils::FindInVector(raw_data_emergency, SPILL_NUMBER_MARKER);
 
     if (m_config.has_spill_number && has_spill_number) {
       is.seekg(start_read + std::streampos((spill_number_pos + 1) * BYTES_PER_LINE));
@@ -363,13 +508,13 @@ bool SectionSeeker::SeekSpillTrailer(std::istream& is) {
     // If the trailer marker and the space x2020 marker are spaced at
     // least 3 positions there is still hope to extract something
     // meaningful from the spill trailer
-    if ((raw_data[0] == SPILL_TRAILER_MARKER) && has_space_marker && space_marker_pos > 3) {
+    if (has_trailer_marker && has_space_marker && space_marker_pos > 3) {
       m_current_section.start = start_read;
       m_current_section.stop = is.tellg();
       m_current_section.type = SpillTrailer;
       ++m_last_ispill;
       return true;
-    } else if (raw_data[0] == SPILL_TRAILER_MARKER &&
+    } else if (has_trailer_marker &&
                ((m_config.has_spill_number && has_spill_number) || has_spill_header)) {
       // The spill trailer is beyond any hope of recovery. Skip it.
       m_current_section.type = SpillTrailer;
@@ -386,10 +531,9 @@ bool SectionSeeker::SeekSpillTrailer(std::istream& is) {
 //                             SeekPhantomMenace                             //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool SectionSeeker::SeekPhantomMenace(std::istream& is) {
+bool SectionSeeker::SeekPhantomMenace(RawDataInput& is) {
   std::streampos start_read = is.tellg();
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(PHANTOM_MENACE_LENGTH);
-  wg_utils::ReadChunk(is, raw_data);
+  RawDataSpan raw_data = is.ReadLines(PHANTOM_MENACE_LENGTH);
 
   if (raw_data[1] == x0000 &&
       raw_data[2] == x0000) {
@@ -405,35 +549,31 @@ bool SectionSeeker::SeekPhantomMenace(std::istream& is) {
 //                                SeekRawData                                //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool SectionSeeker::SeekRawData(std::istream& is) {
+bool SectionSeeker::SeekRawData(RawDataInput& is) {
   std::streampos start_read = is.tellg();
   std::bitset<BITS_PER_LINE> raw_data_line;
 
   if (start_read > BYTES_PER_LINE) {
-    is.seekg(- BYTES_PER_LINE, std::ios::cur);
-    wg_utils::ReadLine(is, raw_data_line);
+    is.seekg(start_read - std::streamoff(BYTES_PER_LINE));
+    raw_data_line = is.ReadLines(1)[0];
     if (raw_data_line != SPACE_MARKER && raw_data_line != IP_MARKER) {
       return false;
     }
   }
 
-  unsigned n_raw_data = 0;
-  
-  do {
-    wg_utils::ReadLine(is, raw_data_line);
-    ++n_raw_data;
-  }
-  while (raw_data_line != CHIP_TRAILER_MARKER && n_raw_data < MAX_RAWDATA_LENGTH);
-  // rewind only the last line
-  is.seekg(- BYTES_PER_LINE, std::ios::cur);
-  --n_raw_data;
-
-  if (n_raw_data >= MAX_RAWDATA_LENGTH) {
+  // Look for the chip trailer marker that closes the raw data
+  RawDataSpan raw_data = is.PeekLines(MAX_RAWDATA_LENGTH);
+  std::size_t n_raw_data = wg_utils::FindLine(raw_data, 0, CHIP_TRAILER_MARKER.to_ulong());
+  if (n_raw_data == raw_data.size()) {
+    // The end of file is reached before the chip trailer
+    if (raw_data.size() < MAX_RAWDATA_LENGTH) throw wgEOF("EOF reached");
     is.seekg(start_read);
     return false;
   }
-  
-  if ((n_raw_data - m_config.n_chip_id) % ONE_COLUMN_LENGTH == 0) {
+  is.seekg(start_read + std::streamoff(n_raw_data * BYTES_PER_LINE));
+
+  if (n_raw_data >= m_config.n_chip_id &&
+      (n_raw_data - m_config.n_chip_id) % ONE_COLUMN_LENGTH == 0) {
     m_current_section.start = start_read;
     m_current_section.stop = is.tellg();
     m_current_section.type = RawData;
@@ -449,15 +589,15 @@ bool SectionSeeker::SeekRawData(std::istream& is) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void SectionSeeker::InitializeRing() {
-  m_seekers_ring[SectionType::SpillHeader]  = [this](std::istream& is) { return this->SeekSpillHeader(is); };  
-  m_seekers_ring[SectionType::ChipHeader]   = [this](std::istream& is) { return this->SeekChipHeader(is); };  
-  m_seekers_ring[SectionType::RawData]      = [this](std::istream& is) { return this->SeekRawData(is); };  
-  m_seekers_ring[SectionType::ChipTrailer]  = [this](std::istream& is) { return this->SeekChipTrailer(is); };  
-  m_seekers_ring[SectionType::SpillTrailer] = [this](std::istream& is) { return this->SeekSpillTrailer(is); };
+  m_seekers_ring[SectionType::SpillHeader]  = [this](RawDataInput& is) { return this->SeekSpillHeader(is); };  
+  m_seekers_ring[SectionType::ChipHeader]   = [this](RawDataInput& is) { return this->SeekChipHeader(is); };  
+  m_seekers_ring[SectionType::RawData]      = [this](RawDataInput& is) { return this->SeekRawData(is); };  
+  m_seekers_ring[SectionType::ChipTrailer]  = [this](RawDataInput& is) { return this->SeekChipTrailer(is); };  
+  m_seekers_ring[SectionType::SpillTrailer] = [this](RawDataInput& is) { return this->SeekSpillTrailer(is); };
   if (m_config.has_phantom_menace)
-    m_seekers_ring[SectionType::PhantomMenace] = [this](std::istream& is) { return this->SeekPhantomMenace(is); };
+    m_seekers_ring[SectionType::PhantomMenace] = [this](RawDataInput& is) { return this->SeekPhantomMenace(is); };
   if (m_config.has_spill_number)
-    m_seekers_ring[SectionType::SpillNumber]   = [this](std::istream& is) { return this->SeekSpillNumber(is); };  
+    m_seekers_ring[SectionType::SpillNumber]   = [this](RawDataInput& is) { return this->SeekSpillNumber(is); };  
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,133 @@
+// system includes
+#include <string>
+#include <array>
+#include <chrono>
+#include <fstream>
+
+// nlohmann_json includes
+#include <nlohmann/json.hpp>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoder.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderStats.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+//                                DecoderStats                               //
+///////////////////////////////////////////////////////////////////////////////
+
+DecoderStats::clock::time_point DecoderStats::AddTime(DecoderStage stage,
+                                                      clock::time_point start) {
+  clock::time_point now = clock::now();
+  stage_seconds[stage] += std::chrono::duration<double>(now - start).count();
+  return now;
+}
+
+double DecoderStats::FillSeconds() const {
+  return stage_seconds[STAGE_HIST] + stage_seconds[STAGE_FILL] + stage_seconds[STAGE_FLUSH];
+}
+
+void DecoderStats::CountSpill(Raw_t& rd) {
+  ++n_filled_spills;
+  for (unsigned i = 0; i < N_DEBUG_SPILL; ++i)
+    debug_spill[i] += rd.debug_spill[i];
+  for (int ichip = 0; ichip < rd.n_chips; ++ichip)
+    for (unsigned i = 0; i < N_DEBUG_CHIP; ++i)
+      debug_chip[i] += rd.debug_chip[ichip][i];
+}
+
+void DecoderStats::SetSpillCounter(const SpillCounter& counter) {
+  n_good_spills = counter.n_good_spills;
+  n_bad_spills = counter.n_bad_spills;
+}
+
+std::string DecoderStageName(DecoderStage stage) {
+  switch (stage) {
+    case STAGE_PROBE  : return "probe";
+    case STAGE_INDEX  : return "index";
+    case STAGE_SEEK   : return "seek";
+    case STAGE_READ   : return "read";
+    case STAGE_DECODE : return "decode";
+    case STAGE_HIST   : return "hist";
+    case STAGE_FILL   : return "fill";
+    case STAGE_FLUSH  : return "flush";
+    case STAGE_WRITE  : return "write";
+    default           : return "unknown";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                             WriteDecoderReport                            //
+///////////////////////////////////////////////////////////////////////////////
+
+// Names of the sections as indexed by the SectionSeeker::SectionType enum
+static const std::array<std::string, NUM_SECTION_TYPES> SECTION_NAMES = {{
+    "spill_header", "chip_header", "raw_data", "chip_trailer",
+    "spill_trailer", "phantom_menace", "spill_number"}};
+
+// Names of the debug counters as indexed by the SPILL_DEBUG_CODES enum
+static const std::array<std::string, N_DEBUG_SPILL> DEBUG_SPILL_NAMES = {{
+    "spill_mode", "same_spill_number", "spill_number_gap", "same_spill_count",
+    "spill_count_gap", "spill_trailer", "wrong_nchips"}};
+
+// Names of the debug counters as indexed by the CHIP_DEBUG_CODES enum
+static const std::array<std::string, N_DEBUG_CHIP> DEBUG_CHIP_NAMES = {{
+    "wrong_bcid", "wrong_hit_bit", "wrong_gain_bit", "wrong_adc",
+    "wrong_tdc", "wrong_chipid", "wrong_ncolumns"}};
+
+void WriteDecoderReport(const std::string& report_file,
+                        const std::string& input_raw_file,
+                        const unsigned dif,
+                        const int result,
+                        const DecoderStats& stats) {
+  nlohmann::json report;
+  report["raw_file"] = input_raw_file;
+  report["dif"] = dif;
+  report["result"] = result;
+
+  // ============ Input ============ //
+
+  const unsigned long long skipped_bytes =
+      stats.skipped_lines * BYTES_PER_LINE + stats.seeker.n_thrown_bytes;
+  report["input"]["bytes_read"] = stats.bytes_read;
+  report["input"]["skipped_lines"] = stats.skipped_lines;
+  report["input"]["skipped_bytes"] = skipped_bytes;
+  report["input"]["skipped_fraction"] = stats.bytes_read > 0 ?
+                                        (double) skipped_bytes / stats.bytes_read : 0.;
+  report["input"]["resyncs"] = stats.seeker.n_resyncs;
+  report["input"]["thrown_bytes"] = stats.seeker.n_thrown_bytes;
+  for (unsigned type = 0; type < NUM_SECTION_TYPES; ++type)
+    report["input"]["sections"][SECTION_NAMES[type]] = stats.seeker.n_sections[type];
+
+  // ============ Spills ============ //
+
+  report["spills"]["good"] = stats.n_good_spills;
+  report["spills"]["bad"] = stats.n_bad_spills;
+  report["spills"]["filled"] = stats.n_filled_spills;
+  for (unsigned i = 0; i < N_DEBUG_SPILL; ++i)
+    report["debug_spill"][DEBUG_SPILL_NAMES[i]] = stats.debug_spill[i];
+  for (unsigned i = 0; i < N_DEBUG_CHIP; ++i)
+    report["debug_chip"][DEBUG_CHIP_NAMES[i]] = stats.debug_chip[i];
+
+  // ============ Timing ============ //
+
+  for (unsigned stage = 0; stage < N_DECODER_STAGES; ++stage)
+    report["seconds"][DecoderStageName((DecoderStage) stage)] = stats.stage_seconds[stage];
+  report["seconds"]["total"] = stats.total_seconds;
+  report["flushes"] = stats.n_flushes;
+  report["mb_per_second"] = stats.total_seconds > 0 ?
+                            stats.bytes_read / 1e6 / stats.total_seconds : 0.;
+  report["spills_per_second"] = stats.total_seconds > 0 ?
+                                stats.n_filled_spills / stats.total_seconds : 0.;
+
+  std::ofstream ofs(report_file);
+  if (!ofs.is_open())
+    throw wgInvalidFile("failed to open " + report_file);
+  ofs << report.dump(2) << std::endl;
+  if (!ofs)
+    throw wgInvalidFile("failed to write " + report_file);
+}
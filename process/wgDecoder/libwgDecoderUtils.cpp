@@ -3,11 +3,18 @@
 #include <istream>
 #include <functional>
 #include <vector>
+#include <limits>
+#include <memory>
+#include <algorithm>
 
 // system C includes
 #include <csignal>
 #include <cstring>
-#include <sys/resource.h>
+
+// SIMD includes
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // user includes
 #include "wgConst.hpp"
@@ -16,6 +23,7 @@
 #include "wgLogger.hpp"
 #include "wgDecoder.hpp"
 #include "wgDecoderUtils.hpp"
+#include "wgDecoderIndex.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////
 //                                  ReadLine                                 //
@@ -24,7 +32,11 @@
 namespace wagasci_decoder_utils {
 
 void ThrowOneByte(std::istream& is) {
-  is.seekg(std::ios_base::cur + 1);
+  is.seekg(1, std::ios_base::cur);
+}
+
+void ThrowOneByte(RawDataInput& is) {
+  is.seekg(is.tellg() + std::streamoff(1));
 }
 
 
@@ -82,171 +94,240 @@ std::pair<bool, std::size_t> FindInVector(
   return result;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-//                                GetNumChipID                               //
-///////////////////////////////////////////////////////////////////////////////
-
-unsigned GetNumChipID(std::string & input_raw_file) {
-  
-  std::ifstream ifs;
-  ifs.open(input_raw_file.c_str(), std::ios_base::in | std::ios_base::binary);
-  if (!ifs.is_open()) {
-    Log.eWrite("[wgDecoder] Failed to open raw file: " +
-               std::string(std::strerror(errno)));
-    return ERR_FAILED_OPEN_RAW_FILE;
+std::pair<bool, std::size_t> FindInVector(const RawDataSpan& span_of_elements,
+                                          const std::bitset<BITS_PER_LINE>& element) {
+  for (std::size_t i = 0; i < span_of_elements.size(); ++i) {
+    if (span_of_elements[i] == element)
+      return std::make_pair(true, i);
   }
-  
-  std::bitset<BITS_PER_LINE> raw_data;
-  std::bitset<BITS_PER_LINE> last_two_raw_data[2];
-  unsigned iline = 0;
-  unsigned max_lines = 20 * NCHIPS * (16 * (1 + 2 * NCHANNELS) + 2) ;
-  unsigned found_counter = 0;
-  
-  while (ifs.read((char * ) &raw_data, BYTES_PER_LINE) &&
-         ++iline < max_lines &&
-         found_counter < 3) {
-
-    if (raw_data == CHIP_TRAILER_MARKER &&
-        last_two_raw_data[0] == last_two_raw_data[1])
-      ++found_counter;
-
-    last_two_raw_data[1] = last_two_raw_data[0];
-    last_two_raw_data[0] = raw_data;
-  }
-
-  bool found = found_counter >= 3;
-
-  ifs.close();
-  if (found) return 2;
-  else return 1;
+  return std::make_pair(false, (std::size_t) -1);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-//                              HasSpillNumber                               //
+//                                  FindLine                                 //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool HasSpillNumber(std::string & input_raw_file) {
-  
-  std::ifstream ifs;
-  ifs.open(input_raw_file.c_str(), std::ios_base::in | std::ios_base::binary);
-  if (!ifs.is_open()) {
-    Log.eWrite("[wgDecoder] Failed to open raw file: " +
-               std::string(strerror(errno)));
-    return false;
+// The SSE2 versions compare eight lines at a time. The raw data is
+// little-endian so a 16-bit lane of the SSE register is exactly one
+// line. The leftover lines (and all the lines on architectures without
+// SSE2) are compared one by one.
+
+std::size_t FindLine(const RawDataSpan& span, std::size_t start, uint16_t line) {
+  std::size_t i = start;
+#if defined(__SSE2__)
+  const __m128i value = _mm_set1_epi16(line);
+  for (; i + 8 <= span.size(); i += 8) {
+    __m128i lines = _mm_loadu_si128(reinterpret_cast<const __m128i*>(span.data() + i * BYTES_PER_LINE));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(lines, value));
+    if (mask != 0) return i + __builtin_ctz(mask) / BYTES_PER_LINE;
   }
-  
-  std::bitset<BITS_PER_LINE> raw_data;
-  unsigned iline = 0;
-  unsigned max_lines = 20 * NCHIPS * (16 * (1 + 2 * NCHANNELS) + 2);
-  unsigned found_counter = 0;
-  
-  while (ifs.read((char * ) &raw_data, BYTES_PER_LINE) &&
-         ++iline < max_lines &&
-         found_counter < 3) {
-
-    if (raw_data == SPILL_NUMBER_MARKER)
-      found_counter++;
+#endif
+  for (; i < span.size(); ++i) {
+    if (span.line(i) == line) return i;
   }
+  return span.size();
+}
 
-  bool found = found_counter >= 3;
-
-  ifs.close();
-  return found;
+std::size_t FindCandidateLine(const RawDataSpan& span, std::size_t start, unsigned patterns) {
+  std::size_t i = start;
+#if defined(__SSE2__)
+  // x >= 0xFFFA if and only if x + 5 saturates to 0xFFFF
+  const __m128i five  = _mm_set1_epi16(5);
+  const __m128i ones  = _mm_set1_epi16(-1);
+  const __m128i space = _mm_set1_epi16(0x2020);
+  const __m128i ip    = _mm_set1_epi16(0x5049);
+  const __m128i zero  = _mm_setzero_si128();
+  for (; i + 8 <= span.size(); i += 8) {
+    __m128i lines = _mm_loadu_si128(reinterpret_cast<const __m128i*>(span.data() + i * BYTES_PER_LINE));
+    __m128i match = zero;
+    if (patterns & MARKER_PATTERN)
+      match = _mm_cmpeq_epi16(_mm_adds_epu16(lines, five), ones);
+    if (patterns & SPACE_PATTERN)
+      match = _mm_or_si128(match, _mm_or_si128(_mm_cmpeq_epi16(lines, space),
+                                               _mm_cmpeq_epi16(lines, ip)));
+    if (patterns & ZERO_PATTERN)
+      match = _mm_or_si128(match, _mm_cmpeq_epi16(lines, zero));
+    int mask = _mm_movemask_epi8(match);
+    if (mask != 0) return i + __builtin_ctz(mask) / BYTES_PER_LINE;
+  }
+#endif
+  for (; i < span.size(); ++i) {
+    uint16_t line = span.line(i);
+    if (((patterns & MARKER_PATTERN) && line >= 0xFFFA) ||
+        ((patterns & SPACE_PATTERN) && (line == 0x2020 || line == 0x5049)) ||
+        ((patterns & ZERO_PATTERN) && line == 0x0000))
+      return i;
+  }
+  return span.size();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-//                              HasPhantomMenace                             //
+//                                UnpackColumn                               //
 ///////////////////////////////////////////////////////////////////////////////
 
-bool HasPhantomMenace(std::string & input_raw_file) {
-  
-  std::ifstream ifs;
-  ifs.open(input_raw_file.c_str(), std::ios_base::in | std::ios_base::binary);
-  if (!ifs.is_open()) {
-    Log.eWrite("[wgDecoder] Failed to open raw file: " +
-               std::string(strerror(errno)));
-    return false;
-  }
-  
-  std::vector<std::bitset<BITS_PER_LINE>> raw_data(PHANTOM_MENACE_LENGTH + 2);
-  unsigned max_lines = 20 * NCHIPS * (16 * (1 + 2 * NCHANNELS) + 2);
-  unsigned found_counter = 0;
-
-  try {
-    unsigned iline = 0;
-    while (++iline < max_lines && found_counter < 3) {
-      ReadChunk(ifs, raw_data);
-      if (raw_data[0] == SPACE_MARKER &&
-          raw_data[2] == x0000 &&
-          raw_data[3] == x0000 &&
-          raw_data[4] == SPILL_HEADER_MARKER)
-        ++found_counter;
-      ifs.seekg(iline * BYTES_PER_LINE);
-    }
-  } catch (const wgEOF& e) {;}
+// The SSE2 version unpacks eight channels at a time. The lines of
+// eight consecutive channels are loaded with a single instruction and
+// reversed, so that the first lane is the first channel. The time line
+// of each channel is at NCHANNELS lines of distance from the charge
+// line so the hit and gain bits can be compared lane by lane. If
+// NCHANNELS is not a multiple of eight, the last group overlaps with
+// the previous one and the overlapping lanes are not counted twice.
+
+#if defined(__SSE2__)
+static inline __m128i ReverseLines(__m128i lines) {
+  lines = _mm_shuffle_epi32(lines, _MM_SHUFFLE(0, 1, 2, 3));
+  lines = _mm_shufflelo_epi16(lines, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_shufflehi_epi16(lines, _MM_SHUFFLE(2, 3, 0, 1));
+}
 
-  bool found = found_counter >= 3;
-    
-  ifs.close();
-  return found;
+static inline void StoreLines(int * destination, __m128i lines) {
+  const __m128i zero = _mm_setzero_si128();
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(destination),     _mm_unpacklo_epi16(lines, zero));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + 4), _mm_unpackhi_epi16(lines, zero));
+}
+
+// Number of lanes set in "match" excluding the lowest "skip" lanes
+static inline unsigned CountLanes(__m128i match, unsigned skip) {
+  unsigned mask = _mm_movemask_epi8(match) & (0xFFFF << (skip * BYTES_PER_LINE));
+  return __builtin_popcount(mask) / BYTES_PER_LINE;
+}
+#endif
+
+void UnpackColumn(const char * column, UnpackedColumn& unpacked) {
+  unpacked.n_wrong_adc = 0;
+  unpacked.n_wrong_tdc = 0;
+  unpacked.n_wrong_hit_bit = 0;
+  unpacked.n_wrong_gain_bit = 0;
+  std::size_t ichan = 0;
+#if defined(__SSE2__)
+  static_assert(NCHANNELS >= 8, "UnpackColumn needs at least eight channels");
+  const __m128i value_mask = _mm_set1_epi16(0x0FFF);
+  const __m128i hit_mask   = _mm_set1_epi16(0x1000);
+  const __m128i gain_mask  = _mm_set1_epi16(0x2000);
+  const __m128i one        = _mm_set1_epi16(1);
+  const __m128i max_value  = _mm_set1_epi16(MAX_VALUE_12BITS);
+  std::size_t done = 0;
+  while (done < NCHANNELS) {
+    ichan = done + 8 <= NCHANNELS ? done : NCHANNELS - 8;
+    unsigned skip = done - ichan;
+    __m128i charge_lines = ReverseLines(_mm_loadu_si128(reinterpret_cast<const __m128i*>(
+        column + (COLUMN_CHANNEL_LINES - 8 - ichan) * BYTES_PER_LINE)));
+    __m128i time_lines = ReverseLines(_mm_loadu_si128(reinterpret_cast<const __m128i*>(
+        column + (NCHANNELS - 8 - ichan) * BYTES_PER_LINE)));
+    __m128i charge = _mm_and_si128(charge_lines, value_mask);
+    __m128i time   = _mm_and_si128(time_lines, value_mask);
+    StoreLines(unpacked.charge + ichan, charge);
+    StoreLines(unpacked.time + ichan, time);
+    StoreLines(unpacked.hit + ichan, _mm_and_si128(_mm_srli_epi16(charge_lines, 12), one));
+    StoreLines(unpacked.gs + ichan,  _mm_and_si128(_mm_srli_epi16(charge_lines, 13), one));
+    __m128i different = _mm_xor_si128(charge_lines, time_lines);
+    unpacked.n_wrong_adc += CountLanes(_mm_cmpgt_epi16(charge, max_value), skip);
+    unpacked.n_wrong_tdc += CountLanes(_mm_cmpgt_epi16(time, max_value), skip);
+    unpacked.n_wrong_hit_bit += CountLanes(_mm_cmpeq_epi16(_mm_and_si128(different, hit_mask),
+                                                           hit_mask), skip);
+    unpacked.n_wrong_gain_bit += CountLanes(_mm_cmpeq_epi16(_mm_and_si128(different, gain_mask),
+                                                            gain_mask), skip);
+    done = ichan + 8;
+  }
+  ichan = NCHANNELS;
+#endif
+  for (; ichan < NCHANNELS; ++ichan) {
+    uint16_t charge_line, time_line;
+    std::memcpy(&charge_line, column + (COLUMN_CHANNEL_LINES - 1 - ichan) * BYTES_PER_LINE,
+                BYTES_PER_LINE);
+    std::memcpy(&time_line, column + (NCHANNELS - 1 - ichan) * BYTES_PER_LINE, BYTES_PER_LINE);
+    unpacked.charge[ichan] = charge_line & 0x0FFF;
+    unpacked.time[ichan]   = time_line & 0x0FFF;
+    unpacked.hit[ichan]    = (charge_line >> 12) & 1;
+    unpacked.gs[ichan]     = (charge_line >> 13) & 1;
+    if ((unsigned) unpacked.charge[ichan] > MAX_VALUE_12BITS) ++unpacked.n_wrong_adc;
+    if ((unsigned) unpacked.time[ichan] > MAX_VALUE_12BITS)   ++unpacked.n_wrong_tdc;
+    if (((charge_line ^ time_line) >> 12) & 1) ++unpacked.n_wrong_hit_bit;
+    if (((charge_line ^ time_line) >> 13) & 1) ++unpacked.n_wrong_gain_bit;
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-//                                 GetNumChips                               //
+//                                ProbeRawData                               //
 ///////////////////////////////////////////////////////////////////////////////
 
-unsigned GetNumChips(std::string & input_raw_file) {
-  
-  std::ifstream ifs;
-  ifs.open(input_raw_file.c_str(), std::ios_base::in | std::ios_base::binary);
-  if (!ifs.is_open()) {
-    Log.eWrite("[wgDecoder] Failed to open raw file: " +
-               std::string(strerror(errno)));
-    return ERR_FAILED_OPEN_RAW_FILE;
-  }
-  
-  std::bitset<BITS_PER_LINE> raw_data;
-  std::vector<unsigned> n_chips_vec;
-
-  unsigned counter = 0;
-  
-  while ( ifs.read((char * ) &raw_data, BYTES_PER_LINE) && counter < 100 ) {
-    if (raw_data == SPILL_TRAILER_MARKER) {
-      ++counter;
-      ifs.seekg(2 * BYTES_PER_LINE, std::ios::cur);
-      ifs.read((char * ) &raw_data, BYTES_PER_LINE);
-      n_chips_vec.push_back(raw_data.to_ulong());
+RawDataConfig ProbeRawData(const RawDataSpan& span, const bool at_end, bool& conclusive) {
+  const uint16_t space_marker         = SPACE_MARKER.to_ulong();
+  const uint16_t spill_number_marker  = SPILL_NUMBER_MARKER.to_ulong();
+  const uint16_t spill_header_marker  = SPILL_HEADER_MARKER.to_ulong();
+  const uint16_t chip_trailer_marker  = CHIP_TRAILER_MARKER.to_ulong();
+  const uint16_t spill_trailer_marker = SPILL_TRAILER_MARKER.to_ulong();
+
+  unsigned n_chips = 0;
+  unsigned n_spill_trailers = 0;
+  unsigned n_duplicate_chipids = 0;
+  unsigned n_spill_numbers = 0;
+  unsigned n_phantom_menaces = 0;
+
+  // Only the section markers and the space markers are interesting
+  std::size_t iline = FindCandidateLine(span, 0, MARKER_PATTERN | SPACE_PATTERN);
+  for (; iline < span.size() && n_spill_trailers < PROBE_MAX_SPILLS;
+       iline = FindCandidateLine(span, iline + 1, MARKER_PATTERN | SPACE_PATTERN)) {
+    const uint16_t line = span.line(iline);
+    if (line == chip_trailer_marker) {
+      // The CHIP ID is written twice right before the chip trailer
+      if (iline >= 2 && span.line(iline - 1) == span.line(iline - 2))
+        ++n_duplicate_chipids;
+    } else if (line == spill_number_marker) {
+      ++n_spill_numbers;
+    } else if (line == space_marker) {
+      // The PhantomMenace section is two 0x0000 lines between the
+      // space marker (plus one line) and the spill header
+      if (iline + 4 < span.size() &&
+          span.line(iline + 2) == 0x0000 &&
+          span.line(iline + 3) == 0x0000 &&
+          span.line(iline + 4) == spill_header_marker)
+        ++n_phantom_menaces;
+    } else if (line == spill_trailer_marker) {
+      // The number of chips is the fourth line of the spill trailer
+      if (iline + 3 < span.size()) {
+        n_chips = std::max(n_chips, (unsigned) span.line(iline + 3));
+        ++n_spill_trailers;
       }
     }
-  ifs.close();
-  
-  if (n_chips_vec.size() == 0) return 0;
+  }
 
-  return *std::max_element(n_chips_vec.begin(), n_chips_vec.end());
+  conclusive = at_end || n_spill_trailers >= PROBE_MIN_SPILLS;
+  return RawDataConfig(n_chips,
+                       NCHANNELS,
+                       n_duplicate_chipids >= 3 ? 2 : 1,
+                       n_spill_numbers >= 3,
+                       n_phantom_menaces >= 3,
+                       false,
+                       false);
 }
 
-///////////////////////////////////////////////////////////////////////////////
-//                            Increase stack size                            //
-///////////////////////////////////////////////////////////////////////////////
+RawDataConfig ProbeRawData(RawDataInput& input) {
+  RawDataSpan prefix = input.PeekLines(PROBE_MAX_LINES);
+  bool conclusive;
+  RawDataConfig config = ProbeRawData(prefix, prefix.size() < PROBE_MAX_LINES, conclusive);
+  if (!conclusive && dynamic_cast<MappedRawDataInput*>(&input) != NULL) {
+    Log.Write("[wgDecoder] The raw data format is ambiguous in the first " +
+              std::to_string(PROBE_MAX_LINES) + " lines : probing the whole file");
+    return ProbeRawData(input.PeekLines(std::numeric_limits<std::size_t>::max()),
+                        true, conclusive);
+  } else if (!conclusive) {
+    Log.eWrite("[wgDecoder] The raw data format is ambiguous in the first " +
+               std::to_string(PROBE_MAX_LINES) + " lines : using the best guess");
+  }
+  return config;
+}
 
-void increase_stack_size() {
-  const rlim_t kStackSize = 128L * 1024L * 1024L;   // min stack size = 64 Mb
-  struct rlimit rl;
-  int result;
-
-  result = getrlimit(RLIMIT_STACK, &rl);
-  if (result == 0)
-  {
-    if (rl.rlim_cur < kStackSize)
-    {
-      rl.rlim_cur = kStackSize;
-      result = setrlimit(RLIMIT_STACK, &rl);
-      if (result != 0)
-      {
-        fprintf(stderr, "setrlimit returned result = %d\n", result);
-      }
-    }
+RawDataConfig ProbeRawData(const std::string& input_raw_file) {
+  // No need to read the raw file if its spill index is available
+  SpillIndex index;
+  if (ReadSpillIndex(input_raw_file, index, true)) {
+    return RawDataConfig(index.max_n_chips, NCHANNELS, index.n_chip_id,
+                         index.has_spill_number, index.has_phantom_menace,
+                         false, false);
   }
+  std::unique_ptr<RawDataInput> input = OpenRawDataInput(input_raw_file);
+  return ProbeRawData(*input);
 }
 
 } // namespace wagasci_decoder_utils
@@ -0,0 +1,270 @@
+// system includes
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <ctime>
+#include <memory>
+
+// system C includes
+#include <cstdio>
+#include <getopt.h>
+
+// ROOT includes
+#include "TFile.h"
+#include "TTree.h"
+
+// nlohmann_json includes
+#include <nlohmann/json.hpp>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgErrorCodes.hpp"
+#include "wgExceptions.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgGetTree.hpp"
+#include "wgColumns.hpp"
+#include "wgDecoder.hpp"
+#include "wgRawEmulator.hpp"
+
+// Read benchmark of the columnar export (see wgColumns.hpp) against
+// the decoder TTree. A realistic raw file is generated with the
+// wgRawEmulator and decoded twice by the wgDecoder function, once with
+// the dense and once with the sparse TTree, both times together with
+// the columnar export. The same analysis (sum of the charge of all the
+// hit cells of all the spills) is then timed :
+//
+//  - root_dense : wgGetTree on the dense TTree (all branches),
+//
+//  - root_dense_selected : the dense TTree with only the charge and
+//    hit branches enabled,
+//
+//  - root_sparse : wgGetTree on the sparse TTree (the hit list is
+//    expanded into the Raw_t arrays),
+//
+//  - columns : ColumnReader on the columnar export.
+//
+// The time includes opening the files, so that the start-up cost of
+// ROOT is measured too. The files are read just after being written,
+// so they are in the page cache. The results are written in JSON
+// format and every measure is the best of "-n" repetitions. The sums
+// of all the readers must be the same.
+
+void print_help(const char * program_name) {
+  std::cout << program_name << " : columnar export read benchmark\n"
+      "  -s (int)   : number of spills (default 1000)\n"
+      "  -n (int)   : number of repetitions of each measure (default 3)\n"
+      "  -d (char*) : working directory for the raw, ROOT and column files (default .)\n"
+      "  -o (char*) : output JSON file (default bench_columns.json)\n"
+      "  -h         : print this help\n";
+  exit(0);
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+double Seconds(bench_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+struct ReadResult {
+  double seconds = 0;
+  long long n_entries = 0;
+  long long charge_sum = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  Readers                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+long long SumHitCharge(Raw_t& rd) {
+  long long sum = 0;
+  for (int ichip = 0; ichip < rd.n_chips; ++ichip)
+    for (int ichan = 0; ichan < rd.n_chans; ++ichan)
+      for (int icol = 0; icol < rd.n_cols; ++icol)
+        if (rd.hit[ichip][ichan][icol] == (int) HIT_BIT)
+          sum += rd.charge[ichip][ichan][icol];
+  return sum;
+}
+
+ReadResult ReadWithGetTree(const std::string& root_file, unsigned n_chips) {
+  ReadResult result;
+  auto start = bench_clock::now();
+  Raw_t rd(n_chips);
+  wgGetTree get_tree(root_file, rd, 1);
+  result.n_entries = get_tree.tree->GetEntries();
+  for (long long ientry = 0; ientry < result.n_entries; ++ientry) {
+    get_tree.GetEntry(ientry);
+    result.charge_sum += SumHitCharge(rd);
+  }
+  result.seconds = Seconds(bench_clock::now() - start);
+  return result;
+}
+
+ReadResult ReadSelectedBranches(const std::string& root_file, unsigned n_chips) {
+  ReadResult result;
+  auto start = bench_clock::now();
+  Raw_t rd(n_chips);
+  TFile file(root_file.c_str(), "read");
+  TTree * tree = (TTree*) file.Get("tree_dif_1");
+  if (tree == NULL) return result;
+  tree->SetBranchStatus("*", 0);
+  tree->SetBranchStatus("charge", 1);
+  tree->SetBranchStatus("hit", 1);
+  tree->SetBranchAddress("charge", rd.charge.data());
+  tree->SetBranchAddress("hit", rd.hit.data());
+  result.n_entries = tree->GetEntries();
+  for (long long ientry = 0; ientry < result.n_entries; ++ientry) {
+    tree->GetEntry(ientry);
+    result.charge_sum += SumHitCharge(rd);
+  }
+  file.Close();
+  result.seconds = Seconds(bench_clock::now() - start);
+  return result;
+}
+
+ReadResult ReadColumns(const std::string& columns_dir) {
+  ReadResult result;
+  auto start = bench_clock::now();
+  ColumnReader reader(columns_dir);
+  const int * charge = reader.GetColumn<int>("charge");
+  const int * hit = reader.GetColumn<int>("hit");
+  const std::vector<std::size_t>& shape = reader.GetShape("charge");
+  std::size_t n_cells = 1;
+  for (std::size_t dim : shape) n_cells *= dim;
+  for (std::size_t icell = 0; icell < n_cells; ++icell)
+    if (hit[icell] == (int) HIT_BIT)
+      result.charge_sum += charge[icell];
+  result.n_entries = reader.GetEntries();
+  result.seconds = Seconds(bench_clock::now() - start);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                    main                                   //
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+  int opt;
+  unsigned n_spills = 1000;
+  unsigned n_repetitions = 3;
+  std::string work_dir(".");
+  std::string output_file("bench_columns.json");
+
+  while ((opt = getopt(argc, argv, "s:n:d:o:h")) != -1) {
+    switch(opt) {
+      case 's':
+        n_spills = std::stoi(optarg);
+        break;
+      case 'n':
+        n_repetitions = std::stoi(optarg);
+        break;
+      case 'd':
+        work_dir = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'h':
+        print_help(argv[0]);
+        break;
+      default :
+        print_help(argv[0]);
+    }
+  }
+  if (n_repetitions == 0) n_repetitions = 1;
+
+  // The decoder log would be mixed with the benchmark output
+  Log.WhereToLog = LOGFILE;
+
+  // ============ Generate and decode the dataset ============ //
+
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = n_spills;
+  raw_config.n_chips = NCHIPS;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+  raw_config.realistic = true;
+  raw_config.seed = 0xC011;
+
+  const std::string dense_dir = work_dir + "/bench_columns_dense";
+  const std::string sparse_dir = work_dir + "/bench_columns_sparse";
+  const std::string raw_file = work_dir + "/bench_columns_ecal_dif_1.raw";
+  if (wgRawEmulator(raw_file, raw_config) != 0) {
+    std::cerr << "Failed to generate " << raw_file << "\n";
+    return 1;
+  }
+  for (bool sparse : {false, true}) {
+    DecoderOptions options;
+    options.overwrite = true;
+    options.sparse_output = sparse;
+    options.write_columns = true;
+    int result = DecodeRawFile(raw_file, "", sparse ? sparse_dir : dense_dir, 1, 0, options);
+    if (result != WG_SUCCESS) {
+      std::cerr << "Failed to decode " << raw_file << " : error " << result << "\n";
+      return 1;
+    }
+  }
+  const std::string dense_tree = dense_dir + "/bench_columns_ecal_dif_1_tree.root";
+  const std::string sparse_tree = sparse_dir + "/bench_columns_ecal_dif_1_tree.root";
+  const std::string columns_dir = dense_dir + "/bench_columns_ecal_dif_1_columns";
+
+  // ============ Read ============ //
+
+  const std::vector<std::string> reader_names = {
+    "root_dense", "root_dense_selected", "root_sparse", "columns"
+  };
+  std::vector<ReadResult> best(reader_names.size());
+  for (unsigned irep = 0; irep < n_repetitions; ++irep) {
+    for (std::size_t ireader = 0; ireader < reader_names.size(); ++ireader) {
+      ReadResult result;
+      switch (ireader) {
+        case 0 : result = ReadWithGetTree(dense_tree, NCHIPS); break;
+        case 1 : result = ReadSelectedBranches(dense_tree, NCHIPS); break;
+        case 2 : result = ReadWithGetTree(sparse_tree, NCHIPS); break;
+        default : result = ReadColumns(columns_dir); break;
+      }
+      if (irep == 0 || result.seconds < best[ireader].seconds) best[ireader] = result;
+    }
+  }
+
+  // ============ Results ============ //
+
+  nlohmann::json results;
+  results["benchmark"] = "bench_columns";
+  results["timestamp"] = (long) std::time(nullptr);
+  results["n_spills"] = n_spills;
+  results["n_repetitions"] = n_repetitions;
+  results["readers"] = nlohmann::json::array();
+  bool same_sums = true;
+  for (std::size_t ireader = 0; ireader < reader_names.size(); ++ireader) {
+    const ReadResult& result = best[ireader];
+    same_sums = same_sums && result.charge_sum == best.front().charge_sum &&
+                result.n_entries == best.front().n_entries;
+    nlohmann::json json;
+    json["reader"] = reader_names[ireader];
+    json["seconds"] = result.seconds;
+    json["n_entries"] = result.n_entries;
+    json["entries_per_s"] = result.seconds > 0 ? result.n_entries / result.seconds : 0;
+    json["charge_sum"] = result.charge_sum;
+    json["speedup_vs_root_dense"] = result.seconds > 0 ? best.front().seconds / result.seconds : 0;
+    results["readers"].push_back(json);
+    std::cout << reader_names[ireader] << " : " << result.seconds << " s, " <<
+        json["entries_per_s"].get<double>() << " spills/s\n";
+  }
+  results["same_sums"] = same_sums;
+  if (!same_sums)
+    std::cerr << "The readers do not agree on the charge sum!\n";
+
+  std::remove(raw_file.c_str());
+
+  std::ofstream ofs(output_file);
+  ofs << results.dump(2) << "\n";
+  if (!ofs) {
+    std::cerr << "Failed to write " << output_file << "\n";
+    return 1;
+  }
+  std::cout << "Results written to " << output_file << "\n";
+  return same_sums ? 0 : 1;
+}
@@ -0,0 +1,465 @@
+// system includes
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <ctime>
+#include <memory>
+#include <algorithm>
+
+// system C includes
+#include <cstdio>
+#include <getopt.h>
+#include <sys/resource.h>
+
+// ROOT includes
+#include "TFile.h"
+#include "TTree.h"
+
+// nlohmann_json includes
+#include <nlohmann/json.hpp>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgErrorCodes.hpp"
+#include "wgExceptions.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoder.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderOutput.hpp"
+#include "wgRawEmulator.hpp"
+
+// Decoder throughput benchmark. A set of raw files of different shapes
+// (number of chips, number of columns, spill number and phantom menace
+// sections, rate of injected faults) is generated with the wgRawEmulator
+// and decoded twice:
+//
+//  - by the wgDecoder function, to measure the end-to-end throughput
+//    (MB/s, spills/s) and the peak resident memory,
+//
+//  - by a SectionSeeker/SectionReader loop like the one of the
+//    DecodeDifFile function, to split the decoding time among the seek,
+//    read (headers and trailers), unpack (chip raw data) and fill
+//    (TTree::Fill) stages.
+//
+// The largest clean datasets are then decoded once for each output
+// profile (see wgDecoderOutput.hpp) to compare the size of the ROOT
+// files and the write and read throughput. The file is read back just
+// after being written, so the read time is mostly the decompression
+// time.
+//
+// The results are written in JSON format so that they can be compared
+// between commits. The number of faults injected by the wgRawEmulator
+// is reported too, so that the decoded spills can be compared with the
+// ground truth. Every measure is the best of "-n" repetitions.
+
+void print_help(const char * program_name) {
+  std::cout << program_name << " : wgDecoder throughput benchmark\n"
+      "  -s (int)   : number of spills of each dataset (default 200)\n"
+      "  -n (int)   : number of repetitions of each measure (default 3)\n"
+      "  -d (char*) : working directory for the raw and ROOT files (default .)\n"
+      "  -t (int)   : number of threads of the output profile benchmark (default 1)\n"
+      "  -o (char*) : output JSON file (default bench_decoder.json)\n"
+      "  -h         : print this help\n";
+  exit(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                   Datasets                                //
+///////////////////////////////////////////////////////////////////////////////
+
+struct Dataset {
+  std::string name;
+  RawEmulatorConfig raw;
+};
+
+// Probability of each kind of fault per spill (or per chip) in the
+// corrupted datasets
+const double BENCH_FAULT_RATE = 0.01;
+
+void SetFaultRates(RawEmulatorConfig& raw, double fault_rate) {
+  raw.seed = 0xDEC0DE;
+  raw.dropped_byte_rate = fault_rate;
+  raw.duplicated_byte_rate = fault_rate;
+  raw.missing_chip_trailer_rate = fault_rate;
+  raw.truncated_column_rate = fault_rate;
+  raw.spill_count_gap_rate = fault_rate;
+  raw.chip_id_mismatch_rate = fault_rate;
+}
+
+std::vector<Dataset> MakeDatasets(unsigned n_spills) {
+  std::vector<Dataset> datasets;
+  for (unsigned n_chips : {1u, 3u, NCHIPS}) {
+    for (unsigned n_columns : {1u, MEMDEPTH}) {
+      for (unsigned variant = 0; variant < 3; ++variant) {
+        for (double fault_rate : {0.0, BENCH_FAULT_RATE}) {
+          Dataset dataset;
+          dataset.raw.n_spills = n_spills;
+          dataset.raw.n_chips = n_chips;
+          dataset.raw.n_columns = n_columns;
+          dataset.raw.n_chip_id = 2;
+          dataset.raw.has_spill_number = variant == 1;
+          dataset.raw.has_phantom_menace = variant == 2;
+          dataset.raw.charge = 700;
+          dataset.raw.time = 1200;
+          dataset.raw.bcid = 33;
+          SetFaultRates(dataset.raw, fault_rate);
+          std::ostringstream name;
+          name << "chips" << n_chips << "_cols" << n_columns << "_" <<
+              (variant == 0 ? "plain" : variant == 1 ? "spillnumber" : "phantom") <<
+              (fault_rate > 0 ? "_faults" : "_clean");
+          dataset.name = name.str();
+          datasets.push_back(dataset);
+        }
+      }
+    }
+    // Dark noise with a varying number of columns per chip
+    for (double fault_rate : {0.0, BENCH_FAULT_RATE}) {
+      Dataset dataset;
+      dataset.raw.n_spills = n_spills;
+      dataset.raw.n_chips = n_chips;
+      dataset.raw.n_columns = MEMDEPTH;
+      dataset.raw.n_chip_id = 2;
+      dataset.raw.realistic = true;
+      SetFaultRates(dataset.raw, fault_rate);
+      dataset.name = "chips" + std::to_string(n_chips) + "_realistic" +
+                     (fault_rate > 0 ? "_faults" : "_clean");
+      datasets.push_back(dataset);
+    }
+  }
+  return datasets;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Peak memory                               //
+///////////////////////////////////////////////////////////////////////////////
+
+// Reset the peak resident set size of the process (Linux only)
+void ResetPeakRss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  if (clear_refs.is_open()) clear_refs << "5";
+}
+
+// Peak resident set size of the process in kB
+long PeakRss() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return std::stol(line.substr(6));
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                   Stages                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+struct StageTimes {
+  double seek = 0;
+  double read = 0;
+  double unpack = 0;
+  double fill = 0;
+  double total = 0;
+  unsigned n_spills = 0;
+  SpillCounter counter;
+  unsigned skipped_lines = 0;
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+double Seconds(bench_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+StageTimes DecodeStages(const std::string& raw_file, const std::string& root_file) {
+  StageTimes times;
+  RawDataConfig format = wagasci_decoder_utils::ProbeRawData(raw_file);
+  if (format.n_chips == 0) return times;
+  RawDataConfig config(format.n_chips, NCHANNELS, format.n_chip_id, format.has_spill_number,
+                       format.has_phantom_menace, false, false);
+  unsigned n_chips = config.n_chips;
+  Raw_t rd(n_chips);
+
+  TFile file(root_file.c_str(), "recreate");
+  TTree * tree = new TTree("tree", "tree");
+  tree->SetDirectory(&file);
+  tree->Branch("spill_number", &rd.spill_number , "spill_number/I");
+  tree->Branch("spill_mode"  , &rd.spill_mode   , "spill_mode/I");
+  tree->Branch("spill_count" , &rd.spill_count  , "spill_count/I");
+  tree->Branch("chipid"      , rd.chipid.data() , Form("chipid[%d]/I"         , n_chips));
+  tree->Branch("charge"      , rd.charge.data() , Form("charge[%d][%d][%d]/I" , n_chips, NCHANNELS, MEMDEPTH));
+  tree->Branch("time"        , rd.time.data()   , Form("time[%d][%d][%d]/I"   , n_chips, NCHANNELS, MEMDEPTH));
+  tree->Branch("bcid"        , rd.bcid.data()   , Form("bcid[%d][%d]/I"       , n_chips, MEMDEPTH));
+  tree->Branch("hit"         , rd.hit.data()    , Form("hit[%d][%d][%d]/I"    , n_chips, NCHANNELS, MEMDEPTH));
+  tree->Branch("gs"          , rd.gs.data()     , Form("gs[%d][%d][%d]/I"     , n_chips, NCHANNELS, MEMDEPTH));
+
+  bench_clock::duration seek(0), read(0), unpack(0), fill(0);
+  auto start = bench_clock::now();
+  std::unique_ptr<RawDataInput> input = OpenRawDataInput(raw_file);
+  SectionSeeker seeker(config);
+  SectionReader reader(config, [&](Raw_t&) {
+      auto fill_start = bench_clock::now();
+      tree->Fill();
+      fill += bench_clock::now() - fill_start;
+      ++times.n_spills;
+    }, rd);
+  try {
+    while (true) {
+      auto seek_start = bench_clock::now();
+      SectionSeeker::Section section = seeker.SeekNextSection(*input, times.skipped_lines);
+      auto read_start = bench_clock::now();
+      seek += read_start - seek_start;
+      reader.ReadNextSection(section);
+      if (section.type == SectionSeeker::SectionType::RawData)
+        unpack += bench_clock::now() - read_start;
+      else
+        read += bench_clock::now() - read_start;
+      times.counter.Count(section);
+    }
+  } catch (const wgEOF&) {}
+  tree->Write();
+  file.Close();
+  times.total = Seconds(bench_clock::now() - start);
+
+  // The spills are filled while reading the spill trailers
+  times.seek = Seconds(seek);
+  times.read = Seconds(read - fill);
+  times.unpack = Seconds(unpack);
+  times.fill = Seconds(fill);
+  return times;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               Output profiles                             //
+///////////////////////////////////////////////////////////////////////////////
+
+// Datasets used to compare the output profiles
+const std::vector<std::string> PROFILE_DATASETS = {
+  "chips20_cols16_plain_clean", "chips20_realistic_clean"
+};
+
+struct ProfileTimes {
+  int result = WG_SUCCESS;
+  double write = 0;
+  double read = 0;
+  long long file_bytes = 0;
+  long long read_bytes = 0;
+  long long n_entries = 0;
+};
+
+// Read all the branches of all the entries of the tree_name TTree
+double ReadTree(const std::string& root_file, const std::string& tree_name,
+                ProfileTimes& times) {
+  auto start = bench_clock::now();
+  TFile file(root_file.c_str(), "read");
+  TTree * tree = (TTree*) file.Get(tree_name.c_str());
+  if (tree == NULL) return 0;
+  times.file_bytes = file.GetSize();
+  times.n_entries = tree->GetEntries();
+  times.read_bytes = 0;
+  for (long long ientry = 0; ientry < times.n_entries; ++ientry)
+    times.read_bytes += tree->GetEntry(ientry);
+  file.Close();
+  return Seconds(bench_clock::now() - start);
+}
+
+ProfileTimes BenchProfile(const std::string& raw_file, const std::string& root_file,
+                          const std::string& work_dir, const std::string& profile,
+                          unsigned n_threads, unsigned n_repetitions) {
+  ProfileTimes times;
+  for (unsigned irep = 0; irep < n_repetitions; ++irep) {
+    auto start = bench_clock::now();
+    DecoderOptions options;
+    options.overwrite = true;
+    options.n_threads = n_threads;
+    options.output_profile = profile;
+    times.result = DecodeRawFile(raw_file, "", work_dir, 1, 0, options);
+    double write = Seconds(bench_clock::now() - start);
+    if (irep == 0 || write < times.write) times.write = write;
+    double read = ReadTree(root_file, "tree_dif_1", times);
+    if (irep == 0 || read < times.read) times.read = read;
+  }
+  return times;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                    main                                   //
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+  int opt;
+  unsigned n_spills = 200;
+  unsigned n_repetitions = 3;
+  unsigned n_threads = 1;
+  std::string work_dir(".");
+  std::string output_file("bench_decoder.json");
+
+  while ((opt = getopt(argc, argv, "s:n:d:t:o:h")) != -1) {
+    switch(opt) {
+      case 's':
+        n_spills = std::stoi(optarg);
+        break;
+      case 'n':
+        n_repetitions = std::stoi(optarg);
+        break;
+      case 'd':
+        work_dir = optarg;
+        break;
+      case 't':
+        n_threads = std::stoi(optarg);
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'h':
+        print_help(argv[0]);
+        break;
+      default :
+        print_help(argv[0]);
+    }
+  }
+  if (n_repetitions == 0) n_repetitions = 1;
+
+  // The decoder log would be mixed with the benchmark output
+  Log.WhereToLog = LOGFILE;
+
+  nlohmann::json results;
+  results["benchmark"] = "bench_decoder";
+  results["timestamp"] = (long) std::time(nullptr);
+  results["n_spills"] = n_spills;
+  results["n_repetitions"] = n_repetitions;
+  results["datasets"] = nlohmann::json::array();
+  results["profiles"] = nlohmann::json::array();
+
+  for (const Dataset& dataset : MakeDatasets(n_spills)) {
+    std::string raw_file = work_dir + "/bench_decoder_" + dataset.name + ".raw";
+    std::string root_file = work_dir + "/bench_decoder_" + dataset.name + "_tree.root";
+    std::string stages_file = work_dir + "/bench_decoder_stages.root";
+    std::string manifest_file = work_dir + "/bench_decoder_" + dataset.name + ".json";
+
+    // ============ Generate the dataset ============ //
+
+    RawEmulatorConfig raw_config = dataset.raw;
+    raw_config.manifest_file = manifest_file;
+    if (wgRawEmulator(raw_file, raw_config) != 0) {
+      std::cerr << "Failed to generate " << raw_file << "\n";
+      return 1;
+    }
+    nlohmann::json manifest;
+    {
+      std::ifstream manifest_is(manifest_file);
+      manifest_is >> manifest;
+    }
+    std::size_t size;
+    {
+      MappedRawDataInput input(raw_file);
+      size = input.size();
+    }
+    double size_mb = size / 1e6;
+
+    // ============ Decode ============ //
+
+    double decoder_time = 0;
+    long peak_rss = 0;
+    int result = WG_SUCCESS;
+    StageTimes stages;
+    for (unsigned irep = 0; irep < n_repetitions; ++irep) {
+      ResetPeakRss();
+      auto start = bench_clock::now();
+      DecoderOptions options;
+      options.overwrite = true;
+      result = DecodeRawFile(raw_file, "", work_dir, 1, 0, options);
+      double time = Seconds(bench_clock::now() - start);
+      if (irep == 0 || time < decoder_time) decoder_time = time;
+      peak_rss = std::max(peak_rss, PeakRss());
+
+      StageTimes rep_stages = DecodeStages(raw_file, stages_file);
+      if (irep == 0 || rep_stages.total < stages.total) stages = rep_stages;
+    }
+
+    // ============ Results ============ //
+
+    nlohmann::json json;
+    json["name"] = dataset.name;
+    json["n_spills"] = dataset.raw.n_spills;
+    json["n_chips"] = dataset.raw.n_chips;
+    json["n_columns"] = dataset.raw.n_columns;
+    json["has_spill_number"] = dataset.raw.has_spill_number;
+    json["has_phantom_menace"] = dataset.raw.has_phantom_menace;
+    json["realistic"] = dataset.raw.realistic;
+    json["fault_rate"] = dataset.raw.dropped_byte_rate;
+    json["injected_faults"] = manifest["fault_totals"];
+    json["corrupted_spills"] = manifest["n_corrupted_spills"];
+    json["size_bytes"] = size;
+    json["decoded_spills"] = stages.n_spills;
+    json["good_spills"] = stages.counter.n_good_spills;
+    json["bad_spills"] = stages.counter.n_bad_spills;
+    json["skipped_lines"] = stages.skipped_lines;
+    json["decoder"]["result"] = result;
+    json["decoder"]["seconds"] = decoder_time;
+    json["decoder"]["mb_per_s"] = size_mb / decoder_time;
+    json["decoder"]["spills_per_s"] = stages.n_spills / decoder_time;
+    json["decoder"]["peak_rss_kb"] = peak_rss;
+    json["stages"]["seek_seconds"] = stages.seek;
+    json["stages"]["read_seconds"] = stages.read;
+    json["stages"]["unpack_seconds"] = stages.unpack;
+    json["stages"]["fill_seconds"] = stages.fill;
+    json["stages"]["total_seconds"] = stages.total;
+    json["stages"]["mb_per_s"] = size_mb / stages.total;
+    results["datasets"].push_back(json);
+
+    std::cout << dataset.name << " : " << size_mb / decoder_time << " MB/s, " <<
+        stages.n_spills / decoder_time << " spills/s\n";
+
+    // ============ Output profiles ============ //
+
+    if (std::find(PROFILE_DATASETS.begin(), PROFILE_DATASETS.end(), dataset.name) !=
+        PROFILE_DATASETS.end()) {
+      for (const std::string& profile : OutputProfileNames()) {
+        ProfileTimes times = BenchProfile(raw_file, root_file, work_dir, profile,
+                                          n_threads, n_repetitions);
+        nlohmann::json profile_json;
+        profile_json["dataset"] = dataset.name;
+        profile_json["profile"] = profile;
+        profile_json["n_threads"] = n_threads;
+        profile_json["result"] = times.result;
+        profile_json["file_bytes"] = times.file_bytes;
+        profile_json["compression_ratio"] = times.file_bytes > 0 ?
+                                            (double) times.read_bytes / times.file_bytes : 0;
+        profile_json["write_seconds"] = times.write;
+        profile_json["write_mb_per_s"] = size_mb / times.write;
+        profile_json["read_seconds"] = times.read;
+        profile_json["read_mb_per_s"] = times.read > 0 ? times.read_bytes / 1e6 / times.read : 0;
+        profile_json["read_entries_per_s"] = times.read > 0 ? times.n_entries / times.read : 0;
+        results["profiles"].push_back(profile_json);
+
+        std::cout << dataset.name << " profile " << profile << " : " <<
+            times.file_bytes / 1e6 << " MB, write " << size_mb / times.write <<
+            " MB/s, read " << profile_json["read_mb_per_s"].get<double>() << " MB/s\n";
+      }
+    }
+
+    std::remove(raw_file.c_str());
+    std::remove(root_file.c_str());
+    std::remove(stages_file.c_str());
+    std::remove(manifest_file.c_str());
+  }
+
+  std::ofstream ofs(output_file);
+  ofs << results.dump(2) << "\n";
+  if (!ofs) {
+    std::cerr << "Failed to write " << output_file << "\n";
+    return 1;
+  }
+  std::cout << "Results written to " << output_file << "\n";
+  return 0;
+}
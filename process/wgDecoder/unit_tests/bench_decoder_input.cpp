@@ -0,0 +1,102 @@
+// system includes
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+// system C includes
+#include <getopt.h>
+
+// ROOT includes
+#include "TTree.h"
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgRawEmulator.hpp"
+
+// Compare the decoding throughput of the memory-mapped input backend
+// with the stream fallback on a file generated by the wgRawEmulator.
+
+void print_help(const char * program_name) {
+  std::cout << program_name << " : wgDecoder input backends throughput comparison\n"
+      "  -s (int)   : number of spills (default 1000)\n"
+      "  -c (int)   : number of chips (default 20)\n"
+      "  -o (char*) : raw file to generate (default bench_decoder_input.raw)\n"
+      "  -h         : print this help\n";
+  exit(0);
+}
+
+double Decode(RawDataInput& input, const RawDataConfig& config) {
+  Raw_t rd(config.n_chips);
+  TTree tree("tree", "tree");
+  tree.Branch("spill_count", &rd.spill_count, "spill_count/I");
+  auto start = std::chrono::steady_clock::now();
+  try {
+    SectionSeeker seeker(config);
+    SectionReader reader(config, &tree, rd);
+    unsigned skipped_lines = 0;
+    while (true) {
+      SectionSeeker::Section section = seeker.SeekNextSection(input, skipped_lines);
+      reader.ReadNextSection(section);
+    }
+  } catch (const wgEOF&) {}
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  std::string raw_file("bench_decoder_input.raw");
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = 1000;
+  raw_config.n_chips = 20;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+
+  while ((opt = getopt(argc, argv, "s:c:o:h")) != -1) {
+    switch(opt) {
+      case 's':
+        raw_config.n_spills = std::stoi(optarg);
+        break;
+      case 'c':
+        raw_config.n_chips = std::stoi(optarg);
+        break;
+      case 'o':
+        raw_file = optarg;
+        break;
+      case 'h':
+        print_help(argv[0]);
+        break;
+      default :
+        print_help(argv[0]);
+    }
+  }
+
+  if (wgRawEmulator(raw_file, raw_config) != 0) {
+    std::cout << "Failed to generate " << raw_file << "\n";
+    return 1;
+  }
+  RawDataConfig config(raw_config.n_chips, NCHANNELS, raw_config.n_chip_id,
+                       raw_config.has_spill_number, false, false, false);
+
+  MappedRawDataInput mapped_input(raw_file);
+  double size_mb = mapped_input.size() / 1e6;
+  double mapped_time = Decode(mapped_input, config);
+
+  std::ifstream ifs(raw_file.c_str(), std::ios_base::in | std::ios_base::binary);
+  StreamRawDataInput stream_input(ifs);
+  double stream_time = Decode(stream_input, config);
+
+  std::cout << "File size          : " << size_mb << " MB\n";
+  std::cout << "Memory-mapped input: " << mapped_time << " s (" <<
+      size_mb / mapped_time << " MB/s)\n";
+  std::cout << "Stream input       : " << stream_time << " s (" <<
+      size_mb / stream_time << " MB/s)\n";
+  return 0;
+}
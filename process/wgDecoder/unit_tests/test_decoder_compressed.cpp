@@ -0,0 +1,220 @@
+// system includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <memory>
+#include <stdexcept>
+
+// system C includes
+#include <cstdio>
+#include <cstring>
+
+// compression libraries
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderCompressed.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgRawEmulator.hpp"
+
+// A compressed raw file must be decoded exactly like the uncompressed
+// one. A raw file is generated with the wgRawEmulator and some bytes
+// are corrupted, so that the SectionSeeker has to resynchronize while
+// reading the decompressed stream. The file is compressed in the
+// gzip, zstd and xz formats and every file is probed and decoded. All
+// the per-spill data passed to the fill function is recorded and
+// compared with the decoding of the uncompressed file. The formats
+// whose library was not found when building the wgDecoder are
+// skipped.
+
+// Per-spill data of all the spills, in fill order
+typedef std::vector<std::vector<char>> SpillRecords;
+
+template <typename T>
+void Append(std::vector<char>& record, const T * data, std::size_t size) {
+  const char * bytes = reinterpret_cast<const char *>(data);
+  record.insert(record.end(), bytes, bytes + size * sizeof(T));
+}
+
+void Record(SpillRecords& records, Raw_t& rd) {
+  const std::size_t n_cells = rd.n_chips * rd.n_chans * rd.n_cols;
+  std::vector<char> record;
+  Append(record, &rd.spill_number, 1);
+  Append(record, &rd.spill_mode, 1);
+  Append(record, &rd.spill_count, 1);
+  Append(record, rd.chipid.data(), rd.chipid.size());
+  Append(record, rd.charge.data(), n_cells);
+  Append(record, rd.time.data(), n_cells);
+  Append(record, rd.bcid.data(), (std::size_t) rd.n_chips * rd.n_cols);
+  Append(record, rd.hit.data(), n_cells);
+  Append(record, rd.gs.data(), n_cells);
+  Append(record, rd.debug_spill.data(), rd.debug_spill.size());
+  Append(record, rd.debug_chip.data(), (std::size_t) rd.n_chips * N_DEBUG_CHIP);
+  records.push_back(record);
+}
+
+// Decode the raw_file file. The skipped lines are returned in
+// skipped_lines.
+SpillRecords Decode(const std::string& raw_file, const RawDataConfig& config,
+                    unsigned& skipped_lines) {
+  SpillRecords records;
+  std::unique_ptr<RawDataInput> input = OpenRawDataInput(raw_file);
+  Raw_t rd(config.n_chips);
+  SectionReader::filler fill = [&](Raw_t& spill_rd) { Record(records, spill_rd); };
+  SectionSeeker seeker(config);
+  SectionReader reader(config, fill, rd);
+  skipped_lines = 0;
+  try {
+    while (true) {
+      SectionSeeker::Section section = seeker.SeekNextSection(*input, skipped_lines);
+      reader.ReadNextSection(section);
+    }
+  } catch (const wgEOF&) {}
+  return records;
+}
+
+// Compress the bytes into the compressed_file file. Return false if
+// the format is not available.
+bool Compress(const std::vector<char>& bytes, const std::string& compressed_file,
+              RawDataCompression compression) {
+  std::vector<char> compressed;
+  switch (compression) {
+    case RAW_DATA_GZIP : {
+#ifdef HAVE_ZLIB
+      gzFile gz = gzopen(compressed_file.c_str(), "wb");
+      if (gz == NULL || gzwrite(gz, bytes.data(), bytes.size()) != (int) bytes.size())
+        throw std::runtime_error("gzip compression failed");
+      gzclose(gz);
+      return true;
+#else
+      return false;
+#endif
+    }
+    case RAW_DATA_ZSTD : {
+#ifdef HAVE_ZSTD
+      compressed.resize(ZSTD_compressBound(bytes.size()));
+      std::size_t size = ZSTD_compress(compressed.data(), compressed.size(),
+                                       bytes.data(), bytes.size(), 3);
+      if (ZSTD_isError(size))
+        throw std::runtime_error("zstd compression failed");
+      compressed.resize(size);
+      break;
+#else
+      return false;
+#endif
+    }
+    case RAW_DATA_XZ : {
+#ifdef HAVE_LZMA
+      compressed.resize(lzma_stream_buffer_bound(bytes.size()));
+      std::size_t size = 0;
+      if (lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, NULL,
+                                  reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(),
+                                  reinterpret_cast<uint8_t *>(compressed.data()), &size,
+                                  compressed.size()) != LZMA_OK)
+        throw std::runtime_error("xz compression failed");
+      compressed.resize(size);
+      break;
+#else
+      return false;
+#endif
+    }
+    default :
+      return false;
+  }
+  std::ofstream ofs(compressed_file, std::ios::binary);
+  ofs.write(compressed.data(), compressed.size());
+  return true;
+}
+
+int main() {
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = 100;
+  raw_config.n_chips = 3;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+  raw_config.has_spill_number = true;
+  raw_config.realistic = true;
+  raw_config.seed = 0xC0DE;
+
+  const std::string raw_file = "compressed_test.raw";
+  wgRawEmulator(raw_file, raw_config);
+
+  std::ifstream ifs(raw_file, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(ifs)),
+                          std::istreambuf_iterator<char>());
+  ifs.close();
+  std::mt19937 rng(raw_config.seed);
+  for (unsigned ierror = 0; ierror < 10; ++ierror) {
+    std::size_t position = rng() % bytes.size();
+    switch (rng() % 3) {
+      case 0 : bytes[position] = (char) rng(); break;
+      case 1 : bytes.erase(bytes.begin() + position); break;
+      default : bytes.insert(bytes.begin() + position, (char) rng()); break;
+    }
+  }
+  std::ofstream ofs(raw_file, std::ios::binary);
+  ofs.write(bytes.data(), bytes.size());
+  ofs.close();
+
+  const RawDataConfig config = wagasci_decoder_utils::ProbeRawData(raw_file);
+  unsigned skipped_lines = 0;
+  const SpillRecords expected = Decode(raw_file, config, skipped_lines);
+  std::remove(raw_file.c_str());
+  if (expected.empty()) {
+    std::cout << "[CompressedRawDataInput] no spill decoded from the uncompressed file\n";
+    return 1;
+  }
+
+  int result = 0;
+  for (RawDataCompression compression : {RAW_DATA_GZIP, RAW_DATA_ZSTD, RAW_DATA_XZ}) {
+    const std::string name = RawDataCompressionName(compression);
+    const std::string compressed_file = raw_file + (compression == RAW_DATA_GZIP ? ".gz" :
+                                                    compression == RAW_DATA_ZSTD ? ".zst" :
+                                                    ".xz");
+    if (!Compress(bytes, compressed_file, compression)) {
+      std::cout << "[CompressedRawDataInput] " << name << " skipped : library not found\n";
+      continue;
+    }
+    try {
+      if (GetRawDataCompression(compressed_file) != compression)
+        throw std::runtime_error("compression format not detected");
+      const RawDataConfig compressed_config = wagasci_decoder_utils::ProbeRawData(compressed_file);
+      if (compressed_config.n_chips != config.n_chips ||
+          compressed_config.n_chip_id != config.n_chip_id ||
+          compressed_config.has_spill_number != config.has_spill_number ||
+          compressed_config.has_phantom_menace != config.has_phantom_menace)
+        throw std::runtime_error("different raw data format probed");
+      unsigned compressed_skipped_lines = 0;
+      SpillRecords records = Decode(compressed_file, config, compressed_skipped_lines);
+      if (records != expected || compressed_skipped_lines != skipped_lines) {
+        std::cout << "[CompressedRawDataInput] spills : " << records.size() <<
+            " | uncompressed spills : " << expected.size() << " | skipped lines : " <<
+            compressed_skipped_lines << " | uncompressed skipped lines : " <<
+            skipped_lines << "\n";
+        throw std::runtime_error("different spills decoded");
+      }
+    } catch (const std::exception& e) {
+      std::cout << "[CompressedRawDataInput] " << name << " test failed : " << e.what() << "\n";
+      result = 1;
+    }
+    std::remove(compressed_file.c_str());
+  }
+  return result;
+}
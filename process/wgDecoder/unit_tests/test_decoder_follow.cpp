@@ -0,0 +1,182 @@
+// system includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <thread>
+#include <chrono>
+
+// system C includes
+#include <cstdio>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgErrorCodes.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgGetTree.hpp"
+#include "wgDecoder.hpp"
+#include "wgDecoderFollow.hpp"
+#include "wgRawEmulator.hpp"
+
+// A raw file decoded in follow mode while it is being written must give
+// exactly the same TTree as the decoding of the whole file in one go.
+// A raw file is generated with the wgRawEmulator and some bytes are
+// corrupted. The wgDecoder follows the raw file while another thread
+// writes it in steps that end in the middle of a spill, so that the
+// follower has to roll back to the last complete spill every time.
+// When the whole file is written the stop file is created (the idle
+// timeout only makes sure that the test never hangs). The raw file is
+// then decoded again in one go and both TTrees are compared entry by
+// entry.
+
+const unsigned N_CHIPS = 3;
+const unsigned DIF = 1;
+// Number of steps in which the raw file is written
+const unsigned N_STEPS = 6;
+// Time between two steps
+const unsigned STEP_MILLISECONDS = 2 * FOLLOW_POLL_MILLISECONDS;
+
+// Compare one entry of the followed (rf) and one-shot (ro) TTrees
+bool CompareEntry(Raw_t& rf, Raw_t& ro) {
+  if (rf.spill_number != ro.spill_number || rf.spill_mode != ro.spill_mode ||
+      rf.spill_count != ro.spill_count) {
+    std::cout << "[wgDecoder] spill info mismatch : spill_count " << ro.spill_count <<
+        " | followed spill_count " << rf.spill_count << "\n";
+    return false;
+  }
+  for (unsigned ichip = 0; ichip < N_CHIPS; ++ichip) {
+    if (rf.chipid[ichip] != ro.chipid[ichip]) {
+      std::cout << "[wgDecoder] chipid mismatch : chip " << ichip << "\n";
+      return false;
+    }
+    for (unsigned icol = 0; icol < MEMDEPTH; ++icol) {
+      if (rf.bcid[ichip][icol] != ro.bcid[ichip][icol]) {
+        std::cout << "[wgDecoder] bcid mismatch : chip " << ichip << ", column " << icol << "\n";
+        return false;
+      }
+      for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
+        if (rf.hit   [ichip][ichan][icol] != ro.hit   [ichip][ichan][icol] ||
+            rf.charge[ichip][ichan][icol] != ro.charge[ichip][ichan][icol] ||
+            rf.time  [ichip][ichan][icol] != ro.time  [ichip][ichan][icol] ||
+            rf.gs    [ichip][ichan][icol] != ro.gs    [ichip][ichan][icol]) {
+          std::cout << "[wgDecoder] cell mismatch : chip " << ichip << ", channel " << ichan <<
+              ", column " << icol << "\n";
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  // The decoder log would be mixed with the test output
+  Log.WhereToLog = LOGFILE;
+
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = 60;
+  raw_config.n_chips = N_CHIPS;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+  raw_config.has_spill_number = true;
+  raw_config.realistic = true;
+  raw_config.seed = 0xF011;
+
+  const std::string raw_file = "follow_ecal_dif_1.raw";
+  const std::string stop_file = "follow_test.stop";
+  const std::string followed_dir = "follow_test_followed";
+  const std::string oneshot_dir = "follow_test_oneshot";
+  if (wgRawEmulator(raw_file, raw_config) != 0) {
+    std::cout << "[wgRawEmulator] failed to generate " << raw_file << "\n";
+    return 1;
+  }
+  std::ifstream ifs(raw_file, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(ifs)),
+                          std::istreambuf_iterator<char>());
+  ifs.close();
+  std::mt19937 rng(raw_config.seed);
+  for (unsigned ierror = 0; ierror < 10; ++ierror) {
+    std::size_t position = rng() % bytes.size();
+    switch (rng() % 3) {
+      case 0 : bytes[position] = (char) rng(); break;
+      case 1 : bytes.erase(bytes.begin() + position); break;
+      default : bytes.insert(bytes.begin() + position, (char) rng()); break;
+    }
+  }
+
+  // ============ Follow the raw file while it is written ============ //
+
+  // The step sizes are not a multiple of the spill size, so that every
+  // step but the last one ends in the middle of a spill
+  std::vector<std::size_t> steps;
+  for (unsigned istep = 1; istep < N_STEPS; ++istep)
+    steps.push_back(bytes.size() * istep / N_STEPS + rng() % 1000);
+  steps.push_back(bytes.size());
+
+  std::remove(stop_file.c_str());
+  std::ofstream ofs(raw_file, std::ios::binary | std::ios::trunc);
+  ofs.write(bytes.data(), steps[0]);
+  ofs.flush();
+
+  std::thread writer([&]() {
+      for (unsigned istep = 1; istep < steps.size(); ++istep) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MILLISECONDS));
+        ofs.write(bytes.data() + steps[istep - 1], steps[istep] - steps[istep - 1]);
+        ofs.flush();
+      }
+      ofs.close();
+      std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MILLISECONDS));
+      std::ofstream stop(stop_file);
+    });
+
+  DecoderOptions options;
+  options.overwrite = true;
+  options.follow = true;
+  options.stop_file = stop_file;
+  options.idle_timeout = 60;
+  int follow_result = DecodeRawFile(raw_file, "", followed_dir, DIF, 0, options);
+  writer.join();
+  std::remove(stop_file.c_str());
+  if (follow_result != WG_SUCCESS) {
+    std::cout << "[wgDecoder] follow mode decoding failed with error " << follow_result << "\n";
+    std::remove(raw_file.c_str());
+    return 1;
+  }
+
+  // ============ Decode the whole raw file in one go ============ //
+
+  options.follow = false;
+  options.stop_file.clear();
+  options.idle_timeout = 0;
+  int oneshot_result = DecodeRawFile(raw_file, "", oneshot_dir, DIF, 0, options);
+  std::remove(raw_file.c_str());
+  if (oneshot_result != WG_SUCCESS) {
+    std::cout << "[wgDecoder] one-shot decoding failed with error " << oneshot_result << "\n";
+    return 1;
+  }
+
+  // ============ Compare the TTrees ============ //
+
+  int result = 0;
+  Raw_t rf(N_CHIPS), ro(N_CHIPS);
+  wgGetTree followed(followed_dir + "/follow_ecal_dif_1_tree.root", rf, DIF);
+  wgGetTree oneshot(oneshot_dir + "/follow_ecal_dif_1_tree.root", ro, DIF);
+  const Long64_t n_entries = oneshot.tree->GetEntries();
+  if (n_entries == 0 || followed.tree->GetEntries() != n_entries) {
+    std::cout << "[wgDecoder] entries : " << followed.tree->GetEntries() <<
+        " | one-shot entries : " << n_entries << "\n";
+    result = 1;
+  }
+  for (Long64_t ientry = 0; result == 0 && ientry < n_entries; ++ientry) {
+    followed.GetEntry(ientry);
+    oneshot.GetEntry(ientry);
+    if (!CompareEntry(rf, ro)) {
+      std::cout << "[wgDecoder] follow mode test failed at entry " << ientry << "\n";
+      result = 1;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,244 @@
+// system includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <memory>
+
+// system C includes
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <utime.h>
+#include <unistd.h>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgDecoderIndex.hpp"
+#include "wgRawEmulator.hpp"
+
+// The spill index sidecar must describe the raw file exactly and must
+// be ignored as soon as the raw file changes. A raw file is generated
+// with the wgRawEmulator and some bytes are corrupted. Then :
+//
+//  - the index is built and written next to the raw file. It is read
+//    back and must have one entry per spill of a full sequential
+//    decoding, with the same spill counters and skipped lines,
+//
+//  - some ranges of spills are decoded with the index read back from
+//    the sidecar (with 1 and 2 threads) and must give the same spills
+//    as the same range of the full decoding,
+//
+//  - the raw file is modified (same size but newer), grown or
+//    truncated and the sidecar is corrupted : every time the index
+//    must not be read anymore.
+
+// Per-spill data of all the spills, in fill order
+typedef std::vector<std::vector<char>> SpillRecords;
+
+template <typename T>
+void Append(std::vector<char>& record, const T * data, std::size_t size) {
+  const char * bytes = reinterpret_cast<const char *>(data);
+  record.insert(record.end(), bytes, bytes + size * sizeof(T));
+}
+
+void Record(SpillRecords& records, Raw_t& rd) {
+  const std::size_t n_cells = rd.n_chips * rd.n_chans * rd.n_cols;
+  std::vector<char> record;
+  Append(record, &rd.spill_number, 1);
+  Append(record, &rd.spill_mode, 1);
+  Append(record, &rd.spill_count, 1);
+  Append(record, rd.chipid.data(), rd.chipid.size());
+  Append(record, rd.charge.data(), n_cells);
+  Append(record, rd.time.data(), n_cells);
+  Append(record, rd.bcid.data(), (std::size_t) rd.n_chips * rd.n_cols);
+  Append(record, rd.hit.data(), n_cells);
+  Append(record, rd.gs.data(), n_cells);
+  Append(record, rd.debug_spill.data(), rd.debug_spill.size());
+  Append(record, rd.debug_chip.data(), (std::size_t) rd.n_chips * N_DEBUG_CHIP);
+  records.push_back(record);
+}
+
+void WriteBytes(const std::string& file, const std::vector<char>& bytes) {
+  std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+  ofs.write(bytes.data(), bytes.size());
+}
+
+// Set the modification time of the file "seconds" seconds after its
+// current one
+void Touch(const std::string& file, int seconds) {
+  struct stat file_stat;
+  stat(file.c_str(), &file_stat);
+  struct utimbuf times;
+  times.actime = file_stat.st_atime;
+  times.modtime = file_stat.st_mtime + seconds;
+  utime(file.c_str(), &times);
+}
+
+int main() {
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = 100;
+  raw_config.n_chips = 3;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+  raw_config.has_spill_number = true;
+  raw_config.realistic = true;
+  raw_config.seed = 0x1D3;
+
+  const std::string raw_file = "index_test.raw";
+  const std::string index_file = SpillIndexPath(raw_file);
+  wgRawEmulator(raw_file, raw_config);
+  std::ifstream ifs(raw_file, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(ifs)),
+                          std::istreambuf_iterator<char>());
+  ifs.close();
+  std::mt19937 rng(raw_config.seed);
+  for (unsigned ierror = 0; ierror < 10; ++ierror) {
+    std::size_t position = rng() % bytes.size();
+    switch (rng() % 3) {
+      case 0 : bytes[position] = (char) rng(); break;
+      case 1 : bytes.erase(bytes.begin() + position); break;
+      default : bytes.insert(bytes.begin() + position, (char) rng()); break;
+    }
+  }
+  WriteBytes(raw_file, bytes);
+  std::remove(index_file.c_str());
+
+  int result = 0;
+  const RawDataConfig config = wagasci_decoder_utils::ProbeRawData(raw_file);
+
+  // ============ Full sequential decoding ============ //
+
+  SpillRecords expected;
+  SpillCounter counter;
+  unsigned skipped_lines = 0;
+  {
+    Raw_t rd(config.n_chips);
+    SectionReader::filler fill = [&](Raw_t& spill_rd) { Record(expected, spill_rd); };
+    std::unique_ptr<RawDataInput> input = OpenRawDataInput(raw_file);
+    SectionSeeker seeker(config);
+    SectionReader reader(config, fill, rd);
+    try {
+      while (true) {
+        SectionSeeker::Section section = seeker.SeekNextSection(*input, skipped_lines);
+        counter.Count(section);
+        reader.ReadNextSection(section);
+      }
+    } catch (const wgEOF&) {}
+  }
+
+  // ============ Write and read back the index ============ //
+
+  {
+    std::unique_ptr<RawDataInput> input = OpenRawDataInput(raw_file);
+    SpillCounter index_counter;
+    unsigned index_skipped_lines = 0;
+    SpillIndex index = BuildSpillIndex(*input, config, index_counter, index_skipped_lines);
+    WriteSpillIndex(raw_file, index);
+  }
+  SpillIndex index;
+  if (!ReadSpillIndex(raw_file, index)) {
+    std::cout << "[SpillIndex] the fresh index was not read\n";
+    std::remove(raw_file.c_str());
+    std::remove(index_file.c_str());
+    return 1;
+  }
+  if (index.entries.size() != expected.size() ||
+      index.n_good_spills != counter.n_good_spills ||
+      index.n_bad_spills != counter.n_bad_spills ||
+      index.skipped_lines != skipped_lines ||
+      index.n_chips != config.n_chips || index.n_chip_id != config.n_chip_id ||
+      index.has_spill_number != config.has_spill_number) {
+    std::cout << "[SpillIndex] index test failed\n";
+    std::cout << "[SpillIndex] entries : " << index.entries.size() << " | spills : " <<
+        expected.size() << " | skipped lines : " << index.skipped_lines << " | expected : " <<
+        skipped_lines << "\n";
+    result = 1;
+  }
+
+  // ============ Decode ranges of spills with the index ============ //
+
+  const std::size_t n_entries = index.entries.size();
+  const std::vector<std::pair<std::size_t, std::size_t>> ranges = {
+    {0, n_entries}, {0, 1}, {n_entries / 3, 2 * n_entries / 3}, {n_entries - 1, n_entries}
+  };
+  for (unsigned n_threads : {1, 2}) {
+    for (auto const & range : ranges) {
+      SpillRecords records;
+      Raw_t rd(config.n_chips);
+      SectionReader::filler fill = [&](Raw_t& spill_rd) { Record(records, spill_rd); };
+      SpillCounter range_counter;
+      std::vector<SpillChunk> chunks = MakeSpillChunks(index, SPILLS_PER_CHUNK, range.first,
+                                                       range.second, range_counter);
+      DecodeSpillsInParallel(raw_file, config, chunks, fill, rd, n_threads);
+      if (records != SpillRecords(expected.begin() + range.first,
+                                  expected.begin() + range.second)) {
+        std::cout << "[SpillIndex] range " << range.first << " - " << range.second <<
+            " test failed with " << n_threads << " threads : " << records.size() <<
+            " spills decoded\n";
+        result = 1;
+      }
+    }
+  }
+
+  // ============ Stale index ============ //
+
+  struct StaleTest {
+    std::string name;
+    std::vector<char> raw_bytes;
+    int touch_seconds;
+    bool corrupt_sidecar;
+  };
+  std::vector<char> modified(bytes);
+  modified[modified.size() / 2] ^= 0x5A;
+  std::vector<char> grown(bytes);
+  grown.insert(grown.end(), 16, ' ');
+  std::vector<char> truncated(bytes.begin(), bytes.begin() + bytes.size() / 2);
+  std::ifstream index_ifs(index_file, std::ios::binary);
+  std::vector<char> index_bytes((std::istreambuf_iterator<char>(index_ifs)),
+                                std::istreambuf_iterator<char>());
+  index_ifs.close();
+  const std::vector<StaleTest> tests = {
+    {"modified", modified, 10, false},
+    {"grown", grown, 0, false},
+    {"truncated", truncated, 0, false},
+    {"corrupted sidecar", bytes, 0, true}
+  };
+  for (auto const & test : tests) {
+    // The sidecar is written again for the original raw file
+    WriteBytes(raw_file, bytes);
+    {
+      std::unique_ptr<RawDataInput> input = OpenRawDataInput(raw_file);
+      SpillCounter index_counter;
+      unsigned index_skipped_lines = 0;
+      SpillIndex fresh = BuildSpillIndex(*input, config, index_counter, index_skipped_lines);
+      WriteSpillIndex(raw_file, fresh);
+    }
+    if (test.corrupt_sidecar)
+      WriteBytes(index_file, std::vector<char>(index_bytes.begin(),
+                                               index_bytes.begin() + index_bytes.size() / 2));
+    else
+      WriteBytes(raw_file, test.raw_bytes);
+    if (test.touch_seconds != 0) Touch(raw_file, test.touch_seconds);
+    // The header of the truncated sidecar is still valid
+    SpillIndex stale;
+    if (ReadSpillIndex(raw_file, stale) ||
+        (!test.corrupt_sidecar && ReadSpillIndex(raw_file, stale, true))) {
+      std::cout << "[SpillIndex] " << test.name << " test failed : the stale index was read\n";
+      result = 1;
+    }
+  }
+
+  std::remove(raw_file.c_str());
+  std::remove(index_file.c_str());
+  return result;
+}
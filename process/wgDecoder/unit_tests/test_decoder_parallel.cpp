@@ -0,0 +1,155 @@
+// system includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+
+// system C includes
+#include <cstdio>
+#include <cstring>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgRawData.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgDecoderReader.hpp"
+#include "wgDecoderParallel.hpp"
+#include "wgRawEmulator.hpp"
+
+// The parallel decoder (IndexSpills + DecodeSpillsInParallel) must
+// call the fill function with exactly the same spills as the
+// sequential decoder. A raw file is generated with the wgRawEmulator,
+// a corrupted copy of it is made (some bytes are changed, removed or
+// inserted) and both files are decoded sequentially and with 1, 2 and
+// 4 threads, with and without the calibration. All the per-spill data
+// passed to the fill function is recorded and compared.
+
+// Per-spill data of all the spills, in fill order
+typedef std::vector<std::vector<char>> SpillRecords;
+
+template <typename T>
+void Append(std::vector<char>& record, const T * data, std::size_t size) {
+  const char * bytes = reinterpret_cast<const char *>(data);
+  record.insert(record.end(), bytes, bytes + size * sizeof(T));
+}
+
+void Record(SpillRecords& records, Raw_t& rd, bool calibration) {
+  const std::size_t n_cells = rd.n_chips * rd.n_chans * rd.n_cols;
+  std::vector<char> record;
+  Append(record, &rd.spill_number, 1);
+  Append(record, &rd.spill_mode, 1);
+  Append(record, &rd.spill_count, 1);
+  Append(record, rd.chipid.data(), rd.chipid.size());
+  Append(record, rd.charge.data(), n_cells);
+  Append(record, rd.time.data(), n_cells);
+  Append(record, rd.bcid.data(), (std::size_t) rd.n_chips * rd.n_cols);
+  Append(record, rd.hit.data(), n_cells);
+  Append(record, rd.gs.data(), n_cells);
+  Append(record, rd.debug_spill.data(), rd.debug_spill.size());
+  Append(record, rd.debug_chip.data(), (std::size_t) rd.n_chips * N_DEBUG_CHIP);
+  if (calibration) {
+    Append(record, rd.pe.data(), n_cells);
+    Append(record, rd.time_ns.data(), n_cells);
+  }
+  records.push_back(record);
+}
+
+// Some arbitrary calibration constants
+void Calibrate(Raw_t& rd) {
+  const std::size_t n_cells = rd.n_chips * rd.n_chans * rd.n_cols;
+  for (std::size_t icell = 0; icell < n_cells; ++icell) {
+    rd.pedestal.data()[icell] = 100 + icell % 7;
+    rd.gain.data()[icell] = icell % 11 == 0 ? -1 : 40 + 0.1 * (icell % 13);
+  }
+  for (std::size_t i = 0; i < (std::size_t) rd.n_chips * rd.n_chans * 2; ++i) {
+    rd.tdc_slope.data()[i] = i % 9 == 0 ? 0 : 2.5 + 0.01 * i;
+    rd.tdc_intcpt.data()[i] = 50 + i % 5;
+  }
+}
+
+SpillRecords Decode(const std::string& raw_file, const RawDataConfig& config,
+                    bool calibration, unsigned n_threads) {
+  SpillRecords records;
+  Raw_t rd(config.n_chips);
+  if (calibration) Calibrate(rd);
+  SectionReader::filler fill = [&](Raw_t& spill_rd) { Record(records, spill_rd, calibration); };
+  std::unique_ptr<RawDataInput> input = OpenRawDataInput(raw_file);
+  if (n_threads == 0) {
+    SectionSeeker seeker(config);
+    SectionReader reader(config, fill, rd);
+    unsigned skipped_lines = 0;
+    try {
+      while (true) {
+        SectionSeeker::Section section = seeker.SeekNextSection(*input, skipped_lines);
+        reader.ReadNextSection(section);
+      }
+    } catch (const wgEOF&) {}
+  } else {
+    SpillCounter counter;
+    unsigned skipped_lines = 0;
+    std::vector<SpillChunk> chunks = IndexSpills(*input, config, SPILLS_PER_CHUNK,
+                                                 counter, skipped_lines);
+    DecodeSpillsInParallel(raw_file, config, chunks, fill, rd, n_threads);
+  }
+  return records;
+}
+
+int main() {
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = 100;
+  raw_config.n_chips = 3;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+  raw_config.has_spill_number = true;
+  raw_config.realistic = true;
+  raw_config.seed = 0x9A7A;
+
+  const std::string clean_file = "parallel_clean.raw";
+  const std::string dirty_file = "parallel_dirty.raw";
+  wgRawEmulator(clean_file, raw_config);
+
+  std::ifstream ifs(clean_file, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(ifs)),
+                          std::istreambuf_iterator<char>());
+  ifs.close();
+  std::mt19937 rng(raw_config.seed);
+  for (unsigned ierror = 0; ierror < 30; ++ierror) {
+    std::size_t position = rng() % bytes.size();
+    switch (rng() % 3) {
+      case 0 : bytes[position] = (char) rng(); break;
+      case 1 : bytes.erase(bytes.begin() + position); break;
+      default : bytes.insert(bytes.begin() + position, (char) rng()); break;
+    }
+  }
+  std::ofstream ofs(dirty_file, std::ios::binary);
+  ofs.write(bytes.data(), bytes.size());
+  ofs.close();
+
+  int result = 0;
+  for (const std::string& raw_file : {clean_file, dirty_file}) {
+    RawDataConfig probe = wagasci_decoder_utils::ProbeRawData(clean_file);
+    for (bool calibration : {false, true}) {
+      RawDataConfig config(probe.n_chips, NCHANNELS, probe.n_chip_id, probe.has_spill_number,
+                           probe.has_phantom_menace, calibration, calibration);
+      SpillRecords sequential = Decode(raw_file, config, calibration, 0);
+      for (unsigned n_threads : {1, 2, 4}) {
+        SpillRecords parallel = Decode(raw_file, config, calibration, n_threads);
+        if (parallel != sequential) {
+          std::cout << "[DecodeSpillsInParallel] " << raw_file << " test failed with " <<
+              n_threads << " threads" << (calibration ? " (calibration)" : "") << "\n";
+          std::cout << "[DecodeSpillsInParallel] spills : " << parallel.size() <<
+              " | sequential spills : " << sequential.size() << "\n";
+          result = 1;
+        }
+      }
+    }
+  }
+  std::remove(clean_file.c_str());
+  std::remove(dirty_file.c_str());
+  return result;
+}
@@ -0,0 +1,151 @@
+// system includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+// system C includes
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgDecoder.hpp"
+#include "wgDecoderUtils.hpp"
+#include "wgDecoderInput.hpp"
+#include "wgDecoderSeeker.hpp"
+#include "wgRawEmulator.hpp"
+
+// Resynchronization of the SectionSeeker on lines that cannot be
+// recognized as part of any section. A clean raw file is generated with
+// the wgRawEmulator and some garbage lines (0x1234) are added at the
+// start of the file, at the end of the file, or the file is made only
+// of garbage. The seeker must reach the end of the file (wgEOF) in all
+// the cases and find all the spills of the clean file. If the seeker
+// hangs the test is killed by the alarm.
+//
+// Then the file is cut in the middle of the last spill trailer. The
+// seeker must reach the end of the file and, if the truncated trailer
+// can still be recovered (space marker far enough from the trailer
+// marker), find it.
+
+const unsigned ALARM_SECONDS = 60;
+const unsigned N_GARBAGE_LINES = 100;
+
+// Write the raw file made of n_before garbage lines, the clean lines
+// and n_after garbage lines
+void WriteRawFile(const std::string& raw_file, const std::vector<char>& clean,
+                  unsigned n_before, unsigned n_after) {
+  const char garbage[BYTES_PER_LINE] = {0x34, 0x12};
+  std::ofstream ofs(raw_file, std::ios::binary);
+  for (unsigned iline = 0; iline < n_before; ++iline)
+    ofs.write(garbage, BYTES_PER_LINE);
+  ofs.write(clean.data(), clean.size());
+  for (unsigned iline = 0; iline < n_after; ++iline)
+    ofs.write(garbage, BYTES_PER_LINE);
+}
+
+// Seek all the sections until the end of the file and return the
+// number of sections of type "type" found
+unsigned CountSections(const std::string& raw_file, const RawDataConfig& config,
+                       unsigned& skipped_lines,
+                       SectionSeeker::SectionType type = SectionSeeker::SpillHeader) {
+  std::unique_ptr<RawDataInput> input = OpenRawDataInput(raw_file);
+  SectionSeeker seeker(config);
+  skipped_lines = 0;
+  try {
+    while (true) {
+      seeker.SeekNextSection(*input, skipped_lines);
+    }
+  } catch (const wgEOF&) {}
+  return seeker.GetStatistics().n_sections[type];
+}
+
+int main() {
+  alarm(ALARM_SECONDS);
+
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = 10;
+  raw_config.n_chips = 3;
+  raw_config.n_chip_id = 2;
+  raw_config.has_spill_number = true;
+
+  const std::string clean_file = "resync_clean.raw";
+  const std::string raw_file = "resync.raw";
+  wgRawEmulator(clean_file, raw_config);
+  RawDataConfig config = wagasci_decoder_utils::ProbeRawData(clean_file);
+  std::ifstream ifs(clean_file, std::ios::binary);
+  std::vector<char> clean((std::istreambuf_iterator<char>(ifs)),
+                          std::istreambuf_iterator<char>());
+  ifs.close();
+  std::remove(clean_file.c_str());
+
+  struct Case {
+    std::string name;
+    bool with_data;
+    unsigned n_before;
+    unsigned n_after;
+  };
+  const std::vector<Case> cases = {
+    {"garbage at the end",      true,  0,               N_GARBAGE_LINES},
+    {"garbage at offset 0",     true,  N_GARBAGE_LINES, 0},
+    {"garbage at both ends",    true,  N_GARBAGE_LINES, N_GARBAGE_LINES},
+    {"only garbage",            false, N_GARBAGE_LINES, 0}
+  };
+
+  int result = 0;
+  for (const Case& test : cases) {
+    WriteRawFile(raw_file, test.with_data ? clean : std::vector<char>(),
+                 test.n_before, test.n_after);
+    unsigned skipped_lines = 0;
+    unsigned n_spills = CountSections(raw_file, config, skipped_lines);
+    unsigned expected = test.with_data ? raw_config.n_spills : 0;
+    if (n_spills != expected || skipped_lines < test.n_before + test.n_after) {
+      std::cout << "[Resynchronize] " << test.name << " test failed\n";
+      std::cout << "[Resynchronize] spills found : " << n_spills << " | expected : " <<
+          expected << " | skipped lines : " << skipped_lines << "\n";
+      result = 1;
+    }
+  }
+
+  // The last spill trailer is cut after n_lines lines. If space_line is
+  // not zero the space marker is written at that line of the
+  // truncated trailer so that it can be recovered.
+  struct TrailerCase {
+    std::string name;
+    unsigned n_lines;
+    unsigned space_line;
+    unsigned expected_trailers;
+  };
+  const std::vector<TrailerCase> trailer_cases = {
+    {"file ending mid-trailer",                        4, 0, raw_config.n_spills - 1},
+    {"file ending mid-trailer (recoverable trailer)",  5, 4, raw_config.n_spills},
+    {"file ending right after the trailer marker",     1, 0, raw_config.n_spills - 1}
+  };
+  for (const TrailerCase& test : trailer_cases) {
+    std::vector<char> truncated(clean.begin(), clean.end() -
+                                (SPILL_TRAILER_LENGTH - test.n_lines) * BYTES_PER_LINE);
+    if (test.space_line != 0) {
+      const uint16_t space = SPACE_MARKER.to_ulong();
+      std::memcpy(truncated.data() + truncated.size() -
+                  (test.n_lines - test.space_line) * BYTES_PER_LINE, &space, BYTES_PER_LINE);
+    }
+    WriteRawFile(raw_file, truncated, 0, 0);
+    unsigned skipped_lines = 0;
+    unsigned n_spills = CountSections(raw_file, config, skipped_lines);
+    unsigned n_trailers = CountSections(raw_file, config, skipped_lines,
+                                        SectionSeeker::SpillTrailer);
+    if (n_spills != raw_config.n_spills || n_trailers != test.expected_trailers) {
+      std::cout << "[SeekSpillTrailer] " << test.name << " test failed\n";
+      std::cout << "[SeekSpillTrailer] spills found : " << n_spills << " | spill trailers found : " <<
+          n_trailers << " | expected : " << test.expected_trailers << "\n";
+      result = 1;
+    }
+  }
+
+  std::remove(raw_file.c_str());
+  return result;
+}
@@ -0,0 +1,135 @@
+// system includes
+#include <string>
+#include <iostream>
+
+// system C includes
+#include <cstdio>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgErrorCodes.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgGetTree.hpp"
+#include "wgDecoder.hpp"
+#include "wgRawEmulator.hpp"
+
+// The sparse TTree (list of hits, see the Hits_t class) must read back
+// through wgGetTree exactly like the dense TTree, for all the cells
+// with a hit. A raw file is generated with the wgRawEmulator and
+// decoded twice by the wgDecoder function, once with the dense and
+// once with the sparse output. Both TTrees are then read entry by
+// entry and compared cell by cell. The cells without a hit are not
+// kept in the sparse TTree and must read back as not set (-1).
+
+const unsigned N_CHIPS = 3;
+const unsigned DIF = 1;
+
+// Compare one entry of the dense (rd) and sparse (rs) TTrees. The
+// number of hit cells is added to n_hits.
+bool CompareEntry(Raw_t& rd, Raw_t& rs, unsigned& n_hits) {
+  if (rd.spill_number != rs.spill_number || rd.spill_mode != rs.spill_mode ||
+      rd.spill_count != rs.spill_count) {
+    std::cout << "[wgGetTree] spill info mismatch : spill_count " << rd.spill_count <<
+        " | sparse spill_count " << rs.spill_count << "\n";
+    return false;
+  }
+  for (unsigned ichip = 0; ichip < N_CHIPS; ++ichip) {
+    if (rd.chipid[ichip] != rs.chipid[ichip]) {
+      std::cout << "[wgGetTree] chipid mismatch : chip " << ichip << "\n";
+      return false;
+    }
+    for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
+      for (unsigned icol = 0; icol < MEMDEPTH; ++icol) {
+        const bool hit = rd.hit[ichip][ichan][icol] == (int) HIT_BIT;
+        bool same;
+        if (hit) {
+          ++n_hits;
+          same = rs.hit    [ichip][ichan][icol] == (int) HIT_BIT &&
+                 rs.charge [ichip][ichan][icol] == rd.charge [ichip][ichan][icol] &&
+                 rs.time   [ichip][ichan][icol] == rd.time   [ichip][ichan][icol] &&
+                 rs.gs     [ichip][ichan][icol] == rd.gs     [ichip][ichan][icol] &&
+                 rs.pe     [ichip][ichan][icol] == rd.pe     [ichip][ichan][icol] &&
+                 rs.time_ns[ichip][ichan][icol] == rd.time_ns[ichip][ichan][icol] &&
+                 rs.bcid   [ichip][icol]        == rd.bcid   [ichip][icol];
+        } else {
+          same = rs.hit   [ichip][ichan][icol] == -1 &&
+                 rs.charge[ichip][ichan][icol] == -1 &&
+                 rs.time  [ichip][ichan][icol] == -1;
+        }
+        if (!same) {
+          std::cout << "[wgGetTree] " << (hit ? "hit" : "no hit") << " cell mismatch : spill_count " <<
+              rd.spill_count << ", chip " << ichip << ", channel " << ichan << ", column " <<
+              icol << "\n";
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  // The decoder log would be mixed with the test output
+  Log.WhereToLog = LOGFILE;
+
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = 50;
+  raw_config.n_chips = N_CHIPS;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+  raw_config.has_spill_number = true;
+  raw_config.realistic = true;
+  raw_config.seed = 0x5BA5;
+
+  const std::string raw_file = "sparse_ecal_dif_1.raw";
+  const std::string dense_dir = "sparse_test_dense";
+  const std::string sparse_dir = "sparse_test_sparse";
+  if (wgRawEmulator(raw_file, raw_config) != 0) {
+    std::cout << "[wgRawEmulator] failed to generate " << raw_file << "\n";
+    return 1;
+  }
+  for (bool sparse : {false, true}) {
+    DecoderOptions options;
+    options.overwrite = true;
+    options.sparse_output = sparse;
+    int result = DecodeRawFile(raw_file, "", sparse ? sparse_dir : dense_dir, DIF, 0, options);
+    if (result != WG_SUCCESS) {
+      std::cout << "[wgDecoder] " << (sparse ? "sparse" : "dense") <<
+          " decoding failed with error " << result << "\n";
+      return 1;
+    }
+  }
+
+  int result = 0;
+  Raw_t rd(N_CHIPS), rs(N_CHIPS);
+  wgGetTree dense(dense_dir + "/sparse_ecal_dif_1_tree.root", rd, DIF);
+  wgGetTree sparse(sparse_dir + "/sparse_ecal_dif_1_tree.root", rs, DIF);
+  if (!sparse.IsSparse() || dense.IsSparse()) {
+    std::cout << "[wgGetTree] wrong TTree layout detected\n";
+    result = 1;
+  }
+  const Long64_t n_entries = dense.tree->GetEntries();
+  if (n_entries == 0 || sparse.tree->GetEntries() != n_entries) {
+    std::cout << "[wgGetTree] entries : " << sparse.tree->GetEntries() <<
+        " | dense entries : " << n_entries << "\n";
+    result = 1;
+  }
+
+  unsigned n_hits = 0;
+  for (Long64_t ientry = 0; result == 0 && ientry < n_entries; ++ientry) {
+    dense.GetEntry(ientry);
+    sparse.GetEntry(ientry);
+    if (!CompareEntry(rd, rs, n_hits)) {
+      std::cout << "[wgGetTree] sparse TTree test failed at entry " << ientry << "\n";
+      result = 1;
+    }
+  }
+  if (result == 0 && n_hits == 0) {
+    std::cout << "[wgGetTree] no hit found : the test is meaningless\n";
+    result = 1;
+  }
+
+  std::remove(raw_file.c_str());
+  return result;
+}
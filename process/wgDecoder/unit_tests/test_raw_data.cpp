@@ -28,14 +28,11 @@ int main (int argc, char** argv) {
     }
   }
 
-  unsigned n_chips = wagasci_decoder_utils::GetNumChips(raw_file);
-  unsigned n_chip_id = wagasci_decoder_utils::GetNumChipID(raw_file);
-  bool has_spill_number = wagasci_decoder_utils::HasSpillNumber(raw_file);
-  bool has_phantom_menace = wagasci_decoder_utils::HasPhantomMenace(raw_file);
+  RawDataConfig config = wagasci_decoder_utils::ProbeRawData(raw_file);
     
-  std::cout << "Number of chips " << n_chips << "\n";
-  std::cout << "Number of chip ID : " << n_chip_id << "\n";
-  std::cout << "Has spill number : " << has_spill_number << "\n";
-  std::cout << "Has phantom menace : " << has_phantom_menace << "\n";
+  std::cout << "Number of chips " << config.n_chips << "\n";
+  std::cout << "Number of chip ID : " << config.n_chip_id << "\n";
+  std::cout << "Has spill number : " << config.has_spill_number << "\n";
+  std::cout << "Has phantom menace : " << config.has_phantom_menace << "\n";
   return 0;
 }
@@ -1,5 +1,6 @@
 // system C++ includes
 #include <string>
+#include <bitset>
 
 // system C includes
 #include <getopt.h>
@@ -9,17 +10,42 @@
 #include "wgFileSystemTools.hpp"
 #include "wgErrorCodes.hpp"
 #include "wgDecoder.hpp"
+#include "wgMakeHist.hpp"
 #include "wgLogger.hpp"
 
 void print_help(const char * program_name) {
   std::cout << "this program decodes a .raw file into a .root file\n"
       "usage example: " << program_name << " -f inputfile.raw -r\n"
+      "               " << program_name << " -d run_directory -s -t 8\n"
       "  -h         : help\n"
-      "  -f (char*) : input .raw file to read (mandatory)\n"
+      "  -f (char*) : input .raw file to read, also .raw.gz, .raw.zst or .raw.xz\n"
+      "               (mandatory if -d is not set)\n"
+      "  -d (char*) : decode all the *_ecal_dif_*.raw files in this run directory\n"
       "  -c (char*) : directory containing the calibration card files (default = WAGASCI_CONFDIR)\n"
       "  -o (char*) : output directory (default = WAGASCI_DECODEDIR)\n"
       "  -n (int)   : DIF number 0-7 (default = 0)\n"
       "  -x (int)   : number of ASU chips per DIF 1-20 (default = autodetected)\n"
+      "  -t (int)   : number of decoding threads (default = 1, 0 = all cores)\n"
+      "  -z         : sparse output : write only the list of hits (default = false)\n"
+      "  -i         : write the spill index next to the .raw file (default = false)\n"
+      "  -a (int)   : first spill (TTree entry) to decode (default = 0)\n"
+      "  -e (int)   : last spill (TTree entry) to decode (default = -1 = until the end)\n"
+      "  -l         : follow mode : decode the spills while the .raw file is being written\n"
+      "               until the acquisition is over (default = false)\n"
+      "  -k (char*) : with -l, also stop following when this file is created\n"
+      "  -w (int)   : with -l, also stop following when the .raw file does not grow\n"
+      "               for this many seconds (default = 0 = never)\n"
+      "  -p (char*) : output profile : default, fast, archive, compact or scratch\n"
+      "               (default = default)\n"
+      "  -g (char*) : fused mode : fill the wgMakeHist histograms while decoding, using\n"
+      "               this Pyrame xml configuration file, into <raw file>_hist.root\n"
+      "  -m (int)   : with -g, wgMakeHist mode (see wgMakeHist -h) (default = 20)\n"
+      "  -u         : with -g, do not write the TTree (default = false)\n"
+      "  -j         : write the performance counters into the <raw file>_report.json\n"
+      "               run report (default = false)\n"
+      "  -v         : also export the decoded data into the memory-mappable\n"
+      "               <raw file>_columns directory (default = false)\n"
+      "  -s         : with -d, write all the DIFs into a single file (default = false)\n"
       "  -r         : overwrite mode (default = false)\n"
       "  -q         : compatibility mode for old data (default = false)\n"
       "  -b         : silent mode (default = false)\n";
@@ -28,21 +54,25 @@ void print_help(const char * program_name) {
 
 int main(int argc, char** argv) {
   std::string inputFile("");
+  std::string runDir("");
   std::string calibDir("");
   std::string outputDir("");
 
   int opt;
-  bool overwrite = false;
   bool batch = false;
-  bool compatibility_mode = false;
+  int makehist_mode = 20;
   unsigned n_chips = 0;
   unsigned dif = 0;
+  DecoderOptions options;
 
-  while((opt = getopt(argc,argv, "f:c:o:n:x:y:rbqh")) !=-1) {
+  while((opt = getopt(argc,argv, "f:d:c:o:n:x:y:t:a:e:k:w:p:g:m:zuijvslrbqh")) !=-1) {
     switch (opt) {
       case 'f':
         inputFile = optarg;
         break;
+      case 'd':
+        runDir = optarg;
+        break;
       case 'c':
         calibDir = optarg;
         break;
@@ -55,11 +85,56 @@ int main(int argc, char** argv) {
       case 'x':
         n_chips = atoi(optarg);
         break;
+      case 't':
+        options.n_threads = atoi(optarg);
+        break;
+      case 'z':
+        options.sparse_output = true;
+        break;
+      case 'i':
+        options.write_index = true;
+        break;
+      case 'a':
+        options.first_spill = atoi(optarg);
+        break;
+      case 'e':
+        options.last_spill = atoi(optarg);
+        break;
+      case 'l':
+        options.follow = true;
+        break;
+      case 'k':
+        options.stop_file = optarg;
+        break;
+      case 'w':
+        options.idle_timeout = atoi(optarg);
+        break;
+      case 'p':
+        options.output_profile = optarg;
+        break;
+      case 'g':
+        options.pyrame_config_file = optarg;
+        break;
+      case 'm':
+        makehist_mode = atoi(optarg);
+        break;
+      case 'u':
+        options.write_tree = false;
+        break;
+      case 'j':
+        options.write_report = true;
+        break;
+      case 'v':
+        options.write_columns = true;
+        break;
+      case 's':
+        options.single_file = true;
+        break;
       case 'r':
-        overwrite = true;
+        options.overwrite = true;
         break;
       case 'q':
-        compatibility_mode = true;
+        options.compatibility_mode = true;
         break; 
       case 'b':
         batch = true;
@@ -73,19 +148,31 @@ int main(int argc, char** argv) {
   }
 
   if (batch == true) Log.WhereToLog = LOGFILE;
+
+  // The histograms are selected exactly as in the wgMakeHist program
+  std::bitset<makehist::NFLAGS> makehist_flags;
+  try { ModeSelect(makehist_mode, makehist_flags); }
+  catch (const std::exception& e) {
+    Log.eWrite("[wgDecoder] Failed to select mode : " + std::string(e.what()));
+    exit(1);
+  }
+  makehist_flags[makehist::OVERWRITE] = options.overwrite;
+  options.makehist_flags = makehist_flags.to_ulong();
   
   int retcode;
-  if ( (retcode = wgDecoder(inputFile.c_str(),
-                            calibDir.c_str(),
-                            outputDir.c_str(),
-                            overwrite,
-                            compatibility_mode,
-                            dif,
-                            n_chips)) != WG_SUCCESS ) {
+  if (!runDir.empty()) {
+    if ( (retcode = DecodeRun(runDir, calibDir, outputDir, options)) != WG_SUCCESS ) {
+      Log.eWrite("[wgDecoder] Decoder failed with code " + std::to_string(retcode));
+      exit(1);
+    }
+    exit(0);
+  }
+
+  if ( (retcode = DecodeRawFile(inputFile, calibDir, outputDir, dif, n_chips,
+                                options)) != WG_SUCCESS ) {
     Log.eWrite("[wgDecoder] Decoder failed with code " + std::to_string(retcode));
     exit(1);
   }
     
   exit(0);
 }
-
@@ -4,8 +4,19 @@
 #include <vector>
 #include <string>
 #include <bitset>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
 
 // ROOT includes
+#include "TROOT.h"
 #include "TFile.h"
 #include "TH1I.h"
 #include "TTree.h"
@@ -25,11 +36,554 @@
 
 using namespace wagasci_tools;
 
+///////////////////////////////////////////////////////////////////////////////
+//                                 ModeSelect                                //
+///////////////////////////////////////////////////////////////////////////////
+
+void ModeSelect(const unsigned long mode, std::bitset<makehist::NFLAGS>& flag){
+  if ( mode == 1 || mode >= 10 )
+    flag[makehist::SELECT_DARK_NOISE] = true;
+  if ( mode == 2 || mode >= 10 ) {
+    flag[makehist::SELECT_CHARGE_HG]  = true;
+    flag[makehist::SELECT_CHARGE_LG]  = true;
+    flag[makehist::SELECT_PEU]        = true;
+  }
+  if ( mode == 3 || mode == 10 || mode >= 20 )
+    flag[makehist::SELECT_PEDESTAL]   = true;
+  if ( mode == 4 || mode == 11 || mode >= 20 )
+    flag[makehist::SELECT_TIME]       = true;
+  if ( mode < 0  || mode > 20 )
+    throw std::invalid_argument("Mode " + std::to_string(mode) +
+                                " not recognized"); 
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               MakeHistFields                              //
+///////////////////////////////////////////////////////////////////////////////
+
+gettree::Fields MakeHistFields(const std::bitset<makehist::NFLAGS>& flags) {
+  gettree::Fields fields;
+  // Always needed to select the cells and to count the spills
+  fields[gettree::SPILL]  = true;
+  fields[gettree::CHIPID] = true;
+  fields[gettree::HIT]    = true;
+  if (flags[makehist::SELECT_CHARGE_HG] || flags[makehist::SELECT_CHARGE_LG]) {
+    fields[gettree::CHARGE] = true;
+    fields[gettree::GS]     = true;
+  }
+  if (flags[makehist::SELECT_PEDESTAL])
+    fields[gettree::CHARGE] = true;
+  if (flags[makehist::SELECT_PEU])
+    fields[gettree::PE]     = true;
+  if (flags[makehist::SELECT_TIME])
+    fields[gettree::TIME]   = true;
+  if (flags[makehist::SELECT_DARK_NOISE] || flags[makehist::SELECT_TIME])
+    fields[gettree::BCID]   = true;
+  return fields;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 HistTensor                                //
+///////////////////////////////////////////////////////////////////////////////
+
+HistTensor::HistTensor(const std::vector<unsigned>& n_chans,
+                       const unsigned n_cols,
+                       const unsigned n_bins,
+                       const bool double_values) :
+    m_n_cols(n_cols), m_n_bins(n_bins), m_stride(n_bins + 2),
+    m_chip_offset(n_chans.size(), 0), m_double_values(double_values) {
+  std::size_t n_hists = 0;
+  for (unsigned ichip = 0; ichip < n_chans.size(); ++ichip) {
+    m_chip_offset[ichip] = n_hists;
+    n_hists += n_chans[ichip] * n_cols;
+  }
+  m_bins.assign(n_hists * m_stride, 0);
+  if (m_double_values) {
+    m_sumwx.assign(n_hists, 0);
+    m_sumwx2.assign(n_hists, 0);
+  }
+}
+
+void HistTensor::AddBins(const HistTensor& other) {
+  if (other.m_bins.size() != m_bins.size())
+    throw std::invalid_argument("[HistTensor] cannot add tensors with a different layout");
+  for (std::size_t ibin = 0; ibin < m_bins.size(); ++ibin)
+    m_bins[ibin] += other.m_bins[ibin];
+}
+
+TH1I * HistTensor::MakeTH1I(const std::size_t ihist, const char * name) const {
+  TH1I * hist = new TH1I(name, name, m_n_bins, 0, m_n_bins);
+  const int * bins = m_bins.data() + ihist * m_stride;
+  std::copy(bins, bins + m_stride, hist->GetArray());
+
+  // TH1::Fill counts all the entries but accumulates the statistics
+  // only of the values inside the axis range. The sums are exact
+  // integers (as they are in TH1::Fill) as long as they are smaller
+  // than 2^53.
+  long long entries = bins[0] + bins[m_n_bins + 1];
+  long long sumw = 0, sumwx = 0, sumwx2 = 0;
+  for (long long ibin = 1; ibin <= m_n_bins; ++ibin) {
+    sumw   += bins[ibin];
+    sumwx  += bins[ibin] * (ibin - 1);
+    sumwx2 += bins[ibin] * (ibin - 1) * (ibin - 1);
+  }
+  entries += sumw;
+  double stats[4] = {(double) sumw, (double) sumw, (double) sumwx, (double) sumwx2};
+  if (m_double_values) {
+    stats[2] = m_sumwx[ihist];
+    stats[3] = m_sumwx2[ihist];
+  }
+  hist->PutStats(stats);
+  hist->SetEntries(entries);
+  return hist;
+}
+
+void HistTensor::LoadTH1I(const std::size_t ihist, const TH1I * hist) {
+  if (hist->GetNbinsX() != (int) m_n_bins || hist->GetXaxis()->GetXmin() != 0 ||
+      hist->GetXaxis()->GetXmax() != m_n_bins)
+    throw std::invalid_argument("[HistTensor] histogram " + std::string(hist->GetName()) +
+                                " has a different binning");
+  std::copy(hist->GetArray(), hist->GetArray() + m_stride,
+            m_bins.begin() + ihist * m_stride);
+  // The statistics of the integer values are calculated from the bins
+  if (m_double_values) {
+    double stats[4];
+    hist->GetStats(stats);
+    m_sumwx[ihist]  = stats[2];
+    m_sumwx2[ihist] = stats[3];
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  MakeHist                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+MakeHist::MakeHist(const std::bitset<makehist::NFLAGS>& flags,
+                   const unsigned dif,
+                   const std::map<unsigned, unsigned>& chip_map,
+                   TFile * output_hist_file) :
+    m_flags(flags), m_dif(dif), m_n_chips(chip_map.size()),
+    m_n_chans(chip_map.size(), 0), m_chip_offset(chip_map.size(), 0),
+    m_output_hist_file(output_hist_file) {
+
+  for (unsigned ichip = 0; ichip < m_n_chips; ++ichip) {
+    auto chip = chip_map.find(ichip);
+    if (chip != chip_map.end()) m_n_chans[ichip] = chip->second;
+  }
+  for (unsigned ichip = 0, ihist = 0; ichip < m_n_chips; ++ichip) {
+    m_chip_offset[ichip] = ihist;
+    ihist += m_n_chans[ichip] * MEMDEPTH;
+  }
+
+  if (m_flags[makehist::SELECT_CHARGE_HG])
+    h_charge_hit_HG = HistTensor(m_n_chans, MEMDEPTH, MAX_VALUE_12BITS);
+  if (m_flags[makehist::SELECT_CHARGE_LG])
+    h_charge_hit_LG = HistTensor(m_n_chans, MEMDEPTH, MAX_VALUE_12BITS);
+  if (m_flags[makehist::SELECT_PEU])
+    h_pe_hit        = HistTensor(m_n_chans, MEMDEPTH, MAX_VALUE_12BITS, true);
+  if (m_flags[makehist::SELECT_PEDESTAL])
+    h_charge_nohit  = HistTensor(m_n_chans, MEMDEPTH, MAX_VALUE_12BITS);
+  if (m_flags[makehist::SELECT_TIME]) {
+    h_time_hit      = HistTensor(m_n_chans, MEMDEPTH, MAX_VALUE_12BITS);
+    h_time_nohit    = HistTensor(m_n_chans, MEMDEPTH, MAX_VALUE_12BITS);
+  }
+  if (m_flags[makehist::SELECT_DARK_NOISE] | m_flags[makehist::SELECT_TIME])
+    h_bcid_hit      = HistTensor(m_n_chans, 1, MAX_VALUE_16BITS);
+}
+
+void MakeHist::Fill(Raw_t& rd) {
+  SpillArrays spill;
+  spill.spill_count = rd.spill_count;
+  spill.n_chips = rd.n_chips;
+  spill.n_chans = rd.n_chans;
+  spill.n_cols = rd.n_cols;
+  spill.chipid = rd.chipid.data();
+  spill.charge = rd.charge.data();
+  spill.time = rd.time.data();
+  spill.bcid = rd.bcid.data();
+  spill.hit = rd.hit.data();
+  spill.gs = rd.gs.data();
+  spill.pe = rd.pe.data();
+  FillSpill(spill);
+}
+
+void MakeHist::Fill(const SpillBlock& block) {
+  const std::size_t n_cells = block.SpillCells();
+  const std::size_t n_bcids = (std::size_t) block.n_chips * block.n_cols;
+  // The columns that are not read are empty
+  auto column = [](const std::vector<int>& array, std::size_t offset) {
+    return array.empty() ? NULL : array.data() + offset;
+  };
+  SpillArrays spill;
+  spill.n_chips = block.n_chips;
+  spill.n_chans = block.n_chans;
+  spill.n_cols = block.n_cols;
+  for (std::size_t ispill = 0; ispill < block.n_spills; ++ispill) {
+    spill.spill_count = block.spill_count.empty() ? 0 : block.spill_count[ispill];
+    spill.chipid = column(block.chipid, ispill * block.n_chips);
+    spill.charge = column(block.charge, ispill * n_cells);
+    spill.time   = column(block.time,   ispill * n_cells);
+    spill.bcid   = column(block.bcid,   ispill * n_bcids);
+    spill.hit    = column(block.hit,    ispill * n_cells);
+    spill.gs     = column(block.gs,     ispill * n_cells);
+    spill.pe     = block.pe.empty() ? NULL : block.pe.data() + ispill * n_cells;
+    FillSpill(spill);
+  }
+}
+
+void MakeHist::FillSpill(const SpillArrays& spill) {
+  if (m_n_spills == 0 || spill.spill_count < m_min_spill_count)
+    m_min_spill_count = spill.spill_count;
+  if (m_n_spills == 0 || spill.spill_count > m_max_spill_count)
+    m_max_spill_count = spill.spill_count;
+  ++m_n_spills;
+
+  // The arrays that were not read (for example the pe array of an
+  // uncalibrated TTree) are skipped
+  if (spill.chipid == NULL || spill.hit == NULL) return;
+  const bool fill_charge_HG = h_charge_hit_HG.IsAllocated() && spill.charge && spill.gs;
+  const bool fill_charge_LG = h_charge_hit_LG.IsAllocated() && spill.charge && spill.gs;
+  const bool fill_pe        = h_pe_hit.IsAllocated() && spill.pe;
+  const bool fill_nohit     = h_charge_nohit.IsAllocated() && spill.charge;
+  const bool fill_time      = h_time_hit.IsAllocated() && spill.time;
+  const bool fill_bcid      = h_bcid_hit.IsAllocated() && spill.bcid;
+  const std::size_t chip_stride = spill.n_chans * spill.n_cols;
+
+  // CHIPS loop
+  for(unsigned ichip = 0; ichip < std::min(m_n_chips, spill.n_chips); ++ichip) {
+    // chipid: chip ID tag as it is recorded in the chip trailer
+    unsigned ichipid = spill.chipid[ichip];
+    if (ichipid >= m_n_chips) continue;
+    const unsigned n_chans = std::min(std::min(m_n_chans[ichip], m_n_chans[ichipid]),
+                                      spill.n_chans);
+    const std::size_t ibcid = ichip * spill.n_cols;
+    // CHANNELS loop
+    for(unsigned ichan = 0; ichan < n_chans; ++ichan) {
+      const std::size_t icell = ichip * chip_stride + ichan * spill.n_cols;
+      // All the CHIP x CHAN x COL tensors have the same layout
+      const std::size_t ihist = m_chip_offset[ichipid] + ichan * MEMDEPTH;
+      const std::size_t ihist_bcid = fill_bcid ? h_bcid_hit.Index(ichipid, ichan) : 0;
+      // COLUMNS loop
+      for(unsigned icol = 0; icol < MEMDEPTH; ++icol) {
+        const int hit = spill.hit[icell + icol];
+        // HIT
+        if ( hit == (int) HIT_BIT ) {
+          if (fill_bcid)
+            h_bcid_hit.Fill(ihist_bcid, spill.bcid[ibcid + icol]);
+          if (fill_pe) {
+            const double pe = spill.pe[icell + icol];
+            if (m_pe_log == NULL)
+              h_pe_hit.Fill(ihist + icol, pe);
+            else if (h_pe_hit.FillBin(ihist + icol, pe))
+              m_pe_log->emplace_back(ihist + icol, pe);
+          }
+          if (fill_time)
+            h_time_hit.Fill(ihist + icol, spill.time[icell + icol]);
+          // HIGH GAIN
+          if (fill_charge_HG && spill.gs[icell + icol] == (int) HIGH_GAIN_BIT)
+            h_charge_hit_HG.Fill(ihist + icol, spill.charge[icell + icol]);
+          // LOW GAIN
+          else if (fill_charge_LG && spill.gs[icell + icol] == (int) LOW_GAIN_BIT)
+            h_charge_hit_LG.Fill(ihist + icol, spill.charge[icell + icol]);
+        }
+        // NO HIT
+        else if ( hit == (int) NO_HIT_BIT ) {
+          if (fill_nohit)
+            h_charge_nohit.Fill(ihist + icol, spill.charge[icell + icol]);
+          if (fill_time)
+            h_time_nohit.Fill(ihist + icol, spill.time[icell + icol]);
+        } // hit
+      } // icol
+    } // ichan
+  } // ichipid
+}
+
+void MakeHist::AddPeStatistics(const ValueLog& pe_log) {
+  for (const auto& value : pe_log)
+    h_pe_hit.AddStatistics(value.first, value.second);
+}
+
+void MakeHist::Merge(const MakeHist& other) {
+  if (other.m_n_spills == 0) return;
+  if (m_n_spills == 0 || other.m_min_spill_count < m_min_spill_count)
+    m_min_spill_count = other.m_min_spill_count;
+  if (m_n_spills == 0 || other.m_max_spill_count > m_max_spill_count)
+    m_max_spill_count = other.m_max_spill_count;
+  m_n_spills += other.m_n_spills;
+
+  HistTensor MakeHist::* tensors[] = {
+    &MakeHist::h_charge_hit_HG, &MakeHist::h_charge_hit_LG, &MakeHist::h_pe_hit,
+    &MakeHist::h_charge_nohit, &MakeHist::h_time_hit, &MakeHist::h_time_nohit,
+    &MakeHist::h_bcid_hit
+  };
+  for (auto tensor : tensors)
+    if ((this->*tensor).IsAllocated())
+      (this->*tensor).AddBins(other.*tensor);
+}
+
+int MakeHist::GetSpillCountRange() const {
+  return std::abs(m_max_spill_count - m_min_spill_count);
+}
+
+void MakeHist::ForEachHistogram(const HistAction& action) {
+  TString h_name;
+  wgColor wgColor;
+  for (unsigned ichip = 0; ichip < m_n_chips; ++ichip) {
+    for (unsigned ichan = 0; ichan < m_n_chans[ichip]; ++ichan) {
+      for (unsigned icol = 0; icol < MEMDEPTH; ++icol) {
+        if (h_charge_hit_HG.IsAllocated()) {
+          // ADC count when there is a hit (hit bit is one) and the high gain
+          // preamp is selected
+          h_name.Form("charge_hit_HG_dif%u_chip%u_ch%u_col%u", m_dif, ichip, ichan, icol);
+          action(h_charge_hit_HG, h_charge_hit_HG.Index(ichip, ichan, icol), h_name,
+                 wgColor::wgcolors[icol]);
+        }
+        if (h_charge_hit_LG.IsAllocated()) {
+          // ADC count when there is a hit (hit bit is one) and the low gain
+          // preamp is selected
+          h_name.Form("charge_hit_LG_dif%u_chip%u_ch%u_col%u", m_dif, ichip, ichan, icol);
+          action(h_charge_hit_LG, h_charge_hit_LG.Index(ichip, ichan, icol), h_name,
+                 wgColor::wgcolors[icol]);
+        }
+        if (h_pe_hit.IsAllocated()) {
+          // Photo-electrons
+          h_name.Form("pe_hit_dif%u_chip%u_ch%u_col%u", m_dif, ichip, ichan, icol);
+          action(h_pe_hit, h_pe_hit.Index(ichip, ichan, icol), h_name,
+                 wgColor::wgcolors[icol]);
+        }
+        if (h_charge_nohit.IsAllocated()) {
+          // ADC count when there is not hit (hit bit is zero)
+          h_name.Form("charge_nohit_dif%u_chip%u_ch%u_col%u", m_dif, ichip, ichan, icol);
+          action(h_charge_nohit, h_charge_nohit.Index(ichip, ichan, icol), h_name,
+                 wgColor::wgcolors[icol + MEMDEPTH * 2 + 2]);
+        }
+        if (h_time_hit.IsAllocated()) {
+          // TDC count when there is a hit (hit bit is one)
+          h_name.Form("time_hit_dif%u_chip%u_ch%u_col%u", m_dif, ichip, ichan, icol);
+          action(h_time_hit, h_time_hit.Index(ichip, ichan, icol), h_name,
+                 wgColor::wgcolors[icol]);
+          // TDC count when there is not hit (hit bit is zero)
+          h_name.Form("time_nohit_dif%u_chip%u_ch%u_col%u", m_dif, ichip, ichan, icol);
+          action(h_time_nohit, h_time_nohit.Index(ichip, ichan, icol), h_name,
+                 wgColor::wgcolors[icol + MEMDEPTH * 2 + 2]);
+        }
+      } //end col
+      if (h_bcid_hit.IsAllocated()) {
+        // BCID
+        h_name.Form("bcid_hit_dif%u_chip%u_ch%u", m_dif, ichip, ichan);
+        action(h_bcid_hit, h_bcid_hit.Index(ichip, ichan), h_name, kBlack);
+      }
+    } //end ch
+  } //end chip
+}
+
+void MakeHist::Read(TFile * input_hist_file) {
+  auto parameter = [input_hist_file](const char * name) {
+    TParameter<int> * parameter = (TParameter<int>*) input_hist_file->Get(name);
+    if (parameter == NULL)
+      throw wgElementNotFound("[MakeHist] parameter " + std::string(name) +
+                              " not found in " + input_hist_file->GetName());
+    int value = parameter->GetVal();
+    delete parameter;
+    return value;
+  };
+  m_n_spills        = parameter("n_spills");
+  m_min_spill_count = parameter("min_spill_count");
+  m_max_spill_count = parameter("max_spill_count");
+
+  ForEachHistogram([input_hist_file](HistTensor& tensor, std::size_t ihist,
+                                     const char * name, int) {
+      TH1I * hist = (TH1I*) input_hist_file->Get(name);
+      if (hist == NULL)
+        throw wgElementNotFound("[MakeHist] histogram " + std::string(name) +
+                                " not found in " + input_hist_file->GetName());
+      tensor.LoadTH1I(ihist, hist);
+      delete hist;
+    });
+}
+
+void MakeHist::Write(const int start_time, const int stop_time,
+                     const int nb_data_pkts, const int nb_lost_pkts) {
+  // In some old runs the time and data packets info is not recorded.
+  // When appending to an existing file the previous cycles of every
+  // object are deleted ("WriteDelete" option).
+  m_output_hist_file->cd();
+  const std::vector<std::pair<const char *, int>> parameters = {
+    {"start_time",      start_time},
+    {"stop_time",       stop_time},
+    {"nb_data_pkts",    nb_data_pkts},
+    {"nb_lost_pkts",    nb_lost_pkts},
+    {"spill_count",     GetSpillCountRange()},
+    {"min_spill_count", m_min_spill_count},
+    {"max_spill_count", m_max_spill_count},
+    {"n_spills",        (int) m_n_spills}
+  };
+  for (const auto& parameter : parameters)
+    m_output_hist_file->WriteObject(new TParameter<int>(parameter.first, parameter.second),
+                                    parameter.first, "WriteDelete");
+
+  // The TH1I histograms are created, written and deleted one at a time
+  // in the same order as they used to be created, so that the keys of
+  // the file are in the same order too.
+  ForEachHistogram([this](HistTensor& tensor, std::size_t ihist,
+                          const char * name, int color) {
+      TH1I * hist = tensor.MakeTH1I(ihist, name);
+      hist->SetDirectory(m_output_hist_file);
+      hist->SetLineColor(color);
+      m_output_hist_file->WriteTObject(hist, NULL, "WriteDelete");
+      delete hist;
+    });
+  m_output_hist_file->Write();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               FillInParallel                              //
+///////////////////////////////////////////////////////////////////////////////
+
+// Number of TTree entries filled by a worker thread in one go
+const Int_t MAKEHIST_CHUNK_SIZE = 256;
+
+// Fill the make_hist histograms with the TTree entries from
+// first_event to n_events - 1 using n_threads threads. Each worker thread reads chunks of
+// MAKEHIST_CHUNK_SIZE entries (block by block) with its own wgGetTree
+// object and fills its own MakeHist object. The bin contents are integers, so the
+// worker histograms are simply added together at the end. The
+// statistics of the photo-electrons histograms are floating point sums
+// instead, that depend on the order of the additions : the workers log
+// the values and the calling thread accumulates them chunk by chunk,
+// strictly in entry order, exactly like the serial fill does.
+static void FillInParallel(const std::string& input_file_name,
+                           const unsigned dif,
+                           const unsigned n_chips,
+                           const std::bitset<makehist::NFLAGS>& flags,
+                           const std::map<unsigned, unsigned>& chip_map,
+                           const Int_t first_event,
+                           const Int_t n_events,
+                           MakeHist& make_hist,
+                           const unsigned n_threads) {
+  const std::size_t n_chunks = (n_events - first_event + MAKEHIST_CHUNK_SIZE - 1) /
+                               MAKEHIST_CHUNK_SIZE;
+  const std::size_t max_chunks_in_flight = 2 * n_threads;
+  const bool log_pe = flags[makehist::SELECT_PEU];
+
+  std::vector<std::unique_ptr<MakeHist>> worker_hists;
+  for (unsigned ithread = 0; ithread < n_threads; ++ithread)
+    worker_hists.emplace_back(new MakeHist(flags, dif, chip_map, NULL));
+
+  // Everything below is protected by the mutex
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<MakeHist::ValueLog> pe_logs(n_chunks);
+  std::vector<bool> chunk_is_filled(n_chunks, false);
+  std::size_t next_chunk = 0, n_committed_chunks = 0;
+  bool abort = false;
+  std::exception_ptr error;
+
+  auto worker = [&](MakeHist * worker_hist) {
+    try {
+      Raw_t rd(n_chips);
+      wgGetTree wg_tree(input_file_name, rd, dif, MakeHistFields(flags));
+      SpillBlock block;
+      MakeHist::ValueLog pe_log;
+      if (log_pe) worker_hist->SetPeLog(&pe_log);
+
+      while (true) {
+        std::size_t ichunk;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]() {
+              return abort || next_chunk >= n_chunks ||
+                  next_chunk < n_committed_chunks + max_chunks_in_flight; });
+          if (abort || next_chunk >= n_chunks) break;
+          ichunk = next_chunk++;
+        }
+
+        Int_t first_chunk_event = first_event + ichunk * MAKEHIST_CHUNK_SIZE;
+        Int_t last_event = std::min(first_chunk_event + MAKEHIST_CHUNK_SIZE, n_events);
+        for (Int_t ievent = first_chunk_event; ievent < last_event; ) {
+          std::size_t n_spills = wg_tree.GetBlock(ievent, block, last_event - ievent);
+          if (n_spills == 0) break;
+          worker_hist->Fill(block);
+          ievent += n_spills;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          pe_logs[ichunk] = std::move(pe_log);
+          chunk_is_filled[ichunk] = true;
+        }
+        pe_log.clear();
+        cv.notify_all();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) error = std::current_exception();
+      abort = true;
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned ithread = 0; ithread < n_threads; ++ithread)
+    threads.emplace_back(worker, worker_hists[ithread].get());
+
+  // Only this thread touches the make_hist object. The chunks are
+  // committed strictly in order.
+  try {
+    for (std::size_t ichunk = 0; ichunk < n_chunks; ++ichunk) {
+      MakeHist::ValueLog pe_log;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return abort || chunk_is_filled[ichunk]; });
+        if (abort) break;
+        pe_log = std::move(pe_logs[ichunk]);
+      }
+      make_hist.AddPeStatistics(pe_log);
+      Int_t first_chunk_event = first_event + ichunk * MAKEHIST_CHUNK_SIZE;
+      if (first_chunk_event % 1000 < MAKEHIST_CHUNK_SIZE)
+        Log.Write("[wgMakeHist] Event number = " + std::to_string(first_chunk_event) +
+                  " / " + std::to_string(n_events));
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++n_committed_chunks;
+      }
+      cv.notify_all();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error) error = std::current_exception();
+    abort = true;
+    cv.notify_all();
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+  if (error) std::rethrow_exception(error);
+
+  for (const auto& worker_hist : worker_hists)
+    make_hist.Merge(*worker_hist);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 wgMakeHist                                //
+///////////////////////////////////////////////////////////////////////////////
+
+// Value of an integer parameter of the hist file or -1 if it is not
+// found (same convention as the wgGetTree::GetStartTime method & co.)
+static int GetHistParameter(TFile * hist_file, const char * name) {
+  TParameter<int> * parameter = (TParameter<int>*) hist_file->Get(name);
+  if (parameter == NULL) return -1;
+  int value = parameter->GetVal();
+  delete parameter;
+  return value;
+}
+
 int wgMakeHist(const char * x_input_file_name,
                const char * x_pyrame_config_file,
                const char * x_output_dir,
                const unsigned long ul_flags,
-               const unsigned dif) {
+               const unsigned dif,
+               unsigned n_threads) {
 
   /////////////////////////////////////////////////////////////////////////////
   //                          Check argument sanity                          //
@@ -66,6 +620,9 @@ int wgMakeHist(const char * x_input_file_name,
   Log.Write("[wgMakeHist] *****  OUTPUT DIRECTORY   : " + output_dir         + "  *****");
   Log.Write("[wgMakeHist] *****  LOG FILE           : " + logfilename        + "  *****");
 
+  if (n_threads == 0) n_threads = std::max<unsigned>(1, std::thread::hardware_concurrency());
+  if (n_threads > 1) ROOT::EnableThreadSafety();
+
   gErrorIgnoreLevel = kError;
   gROOT->SetBatch(kTRUE);
   
@@ -89,34 +646,18 @@ int wgMakeHist(const char * x_input_file_name,
     return ERR_WRONG_CHIP_VALUE;
   }
   
-  /////////////////////////////////////////////////////////////////////////////
-  //                            Define Histograms                            //
-  /////////////////////////////////////////////////////////////////////////////
-
-  //   CHIP        CHAN        COL
-  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_charge_hit_HG(n_chips);
-  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_charge_hit_LG(n_chips);
-  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_pe_hit       (n_chips);
-  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_charge_nohit (n_chips);
-  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_time_hit     (n_chips);
-  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_time_nohit   (n_chips);
-  // h_bcid_hit: For every channel fill it with the BCID of all the columns with
-  // a hit.
-  //   CHIP        CHAN
-  std::vector<std::vector<TH1I*>> h_bcid_hit(n_chips);
-
-  int min_bin = 0;
-  int max_bin = MAX_VALUE_12BITS;
-  int bin     = MAX_VALUE_12BITS;
-  TString h_name;
-  wgColor wgColor;
-
   /////////////////////////////////////////////////////////////////////////////
   //                            Create hist.root                             //
   /////////////////////////////////////////////////////////////////////////////
 
+  // In append mode an existing hist file is updated
+  const bool append = flags[makehist::APPEND] &&
+                      check_exist::root_file(output_dir + "/" + output_file_name);
   TFile * output_hist_file;
-  if (!flags[makehist::OVERWRITE])
+  if (append)
+    output_hist_file = new TFile((output_dir + "/" + output_file_name).c_str(),
+                                 "update");
+  else if (!flags[makehist::OVERWRITE])
     output_hist_file = new TFile((output_dir + "/" + output_file_name).c_str(),
                                  "create");
   else
@@ -128,197 +669,130 @@ int wgMakeHist(const char * x_input_file_name,
     return ERR_FAILED_OPEN_HIST_FILE;
   }
 
-  for (unsigned ichip = 0; ichip < n_chips; ++ichip) {
-    unsigned n_chans = topol->dif_map[dif][ichip];
-    if (flags[makehist::SELECT_CHARGE_HG])
-      h_charge_hit_HG[ichip].resize(n_chans);
-    if (flags[makehist::SELECT_CHARGE_LG])
-      h_charge_hit_LG[ichip].resize(n_chans);
-    if (flags[makehist::SELECT_PEU])
-      h_pe_hit       [ichip].resize(n_chans);
-    if (flags[makehist::SELECT_PEDESTAL])
-      h_charge_nohit [ichip].resize(n_chans);
-    if (flags[makehist::SELECT_TIME]) { 
-      h_time_hit     [ichip].resize(n_chans);
-      h_time_nohit   [ichip].resize(n_chans);
+  MakeHist make_hist(flags, dif, topol->dif_map[dif], output_hist_file);
+
+  // Entry of the TTree from which the filling starts and run info of the
+  // previous calls (append mode only)
+  Int_t first_event = 0;
+  int previous_start_time = -1, previous_stop_time = -1;
+  int previous_data_pkts = -1, previous_lost_pkts = -1;
+  if (append) {
+    if (output_hist_file->GetKey("last_entry") == NULL) {
+      Log.eWrite("[wgMakeHist] Cannot append to " + output_file_name +
+                 " : the last filled entry is not recorded");
+      output_hist_file->Close();
+      delete output_hist_file;
+      return ERR_FAILED_OPEN_HIST_FILE;
     }
-    if (flags[makehist::SELECT_DARK_NOISE] | flags[makehist::SELECT_TIME]) 
-      h_bcid_hit     [ichip].resize(n_chans);
-    for (unsigned ichan = 0; ichan < n_chans; ++ichan) {
-      for (unsigned icol = 0; icol < MEMDEPTH; ++icol) {
-        if (flags[makehist::SELECT_CHARGE_HG]) {
-          // ADC count when there is a hit (hit bit is one) and the high gain
-          // preamp is selected
-          h_name.Form("charge_hit_HG_dif%u_chip%u_ch%u_col%u", dif, ichip, ichan, icol);
-          h_charge_hit_HG[ichip][ichan][icol] = new TH1I(h_name, h_name, bin,
-                                                         min_bin, max_bin);
-          h_charge_hit_HG[ichip][ichan][icol]->SetDirectory(output_hist_file);
-          h_charge_hit_HG[ichip][ichan][icol]->SetLineColor(
-              wgColor::wgcolors[icol]);
-        }
-        if (flags[makehist::SELECT_CHARGE_LG]) {
-          // ADC count when there is a hit (hit bit is one) and the low gain
-          // preamp is selected
-          h_name.Form("charge_hit_LG_dif%u_chip%u_ch%u_col%u", dif, ichip, ichan, icol);
-          h_charge_hit_LG[ichip][ichan][icol] = new TH1I(h_name, h_name, bin,
-                                                         min_bin, max_bin);
-          h_charge_hit_LG[ichip][ichan][icol]->SetDirectory(output_hist_file);
-          h_charge_hit_LG[ichip][ichan][icol]->SetLineColor(
-              wgColor::wgcolors[icol]);
-        }
-        if (flags[makehist::SELECT_PEU]) {
-          // Photo-electrons
-          h_name.Form("pe_hit_dif%u_chip%u_ch%u_col%u", dif, ichip, ichan, icol);
-          h_pe_hit[ichip][ichan][icol] = new TH1I(h_name, h_name, bin,
-                                                  min_bin, max_bin);
-          h_pe_hit[ichip][ichan][icol]->SetDirectory(output_hist_file);
-          h_pe_hit[ichip][ichan][icol]->SetLineColor(wgColor::wgcolors[icol]);
-        }
-        if (flags[makehist::SELECT_PEDESTAL]) {
-          // ADC count when there is not hit (hit bit is zero)
-          h_name.Form("charge_nohit_dif%u_chip%u_ch%u_col%u", dif, ichip, ichan, icol);
-          h_charge_nohit[ichip][ichan][icol] = new TH1I(h_name, h_name, bin,
-                                                        min_bin, max_bin);
-          h_charge_nohit[ichip][ichan][icol]->SetDirectory(output_hist_file);
-          h_charge_nohit[ichip][ichan][icol]->SetLineColor(
-              wgColor::wgcolors[icol + MEMDEPTH * 2 + 2]);
-        }
-        if (flags[makehist::SELECT_TIME]) { 
-          // TDC count when there is a hit (hit bit is one)
-          h_name.Form("time_hit_dif%u_chip%u_ch%u_col%u", dif, ichip, ichan, icol);
-          h_time_hit[ichip][ichan][icol] = new TH1I(h_name, h_name, bin,
-                                                    min_bin, max_bin);
-          h_time_hit[ichip][ichan][icol]->SetDirectory(output_hist_file);
-          h_time_hit[ichip][ichan][icol]->SetLineColor(wgColor::wgcolors[icol]);
-          // TDC count when there is not hit (hit bit is zero)
-          h_name.Form("time_nohit_dif%u_chip%u_ch%u_col%u", dif, ichip, ichan, icol);
-          h_time_nohit[ichip][ichan][icol] = new TH1I(h_name, h_name, bin,
-                                                      min_bin, max_bin);
-          h_time_hit[ichip][ichan][icol]->SetDirectory(output_hist_file);
-          h_time_nohit[ichip][ichan][icol]->SetLineColor(
-              wgColor::wgcolors[icol + MEMDEPTH * 2 + 2]);
-        }
-      } //end col
-      if (flags[makehist::SELECT_DARK_NOISE] | flags[makehist::SELECT_TIME]) {
-        // BCID
-        h_name.Form("bcid_hit_dif%u_chip%u_ch%u", dif, ichip, ichan);
-        h_bcid_hit[ichip][ichan] = new TH1I(h_name, h_name, MAX_VALUE_16BITS,
-                                            0, MAX_VALUE_16BITS);
-        h_bcid_hit[ichip][ichan]->SetLineColor(kBlack);
-      }
-    } //end ch
-  } //end chip
-  
+    try { make_hist.Read(output_hist_file); }
+    catch (const std::exception& e) {
+      Log.eWrite("[wgMakeHist] Cannot append to " + output_file_name + " : " +
+                 std::string(e.what()));
+      output_hist_file->Close();
+      delete output_hist_file;
+      return ERR_FAILED_OPEN_HIST_FILE;
+    }
+    first_event = GetHistParameter(output_hist_file, "last_entry") + 1;
+    previous_start_time = GetHistParameter(output_hist_file, "start_time");
+    previous_stop_time  = GetHistParameter(output_hist_file, "stop_time");
+    previous_data_pkts  = GetHistParameter(output_hist_file, "nb_data_pkts");
+    previous_lost_pkts  = GetHistParameter(output_hist_file, "nb_lost_pkts");
+    Log.Write("[wgMakeHist] Appending to " + output_file_name + " from entry " +
+              std::to_string(first_event));
+  }
+
   /////////////////////////////////////////////////////////////////////////////
   //                           Open tree.root file                           //
   /////////////////////////////////////////////////////////////////////////////
   
   Raw_t rd(n_chips);
-  
-  TParameter<int> * start_time; 
-  TParameter<int> * stop_time;  
-  TParameter<int> * nb_data_pkts;
-  TParameter<int> * nb_lost_pkts;
-  TParameter<int> * spill_count;
 
   try {
-    wgGetTree wg_tree(input_file_name, rd, dif); 
+    wgGetTree wg_tree(input_file_name, rd, dif, MakeHistFields(flags)); 
+
+    // The sparse TTree keeps only the cells with a hit : the pedestal
+    // and time histograms of the cells without a hit cannot be filled
+    if (wg_tree.IsSparse() &&
+        (flags[makehist::SELECT_PEDESTAL] || flags[makehist::SELECT_TIME])) {
+      Log.eWrite("[wgMakeHist] The pedestal and time histograms cannot be filled "
+                 "from the sparse TTree of " + input_file_name);
+      output_hist_file->Close();
+      delete output_hist_file;
+      return ERR_WRONG_MODE;
+    }
 
     /////////////////////////////////////////////////////////////////////////////
-    //                         Get acquisition run info                        //
+    //                                Event loop                               //
     /////////////////////////////////////////////////////////////////////////////
   
-    start_time   = new TParameter<int>("start_time",   wg_tree.GetStartTime());
-    stop_time    = new TParameter<int>("stop_time",    wg_tree.GetStartTime());
-    nb_data_pkts = new TParameter<int>("nb_data_pkts", wg_tree.GetStartTime());
-    nb_lost_pkts = new TParameter<int>("nb_lost_pkts", wg_tree.GetStartTime());
-
-    int max_spill = wg_tree.tree->GetMaximum("spill_count");
-    int min_spill = wg_tree.tree->GetMinimum("spill_count");
-    spill_count = new TParameter<int>("spill_count",
-                                      std::abs(max_spill - min_spill));
     Int_t n_events = wg_tree.tree->GetEntries();
-    if (n_events / n_chips != (unsigned) spill_count->GetVal()) {
+    if (first_event > n_events) {
+      Log.eWrite("[wgMakeHist] Cannot append to " + output_file_name + " : the TTree has " +
+                 std::to_string(n_events) + " entries but " + std::to_string(first_event) +
+                 " were already filled");
+      output_hist_file->Close();
+      delete output_hist_file;
+      return ERR_APPEND_ENTRIES_MISMATCH;
+    }
+    n_threads = std::min<unsigned>(n_threads, (n_events - first_event + MAKEHIST_CHUNK_SIZE - 1) /
+                                   MAKEHIST_CHUNK_SIZE);
+    if (n_threads > 1) {
+      Log.Write("[wgMakeHist] Filling the histograms with " +
+                std::to_string(n_threads) + " threads");
+      FillInParallel(input_file_name, dif, n_chips, flags, topol->dif_map[dif],
+                     first_event, n_events, make_hist, n_threads);
+    } else {
+      // The entries are read and filled one block (TTree cluster) at a
+      // time
+      SpillBlock block;
+      for (Int_t ievent = first_event; ievent < n_events; ) {
+        std::size_t n_spills = wg_tree.GetBlock(ievent, block);
+        if (n_spills == 0) break;
+        if (ievent / 1000 != (Int_t) (ievent + n_spills) / 1000 || ievent == first_event)
+          Log.Write("[wgMakeHist] Event number = " + std::to_string(ievent) +
+                    " / " + std::to_string(n_events));
+        make_hist.Fill(block);
+        ievent += n_spills;
+      } // ievent
+    }
+
+    if (n_events / n_chips != (unsigned) make_hist.GetSpillCountRange()) {
       Log.eWrite("[wgMakeHist] some spills are missing : "
-                 "max_spill - min_spill = " + std::to_string(max_spill) +
-                 " - " + std::to_string(min_spill) + " = " +
-                 std::to_string(spill_count->GetVal()) + ", n_events/n_chips = "
+                 "max_spill - min_spill = " +
+                 std::to_string(make_hist.GetSpillCountRange()) + ", n_events/n_chips = "
                  + std::to_string(n_events / n_chips));
     }
 
     /////////////////////////////////////////////////////////////////////////////
-    //                                Event loop                               //
+    //                         Get acquisition run info                        //
     /////////////////////////////////////////////////////////////////////////////
-  
-    for (Int_t ievent = 0; ievent < n_events; ++ievent) {
 
-      if (ievent % 1000 == 0)
-        Log.Write("[wgMakeHist] Event number = " + std::to_string(ievent) +
-                  " / " + std::to_string(n_events));
-      // Read one event
-      wg_tree.tree->GetEntry(ievent);
-
-      // CHIPS loop
-      for(unsigned ichip = 0; ichip < n_chips; ++ichip) {
-        // chipid: chip ID tag as it is recorded in the chip trailer
-        unsigned ichipid = rd.chipid[ichip];
-        if (ichipid >= n_chips) continue;
-        // CHANNELS loop
-        for(unsigned ichan = 0; ichan < topol->dif_map[dif][ichip]; ++ichan) {
-          // COLUMNS loop
-          for(unsigned icol = 0; icol < MEMDEPTH; ++icol) {
-            // HIT
-            if ( rd.hit[ichip][ichan][icol] == HIT_BIT ) {
-              if (flags[makehist::SELECT_DARK_NOISE] |
-                  flags[makehist::SELECT_TIME])
-                h_bcid_hit  [ichipid][ichan]->Fill(rd.bcid[ichip][icol]);
-              if (flags[makehist::SELECT_PEU]) {
-                h_pe_hit[ichipid][ichan][icol]->Fill(rd.pe[ichip][ichan][icol]);
-              }
-              if (flags[makehist::SELECT_TIME])
-                h_time_hit[ichipid][ichan][icol]->Fill(
-                    rd.time[ichip][ichan][icol]);
-              // HIGH GAIN
-              if(rd.gs[ichip][ichan][icol] == HIGH_GAIN_BIT &&
-                 flags[makehist::SELECT_CHARGE_HG]) { 
-                h_charge_hit_HG[ichipid][ichan][icol]->Fill(
-                    rd.charge[ichip][ichan][icol]);
-              }
-              // LOW GAIN
-              else if(rd.gs[ichip][ichan][icol] == LOW_GAIN_BIT &&
-                      flags[makehist::SELECT_CHARGE_LG]) {
-                h_charge_hit_LG[ichipid][ichan][icol]->Fill(
-                    rd.charge[ichip][ichan][icol]);
-              }	  
-            }
-            // NO HIT
-            else if ( rd.hit[ichip][ichan][icol] == NO_HIT_BIT ) {
-              if (flags[makehist::SELECT_PEDESTAL])
-                h_charge_nohit[ichipid][ichan][icol]->Fill(
-                    rd.charge[ichip][ichan][icol]);
-              if (flags[makehist::SELECT_TIME])
-                h_time_nohit[ichipid][ichan][icol]->Fill(
-                    rd.time[ichip][ichan][icol]);
-            } // hit
-          } // icol
-        } // ichan
-      } // ichipid
-    } // ievent
+    // The start time is the one of the first call. The other info is
+    // recorded in the TTree only at the end of the acquisition, so it
+    // is kept from the previous call until then.
+    int start_time   = previous_start_time != -1 ? previous_start_time :
+                       wg_tree.GetStartTime();
+    int stop_time    = wg_tree.GetStopTime()   != -1 ? wg_tree.GetStopTime() :
+                       previous_stop_time;
+    int nb_data_pkts = wg_tree.GetDataPacket() != -1 ? wg_tree.GetDataPacket() :
+                       previous_data_pkts;
+    int nb_lost_pkts = wg_tree.GetLostPacket() != -1 ? wg_tree.GetLostPacket() :
+                       previous_lost_pkts;
+
+    // Record the last filled entry for the next call in append mode
+    output_hist_file->cd();
+    output_hist_file->WriteObject(new TParameter<int>("last_entry", n_events - 1),
+                                  "last_entry", "WriteDelete");
+    make_hist.Write(start_time, stop_time, nb_data_pkts, nb_lost_pkts);
   } // try
   catch (const std::exception& e) {
     Log.eWrite("[wgMakeHist] failed to get the TTree from file : " +
                std::string(e.what()));
+    output_hist_file->Close();
+    delete output_hist_file;
     return ERR_FAILED_OPEN_TREE_FILE;
   }
   
-  // In some old runs the time and data packets info is not recorded
-  output_hist_file->WriteObject(start_time,   "start_time");
-  output_hist_file->WriteObject(stop_time,    "stop_time");
-  output_hist_file->WriteObject(nb_data_pkts, "nb_data_pkts");
-  output_hist_file->WriteObject(nb_lost_pkts, "nb_lost_pkts");
-  output_hist_file->WriteObject(spill_count,  "spill_count");
-
-  output_hist_file->Write();
   output_hist_file->Close();
   Log.Write("[wgMakeHist] finished");
   delete output_hist_file;
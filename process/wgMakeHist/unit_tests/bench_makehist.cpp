@@ -0,0 +1,531 @@
+// system includes
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <bitset>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <ctime>
+#include <memory>
+#include <algorithm>
+
+// system C includes
+#include <cstdio>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// ROOT includes
+#include "TFile.h"
+#include "TTree.h"
+#include "TH1I.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TError.h"
+
+// nlohmann_json includes
+#include <nlohmann/json.hpp>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgColor.hpp"
+#include "wgErrorCodes.hpp"
+#include "wgExceptions.hpp"
+#include "wgLogger.hpp"
+#include "wgRawData.hpp"
+#include "wgGetTree.hpp"
+#include "wgDecoder.hpp"
+#include "wgMakeHist.hpp"
+#include "wgRawEmulator.hpp"
+
+// Memory and throughput benchmark of the MakeHist class (see
+// wgMakeHist.hpp) against the previous implementation, that used one
+// TH1I object for every histogram (LegacyMakeHist class below). A
+// realistic raw file is generated with the wgRawEmulator and decoded by
+// the wgDecoder function. The TTree is then read and all the histograms
+// (wgMakeHist mode 20) are filled and written by both implementations :
+//
+//  - fill : time spent in the Fill calls only (the TTree reading time
+//    is the same for both and is not counted),
+//
+//  - write : time spent writing the histograms,
+//
+//  - rss : increase of the resident memory after filling all the spills
+//    and peak resident memory of the whole measure.
+//
+// The two output files are then compared histogram by histogram (bin
+// contents, entries, statistics and line color), so the benchmark fails
+// if the output is not the same.
+//
+// The whole event loop (TTree reading plus filling) is then timed for
+// the different ways of reading the TTree with wgGetTree :
+//
+//  - get_entry : all the branches, one GetEntry call per spill,
+//
+//  - get_entry_selected : only the branches needed by the histograms
+//    (see MakeHistFields), one GetEntry call per spill,
+//
+//  - block : only the needed branches, read one TTree cluster at a
+//    time into contiguous arrays (see wgGetTree::GetBlock).
+//
+// The results are written in JSON format and every time is the best of
+// "-n" repetitions.
+
+void print_help(const char * program_name) {
+  std::cout << program_name << " : wgMakeHist histogram engine benchmark\n"
+      "  -s (int)   : number of spills (default 200)\n"
+      "  -c (int)   : number of chips (default 4)\n"
+      "  -n (int)   : number of repetitions of each measure (default 3)\n"
+      "  -d (char*) : working directory for the raw and ROOT files (default .)\n"
+      "  -o (char*) : output JSON file (default bench_makehist.json)\n"
+      "  -h         : print this help\n";
+  exit(0);
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+double Seconds(bench_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                   Memory                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+// Reset the peak resident set size of the process (Linux only)
+void ResetPeakRss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  if (clear_refs.is_open()) clear_refs << "5";
+}
+
+// Peak resident set size of the process in kB
+long PeakRss() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return std::stol(line.substr(6));
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Current resident set size of the process in kB
+long Rss() {
+  std::ifstream statm("/proc/self/statm");
+  long size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               LegacyMakeHist                              //
+///////////////////////////////////////////////////////////////////////////////
+
+// The previous MakeHist implementation : one TH1I object for every
+// histogram, filled directly.
+
+class LegacyMakeHist {
+ public:
+  LegacyMakeHist(unsigned dif, const std::map<unsigned, unsigned>& chip_map,
+                 TFile * output_hist_file) :
+      m_n_chips(chip_map.size()), m_n_chans(chip_map.size(), 0) {
+    for (unsigned ichip = 0; ichip < m_n_chips; ++ichip) {
+      auto chip = chip_map.find(ichip);
+      if (chip != chip_map.end()) m_n_chans[ichip] = chip->second;
+    }
+    TString h_name;
+    wgColor wgColor;
+    output_hist_file->cd();
+    std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> * hists[] = {
+      &h_charge_hit_HG, &h_charge_hit_LG, &h_pe_hit,
+      &h_charge_nohit, &h_time_hit, &h_time_nohit
+    };
+    const char * names[] = {
+      "charge_hit_HG", "charge_hit_LG", "pe_hit",
+      "charge_nohit", "time_hit", "time_nohit"
+    };
+    const unsigned colors[] = {0, 0, 0, MEMDEPTH * 2 + 2, 0, MEMDEPTH * 2 + 2};
+    for (auto hist : hists) hist->resize(m_n_chips);
+    h_bcid_hit.resize(m_n_chips);
+    for (unsigned ichip = 0; ichip < m_n_chips; ++ichip) {
+      for (auto hist : hists) (*hist)[ichip].resize(m_n_chans[ichip]);
+      h_bcid_hit[ichip].resize(m_n_chans[ichip]);
+      for (unsigned ichan = 0; ichan < m_n_chans[ichip]; ++ichan) {
+        for (unsigned icol = 0; icol < MEMDEPTH; ++icol) {
+          for (unsigned itype = 0; itype < 6; ++itype) {
+            h_name.Form("%s_dif%u_chip%u_ch%u_col%u", names[itype], dif, ichip, ichan, icol);
+            TH1I * hist = new TH1I(h_name, h_name, MAX_VALUE_12BITS, 0, MAX_VALUE_12BITS);
+            hist->SetDirectory(output_hist_file);
+            hist->SetLineColor(wgColor::wgcolors[icol + colors[itype]]);
+            (*hists[itype])[ichip][ichan][icol] = hist;
+          }
+        }
+        h_name.Form("bcid_hit_dif%u_chip%u_ch%u", dif, ichip, ichan);
+        h_bcid_hit[ichip][ichan] = new TH1I(h_name, h_name, MAX_VALUE_16BITS,
+                                            0, MAX_VALUE_16BITS);
+        h_bcid_hit[ichip][ichan]->SetLineColor(kBlack);
+      }
+    }
+  }
+
+  void Fill(Raw_t& rd) {
+    for(unsigned ichip = 0; ichip < std::min<unsigned>(m_n_chips, rd.n_chips); ++ichip) {
+      unsigned ichipid = rd.chipid[ichip];
+      if (ichipid >= m_n_chips) continue;
+      for(unsigned ichan = 0; ichan < m_n_chans[ichip]; ++ichan) {
+        for(unsigned icol = 0; icol < MEMDEPTH; ++icol) {
+          if ( rd.hit[ichip][ichan][icol] == (int) HIT_BIT ) {
+            h_bcid_hit[ichipid][ichan]->Fill(rd.bcid[ichip][icol]);
+            h_pe_hit[ichipid][ichan][icol]->Fill(rd.pe[ichip][ichan][icol]);
+            h_time_hit[ichipid][ichan][icol]->Fill(rd.time[ichip][ichan][icol]);
+            if(rd.gs[ichip][ichan][icol] == (int) HIGH_GAIN_BIT)
+              h_charge_hit_HG[ichipid][ichan][icol]->Fill(rd.charge[ichip][ichan][icol]);
+            else if(rd.gs[ichip][ichan][icol] == (int) LOW_GAIN_BIT)
+              h_charge_hit_LG[ichipid][ichan][icol]->Fill(rd.charge[ichip][ichan][icol]);
+          }
+          else if ( rd.hit[ichip][ichan][icol] == (int) NO_HIT_BIT ) {
+            h_charge_nohit[ichipid][ichan][icol]->Fill(rd.charge[ichip][ichan][icol]);
+            h_time_nohit[ichipid][ichan][icol]->Fill(rd.time[ichip][ichan][icol]);
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  unsigned m_n_chips;
+  std::vector<unsigned> m_n_chans;
+  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_charge_hit_HG;
+  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_charge_hit_LG;
+  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_pe_hit;
+  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_charge_nohit;
+  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_time_hit;
+  std::vector<std::vector<std::array<TH1I*, MEMDEPTH>>> h_time_nohit;
+  std::vector<std::vector<TH1I*>> h_bcid_hit;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  Measures                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+struct HistResult {
+  double fill_seconds = 0;
+  double write_seconds = 0;
+  long fill_rss_kb = 0;
+  long peak_rss_kb = 0;
+  long long n_spills = 0;
+};
+
+template <typename Engine>
+HistResult Measure(const std::string& tree_file, const std::string& hist_file,
+                   const std::map<unsigned, unsigned>& chip_map) {
+  HistResult result;
+  Raw_t rd(chip_map.size());
+  wgGetTree get_tree(tree_file, rd, 1);
+  result.n_spills = get_tree.tree->GetEntries();
+
+  ResetPeakRss();
+  long start_rss = Rss();
+  TFile output(hist_file.c_str(), "recreate");
+  std::bitset<makehist::NFLAGS> flags;
+  ModeSelect(20, flags);
+  std::unique_ptr<Engine> engine(new Engine(flags, chip_map, &output));
+  bench_clock::duration fill_time(0);
+  for (long long ispill = 0; ispill < result.n_spills; ++ispill) {
+    get_tree.GetEntry(ispill);
+    auto start = bench_clock::now();
+    engine->Fill(rd);
+    fill_time += bench_clock::now() - start;
+  }
+  result.fill_seconds = Seconds(fill_time);
+  result.fill_rss_kb = Rss() - start_rss;
+
+  auto start = bench_clock::now();
+  engine->Write();
+  output.Close();
+  result.write_seconds = Seconds(bench_clock::now() - start);
+  result.peak_rss_kb = PeakRss();
+  return result;
+}
+
+// Thin wrappers with the same interface
+struct LegacyEngine {
+  TFile * file;
+  LegacyMakeHist make_hist;
+  LegacyEngine(const std::bitset<makehist::NFLAGS>&,
+               const std::map<unsigned, unsigned>& chip_map, TFile * output) :
+      file(output), make_hist(1, chip_map, output) {}
+  void Fill(Raw_t& rd) { make_hist.Fill(rd); }
+  void Write() { file->Write(); }
+};
+
+struct TensorEngine {
+  MakeHist make_hist;
+  TensorEngine(const std::bitset<makehist::NFLAGS>& flags,
+               const std::map<unsigned, unsigned>& chip_map, TFile * output) :
+      make_hist(flags, 1, chip_map, output) {}
+  void Fill(Raw_t& rd) { make_hist.Fill(rd); }
+  void Write() { make_hist.Write(0, 0, 0, 0); }
+};
+
+// Time the whole event loop (reading and filling) and write the
+// histograms into hist_file
+enum LoopReader { LOOP_GET_ENTRY = 0, LOOP_GET_ENTRY_SELECTED, LOOP_BLOCK };
+
+HistResult MeasureLoop(LoopReader reader, const std::string& tree_file,
+                       const std::string& hist_file,
+                       const std::map<unsigned, unsigned>& chip_map) {
+  HistResult result;
+  std::bitset<makehist::NFLAGS> flags;
+  ModeSelect(20, flags);
+  // The TTree is not calibrated : the GetEntry readers would fill the
+  // photo-electrons histograms with the -1 of the Raw_t object while
+  // the block has no pe column at all
+  flags[makehist::SELECT_PEU] = false;
+  TFile output(hist_file.c_str(), "recreate");
+  MakeHist make_hist(flags, 1, chip_map, &output);
+
+  auto start = bench_clock::now();
+  Raw_t rd(chip_map.size());
+  wgGetTree get_tree(tree_file, rd, 1, reader == LOOP_GET_ENTRY ?
+                     gettree::ALL_FIELDS : MakeHistFields(flags));
+  result.n_spills = get_tree.tree->GetEntries();
+  if (reader == LOOP_BLOCK) {
+    SpillBlock block;
+    for (long long ispill = 0; ispill < result.n_spills; ) {
+      std::size_t n_spills = get_tree.GetBlock(ispill, block);
+      if (n_spills == 0) break;
+      make_hist.Fill(block);
+      ispill += n_spills;
+    }
+  } else {
+    for (long long ispill = 0; ispill < result.n_spills; ++ispill) {
+      get_tree.GetEntry(ispill);
+      make_hist.Fill(rd);
+    }
+  }
+  result.fill_seconds = Seconds(bench_clock::now() - start);
+
+  start = bench_clock::now();
+  make_hist.Write(0, 0, 0, 0);
+  output.Close();
+  result.write_seconds = Seconds(bench_clock::now() - start);
+  return result;
+}
+
+// Compare all the histograms of the two files. Return the number of
+// compared histograms or -1 if they are not the same.
+long CompareHistograms(const std::string& legacy_file, const std::string& tensor_file) {
+  TFile legacy(legacy_file.c_str(), "read");
+  TFile tensor(tensor_file.c_str(), "read");
+  long n_histograms = 0;
+  TIter next(legacy.GetListOfKeys());
+  while (TKey * key = (TKey*) next()) {
+    if (std::string(key->GetClassName()) != "TH1I") continue;
+    TH1I * expected = (TH1I*) key->ReadObj();
+    TH1I * actual = (TH1I*) tensor.Get(key->GetName());
+    if (actual == NULL || actual->GetNbinsX() != expected->GetNbinsX() ||
+        actual->GetEntries() != expected->GetEntries() ||
+        actual->GetLineColor() != expected->GetLineColor()) {
+      std::cerr << "Histogram " << key->GetName() << " differs\n";
+      return -1;
+    }
+    double expected_stats[4], actual_stats[4];
+    expected->GetStats(expected_stats);
+    actual->GetStats(actual_stats);
+    if (!std::equal(expected_stats, expected_stats + 4, actual_stats) ||
+        !std::equal(expected->GetArray(), expected->GetArray() + expected->GetSize(),
+                    actual->GetArray())) {
+      std::cerr << "Histogram " << key->GetName() << " differs\n";
+      return -1;
+    }
+    delete expected;
+    delete actual;
+    ++n_histograms;
+  }
+  return n_histograms;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                    main                                   //
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+  int opt;
+  unsigned n_spills = 200;
+  unsigned n_chips = 4;
+  unsigned n_repetitions = 3;
+  std::string work_dir(".");
+  std::string output_file("bench_makehist.json");
+
+  while ((opt = getopt(argc, argv, "s:c:n:d:o:h")) != -1) {
+    switch(opt) {
+      case 's':
+        n_spills = std::stoi(optarg);
+        break;
+      case 'c':
+        n_chips = std::stoi(optarg);
+        break;
+      case 'n':
+        n_repetitions = std::stoi(optarg);
+        break;
+      case 'd':
+        work_dir = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'h':
+        print_help(argv[0]);
+        break;
+      default :
+        print_help(argv[0]);
+    }
+  }
+  if (n_repetitions == 0) n_repetitions = 1;
+  if (n_chips == 0 || n_chips > NCHIPS) n_chips = 4;
+
+  // The decoder log would be mixed with the benchmark output
+  Log.WhereToLog = LOGFILE;
+  gErrorIgnoreLevel = kError;
+
+  // ============ Generate and decode the dataset ============ //
+
+  RawEmulatorConfig raw_config;
+  raw_config.n_spills = n_spills;
+  raw_config.n_chips = n_chips;
+  raw_config.n_columns = MEMDEPTH;
+  raw_config.n_chip_id = 2;
+  raw_config.realistic = true;
+  raw_config.seed = 0x4157;
+
+  const std::string raw_file = work_dir + "/bench_makehist_ecal_dif_1.raw";
+  const std::string tree_file = work_dir + "/bench_makehist_ecal_dif_1_tree.root";
+  if (wgRawEmulator(raw_file, raw_config) != 0) {
+    std::cerr << "Failed to generate " << raw_file << "\n";
+    return 1;
+  }
+  DecoderOptions options;
+  options.overwrite = true;
+  int decoded = DecodeRawFile(raw_file, "", work_dir, 1, n_chips, options);
+  std::remove(raw_file.c_str());
+  if (decoded != WG_SUCCESS) {
+    std::cerr << "Failed to decode " << raw_file << " : error " << decoded << "\n";
+    return 1;
+  }
+  std::map<unsigned, unsigned> chip_map;
+  for (unsigned ichip = 0; ichip < n_chips; ++ichip)
+    chip_map[ichip] = NCHANNELS;
+
+  // ============ Fill and write ============ //
+
+  const std::vector<std::string> engine_names = {"th1i", "tensor"};
+  const std::vector<std::string> hist_files = {
+    work_dir + "/bench_makehist_th1i_hist.root",
+    work_dir + "/bench_makehist_tensor_hist.root"
+  };
+  std::vector<HistResult> best(engine_names.size());
+  for (unsigned irep = 0; irep < n_repetitions; ++irep) {
+    for (std::size_t iengine = 0; iengine < engine_names.size(); ++iengine) {
+      HistResult result;
+      if (iengine == 0)
+        result = Measure<LegacyEngine>(tree_file, hist_files[iengine], chip_map);
+      else
+        result = Measure<TensorEngine>(tree_file, hist_files[iengine], chip_map);
+      if (irep == 0) {
+        best[iengine] = result;
+      } else {
+        best[iengine].fill_seconds = std::min(best[iengine].fill_seconds, result.fill_seconds);
+        best[iengine].write_seconds = std::min(best[iengine].write_seconds, result.write_seconds);
+      }
+    }
+  }
+  long n_histograms = CompareHistograms(hist_files[0], hist_files[1]);
+
+  // ============ Read and fill ============ //
+
+  const std::vector<std::string> loop_names = {
+    "get_entry", "get_entry_selected", "block"
+  };
+  std::vector<std::string> loop_files;
+  for (const std::string& loop_name : loop_names)
+    loop_files.push_back(work_dir + "/bench_makehist_" + loop_name + "_hist.root");
+  std::vector<HistResult> best_loop(loop_names.size());
+  for (unsigned irep = 0; irep < n_repetitions; ++irep) {
+    for (std::size_t iloop = 0; iloop < loop_names.size(); ++iloop) {
+      HistResult result = MeasureLoop((LoopReader) iloop, tree_file, loop_files[iloop], chip_map);
+      if (irep == 0 || result.fill_seconds < best_loop[iloop].fill_seconds)
+        best_loop[iloop] = result;
+    }
+  }
+  bool same_loop_output = true;
+  for (std::size_t iloop = 1; iloop < loop_names.size(); ++iloop)
+    same_loop_output = same_loop_output &&
+                       CompareHistograms(loop_files[0], loop_files[iloop]) > 0;
+
+  // ============ Results ============ //
+
+  nlohmann::json results;
+  results["benchmark"] = "bench_makehist";
+  results["timestamp"] = (long) std::time(nullptr);
+  results["n_spills"] = n_spills;
+  results["n_chips"] = n_chips;
+  results["n_repetitions"] = n_repetitions;
+  results["n_histograms"] = n_histograms;
+  results["same_output"] = n_histograms > 0;
+  results["engines"] = nlohmann::json::array();
+  for (std::size_t iengine = 0; iengine < engine_names.size(); ++iengine) {
+    const HistResult& result = best[iengine];
+    nlohmann::json json;
+    json["engine"] = engine_names[iengine];
+    json["fill_seconds"] = result.fill_seconds;
+    json["write_seconds"] = result.write_seconds;
+    json["spills_per_s"] = result.fill_seconds > 0 ? result.n_spills / result.fill_seconds : 0;
+    json["fill_rss_kB"] = result.fill_rss_kb;
+    json["peak_rss_kB"] = result.peak_rss_kb;
+    json["fill_speedup_vs_th1i"] = result.fill_seconds > 0 ?
+                                   best.front().fill_seconds / result.fill_seconds : 0;
+    results["engines"].push_back(json);
+    std::cout << engine_names[iengine] << " : fill " << result.fill_seconds << " s (" <<
+        json["spills_per_s"].get<double>() << " spills/s), write " <<
+        result.write_seconds << " s, " << result.fill_rss_kb << " kB filled, " <<
+        result.peak_rss_kb << " kB peak\n";
+  }
+  if (n_histograms <= 0)
+    std::cerr << "The two implementations do not write the same histograms!\n";
+
+  results["same_loop_output"] = same_loop_output;
+  results["loops"] = nlohmann::json::array();
+  for (std::size_t iloop = 0; iloop < loop_names.size(); ++iloop) {
+    const HistResult& result = best_loop[iloop];
+    nlohmann::json json;
+    json["reader"] = loop_names[iloop];
+    json["seconds"] = result.fill_seconds;
+    json["spills_per_s"] = result.fill_seconds > 0 ? result.n_spills / result.fill_seconds : 0;
+    json["speedup_vs_get_entry"] = result.fill_seconds > 0 ?
+                                   best_loop.front().fill_seconds / result.fill_seconds : 0;
+    results["loops"].push_back(json);
+    std::cout << loop_names[iloop] << " : read and fill " << result.fill_seconds << " s (" <<
+        json["spills_per_s"].get<double>() << " spills/s)\n";
+  }
+  if (!same_loop_output)
+    std::cerr << "The TTree readers do not give the same histograms!\n";
+
+  std::remove(tree_file.c_str());
+  for (const std::string& hist_file : hist_files)
+    std::remove(hist_file.c_str());
+  for (const std::string& loop_file : loop_files)
+    std::remove(loop_file.c_str());
+
+  std::ofstream ofs(output_file);
+  ofs << results.dump(2) << "\n";
+  if (!ofs) {
+    std::cerr << "Failed to write " << output_file << "\n";
+    return 1;
+  }
+  std::cout << "Results written to " << output_file << "\n";
+  return n_histograms > 0 && same_loop_output ? 0 : 1;
+}
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <string>
 #include <bitset>
+#include <stdexcept>
 
 // system C includes
 #include <getopt.h>
@@ -25,6 +26,9 @@ void print_help(const char * program_name) {
       "  -o (char*) : output directory (default = WAGASCI_HISTDIR)\n"
       "  -n (int)   : DIF number (must be 0-7) (default = 0)\n"
       "  -r         : overwrite mode (default = false)\n"
+      "  -a         : append mode : fill only the new entries of the input file\n"
+      "               into the existing output file (default = false)\n"
+      "  -t (int)   : number of threads (0 = one per core) (default = 1)\n"
       "  -m (int)   : mode (mandatory)\n\n"
       "   =========   modes   ========= \n\n"
       "   1  : only dark noise\n"
@@ -37,24 +41,6 @@ void print_help(const char * program_name) {
   exit(0);
 }
 
-//******************************************************************
-void ModeSelect(const unsigned long mode, std::bitset<makehist::NFLAGS>& flag){
-  if ( mode == 1 || mode >= 10 )
-    flag[makehist::SELECT_DARK_NOISE] = true;
-  if ( mode == 2 || mode >= 10 ) {
-    flag[makehist::SELECT_CHARGE_HG]  = true;
-    flag[makehist::SELECT_CHARGE_LG]  = true;
-    flag[makehist::SELECT_PEU]        = true;
-  }
-  if ( mode == 3 || mode == 10 || mode >= 20 )
-    flag[makehist::SELECT_PEDESTAL]   = true;
-  if ( mode == 4 || mode == 11 || mode >= 20 )
-    flag[makehist::SELECT_TIME]       = true;
-  if ( mode < 0  || mode > 20 )
-    throw std::invalid_argument("Mode " + std::to_string(mode) +
-                                " not recognized"); 
-}
-
 int main(int argc, char** argv) {
   int opt;
   int mode = 0;
@@ -62,9 +48,10 @@ int main(int argc, char** argv) {
   std::string output_dir("");
   std::string pyrame_config_file("");
   unsigned dif = 0;
+  unsigned n_threads = 1;
   std::bitset<makehist::NFLAGS> flags;
 
-  while((opt = getopt(argc,argv, "f:p:o:n:m:rh")) != -1 ){
+  while((opt = getopt(argc,argv, "f:p:o:n:m:t:rah")) != -1 ){
     switch(opt){
       case 'f':
         input_file = optarg;
@@ -84,6 +71,19 @@ int main(int argc, char** argv) {
       case 'r':
         flags[makehist::OVERWRITE] = true;
         break;
+      case 'a':
+        flags[makehist::APPEND] = true;
+        break;
+      case 't':
+        try {
+          const int threads = std::stoi(optarg);
+          if (threads < 0) throw std::out_of_range("negative number of threads");
+          n_threads = threads;
+        } catch (const std::logic_error& e) {
+          Log.eWrite("[wgMakeHist] Invalid number of threads : " + std::string(optarg));
+          print_help(argv[0]);
+        }
+        break;
       case 'h':
         print_help(argv[0]);
         break;
@@ -108,7 +108,8 @@ int main(int argc, char** argv) {
                            pyrame_config_file.c_str(),
                            output_dir.c_str(),
                            flags.to_ulong(),
-                           dif)) != WG_SUCCESS ) {
+                           dif,
+                           n_threads)) != WG_SUCCESS ) {
     Log.eWrite("[wgMakeHist] returned error " +  std::to_string(result));
     exit(result);
   }
@@ -1,158 +1,400 @@
 // system includes
 #include <string>
-#include <bitset>
 #include <vector>
+#include <map>
+#include <memory>
 #include <fstream>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+
+// system C includes
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// nlohmann_json includes
+#include <nlohmann/json.hpp>
 
 // user includes
 #include "wgDecoder.hpp"
 #include "wgRawEmulator.hpp"
 
-std::vector<std::bitset<BITS_PER_LINE>> SpillNumber(unsigned spill_id, unsigned spill_mode) {
-  std::vector<std::bitset<BITS_PER_LINE>> spill_number;
+// The spills are written into blocks of this size (in bytes) before
+// being written to the output file
+const std::size_t RAW_EMULATOR_BLOCK_SIZE = 8 * 1024 * 1024;
 
-  spill_number.push_back(SPILL_NUMBER_MARKER); // Marker
-  spill_number.push_back(std::bitset<BITS_PER_LINE>(spill_id)); // spill ID
-  spill_number.push_back(std::bitset<BITS_PER_LINE>(spill_mode)); // spill flag
+// All the raw data of one spill. The buffer is reused for every spill.
+typedef std::vector<uint16_t> RawLines;
 
-  return spill_number;
+void SpillNumber(RawLines & lines, unsigned spill_id, unsigned spill_mode) {
+  lines.push_back(SPILL_NUMBER_MARKER.to_ulong()); // Marker
+  lines.push_back(spill_id); // spill ID
+  lines.push_back(spill_mode); // spill flag
 }
 
-std::vector<std::bitset<BITS_PER_LINE>> SpillHeader(unsigned spill_id) {
-  std::vector<std::bitset<BITS_PER_LINE>> spill_header;
-
-  spill_header.push_back(SPILL_HEADER_MARKER); // Marker
-  spill_header.push_back(std::bitset<BITS_PER_LINE>(0)); // spill ID
-  spill_header.push_back(std::bitset<BITS_PER_LINE>(spill_id)); // spill ID
-  spill_header.push_back(SP_MARKER);
-  spill_header.push_back(IL_MARKER);
-  spill_header.push_back(SPACE_MARKER);
-
-  return spill_header;
+void SpillHeader(RawLines & lines, unsigned spill_id) {
+  lines.push_back(SPILL_HEADER_MARKER.to_ulong()); // Marker
+  lines.push_back(0); // spill ID
+  lines.push_back(spill_id); // spill ID
+  lines.push_back(SP_MARKER.to_ulong());
+  lines.push_back(IL_MARKER.to_ulong());
+  lines.push_back(SPACE_MARKER.to_ulong());
 }
 
-std::vector<std::bitset<BITS_PER_LINE>> ChipHeader(unsigned chip_id) {
-  std::vector<std::bitset<BITS_PER_LINE>> chip_header;
-
+void ChipHeader(RawLines & lines, unsigned chip_id) {
   if (chip_id > 255)
     throw std::invalid_argument("chip ID is greater than 255 : " + std::to_string(chip_id));
-  
-  chip_header.push_back(CHIP_HEADER_MARKER);
-  chip_header.push_back(std::bitset<BITS_PER_LINE>(chip_id) | xFF00); // chip ID
-  chip_header.push_back(CH_MARKER);
-  chip_header.push_back(IP_MARKER);
-  chip_header.push_back(SPACE_MARKER);
-
-  return chip_header;
-}
-
-std::vector<std::bitset<BITS_PER_LINE>> RawTDC(unsigned time, bool hit, bool gain) {
-
-  if (time > 4095)
-    throw std::invalid_argument("time is greater than 4095 : " + std::to_string(time));
-
-  std::bitset<BITS_PER_LINE> bitset(time);
-  bitset[BITS_PER_LINE-3] = gain;
-  bitset[BITS_PER_LINE-4] = hit;
-  std::vector<std::bitset<BITS_PER_LINE>> raw_tdc(NCHANNELS, bitset);
-
-  return raw_tdc;
-}
-
-std::vector<std::bitset<BITS_PER_LINE>> RawADC(unsigned charge, bool hit, bool gain) {
-
-  if (charge > 4095)
-    throw std::invalid_argument("charge is greater than 4095 : " + std::to_string(charge));
 
-  std::bitset<BITS_PER_LINE> bitset(charge);
-  bitset[BITS_PER_LINE-3] = gain;
-  bitset[BITS_PER_LINE-4] = hit;
-  std::vector<std::bitset<BITS_PER_LINE>> raw_adc(NCHANNELS, bitset);
-  return raw_adc;
+  lines.push_back(CHIP_HEADER_MARKER.to_ulong());
+  lines.push_back(chip_id | xFF00.to_ulong()); // chip ID
+  lines.push_back(CH_MARKER.to_ulong());
+  lines.push_back(IP_MARKER.to_ulong());
+  lines.push_back(SPACE_MARKER.to_ulong());
 }
 
-std::vector<std::bitset<BITS_PER_LINE>> RawBCID(unsigned bcid, unsigned n_columns) {
-  std::vector<std::bitset<BITS_PER_LINE>> raw_bcid(n_columns, std::bitset<BITS_PER_LINE>(bcid));
-  return raw_bcid;
+// TDC or ADC line
+uint16_t RawValue(unsigned value, bool hit, bool gain) {
+  return value | (gain << (BITS_PER_LINE - 3)) | (hit << (BITS_PER_LINE - 4));
 }
 
-std::vector<std::bitset<BITS_PER_LINE>> ChipID(unsigned chip_id, unsigned n_chip_id) {
-  std::vector<std::bitset<BITS_PER_LINE>> raw_chip_id(n_chip_id, chip_id);
-  return raw_chip_id;
+void ChipID(RawLines & lines, unsigned chip_id, unsigned n_chip_id) {
+  lines.insert(lines.end(), n_chip_id, chip_id);
 }
 
-
-std::vector<std::bitset<BITS_PER_LINE>> ChipTrailer(unsigned chip_id) {
-  std::vector<std::bitset<BITS_PER_LINE>> chip_trailer;
-
+void ChipTrailer(RawLines & lines, unsigned chip_id) {
   if (chip_id > 255)
     throw std::invalid_argument("chip ID is greater than 255 : " + std::to_string(chip_id));
-  
-  chip_trailer.push_back(CHIP_TRAILER_MARKER);
-  chip_trailer.push_back(std::bitset<BITS_PER_LINE>(chip_id) | xFF00 ); // chip ID
-  chip_trailer.push_back(SPACE_MARKER);
-  chip_trailer.push_back(SPACE_MARKER);
 
-  return chip_trailer;
+  lines.push_back(CHIP_TRAILER_MARKER.to_ulong());
+  lines.push_back(chip_id | xFF00.to_ulong()); // chip ID
+  lines.push_back(SPACE_MARKER.to_ulong());
+  lines.push_back(SPACE_MARKER.to_ulong());
 }
 
-std::vector<std::bitset<BITS_PER_LINE>> SpillTrailer(unsigned spill_id, unsigned n_chips) {
-  std::vector<std::bitset<BITS_PER_LINE>> spill_trailer;
-
+void SpillTrailer(RawLines & lines, unsigned spill_id, unsigned n_chips) {
   if (n_chips > 255)
     throw std::invalid_argument("chip ID is greater than 255 : " + std::to_string(n_chips));
 
-  spill_trailer.push_back(SPILL_TRAILER_MARKER);
-  spill_trailer.push_back(std::bitset<BITS_PER_LINE>(0)); // spill ID
-  spill_trailer.push_back(std::bitset<BITS_PER_LINE>(spill_id)); // spill ID
-  spill_trailer.push_back(std::bitset<BITS_PER_LINE>(n_chips) & x00FF); // nb_chip
-  spill_trailer.push_back(std::bitset<BITS_PER_LINE>(0)); // spill ID
-  spill_trailer.push_back(std::bitset<BITS_PER_LINE>(spill_id)); // spill ID
-  spill_trailer.push_back(SPACE_MARKER);
-
-  return spill_trailer;
+  lines.push_back(SPILL_TRAILER_MARKER.to_ulong());
+  lines.push_back(0); // spill ID
+  lines.push_back(spill_id); // spill ID
+  lines.push_back(n_chips & x00FF.to_ulong()); // nb_chip
+  lines.push_back(0); // spill ID
+  lines.push_back(spill_id); // spill ID
+  lines.push_back(SPACE_MARKER.to_ulong());
 }
 
-std::ofstream& operator<<(std::ofstream& ofs, uint16_t data) {
-  ofs.write((char*) &data, sizeof(uint16_t));
-  return ofs;
+void PhantomMenace(RawLines & lines) {
+  lines.insert(lines.end(), PHANTOM_MENACE_LENGTH, x0000.to_ulong());
 }
 
-void WriteToBinary(std::ofstream & os, std::vector<std::bitset<BITS_PER_LINE>> raw_vector) {
-  for (auto const & raw_line : raw_vector) {
-    uint16_t bit_line = raw_line.to_ulong();
-    os << bit_line;
+///////////////////////////////////////////////////////////////////////////////
+//                                Chip content                               //
+///////////////////////////////////////////////////////////////////////////////
+
+// Every column of every chip has the same time, charge, hit, gain and
+// BCID. Return the number of columns.
+unsigned ConstantChipData(RawLines & lines, const RawEmulatorConfig & raw) {
+  if (raw.time > MAX_VALUE_12BITS)
+    throw std::invalid_argument("time is greater than 4095 : " + std::to_string(raw.time));
+  if (raw.charge > MAX_VALUE_12BITS)
+    throw std::invalid_argument("charge is greater than 4095 : " + std::to_string(raw.charge));
+
+  for (unsigned icol = 0; icol < raw.n_columns; ++icol) {
+    lines.insert(lines.end(), NCHANNELS, RawValue(raw.time, raw.hit, raw.gain));
+    lines.insert(lines.end(), NCHANNELS, RawValue(raw.charge, raw.hit, raw.gain));
   }
+  lines.insert(lines.end(), raw.n_columns, raw.bcid);
+  return raw.n_columns;
 }
 
+// Range of the TDC ramp (the time is not correlated with the BCID)
+const unsigned REALISTIC_TDC_MIN = 700;
+const unsigned REALISTIC_TDC_MAX = 3500;
+
+// Dark noise content (see the RawEmulatorConfig::realistic member). The
+// random generator is independent from the fault injection one, so
+// that the faults do not change when the content does.
+class RealisticChipData {
+ public:
+  RealisticChipData(const RawEmulatorConfig & raw) :
+      m_raw(raw), m_generator(raw.seed + 1), m_uniform(0, 1), m_noise(0, 1),
+      m_n_hits(raw.dark_noise_rate > 0 ? raw.dark_noise_rate : 1),
+      m_crosstalk(raw.crosstalk > 0 ? raw.crosstalk : 1),
+      m_bcid(1, raw.bcid_window), m_tdc(REALISTIC_TDC_MIN, REALISTIC_TDC_MAX) {
+    if (raw.bcid_window == 0 || raw.bcid_window > MAX_VALUE_12BITS)
+      throw std::invalid_argument("the BCID window must be between 1 and 4095 : " +
+                                  std::to_string(raw.bcid_window));
+    if (raw.n_columns > MEMDEPTH)
+      throw std::invalid_argument("the number of columns is greater than " +
+                                  std::to_string(MEMDEPTH) + " : " + std::to_string(raw.n_columns));
+    m_pedestal.resize(raw.n_chips * NCHANNELS * MEMDEPTH);
+    for (auto & pedestal : m_pedestal)
+      pedestal = raw.pedestal + raw.pedestal_spread * m_noise(m_generator);
+    m_pe_gain.resize(raw.n_chips * NCHANNELS);
+    for (auto & pe_gain : m_pe_gain)
+      pe_gain = std::max(1., raw.pe_gain + raw.pe_gain_spread * m_noise(m_generator));
+  }
+
+  // Append the columns and BCIDs of the chip "ichip" (starting from
+  // one). Return the number of columns.
+  unsigned Append(RawLines & lines, unsigned ichip) {
+    // BCID and channel of every dark noise hit
+    m_hits.clear();
+    if (m_raw.dark_noise_rate > 0) {
+      for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
+        for (unsigned n_hits = m_n_hits(m_generator); n_hits > 0; --n_hits)
+          m_hits.push_back({m_bcid(m_generator), ichan});
+      }
+    }
+    std::sort(m_hits.begin(), m_hits.end());
+
+    // One column for each different BCID. When the memory is full the
+    // remaining hits are lost.
+    m_column_bcid.clear();
+    m_column_hits.clear();
+    for (auto const & hit : m_hits) {
+      if (m_column_bcid.empty() || m_column_bcid.back() != hit.first) {
+        if (m_column_bcid.size() == m_raw.n_columns) break;
+        m_column_bcid.push_back(hit.first);
+        m_column_hits.push_back(0);
+      }
+      m_column_hits.back() |= uint64_t(1) << hit.second;
+    }
+    unsigned n_columns = m_column_bcid.size();
+
+    // The last column is written first and in each column the last
+    // channel is written first
+    for (unsigned icol = n_columns; icol-- > 0; ) {
+      std::size_t tdc_start = lines.size();
+      lines.resize(tdc_start + 2 * NCHANNELS);
+      for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
+        bool hit = m_column_hits[icol] & (uint64_t(1) << ichan);
+        double pedestal = m_pedestal[((ichip - 1) * NCHANNELS + ichan) * MEMDEPTH + icol];
+        double charge, sigma = m_raw.pedestal_noise;
+        bool high_gain = true;
+        if (hit) {
+          unsigned n_pe = 1 + (m_raw.crosstalk > 0 ? m_crosstalk(m_generator) : 0);
+          high_gain = m_uniform(m_generator) < m_raw.high_gain_fraction;
+          double scale = high_gain ? 1 : 0.1;
+          double pe_gain = m_pe_gain[(ichip - 1) * NCHANNELS + ichan] * scale;
+          double pe_noise = m_raw.pe_gain_noise * scale;
+          charge = pedestal + n_pe * pe_gain;
+          sigma = std::sqrt(sigma * sigma + n_pe * pe_noise * pe_noise);
+        } else {
+          charge = pedestal;
+        }
+        charge += sigma * m_noise(m_generator);
+        lines[tdc_start + NCHANNELS - 1 - ichan] = RawValue(m_tdc(m_generator), hit, high_gain);
+        lines[tdc_start + 2 * NCHANNELS - 1 - ichan] = RawValue(Clip(charge), hit, high_gain);
+      }
+    }
+    for (unsigned icol = n_columns; icol-- > 0; )
+      lines.push_back(m_column_bcid[icol]);
+    return n_columns;
+  }
+
+  // True pedestal of every chip, channel and column and true gain of
+  // every chip and channel
+  nlohmann::json Truth() const {
+    nlohmann::json truth;
+    for (unsigned ichip = 0; ichip < m_raw.n_chips; ++ichip) {
+      for (unsigned ichan = 0; ichan < NCHANNELS; ++ichan) {
+        auto first = m_pedestal.begin() + (ichip * NCHANNELS + ichan) * MEMDEPTH;
+        truth["pedestal"][ichip][ichan] = std::vector<double>(first, first + m_raw.n_columns);
+        truth["pe_gain"][ichip][ichan] = m_pe_gain[ichip * NCHANNELS + ichan];
+      }
+    }
+    return truth;
+  }
+
+ private:
+  static unsigned Clip(double value) {
+    if (value < 0) return 0;
+    if (value > MAX_VALUE_12BITS) return MAX_VALUE_12BITS;
+    return std::lround(value);
+  }
+
+  const RawEmulatorConfig & m_raw;
+  std::mt19937 m_generator;
+  std::uniform_real_distribution<double> m_uniform;
+  std::normal_distribution<double> m_noise;
+  std::poisson_distribution<unsigned> m_n_hits;
+  std::poisson_distribution<unsigned> m_crosstalk;
+  std::uniform_int_distribution<unsigned> m_bcid;
+  std::uniform_int_distribution<unsigned> m_tdc;
+  // [chip][channel][column] and [chip][channel]
+  std::vector<double> m_pedestal;
+  std::vector<double> m_pe_gain;
+  // Buffers reused for every chip
+  std::vector<std::pair<unsigned, unsigned>> m_hits;
+  std::vector<unsigned> m_column_bcid;
+  std::vector<uint64_t> m_column_hits;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                               wgRawEmulator                               //
+///////////////////////////////////////////////////////////////////////////////
+
 int wgRawEmulator(const std::string & output_file, RawEmulatorConfig & raw) {
 
   std::ofstream os;
-  
+
+  // ============ Fault injection ============ //
+
+  std::mt19937 generator(raw.seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  // The random generator is used only if the rate is not zero, so that
+  // the faults of one kind do not change when the rate of another kind
+  // is switched on or off
+  auto happens = [&](double rate) { return rate > 0 && uniform(generator) < rate; };
+
+  nlohmann::json manifest_spills = nlohmann::json::array();
+  std::map<std::string, unsigned> fault_totals;
+  unsigned n_corrupted_spills = 0;
+
   try {
     os.open(output_file, std::ios::out | std::ios::binary);
-    
+
+    std::unique_ptr<RealisticChipData> realistic;
+    if (raw.realistic) realistic.reset(new RealisticChipData(raw));
+
+    RawLines spill;
+    std::vector<char> block;
+    block.reserve(RAW_EMULATOR_BLOCK_SIZE);
+
+    uint64_t offset = 0;
+    unsigned spill_count_offset = 0;
     for (unsigned ispill = 1; ispill <= raw.n_spills; ++ispill) {
+      nlohmann::json faults = nlohmann::json::array();
 
-      if (raw.has_spill_number) WriteToBinary(os, SpillNumber(ispill, raw.spill_mode));
-      WriteToBinary(os, SpillHeader(ispill));
+      if (happens(raw.spill_count_gap_rate)) {
+        unsigned gap = 1 + generator() % 3;
+        spill_count_offset += gap;
+        faults.push_back({{"type", "spill_count_gap"}, {"gap", gap}});
+      }
+      unsigned spill_count = ispill + spill_count_offset;
+
+      spill.clear();
+      if (raw.has_spill_number) SpillNumber(spill, ispill, raw.spill_mode);
+      SpillHeader(spill, spill_count);
 
       for (unsigned ichip = 1; ichip <= raw.n_chips; ++ichip) {
-        WriteToBinary(os, ChipHeader(ichip));
-  
-        for (unsigned icol = 1; icol <= raw.n_columns; ++icol) {
-          WriteToBinary(os, RawTDC(raw.time, raw.hit, raw.gain));
-          WriteToBinary(os, RawADC(raw.charge, raw.hit, raw.gain));
+        ChipHeader(spill, ichip);
+
+        std::size_t chip_start = spill.size();
+        unsigned n_columns = realistic ? realistic->Append(spill, ichip) :
+                             ConstantChipData(spill, raw);
+        if (n_columns > 0 && happens(raw.truncated_column_rate)) {
+          unsigned icol = generator() % n_columns;
+          unsigned n_lines = 1 + generator() % (2 * NCHANNELS - 1);
+          unsigned first_line = icol * 2 * NCHANNELS + generator() % (2 * NCHANNELS - n_lines + 1);
+          spill.erase(spill.begin() + chip_start + first_line,
+                      spill.begin() + chip_start + first_line + n_lines);
+          // In realistic mode the last column is written first
+          unsigned column = realistic ? n_columns - 1 - icol : icol;
+          faults.push_back({{"type", "truncated_column"}, {"chip", ichip}, {"column", column},
+                            {"lines", n_lines}});
+        }
+        ChipID(spill, ichip, raw.n_chip_id);
+
+        unsigned trailer_chip_id = ichip;
+        if (happens(raw.chip_id_mismatch_rate)) {
+          // Any other valid chip ID (the chip IDs go from 1 to 255)
+          trailer_chip_id = ichip % 255 + 1;
+          faults.push_back({{"type", "chip_id_mismatch"}, {"chip", ichip},
+                            {"trailer_chip_id", trailer_chip_id}});
         }
-        WriteToBinary(os, RawBCID(raw.bcid, raw.n_columns));
-        WriteToBinary(os, ChipID(ichip, raw.n_chip_id));
-  
-        WriteToBinary(os, ChipTrailer(ichip));
+        if (happens(raw.missing_chip_trailer_rate))
+          faults.push_back({{"type", "missing_chip_trailer"}, {"chip", ichip}});
+        else
+          ChipTrailer(spill, trailer_chip_id);
       }
 
-      WriteToBinary(os, SpillTrailer(ispill, raw.n_chips));
+      SpillTrailer(spill, spill_count, raw.n_chips);
+      if (raw.has_phantom_menace) PhantomMenace(spill);
+
+      // The spill is copied at the end of the current block and the byte
+      // faults are applied there
+      std::size_t spill_start = block.size();
+      std::size_t spill_length = spill.size() * sizeof(uint16_t);
+      block.resize(spill_start + spill_length);
+      std::memcpy(&block[spill_start], spill.data(), spill_length);
+      if (happens(raw.dropped_byte_rate)) {
+        std::size_t pos = generator() % spill_length;
+        block.erase(block.begin() + spill_start + pos);
+        --spill_length;
+        faults.push_back({{"type", "dropped_byte"}, {"offset", offset + pos}});
+      }
+      if (happens(raw.duplicated_byte_rate)) {
+        std::size_t pos = generator() % spill_length;
+        block.insert(block.begin() + spill_start + pos, block[spill_start + pos]);
+        ++spill_length;
+        faults.push_back({{"type", "duplicated_byte"}, {"offset", offset + pos}});
+      }
+      if (block.size() >= RAW_EMULATOR_BLOCK_SIZE) {
+        os.write(block.data(), block.size());
+        block.clear();
+      }
+
+      // ============ Ground truth ============ //
+
+      if (!raw.manifest_file.empty()) {
+        for (auto const & fault : faults)
+          ++fault_totals[fault["type"].get<std::string>()];
+        if (!faults.empty()) ++n_corrupted_spills;
+        manifest_spills.push_back({{"spill_number", ispill},
+                                   {"spill_count", spill_count},
+                                   {"offset", offset},
+                                   {"length", spill_length},
+                                   {"faults", faults}});
+      }
+      offset += spill_length;
     }
+    os.write(block.data(), block.size());
     os.close();
+    if (!os)
+      throw std::runtime_error("failed to write the output file : " + output_file);
+
+    if (!raw.manifest_file.empty()) {
+      nlohmann::json manifest;
+      manifest["raw_file"] = output_file;
+      manifest["seed"] = raw.seed;
+      manifest["n_spills"] = raw.n_spills;
+      manifest["n_chips"] = raw.n_chips;
+      manifest["n_columns"] = raw.n_columns;
+      manifest["n_chip_id"] = raw.n_chip_id;
+      manifest["has_spill_number"] = raw.has_spill_number;
+      manifest["has_phantom_menace"] = raw.has_phantom_menace;
+      manifest["realistic"] = raw.realistic;
+      if (raw.realistic) {
+        manifest["content"]["dark_noise_rate"] = raw.dark_noise_rate;
+        manifest["content"]["crosstalk"] = raw.crosstalk;
+        manifest["content"]["pedestal"] = raw.pedestal;
+        manifest["content"]["pedestal_spread"] = raw.pedestal_spread;
+        manifest["content"]["pedestal_noise"] = raw.pedestal_noise;
+        manifest["content"]["pe_gain"] = raw.pe_gain;
+        manifest["content"]["pe_gain_spread"] = raw.pe_gain_spread;
+        manifest["content"]["pe_gain_noise"] = raw.pe_gain_noise;
+        manifest["content"]["high_gain_fraction"] = raw.high_gain_fraction;
+        manifest["content"]["bcid_window"] = raw.bcid_window;
+        manifest["truth"] = realistic->Truth();
+      }
+      manifest["rates"]["dropped_byte"] = raw.dropped_byte_rate;
+      manifest["rates"]["duplicated_byte"] = raw.duplicated_byte_rate;
+      manifest["rates"]["missing_chip_trailer"] = raw.missing_chip_trailer_rate;
+      manifest["rates"]["truncated_column"] = raw.truncated_column_rate;
+      manifest["rates"]["spill_count_gap"] = raw.spill_count_gap_rate;
+      manifest["rates"]["chip_id_mismatch"] = raw.chip_id_mismatch_rate;
+      manifest["fault_totals"] = fault_totals;
+      manifest["n_corrupted_spills"] = n_corrupted_spills;
+      manifest["spills"] = manifest_spills;
+      std::ofstream manifest_os(raw.manifest_file);
+      manifest_os << manifest.dump(1) << "\n";
+      if (!manifest_os)
+        throw std::runtime_error("failed to write the manifest file : " + raw.manifest_file);
+    }
   }
   catch (const std::exception & e) {
     std::cout << e.what() << "\n";
@@ -15,6 +15,22 @@ void print_help(const char * program_name) {
       "  -c         : number of chips (default 20)\n"
       "  -m         : old raw data format mode (default no)\n"
       "  -n         : has spill number (default no)\n"
+      "  -p         : has phantom menace (default no)\n"
+      "  -k (int)   : number of columns (default 1 or 16 in realistic mode)\n"
+      " realistic content :\n"
+      "  -r         : dark noise hits with a multi p.e. spectrum (default no)\n"
+      "  -a (double): mean number of dark noise hits per channel per spill (default 0.3)\n"
+      "  -u (double): pedestal in ADC counts (default 450)\n"
+      "  -j (double): high gain ADC counts per p.e. (default 40)\n"
+      " fault injection (the rates are probabilities per spill or per chip) :\n"
+      "  -e (int)   : random generator seed (default 0)\n"
+      "  -b (double): dropped byte rate per spill (default 0)\n"
+      "  -d (double): duplicated byte rate per spill (default 0)\n"
+      "  -g (double): spill count gap rate per spill (default 0)\n"
+      "  -t (double): missing chip trailer rate per chip (default 0)\n"
+      "  -l (double): truncated column rate per chip (default 0)\n"
+      "  -i (double): chip ID mismatch rate per chip (default 0)\n"
+      "  -f (char*) : write the ground truth manifest into this JSON file\n"
       "  -o (char*) : output file path\n"
       "  -h         : print this help\n";
   exit(0);
@@ -29,8 +45,9 @@ int main(int argc, char** argv) {
   raw_config.n_chips = 20;
   raw_config.n_chip_id = 2;
   raw_config.has_spill_number = false;
+  int n_columns = -1;
 
-  while ((opt = getopt(argc, argv, "s:c:o:hmn")) != -1) {
+  while ((opt = getopt(argc, argv, "s:c:o:e:b:d:g:t:l:i:f:k:a:u:j:hmnpr")) != -1) {
     switch(opt) {
       case 's':
         raw_config.n_spills = std::stoi(optarg);
@@ -44,9 +61,51 @@ int main(int argc, char** argv) {
       case 'n':
          raw_config.has_spill_number = true;
         break;
+      case 'p':
+        raw_config.has_phantom_menace = true;
+        break;
+      case 'k':
+        n_columns = std::stoi(optarg);
+        break;
+      case 'r':
+        raw_config.realistic = true;
+        break;
+      case 'a':
+        raw_config.dark_noise_rate = std::stod(optarg);
+        break;
+      case 'u':
+        raw_config.pedestal = std::stod(optarg);
+        break;
+      case 'j':
+        raw_config.pe_gain = std::stod(optarg);
+        break;
       case 'o':
         output_file = optarg;
         break;
+      case 'e':
+        raw_config.seed = std::stoul(optarg);
+        break;
+      case 'b':
+        raw_config.dropped_byte_rate = std::stod(optarg);
+        break;
+      case 'd':
+        raw_config.duplicated_byte_rate = std::stod(optarg);
+        break;
+      case 'g':
+        raw_config.spill_count_gap_rate = std::stod(optarg);
+        break;
+      case 't':
+        raw_config.missing_chip_trailer_rate = std::stod(optarg);
+        break;
+      case 'l':
+        raw_config.truncated_column_rate = std::stod(optarg);
+        break;
+      case 'i':
+        raw_config.chip_id_mismatch_rate = std::stod(optarg);
+        break;
+      case 'f':
+        raw_config.manifest_file = optarg;
+        break;
       case 'h':
         print_help(argv[0]);
         break;
@@ -60,5 +119,10 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  if (n_columns >= 0)
+    raw_config.n_columns = n_columns;
+  else if (raw_config.realistic)
+    raw_config.n_columns = MEMDEPTH;
+
   wgRawEmulator(output_file, raw_config);
 }
@@ -0,0 +1,328 @@
+// system includes
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <stdexcept>
+
+// system C includes
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// nlohmann_json includes
+#include <nlohmann/json.hpp>
+
+// user includes
+#include "wgConst.hpp"
+#include "wgExceptions.hpp"
+#include "wgFileSystemTools.hpp"
+#include "wgRawData.hpp"
+#include "wgColumns.hpp"
+
+using namespace wagasci_tools;
+
+// Written in the header to recognize the layout
+const std::string COLUMNS_FORMAT = "wagasci_columns";
+const int COLUMNS_VERSION = 1;
+
+// numpy name of the "kind" type of "size" bytes in the native byte
+// order ("i" for signed integers and "f" for floating point)
+static std::string DtypeName(char kind, std::size_t size) {
+  const uint16_t one = 1;
+  const bool little_endian = *reinterpret_cast<const char *>(&one) == 1;
+  return std::string(little_endian ? "<" : ">") + kind + std::to_string(size);
+}
+
+template <typename T> static std::string Dtype();
+template <> std::string Dtype<int>()    { return DtypeName('i', sizeof(int)); }
+template <> std::string Dtype<double>() { return DtypeName('f', sizeof(double)); }
+
+// Size in bytes of an element of the "dtype" type
+static std::size_t DtypeSize(const std::string& dtype) {
+  if (dtype == Dtype<int>()) return sizeof(int);
+  if (dtype == Dtype<double>()) return sizeof(double);
+  throw wgInvalidFile("unsupported column dtype : " + dtype);
+}
+
+static std::size_t NumElements(const std::vector<std::size_t>& shape) {
+  std::size_t n_elements = 1;
+  for (std::size_t dim : shape) n_elements *= dim;
+  return n_elements;
+}
+
+static std::string ColumnFileName(const std::string& name) {
+  return name + ".bin";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                ColumnWriter                               //
+///////////////////////////////////////////////////////////////////////////////
+
+ColumnWriter::ColumnWriter(const std::string& output_dir, bool overwrite) :
+    m_output_dir(output_dir) {
+  make::directory(m_output_dir);
+  const std::string header_file = m_output_dir + "/" + COLUMNS_HEADER_FILE;
+  struct stat header_stat;
+  if (stat(header_file.c_str(), &header_stat) == 0) {
+    if (!overwrite)
+      throw wgInvalidFile(m_output_dir + " already contains a columnar export");
+    // Until the new header is written the directory is incomplete
+    if (std::remove(header_file.c_str()) != 0)
+      throw wgInvalidFile("failed to remove " + header_file + " : " +
+                          std::string(std::strerror(errno)));
+  }
+}
+
+ColumnWriter::~ColumnWriter() {}
+
+ColumnWriter::Column& ColumnWriter::NewColumn(const std::string& name,
+                                              const std::string& dtype,
+                                              const std::vector<std::size_t>& shape,
+                                              bool per_spill,
+                                              const char * address,
+                                              std::size_t element_size) {
+  if (m_closed || m_n_entries > 0)
+    throw wgInvalidFile("column " + name + " added after the first Fill call");
+  if (m_columns.count(name))
+    throw wgInvalidFile("column " + name + " already exists");
+  Column& column = m_columns[name];
+  column.dtype = dtype;
+  column.shape = shape;
+  column.per_spill = per_spill;
+  column.address = address;
+  column.row_bytes = NumElements(shape) * element_size;
+  const std::string file_path = m_output_dir + "/" + ColumnFileName(name);
+  column.ofs.reset(new std::ofstream(file_path, std::ios_base::out | std::ios_base::binary |
+                                     std::ios_base::trunc));
+  if (!column.ofs->is_open())
+    throw wgInvalidFile("failed to open " + file_path + " : " +
+                        std::string(std::strerror(errno)));
+  return column;
+}
+
+void ColumnWriter::AddColumn(const std::string& name, const int * address,
+                             const std::vector<std::size_t>& shape) {
+  NewColumn(name, Dtype<int>(), shape, true,
+            reinterpret_cast<const char *>(address), sizeof(int));
+}
+
+void ColumnWriter::AddColumn(const std::string& name, const double * address,
+                             const std::vector<std::size_t>& shape) {
+  NewColumn(name, Dtype<double>(), shape, true,
+            reinterpret_cast<const char *>(address), sizeof(double));
+}
+
+void ColumnWriter::AddConstant(const std::string& name, const double * data,
+                               const std::vector<std::size_t>& shape) {
+  Column& column = NewColumn(name, Dtype<double>(), shape, false,
+                             reinterpret_cast<const char *>(data), sizeof(double));
+  column.ofs->write(column.address, column.row_bytes);
+  if (!*column.ofs)
+    throw wgInvalidFile("failed to write column " + name + " in " + m_output_dir);
+}
+
+void ColumnWriter::SetAttribute(const std::string& name, long value) {
+  m_attributes[name] = value;
+}
+
+void ColumnWriter::Fill() {
+  for (auto& entry : m_columns) {
+    Column& column = entry.second;
+    if (!column.per_spill) continue;
+    column.ofs->write(column.address, column.row_bytes);
+    if (!*column.ofs)
+      throw wgInvalidFile("failed to write column " + entry.first + " in " + m_output_dir);
+  }
+  ++m_n_entries;
+}
+
+std::size_t ColumnWriter::GetEntries() const {
+  return m_n_entries;
+}
+
+void ColumnWriter::Close() {
+  if (m_closed) return;
+  m_closed = true;
+
+  nlohmann::json header;
+  header["format"] = COLUMNS_FORMAT;
+  header["version"] = COLUMNS_VERSION;
+  header["n_entries"] = m_n_entries;
+  header["attributes"] = nlohmann::json::object();
+  for (auto const& attribute : m_attributes)
+    header["attributes"][attribute.first] = attribute.second;
+  header["columns"] = nlohmann::json::object();
+
+  for (auto& entry : m_columns) {
+    Column& column = entry.second;
+    column.ofs->close();
+    if (column.ofs->fail())
+      throw wgInvalidFile("failed to close column " + entry.first + " in " + m_output_dir);
+    std::vector<std::size_t> shape(column.shape);
+    if (column.per_spill)
+      shape.insert(shape.begin(), m_n_entries);
+    nlohmann::json& json_column = header["columns"][entry.first];
+    json_column["file"] = ColumnFileName(entry.first);
+    json_column["dtype"] = column.dtype;
+    json_column["shape"] = shape;
+    json_column["per_spill"] = column.per_spill;
+  }
+
+  const std::string header_file = m_output_dir + "/" + COLUMNS_HEADER_FILE;
+  std::ofstream ofs(header_file);
+  if (!ofs.is_open())
+    throw wgInvalidFile("failed to open " + header_file);
+  ofs << header.dump(2) << std::endl;
+  if (!ofs)
+    throw wgInvalidFile("failed to write " + header_file);
+}
+
+void AddRawDataColumns(ColumnWriter& writer, Raw_t& rd,
+                       bool adc_is_calibrated, bool tdc_is_calibrated) {
+  const std::size_t n_chips = rd.n_chips, n_chans = rd.n_chans;
+  writer.AddColumn("spill_number", &rd.spill_number   , {});
+  writer.AddColumn("spill_mode"  , &rd.spill_mode     , {});
+  writer.AddColumn("spill_count" , &rd.spill_count    , {});
+  writer.AddColumn("chipid"      , rd.chipid.data()   , {n_chips});
+
+  writer.AddColumn("charge"      , rd.charge.data()   , {n_chips, n_chans, MEMDEPTH});
+  writer.AddColumn("time"        , rd.time.data()     , {n_chips, n_chans, MEMDEPTH});
+  writer.AddColumn("bcid"        , rd.bcid.data()     , {n_chips,          MEMDEPTH});
+  writer.AddColumn("hit"         , rd.hit.data()      , {n_chips, n_chans, MEMDEPTH});
+  writer.AddColumn("gs"          , rd.gs.data()       , {n_chips, n_chans, MEMDEPTH});
+
+  writer.AddColumn("debug_spill" , rd.debug_spill.data(), {N_DEBUG_SPILL});
+  writer.AddColumn("debug_chip"  , rd.debug_chip.data() , {n_chips, N_DEBUG_CHIP});
+
+  if (adc_is_calibrated) {
+    writer.AddColumn("pe"          , rd.pe.data()         , {n_chips, n_chans, MEMDEPTH});
+    writer.AddConstant("pedestal"  , rd.pedestal.data()   , {n_chips, n_chans, MEMDEPTH});
+    writer.AddConstant("gain"      , rd.gain.data()       , {n_chips, n_chans, MEMDEPTH});
+  }
+  if (tdc_is_calibrated) {
+    writer.AddColumn("time_ns"     , rd.time_ns.data()    , {n_chips, n_chans, MEMDEPTH});
+    writer.AddConstant("tdc_slope" , rd.tdc_slope.data()  , {n_chips, n_chans, 2});
+    writer.AddConstant("tdc_intcpt", rd.tdc_intcpt.data() , {n_chips, n_chans, 2});
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                ColumnReader                               //
+///////////////////////////////////////////////////////////////////////////////
+
+ColumnReader::ColumnReader(const std::string& input_dir) : m_input_dir(input_dir) {
+  const std::string header_file = m_input_dir + "/" + COLUMNS_HEADER_FILE;
+  std::ifstream ifs(header_file);
+  if (!ifs.is_open())
+    throw wgInvalidFile("columnar export header not found : " + header_file);
+  nlohmann::json header;
+  try {
+    ifs >> header;
+    if (header.at("format").get<std::string>() != COLUMNS_FORMAT ||
+        header.at("version").get<int>() != COLUMNS_VERSION)
+      throw wgInvalidFile("unknown columnar export format : " + header_file);
+    m_n_entries = header.at("n_entries").get<std::size_t>();
+    for (auto it = header.at("attributes").begin(); it != header.at("attributes").end(); ++it)
+      m_attributes[it.key()] = it.value().get<long>();
+  } catch (const nlohmann::json::exception& e) {
+    throw wgInvalidFile("invalid columnar export header " + header_file + " : " +
+                        std::string(e.what()));
+  }
+
+  try {
+    for (auto it = header.at("columns").begin(); it != header.at("columns").end(); ++it) {
+      MappedColumn& column = m_columns[it.key()];
+      column.dtype = it.value().at("dtype").get<std::string>();
+      column.shape = it.value().at("shape").get<std::vector<std::size_t>>();
+      const std::string file_path = m_input_dir + "/" +
+                                    it.value().at("file").get<std::string>();
+      const std::size_t expected_size = NumElements(column.shape) * DtypeSize(column.dtype);
+
+      int fd = open(file_path.c_str(), O_RDONLY);
+      if (fd == -1)
+        throw wgInvalidFile("failed to open " + file_path + " : " +
+                            std::string(std::strerror(errno)));
+      struct stat file_stat;
+      if (fstat(fd, &file_stat) == -1 || (std::size_t) file_stat.st_size != expected_size) {
+        close(fd);
+        throw wgInvalidFile(file_path + " size does not match the header");
+      }
+      if (expected_size > 0) {
+        void * data = mmap(NULL, expected_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+          close(fd);
+          throw wgInvalidFile("failed to map " + file_path + " : " +
+                              std::string(std::strerror(errno)));
+        }
+        column.data = static_cast<const char *>(data);
+        column.size = expected_size;
+      }
+      // The mapping stays valid after the file descriptor is closed
+      close(fd);
+    }
+  } catch (const nlohmann::json::exception& e) {
+    Unmap();
+    throw wgInvalidFile("invalid columnar export header " + header_file + " : " +
+                        std::string(e.what()));
+  } catch (...) {
+    Unmap();
+    throw;
+  }
+}
+
+ColumnReader::~ColumnReader() {
+  Unmap();
+}
+
+void ColumnReader::Unmap() {
+  for (auto& entry : m_columns) {
+    if (entry.second.data != NULL)
+      munmap(const_cast<char *>(entry.second.data), entry.second.size);
+    entry.second.data = NULL;
+  }
+}
+
+std::size_t ColumnReader::GetEntries() const {
+  return m_n_entries;
+}
+
+bool ColumnReader::HasColumn(const std::string& name) const {
+  return m_columns.count(name) > 0;
+}
+
+const ColumnReader::MappedColumn& ColumnReader::FindColumn(const std::string& name) const {
+  auto it = m_columns.find(name);
+  if (it == m_columns.end())
+    throw wgElementNotFound("column " + name + " not found in " + m_input_dir);
+  return it->second;
+}
+
+const std::vector<std::size_t>& ColumnReader::GetShape(const std::string& name) const {
+  return FindColumn(name).shape;
+}
+
+template <typename T>
+const T * ColumnReader::GetColumn(const std::string& name) const {
+  const MappedColumn& column = FindColumn(name);
+  if (column.dtype != Dtype<T>())
+    throw std::invalid_argument("column " + name + " has dtype " + column.dtype +
+                                " instead of " + Dtype<T>());
+  return reinterpret_cast<const T *>(column.data);
+}
+
+template const int * ColumnReader::GetColumn<int>(const std::string& name) const;
+template const double * ColumnReader::GetColumn<double>(const std::string& name) const;
+
+long ColumnReader::GetAttribute(const std::string& name) const {
+  auto it = m_attributes.find(name);
+  if (it == m_attributes.end())
+    throw wgElementNotFound("attribute " + name + " not found in " + m_input_dir);
+  return it->second;
+}
@@ -238,6 +238,8 @@ void wgEditXML::GetLog(const std::string& filename, std::vector<std::string>& va
        param != NULL;
        param = param->NextSiblingElement("param")) {
     target = param->Attribute("name");
+    // Empty parameters are left empty
+    if (param->GetText() == NULL) continue;
     if (target == "start_time") {
       values[0] = param->GetText();
     } else if (target == "stop_time") {
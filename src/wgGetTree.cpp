@@ -1,5 +1,7 @@
 // system includes
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 // ROOT includes
 #include "TH1I.h"
@@ -16,8 +18,9 @@ using namespace wagasci_tools;
 
 //************************************************************************
 
-wgGetTree::wgGetTree(const std::string& root_file_name, Raw_t& rd, unsigned dif) :
-    m_finputname(root_file_name), m_rd(rd) {
+wgGetTree::wgGetTree(const std::string& root_file_name, Raw_t& rd, unsigned dif,
+                     const gettree::Fields& fields) :
+    m_finputname(root_file_name), m_rd(rd), m_fields(fields) {
   this->Open();
   TString tree_name("tree_dif_" + std::to_string(dif));
   this->SetTreeFile(tree_name);
@@ -63,76 +66,280 @@ bool wgGetTree::BranchExists(const std::string& branch_name) {
   return false;
 }
 
+//************************************************************************
+template <typename T>
+void wgGetTree::BindBranch(const gettree::WG_GETTREE_FIELDS field,
+                           const std::string& branch_name, T * address) {
+  if (!m_fields[field] || !BranchExists(branch_name)) return;
+  tree->SetBranchStatus(branch_name.c_str(), 1);
+  tree->SetBranchAddress(branch_name.c_str(), address);
+}
+
+//************************************************************************
+template <typename T>
+void wgGetTree::ReadConstantBranch(const gettree::WG_GETTREE_FIELDS field,
+                                   const std::string& branch_name, T * address) {
+  if (!m_fields[field] || !BranchExists(branch_name) || tree->GetEntries() == 0)
+    return;
+  tree->SetBranchStatus(branch_name.c_str(), 1);
+  tree->SetBranchAddress(branch_name.c_str(), address);
+  TBranch * branch = tree->GetBranch(branch_name.c_str());
+  branch->GetEntry(0);
+  tree->ResetBranchAddress(branch);
+  tree->SetBranchStatus(branch_name.c_str(), 0);
+}
+
+//************************************************************************
+void wgGetTree::BindBlockBranch(const gettree::WG_GETTREE_FIELDS field,
+                                const std::string& branch_name, int * address,
+                                std::vector<int> SpillBlock::* column,
+                                const std::size_t entry_size) {
+  if (!m_fields[field] || !BranchExists(branch_name)) return;
+  BindBranch(field, branch_name, address);
+  m_block_branches.push_back({tree->GetBranch(branch_name.c_str()), (char*) address,
+                              column, NULL, entry_size});
+}
+
+//************************************************************************
+void wgGetTree::BindBlockBranch(const gettree::WG_GETTREE_FIELDS field,
+                                const std::string& branch_name, double * address,
+                                std::vector<double> SpillBlock::* column,
+                                const std::size_t entry_size) {
+  if (!m_fields[field] || !BranchExists(branch_name)) return;
+  BindBranch(field, branch_name, address);
+  m_block_branches.push_back({tree->GetBranch(branch_name.c_str()), (char*) address,
+                              NULL, column, entry_size});
+}
+
+//************************************************************************
+void wgGetTree::AddSparseBlockColumn(const gettree::WG_GETTREE_FIELDS field,
+                                     const std::string& branch_name,
+                                     std::vector<int> SpillBlock::* column,
+                                     const std::size_t entry_size) {
+  if (!m_fields[field] || !BranchExists(branch_name)) return;
+  m_block_branches.push_back({NULL, NULL, column, NULL, entry_size});
+}
+
 //************************************************************************
 void wgGetTree::SetTreeFile(TString tree_name) {
   tree = (TTree*) m_finput->Get(tree_name);
+  if (tree == NULL)
+    throw wgElementNotFound("[wgGetTree] TTree " + std::string(tree_name.Data()) +
+                            " not found in " + m_finputname);
+  if (tree->GetBranch("n_hits") != NULL) {
+    SetSparseTreeFile(tree_name);
+    return;
+  }
+  Raw_t& rd = m_rd.get();
+  // Only the branches of the selected fields are enabled
+  tree->SetBranchStatus("*", 0);
   try {
-    if (BranchExists("spill_number"))
-      tree->SetBranchAddress("spill_number",&m_rd.get().spill_number);
-    if (BranchExists("spill_mode"))
-      tree->SetBranchAddress("spill_mode",  &m_rd.get().spill_mode);
-    if (BranchExists("spill_count"))
-      tree->SetBranchAddress("spill_count", &m_rd.get().spill_count);
-
-    if (BranchExists("chipid"))
-      tree->SetBranchAddress("chipid",       m_rd.get().chipid.data());
-    if (BranchExists("chanid"))
-      tree->SetBranchAddress("chanid",       m_rd.get().chanid.data());
-    if (BranchExists("colid"))
-      tree->SetBranchAddress("colid",        m_rd.get().colid.data());
-
-    if (BranchExists("charge"))
-      tree->SetBranchAddress("charge",       m_rd.get().charge.data());
-    if (BranchExists("time"))
-      tree->SetBranchAddress("time",         m_rd.get().time.data());
-    if (BranchExists("bcid"))
-      tree->SetBranchAddress("bcid",         m_rd.get().bcid.data());
-    if (BranchExists("hit"))
-      tree->SetBranchAddress("hit",          m_rd.get().hit.data());
-    if (BranchExists("gs"))
-      tree->SetBranchAddress("gs",           m_rd.get().gs.data());
-
-    if (BranchExists("view"))
-      tree->SetBranchAddress("view",        &m_rd.get().view);
-    if (BranchExists("pln"))
-      tree->SetBranchAddress("pln",          m_rd.get().pln.data());
-    if (BranchExists("chan"))
-      tree->SetBranchAddress("ch",           m_rd.get().chan.data());
-    if (BranchExists("grid"))
-      tree->SetBranchAddress("grid",         m_rd.get().grid.data());
-    if (BranchExists("x"))
-      tree->SetBranchAddress("x",            m_rd.get().x.data());
-    if (BranchExists("y"))
-      tree->SetBranchAddress("y",            m_rd.get().y.data());
-    if (BranchExists("z"))
-      tree->SetBranchAddress("z",            m_rd.get().z.data());
-
-    if (BranchExists("pedestal"))
-      tree->SetBranchAddress("pedestal",     m_rd.get().pedestal.data());
-    if (BranchExists("pe"))
-      tree->SetBranchAddress("pe",           m_rd.get().pe.data());
-    if (BranchExists("gain"))
-      tree->SetBranchAddress("gain",         m_rd.get().gain.data());
-    if (BranchExists("time_ns"))
-      tree->SetBranchAddress("time_ns",      m_rd.get().time_ns.data());
-    if (BranchExists("tdc_slope"))
-      tree->SetBranchAddress("tdc_slope",    m_rd.get().tdc_slope.data());
-    if (BranchExists("tdc_intcpt"))
-      tree->SetBranchAddress("tdc_intcpt",   m_rd.get().tdc_intcpt.data());
-
-    if (BranchExists("debug_chip"))
-      tree->SetBranchAddress("debug_chip",   m_rd.get().debug_chip.data());
-    if (BranchExists("debug_spill"))
-      tree->SetBranchAddress("debug_spill",  m_rd.get().debug_spill.data());
+    const std::size_t n_cells = (std::size_t) rd.n_chips * rd.n_chans * rd.n_cols;
+    BindBranch(gettree::SPILL,    "spill_number", &rd.spill_number);
+    BindBranch(gettree::SPILL,    "spill_mode",   &rd.spill_mode);
+    BindBlockBranch(gettree::SPILL,  "spill_count", &rd.spill_count,
+                    &SpillBlock::spill_count, 1);
+
+    BindBlockBranch(gettree::CHIPID, "chipid",      rd.chipid.data(),
+                    &SpillBlock::chipid, rd.n_chips);
+    BindBranch(gettree::CELLID,   "chanid",        rd.chanid.data());
+    BindBranch(gettree::CELLID,   "colid",         rd.colid.data());
+
+    BindBlockBranch(gettree::CHARGE, "charge",      rd.charge.data(),
+                    &SpillBlock::charge, n_cells);
+    BindBlockBranch(gettree::TIME,   "time",        rd.time.data(),
+                    &SpillBlock::time, n_cells);
+    BindBlockBranch(gettree::BCID,   "bcid",        rd.bcid.data(),
+                    &SpillBlock::bcid, rd.n_chips * rd.n_cols);
+    BindBlockBranch(gettree::HIT,    "hit",         rd.hit.data(),
+                    &SpillBlock::hit, n_cells);
+    BindBlockBranch(gettree::GS,     "gs",          rd.gs.data(),
+                    &SpillBlock::gs, n_cells);
+
+    BindBlockBranch(gettree::PE,     "pe",          rd.pe.data(),
+                    &SpillBlock::pe, n_cells);
+    BindBranch(gettree::TIME_NS,  "time_ns",       rd.time_ns.data());
+
+    BindBranch(gettree::DEBUG,    "debug_chip",    rd.debug_chip.data());
+    BindBranch(gettree::DEBUG,    "debug_spill",   rd.debug_spill.data());
+
+    // The geometry and the calibration constants are the same for all
+    // the entries : they are read only once.
+    ReadConstantBranch(gettree::GEOMETRY, "view",       &rd.view);
+    ReadConstantBranch(gettree::GEOMETRY, "pln",         rd.pln.data());
+    ReadConstantBranch(gettree::GEOMETRY, "chan",        rd.chan.data());
+    ReadConstantBranch(gettree::GEOMETRY, "grid",        rd.grid.data());
+    ReadConstantBranch(gettree::GEOMETRY, "x",           rd.x.data());
+    ReadConstantBranch(gettree::GEOMETRY, "y",           rd.y.data());
+    ReadConstantBranch(gettree::GEOMETRY, "z",           rd.z.data());
+
+    ReadConstantBranch(gettree::PEDESTAL, "pedestal",    rd.pedestal.data());
+    ReadConstantBranch(gettree::GAIN,     "gain",        rd.gain.data());
+    ReadConstantBranch(gettree::TDC,      "tdc_slope",   rd.tdc_slope.data());
+    ReadConstantBranch(gettree::TDC,      "tdc_intcpt",  rd.tdc_intcpt.data());
   } catch (const std::exception &e) {
     throw wgElementNotFound( "[wgGetTree] failed to get the TTree from "
                              + m_finputname + " : " + std::string(e.what()));
   }
 }
 
+//************************************************************************
+void wgGetTree::SetSparseTreeFile(TString tree_name) {
+  Raw_t& rd = m_rd.get();
+  m_hits.reset(new Hits_t(rd.n_chips, rd.n_chans));
+  // Only the branches of the selected fields are enabled. The position
+  // of the hits is always needed to expand the list of hits.
+  tree->SetBranchStatus("*", 0);
+  try {
+    BindBranch(gettree::SPILL,   "spill_number", &rd.spill_number);
+    BindBranch(gettree::SPILL,   "spill_mode",   &rd.spill_mode);
+    BindBranch(gettree::SPILL,   "spill_count",  &rd.spill_count);
+    BindBranch(gettree::CHIPID,  "chipid",        rd.chipid.data());
+
+    for (const char * branch : {"n_hits", "hit_chip", "hit_chan", "hit_col"})
+      tree->SetBranchStatus(branch, 1);
+    tree->SetBranchAddress("n_hits",       &m_hits->n_hits);
+    tree->SetBranchAddress("hit_chip",      m_hits->chip.data());
+    tree->SetBranchAddress("hit_chan",      m_hits->chan.data());
+    tree->SetBranchAddress("hit_col",       m_hits->col.data());
+    BindBranch(gettree::BCID,    "hit_bcid",      m_hits->bcid.data());
+    BindBranch(gettree::CHARGE,  "hit_charge",    m_hits->charge.data());
+    BindBranch(gettree::TIME,    "hit_time",      m_hits->time.data());
+    BindBranch(gettree::GS,      "hit_gs",        m_hits->gs.data());
+    BindBranch(gettree::PE,      "hit_pe",        m_hits->pe.data());
+    BindBranch(gettree::TIME_NS, "hit_time_ns",   m_hits->time_ns.data());
+
+    BindBranch(gettree::DEBUG,   "debug_chip",    rd.debug_chip.data());
+    BindBranch(gettree::DEBUG,   "debug_spill",   rd.debug_spill.data());
+  } catch (const std::exception &e) {
+    throw wgElementNotFound( "[wgGetTree] failed to get the TTree from "
+                             + m_finputname + " : " + std::string(e.what()));
+  }
+
+  // The block columns are filled from the expanded Raw_t object, so
+  // the branches are not read directly by GetBlock
+  const std::size_t n_cells = (std::size_t) rd.n_chips * rd.n_chans * rd.n_cols;
+  AddSparseBlockColumn(gettree::SPILL,  "spill_count", &SpillBlock::spill_count, 1);
+  AddSparseBlockColumn(gettree::CHIPID, "chipid",      &SpillBlock::chipid, rd.n_chips);
+  AddSparseBlockColumn(gettree::CHARGE, "hit_charge",  &SpillBlock::charge, n_cells);
+  AddSparseBlockColumn(gettree::TIME,   "hit_time",    &SpillBlock::time, n_cells);
+  AddSparseBlockColumn(gettree::BCID,   "hit_bcid",    &SpillBlock::bcid, rd.n_chips * rd.n_cols);
+  AddSparseBlockColumn(gettree::HIT,    "n_hits",      &SpillBlock::hit, n_cells);
+  AddSparseBlockColumn(gettree::GS,     "hit_gs",      &SpillBlock::gs, n_cells);
+  if (m_fields[gettree::PE] && BranchExists("hit_pe"))
+    m_block_branches.push_back({NULL, NULL, NULL, &SpillBlock::pe, n_cells});
+
+  // The calibration constants are written only once per file
+  TString calib_tree_name(tree_name);
+  calib_tree_name.ReplaceAll("tree_dif_", "calib_dif_");
+  TTree * calib_tree = (TTree*) m_finput->Get(calib_tree_name);
+  if (calib_tree != NULL && calib_tree->GetEntries() > 0) {
+    if (m_fields[gettree::PEDESTAL] && calib_tree->GetBranch("pedestal"))
+      calib_tree->SetBranchAddress("pedestal",   rd.pedestal.data());
+    if (m_fields[gettree::GAIN] && calib_tree->GetBranch("gain"))
+      calib_tree->SetBranchAddress("gain",       rd.gain.data());
+    if (m_fields[gettree::TDC] && calib_tree->GetBranch("tdc_slope"))
+      calib_tree->SetBranchAddress("tdc_slope",  rd.tdc_slope.data());
+    if (m_fields[gettree::TDC] && calib_tree->GetBranch("tdc_intcpt"))
+      calib_tree->SetBranchAddress("tdc_intcpt", rd.tdc_intcpt.data());
+    calib_tree->GetEntry(0);
+    calib_tree->ResetBranchAddresses();
+  }
+}
+
 //************************************************************************
 void wgGetTree::GetEntry(int event) {
   wgGetTree::tree->GetEntry(event);
+  if (m_hits)
+    m_hits->ToRaw(m_rd.get());
+  else
+    // ROOT has written all the arrays
+    m_rd.get().mark_dirty();
+}
+
+//************************************************************************
+void wgGetTree::ResizeBlock(SpillBlock& block, const std::size_t n_spills) const {
+  const Raw_t& rd = m_rd.get();
+  block.n_spills = n_spills;
+  block.n_chips = rd.n_chips;
+  block.n_chans = rd.n_chans;
+  block.n_cols = rd.n_cols;
+  // The columns whose branch was not found are left empty
+  for (const BlockBranch& block_branch : m_block_branches) {
+    if (block_branch.int_column)
+      (block.*block_branch.int_column).resize(n_spills * block_branch.entry_size);
+    else
+      (block.*block_branch.double_column).resize(n_spills * block_branch.entry_size);
+  }
+}
+
+//************************************************************************
+std::size_t wgGetTree::GetBlock(const Long64_t first_entry, SpillBlock& block,
+                                const std::size_t max_spills) {
+  const Long64_t n_entries = tree->GetEntries();
+  if (first_entry < 0 || first_entry >= n_entries || max_spills == 0) {
+    ResizeBlock(block, 0);
+    return 0;
+  }
+  Long64_t last_entry = std::min<Long64_t>(first_entry + max_spills, n_entries);
+  block.first_entry = first_entry;
+
+  if (!m_hits) {
+    // Stop at the end of the cluster
+    TTree::TClusterIterator cluster = tree->GetClusterIterator(first_entry);
+    cluster.Next();
+    last_entry = std::max(first_entry + 1, std::min(last_entry, cluster.GetNextEntry()));
+    ResizeBlock(block, last_entry - first_entry);
+    // Read each branch in one sweep, directly into the block
+    for (const BlockBranch& block_branch : m_block_branches) {
+      std::size_t entry_bytes;
+      char * column;
+      if (block_branch.int_column) {
+        column = (char*) (block.*block_branch.int_column).data();
+        entry_bytes = block_branch.entry_size * sizeof(int);
+      } else {
+        column = (char*) (block.*block_branch.double_column).data();
+        entry_bytes = block_branch.entry_size * sizeof(double);
+      }
+      for (Long64_t ientry = first_entry; ientry < last_entry; ++ientry) {
+        block_branch.branch->SetAddress(column + (ientry - first_entry) * entry_bytes);
+        block_branch.branch->GetEntry(ientry);
+      }
+      block_branch.branch->SetAddress(block_branch.raw_address);
+    }
+  } else {
+    // The list of hits must be expanded one entry at a time
+    ResizeBlock(block, last_entry - first_entry);
+    Raw_t& rd = m_rd.get();
+    const std::size_t n_cells = block.SpillCells();
+    const std::size_t n_bcids = rd.n_chips * rd.n_cols;
+    for (Long64_t ientry = first_entry; ientry < last_entry; ++ientry) {
+      GetEntry(ientry);
+      const std::size_t ispill = ientry - first_entry;
+      if (!block.spill_count.empty())
+        block.spill_count[ispill] = rd.spill_count;
+      if (!block.chipid.empty())
+        std::copy(rd.chipid.begin(), rd.chipid.end(), block.chipid.begin() + ispill * rd.n_chips);
+      if (!block.bcid.empty())
+        std::memcpy(block.bcid.data() + ispill * n_bcids, rd.bcid.data(), n_bcids * sizeof(int));
+      if (!block.charge.empty())
+        std::memcpy(block.charge.data() + ispill * n_cells, rd.charge.data(), n_cells * sizeof(int));
+      if (!block.time.empty())
+        std::memcpy(block.time.data() + ispill * n_cells, rd.time.data(), n_cells * sizeof(int));
+      if (!block.hit.empty())
+        std::memcpy(block.hit.data() + ispill * n_cells, rd.hit.data(), n_cells * sizeof(int));
+      if (!block.gs.empty())
+        std::memcpy(block.gs.data() + ispill * n_cells, rd.gs.data(), n_cells * sizeof(int));
+      if (!block.pe.empty())
+        std::memcpy(block.pe.data() + ispill * n_cells, rd.pe.data(), n_cells * sizeof(double));
+    }
+  }
+  return block.n_spills;
+}
+
+//************************************************************************
+bool wgGetTree::IsSparse() const {
+  return m_hits != nullptr;
 }
 
 //************************************************************************
@@ -4,6 +4,7 @@
 #include <iomanip>
 #include <fstream>
 #include <string>
+#include <mutex>
 
 // system C includes
 #include <cerrno>
@@ -73,6 +74,7 @@ wgLogger::wgLogger(const std::string& log_dir)
 
 void wgLogger::Write(const std::string& log)
 {
+  std::lock_guard<std::mutex> lock(m_mutex);
   if ( WhereToLog == COUT )
     std::cout << "[ " << m_printTime() << " ]: " << log << std::endl;
   else if ( WhereToLog == LOGFILE )
@@ -85,6 +87,7 @@ void wgLogger::Write(const std::string& log)
 
 void wgLogger::eWrite(const std::string& log)
 {
+  std::lock_guard<std::mutex> lock(m_mutex);
   if ( WhereToLog == COUT )
     std::cerr << "[ " << m_printTime() << " ]: " << log << std::endl;
   else if ( WhereToLog == LOGFILE )
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
+#include <string>
 
 #include "wgConst.hpp"
 #include "wgRawData.hpp"
@@ -36,7 +39,11 @@ Raw_t::Raw_t(std::size_t n_chips, std::size_t n_chans) :
   
   debug_spill.resize            (N_DEBUG_SPILL);
   debug_chip.Initialize(n_chips, N_DEBUG_CHIP);
+
+  m_dirty_arrays.resize(n_chips, 0);
+  this->mark_dirty();
   this->clear();
+  this->clear_run_constants();
 }
 
 //***************************************
@@ -46,14 +53,39 @@ void Raw_t::clear(){
   Raw_t::spill_count =                                               -1 ;
   
   std::fill_n(Raw_t::chipid.begin(), Raw_t::chipid.size(),           -1);
+
+  this->clear_spill_arrays();
+
+  std::fill_n(Raw_t::debug_spill.begin(), Raw_t::debug_spill.size(),  0);
+  Raw_t::debug_chip.fill                                             (0);
+}
+
+//***************************************
+void Raw_t::clear_spill_arrays(){
+  // Only the chips that were actually written are reset
+  const std::size_t n_cells = n_chans * MEMDEPTH;
+  for (std::size_t ichip = 0; ichip < m_dirty_arrays.size(); ++ichip) {
+    const unsigned dirty = m_dirty_arrays[ichip];
+    if (dirty == 0) continue;
+    if (dirty & RAW_DATA_ARRAYS) {
+      std::fill_n(Raw_t::charge.data() + ichip * n_cells,  n_cells,  -1);
+      std::fill_n(Raw_t::time.data()   + ichip * n_cells,  n_cells,  -1);
+      std::fill_n(Raw_t::bcid.data()   + ichip * MEMDEPTH, MEMDEPTH, -1);
+      std::fill_n(Raw_t::hit.data()    + ichip * n_cells,  n_cells,  -1);
+      std::fill_n(Raw_t::gs.data()     + ichip * n_cells,  n_cells,  -1);
+    }
+    if (dirty & PE_ARRAY)
+      std::fill_n(Raw_t::pe.data()      + ichip * n_cells, n_cells,  -1);
+    if (dirty & TIME_NS_ARRAY)
+      std::fill_n(Raw_t::time_ns.data() + ichip * n_cells, n_cells,  -1);
+    m_dirty_arrays[ichip] = 0;
+  }
+}
+
+//***************************************
+void Raw_t::clear_run_constants(){
   std::fill_n(Raw_t::chanid.begin(), Raw_t::chanid.size(),           -1);
   std::fill_n(Raw_t::colid.begin(), Raw_t::colid.size(),             -1);
-  
-  Raw_t::charge.fill                                                (-1);
-  Raw_t::time.fill                                                  (-1);
-  Raw_t::bcid.fill                                                  (-1);
-  Raw_t::hit.fill                                                   (-1);
-  Raw_t::gs.fill                                                    (-1);
 
   Raw_t::view =                                                      -1 ;
   Raw_t::pln.fill                                                   (-1);
@@ -64,12 +96,173 @@ void Raw_t::clear(){
   Raw_t::z.fill                                          (std::nan("z"));
   
   Raw_t::pedestal.fill                                              (-1);
-  Raw_t::pe.fill                                                    (-1);
   Raw_t::gain.fill                                                  (-1);
-  Raw_t::time_ns.fill                                               (-1);
   Raw_t::tdc_slope.fill                                              (0);
   Raw_t::tdc_intcpt.fill                                            (-1);
+}
 
-  std::fill_n(Raw_t::debug_spill.begin(), Raw_t::debug_spill.size(),  0);
-  Raw_t::debug_chip.fill                                             (0);
+//***************************************
+void Raw_t::mark_dirty(std::size_t ichip, unsigned arrays){
+  Raw_t::m_dirty_arrays.at(ichip) |= arrays;
+}
+
+//***************************************
+void Raw_t::mark_dirty(){
+  std::fill(m_dirty_arrays.begin(), m_dirty_arrays.end(), (unsigned) ALL_SPILL_ARRAYS);
+}
+
+//***************************************
+void Raw_t::copy(Raw_t& source){
+  if (source.n_chips != Raw_t::n_chips || source.n_chans != Raw_t::n_chans)
+    throw std::invalid_argument("cannot copy a Raw_t object of different size");
+  const std::size_t n_1d = n_chips * n_chans;
+  const std::size_t n_3d = n_chips * n_chans * MEMDEPTH;
+
+  Raw_t::spill_number = source.spill_number;
+  Raw_t::spill_mode   = source.spill_mode;
+  Raw_t::spill_count  = source.spill_count;
+
+  std::copy(source.chipid.begin(), source.chipid.end(), Raw_t::chipid.begin());
+  std::copy(source.chanid.begin(), source.chanid.end(), Raw_t::chanid.begin());
+  std::copy(source.colid.begin(),  source.colid.end(),  Raw_t::colid.begin());
+
+  std::copy_n(source.charge.data(),     n_3d,                Raw_t::charge.data());
+  std::copy_n(source.time.data(),       n_3d,                Raw_t::time.data());
+  std::copy_n(source.bcid.data(),       n_chips * MEMDEPTH,  Raw_t::bcid.data());
+  std::copy_n(source.hit.data(),        n_3d,                Raw_t::hit.data());
+  std::copy_n(source.gs.data(),         n_3d,                Raw_t::gs.data());
+
+  Raw_t::view = source.view;
+  std::copy_n(source.pln.data(),        n_1d,                Raw_t::pln.data());
+  std::copy_n(source.chan.data(),       n_1d,                Raw_t::chan.data());
+  std::copy_n(source.grid.data(),       n_1d,                Raw_t::grid.data());
+  std::copy_n(source.x.data(),          n_1d,                Raw_t::x.data());
+  std::copy_n(source.y.data(),          n_1d,                Raw_t::y.data());
+  std::copy_n(source.z.data(),          n_1d,                Raw_t::z.data());
+
+  std::copy_n(source.pedestal.data(),   n_3d,                Raw_t::pedestal.data());
+  std::copy_n(source.pe.data(),         n_3d,                Raw_t::pe.data());
+  std::copy_n(source.gain.data(),       n_3d,                Raw_t::gain.data());
+  std::copy_n(source.time_ns.data(),    n_3d,                Raw_t::time_ns.data());
+  std::copy_n(source.tdc_slope.data(),  n_1d * 2,            Raw_t::tdc_slope.data());
+  std::copy_n(source.tdc_intcpt.data(), n_1d * 2,            Raw_t::tdc_intcpt.data());
+
+  std::copy(source.debug_spill.begin(), source.debug_spill.end(), Raw_t::debug_spill.begin());
+  std::copy_n(source.debug_chip.data(), n_chips * N_DEBUG_CHIP, Raw_t::debug_chip.data());
+
+  // The chips that are clean in the source are clean here too
+  Raw_t::m_dirty_arrays = source.m_dirty_arrays;
+}
+
+//***************************************
+void Raw_t::copy_spill(Raw_t& source){
+  if (source.n_chips != Raw_t::n_chips || source.n_chans != Raw_t::n_chans)
+    throw std::invalid_argument("cannot copy a Raw_t object of different size");
+  const std::size_t n_cells = n_chans * MEMDEPTH;
+
+  Raw_t::spill_number = source.spill_number;
+  Raw_t::spill_mode   = source.spill_mode;
+  Raw_t::spill_count  = source.spill_count;
+
+  std::copy(source.chipid.begin(), source.chipid.end(), Raw_t::chipid.begin());
+
+  // The arrays of the clean chips are already reset in both objects
+  this->clear_spill_arrays();
+  for (std::size_t ichip = 0; ichip < m_dirty_arrays.size(); ++ichip) {
+    const unsigned dirty = source.m_dirty_arrays[ichip];
+    if (dirty == 0) continue;
+    const std::size_t icell = ichip * n_cells;
+    if (dirty & RAW_DATA_ARRAYS) {
+      std::copy_n(source.charge.data()  + icell, n_cells, Raw_t::charge.data() + icell);
+      std::copy_n(source.time.data()    + icell, n_cells, Raw_t::time.data()   + icell);
+      std::copy_n(source.bcid.data()    + ichip * MEMDEPTH, MEMDEPTH,
+                  Raw_t::bcid.data()    + ichip * MEMDEPTH);
+      std::copy_n(source.hit.data()     + icell, n_cells, Raw_t::hit.data()    + icell);
+      std::copy_n(source.gs.data()      + icell, n_cells, Raw_t::gs.data()     + icell);
+    }
+    if (dirty & PE_ARRAY)
+      std::copy_n(source.pe.data()      + icell, n_cells, Raw_t::pe.data()      + icell);
+    if (dirty & TIME_NS_ARRAY)
+      std::copy_n(source.time_ns.data() + icell, n_cells, Raw_t::time_ns.data() + icell);
+    m_dirty_arrays[ichip] = dirty;
+  }
+
+  std::copy(source.debug_spill.begin(), source.debug_spill.end(), Raw_t::debug_spill.begin());
+  std::copy_n(source.debug_chip.data(), n_chips * N_DEBUG_CHIP, Raw_t::debug_chip.data());
+}
+
+//***************************************
+Hits_t::Hits_t(std::size_t n_chips) : Hits_t(n_chips, NCHANNELS) {}
+
+Hits_t::Hits_t(std::size_t n_chips, std::size_t n_chans) :
+    n_chips(n_chips), n_chans(n_chans) {
+  const std::size_t max_hits = capacity();
+  chip.resize   (max_hits);
+  chan.resize   (max_hits);
+  col.resize    (max_hits);
+  bcid.resize   (max_hits);
+  charge.resize (max_hits);
+  time.resize   (max_hits);
+  gs.resize     (max_hits);
+  pe.resize     (max_hits);
+  time_ns.resize(max_hits);
+  this->clear();
+}
+
+//***************************************
+std::size_t Hits_t::capacity() const {
+  return n_chips * n_chans * MEMDEPTH;
+}
+
+//***************************************
+void Hits_t::clear() {
+  Hits_t::n_hits = 0;
+}
+
+//***************************************
+void Hits_t::FromRaw(Raw_t& rd) {
+  if (rd.n_chips != Hits_t::n_chips || rd.n_chans != Hits_t::n_chans)
+    throw std::invalid_argument("Raw_t and Hits_t objects of different size");
+  const int * hit = rd.hit.data();
+  int ihit = 0;
+  for (int ichip = 0; ichip < n_chips; ++ichip) {
+    for (int ichan = 0; ichan < n_chans; ++ichan) {
+      for (unsigned icol = 0; icol < MEMDEPTH; ++icol) {
+        const std::size_t i = (ichip * n_chans + ichan) * MEMDEPTH + icol;
+        if (hit[i] != (int) HIT_BIT) continue;
+        chip[ihit]    = ichip;
+        chan[ihit]    = ichan;
+        col[ihit]     = icol;
+        bcid[ihit]    = rd.bcid.data()[ichip * MEMDEPTH + icol];
+        charge[ihit]  = rd.charge.data()[i];
+        time[ihit]    = rd.time.data()[i];
+        gs[ihit]      = rd.gs.data()[i];
+        pe[ihit]      = rd.pe.data()[i];
+        time_ns[ihit] = rd.time_ns.data()[i];
+        ++ihit;
+      }
+    }
+  }
+  Hits_t::n_hits = ihit;
+}
+
+//***************************************
+void Hits_t::ToRaw(Raw_t& rd) const {
+  if (rd.n_chips != Hits_t::n_chips || rd.n_chans != Hits_t::n_chans)
+    throw std::invalid_argument("Raw_t and Hits_t objects of different size");
+  rd.clear_spill_arrays();
+  for (int ihit = 0; ihit < n_hits; ++ihit) {
+    if (chip[ihit] < 0 || chip[ihit] >= n_chips || chan[ihit] < 0 || chan[ihit] >= n_chans ||
+        col[ihit] < 0 || col[ihit] >= (int) MEMDEPTH)
+      throw std::out_of_range("hit " + std::to_string(ihit) + " is out of range");
+    rd.mark_dirty(chip[ihit]);
+    const std::size_t i = (chip[ihit] * n_chans + chan[ihit]) * MEMDEPTH + col[ihit];
+    rd.bcid.data()[chip[ihit] * MEMDEPTH + col[ihit]] = bcid[ihit];
+    rd.charge.data()[i]  = charge[ihit];
+    rd.time.data()[i]    = time[ihit];
+    rd.hit.data()[i]     = HIT_BIT;
+    rd.gs.data()[i]      = gs[ihit];
+    rd.pe.data()[i]      = pe[ihit];
+    rd.time_ns.data()[i] = time_ns[ihit];
+  }
 }